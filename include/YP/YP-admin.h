@@ -118,6 +118,28 @@ YP_return_t YP_destroy_phonebook(
         const char* token,
         YP_phonebook_id_t id);
 
+/**
+ * @brief Requests the provider to write a snapshot of a phonebook.
+ * A phonebook whose configuration has a "snapshot" path reloads it
+ * when created or opened.
+ *
+ * @param[in] admin YP admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[in] id phonebook id.
+ * @param[in] path file to write, or NULL for the phonebook's snapshot path.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_snapshot_phonebook(
+        YP_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        YP_phonebook_id_t id,
+        const char* path);
+
 /**
  * @brief Lists the ids of phonebooks available on the provider.
  *
@@ -8,6 +8,7 @@
 
 #include <YP/YP-server.h>
 #include <YP/YP-common.h>
+#include <YP/YP-number.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +20,12 @@ typedef YP_return_t (*YP_backend_close_fn)(void*);
 typedef YP_return_t (*YP_backend_destroy_fn)(void*);
 typedef char* (*YP_backend_get_config_fn)(void*);
 
+/**
+ * @brief Function called by a backend on each record it lists, in
+ * order. Returning a non-zero value stops the listing.
+ */
+typedef int (*YP_record_fn)(void* uargs, const char* name, size_t name_size, YP_number_t number);
+
 /**
  * @brief Implementation of an YP backend.
  */
@@ -34,6 +41,28 @@ typedef struct YP_backend_impl {
     // RPC functions
     void (*hello)(void*);
     int32_t (*sum)(void*, int32_t, int32_t);
+    YP_return_t (*insert)(void*, const char*, size_t, YP_number_t);
+    YP_return_t (*lookup)(void*, const char*, size_t, YP_number_t*);
+    YP_return_t (*erase)(void*, const char*, size_t);
+    // ordered listing: [lower, upper) with lower included if the int is
+    // non-zero, and a NULL upper meaning no bound
+    YP_return_t (*list_range)(void*, const char*, size_t, int,
+                              const char*, size_t, YP_record_fn, void*);
+    YP_return_t (*list_prefix)(void*, const char*, size_t, YP_record_fn, void*);
+    // lists every record, in no particular order (used by the provider
+    // to build per-phonebook structures such as filters)
+    YP_return_t (*iterate)(void*, YP_record_fn, void*);
+    // inserts or updates count records given by their names, name sizes
+    // and numbers, so that the backend can size its structures once
+    // (optional, the provider calls insert on each record otherwise)
+    YP_return_t (*insert_batch)(void*, size_t, const char* const*,
+                                const size_t*, const YP_number_t*);
+    // lists records in no particular order from an opaque position (0
+    // for the first record), stopping at the record on which the callback
+    // returns non-zero, and sets the position so that the next call
+    // starts with that record, or to UINT64_MAX once all were listed
+    // (optional, scans use list_range otherwise)
+    YP_return_t (*scan)(void*, uint64_t*, YP_record_fn, void*);
     // ... add other functions here
 } YP_backend_impl;
 
@@ -16,6 +16,10 @@ extern "C" {
 typedef struct YP_client* YP_client_t;
 #define YP_CLIENT_NULL ((YP_client_t)NULL)
 
+/* Operation started by an _async function and not yet waited on */
+typedef struct YP_request* YP_request_t;
+#define YP_REQUEST_NULL ((YP_request_t)NULL)
+
 /**
  * @brief Creates a YP client.
  *
@@ -35,6 +39,62 @@ YP_return_t YP_client_init(margo_instance_id mid, YP_client_t* client);
  */
 YP_return_t YP_client_finalize(YP_client_t client);
 
+/**
+ * @brief Makes the blocking YP_lookup calls issued concurrently (e.g.
+ * by several ULTs) on the same phonebook handle be sent together as a
+ * single YP_lookup_batch RPC, once max_batch lookups are gathered or
+ * max_delay_us microseconds after the first one, whichever comes
+ * first. Each call still returns its own result. Coalescing is
+ * disabled by default, or with a max_batch of 0 or 1. It should be
+ * set up before lookups are issued.
+ *
+ * @param[in] client YP client
+ * @param[in] max_batch max number of lookups sent together
+ * @param[in] max_delay_us max delay added to a lookup, in microseconds
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_client_set_coalescing(
+        YP_client_t client,
+        size_t max_batch,
+        uint64_t max_delay_us);
+
+/**
+ * @brief Blocks until the operation completes, then releases the
+ * request. The outputs of the operation are only valid after this
+ * call, and its input strings may be released as soon as the _async
+ * function returns.
+ *
+ * @param[in] req request to wait on.
+ *
+ * @return the return code of the operation
+ */
+YP_return_t YP_wait(YP_request_t req);
+
+/**
+ * @brief Sets flag to 1 if the operation completed, 0 otherwise,
+ * without blocking. YP_wait must still be called to get its result.
+ *
+ * @param[in] req request to test.
+ * @param[out] flag whether the operation completed.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_test(YP_request_t req, int* flag);
+
+/**
+ * @brief Blocks until one of the operations completes, releases its
+ * request and sets it to YP_REQUEST_NULL in reqs. Entries of reqs that
+ * are YP_REQUEST_NULL are ignored, but at least one must not be.
+ *
+ * @param[in] count number of requests.
+ * @param[inout] reqs requests to wait on.
+ * @param[out] index index of the request that completed.
+ *
+ * @return the return code of the operation that completed
+ */
+YP_return_t YP_wait_any(size_t count, YP_request_t* reqs, size_t* index);
+
 #ifdef __cplusplus
 }
 #endif
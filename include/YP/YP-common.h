@@ -29,6 +29,9 @@ typedef enum YP_return_t {
     YP_ERR_FROM_ARGOBOTS,     /* Argobots error */
     YP_ERR_OP_UNSUPPORTED,    /* Unsupported operation */
     YP_ERR_OP_FORBIDDEN,      /* Forbidden operation */
+    YP_ERR_NOT_FOUND,         /* Name not found in phonebook */
+    YP_ERR_IO,                /* I/O error */
+    YP_ERR_SCAN_INVALIDATED,  /* Scan interrupted by a rehash */
     /* ... TODO add more error codes here if needed */
     YP_ERR_OTHER              /* Other error */
 } YP_return_t;
@@ -0,0 +1,113 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __YP_NUMBER_H
+#define __YP_NUMBER_H
+
+#include <YP/YP-common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Phone number in canonical E.164 form (country code followed by
+ * the subscriber number, at most 15 digits) packed into 64 bits.
+ *
+ * The digits are stored as an integer left-aligned on 15 digits, so
+ * that leading zeros of the subscriber number are kept, shifted by 4
+ * bits to make room for the number of digits. Two packed numbers are
+ * equal if and only if their E.164 forms are, and compare in the same
+ * order as their E.164 strings.
+ */
+typedef uint64_t YP_number_t;
+
+#define YP_NUMBER_MIN_DIGITS 2
+#define YP_NUMBER_MAX_DIGITS 15
+/* '+', digits, null terminator */
+#define YP_NUMBER_STRING_SIZE (YP_NUMBER_MAX_DIGITS + 2)
+
+/**
+ * @brief Parses a phone number into a YP_number_t. The number must
+ * start with '+' or with the "00" international prefix, followed by
+ * the country code and the subscriber number. Spaces, dashes, dots
+ * and parentheses between digits are ignored.
+ *
+ * @param in input string
+ * @param number resulting number
+ *
+ * @return YP_SUCCESS or YP_ERR_INVALID_ARGS
+ */
+static inline YP_return_t YP_number_from_string(
+        const char* in,
+        YP_number_t* number) {
+    const char* p = in;
+    while(*p == ' ') p++;
+    if(p[0] == '+') p += 1;
+    else if(p[0] == '0' && p[1] == '0') p += 2;
+    else return YP_ERR_INVALID_ARGS;
+    uint64_t digits = 0;
+    unsigned n = 0;
+    for(; *p; p++) {
+        if(*p >= '0' && *p <= '9') {
+            /* country codes never start with 0 */
+            if(n == 0 && *p == '0') return YP_ERR_INVALID_ARGS;
+            if(n == YP_NUMBER_MAX_DIGITS) return YP_ERR_INVALID_ARGS;
+            digits = digits*10 + (uint64_t)(*p - '0');
+            n += 1;
+        } else if(*p != ' ' && *p != '-' && *p != '.' && *p != '(' && *p != ')') {
+            return YP_ERR_INVALID_ARGS;
+        }
+    }
+    if(n < YP_NUMBER_MIN_DIGITS) return YP_ERR_INVALID_ARGS;
+    for(unsigned i = n; i < YP_NUMBER_MAX_DIGITS; i++)
+        digits *= 10;
+    *number = (digits << 4) | n;
+    return YP_SUCCESS;
+}
+
+/**
+ * @brief Checks that a YP_number_t was produced by YP_number_from_string.
+ */
+static inline int YP_number_is_valid(YP_number_t number) {
+    unsigned n = (unsigned)(number & 0xf);
+    uint64_t digits = number >> 4;
+    if(n < YP_NUMBER_MIN_DIGITS || n > YP_NUMBER_MAX_DIGITS)
+        return 0;
+    /* at most 15 digits, the first one non-zero */
+    if(digits >= UINT64_C(1000000000000000) || digits < UINT64_C(100000000000000))
+        return 0;
+    for(unsigned i = n; i < YP_NUMBER_MAX_DIGITS; i++, digits /= 10)
+        if(digits % 10) return 0;
+    return 1;
+}
+
+/**
+ * @brief Converts a YP_number_t into its E.164 string ("+" followed by
+ * the digits). An invalid number is converted into an empty string.
+ *
+ * @param number number to convert
+ * @param out[YP_NUMBER_STRING_SIZE] resulting null-terminated string
+ */
+static inline void YP_number_to_string(
+        YP_number_t number,
+        char out[YP_NUMBER_STRING_SIZE]) {
+    if(!YP_number_is_valid(number)) {
+        out[0] = '\0';
+        return;
+    }
+    unsigned n = (unsigned)(number & 0xf);
+    uint64_t digits = number >> 4;
+    out[0] = '+';
+    for(unsigned i = YP_NUMBER_MAX_DIGITS; i > 0; i--, digits /= 10)
+        if(i <= n) out[i] = (char)('0' + digits % 10);
+    out[n+1] = '\0';
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
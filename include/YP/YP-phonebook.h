@@ -9,6 +9,7 @@
 #include <margo.h>
 #include <YP/YP-common.h>
 #include <YP/YP-client.h>
+#include <YP/YP-number.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +18,9 @@ extern "C" {
 typedef struct YP_phonebook_handle *YP_phonebook_handle_t;
 #define YP_PHONEBOOK_HANDLE_NULL ((YP_phonebook_handle_t)NULL)
 
+typedef struct YP_scan *YP_scan_t;
+#define YP_SCAN_NULL ((YP_scan_t)NULL)
+
 /**
  * @brief Creates a YP phonebook handle.
  *
@@ -55,6 +59,30 @@ YP_return_t YP_phonebook_handle_ref_incr(
  */
 YP_return_t YP_phonebook_handle_release(YP_phonebook_handle_t handle);
 
+/**
+ * @brief Makes YP_lookup keep the results of up to capacity names
+ * (including names that were not found) in the handle, and return
+ * them without contacting the provider until the lease granted with
+ * them expires. Leases are only granted by phonebooks configured with
+ * a "lease" duration (in seconds): writes to a name wait for its
+ * leases to expire, so a cached result is never older than the last
+ * write that completed, except for records erased by their time to
+ * live, which may be seen for up to one lease duration after they
+ * expire. Writes through the handle drop the names they update from
+ * its cache. Only handles with a cache request leases, so lookups from
+ * other handles don't delay writes. A capacity of 0 disables the
+ * cache, which is the default. It should be set up before lookups are
+ * issued.
+ *
+ * @param[in] handle phonebook handle
+ * @param[in] capacity max number of names cached
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_phonebook_handle_set_cache(
+        YP_phonebook_handle_t handle,
+        size_t capacity);
+
 /**
  * @brief Makes the target YP phonebook print Hello World.
  *
@@ -81,6 +109,363 @@ YP_return_t YP_compute_sum(
         int32_t y,
         int32_t* result);
 
+/**
+ * @brief Asynchronous version of YP_compute_sum: forwards the RPC
+ * without waiting for its response. The result is set when req is
+ * waited on (see YP_wait).
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] x first number.
+ * @param[in] y second number.
+ * @param[out] result resulting value.
+ * @param[out] req request to wait on.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_compute_sum_async(
+        YP_phonebook_handle_t handle,
+        int32_t x,
+        int32_t y,
+        int32_t* result,
+        YP_request_t* req);
+
+/**
+ * @brief Inserts a name in the target YP phonebook, or updates
+ * its number if the name is already present.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to insert.
+ * @param[in] number number associated with the name.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_insert(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number);
+
+/**
+ * @brief Inserts a name in the target YP phonebook, or updates it,
+ * and makes it expire after ttl seconds, or never if ttl is 0 (an
+ * update without a ttl also cancels a previous one). The phonebook
+ * must have been configured with "expiry" : true, or with an object
+ * setting the resolution of the deadlines ("expiry" : { "tick" : 0.1 }),
+ * otherwise YP_ERR_OP_UNSUPPORTED is returned for a non-zero ttl.
+ * Deadlines are only kept in memory, so expiry can't be enabled on a
+ * phonebook that is persisted (with a "snapshot", a "wal" or a "path").
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to insert.
+ * @param[in] number number associated with the name.
+ * @param[in] ttl time to live in seconds.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_insert_with_ttl(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        double ttl);
+
+/**
+ * @brief Asynchronous versions of YP_insert and YP_insert_with_ttl.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to insert.
+ * @param[in] number number associated with the name.
+ * @param[in] ttl time to live in seconds.
+ * @param[out] req request to wait on.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_insert_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        YP_request_t* req);
+
+YP_return_t YP_insert_with_ttl_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        double ttl,
+        YP_request_t* req);
+
+/**
+ * @brief Inserts or updates count names in the target YP phonebook
+ * with a single RPC: the records are serialized into one buffer that
+ * the provider pulls as a bulk transfer, and applied by the backend in
+ * one pass when it supports it. Records previously inserted with a
+ * ttl become permanent, as with YP_insert.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] names names to insert.
+ * @param[in] numbers numbers associated with the names.
+ * @param[in] count number of records.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h, in which
+ * case only some of the records may have been inserted.
+ */
+YP_return_t YP_insert_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        const YP_number_t* numbers,
+        size_t count);
+
+/**
+ * @brief Looks up the number associated with a name in the
+ * target YP phonebook.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to look up.
+ * @param[out] number number associated with the name.
+ *
+ * @return YP_SUCCESS, YP_ERR_NOT_FOUND, or other error code
+ * defined in YP-common.h
+ */
+YP_return_t YP_lookup(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t* number);
+
+/**
+ * @brief Asynchronous version of YP_lookup. The number is set when
+ * req is waited on, if the name is found.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to look up.
+ * @param[out] number number associated with the name.
+ * @param[out] req request to wait on.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_lookup_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t* number,
+        YP_request_t* req);
+
+/**
+ * @brief Looks up the numbers associated with count names in the
+ * target YP phonebook with a single RPC: the names are exposed to the
+ * provider as one bulk buffer, and the provider writes the numbers and
+ * the result of each lookup back into numbers and results.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] names names to look up.
+ * @param[in] count number of names.
+ * @param[out] numbers numbers associated with the names.
+ * @param[out] results YP_SUCCESS or YP_ERR_NOT_FOUND for each name.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h, in which
+ * case the content of numbers and results is undefined.
+ */
+YP_return_t YP_lookup_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        size_t count,
+        YP_number_t* numbers,
+        YP_return_t* results);
+
+/**
+ * @brief Removes a name from the target YP phonebook.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to remove.
+ *
+ * @return YP_SUCCESS, YP_ERR_NOT_FOUND, or other error code
+ * defined in YP-common.h
+ */
+YP_return_t YP_erase(
+        YP_phonebook_handle_t handle,
+        const char* name);
+
+/**
+ * @brief Asynchronous version of YP_erase.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] name name to remove.
+ * @param[out] req request to wait on.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_erase_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_request_t* req);
+
+/**
+ * @brief Lists the names of the target YP phonebook that fall
+ * between lower and upper, in lexicographic order, along with their
+ * numbers. To page through the phonebook, call it again with the last
+ * name returned as lower and inclusive set to 0.
+ *
+ * The names are allocated with malloc and should be freed by the
+ * caller.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] lower lower bound (NULL to start from the first name).
+ * @param[in] inclusive whether a name equal to lower is listed.
+ * @param[in] upper exclusive upper bound (NULL for no bound).
+ * @param[out] names array of at least *count names.
+ * @param[out] numbers array of at least *count numbers.
+ * @param[inout] count max number of names to list, then number listed.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_list_range(
+        YP_phonebook_handle_t handle,
+        const char* lower,
+        int inclusive,
+        const char* upper,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count);
+
+/**
+ * @brief Lists the names of the target YP phonebook that start with
+ * the provided prefix, in lexicographic order, along with their
+ * numbers. The names should be freed by the caller.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] prefix prefix.
+ * @param[out] names array of at least *count names.
+ * @param[out] numbers array of at least *count numbers.
+ * @param[inout] count max number of names to list, then number listed.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_list_prefix(
+        YP_phonebook_handle_t handle,
+        const char* prefix,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count);
+
+/**
+ * @brief Looks up the names associated with a number in the target
+ * YP phonebook, in lexicographic order. The phonebook must have been
+ * configured with a reverse index ("reverse_index" : true), otherwise
+ * YP_ERR_OP_UNSUPPORTED is returned. The names should be freed by the
+ * caller.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] number number to look up.
+ * @param[out] names array of at least *count names.
+ * @param[inout] count max number of names to return, then number returned.
+ *
+ * @return YP_SUCCESS, YP_ERR_NOT_FOUND if no name has this number,
+ * or other error code defined in YP-common.h
+ */
+YP_return_t YP_lookup_number(
+        YP_phonebook_handle_t handle,
+        YP_number_t number,
+        char** names,
+        size_t* count);
+
+/**
+ * @brief Looks for the names closest to a possibly misspelled query in
+ * the target YP phonebook, best match first. Case, punctuation and the
+ * order of words are ignored. The phonebook must have been configured
+ * with a fuzzy index ("fuzzy_index" : true), otherwise
+ * YP_ERR_OP_UNSUPPORTED is returned. At most 1024 matches are returned.
+ * The names should be freed by the caller.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] query name to look for.
+ * @param[out] names array of at least *count names.
+ * @param[out] numbers array of at least *count numbers.
+ * @param[out] scores array of at least *count similarities between 0
+ * and 1, may be NULL.
+ * @param[inout] count max number of matches to return, then number returned.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_fuzzy_search(
+        YP_phonebook_handle_t handle,
+        const char* query,
+        char** names,
+        YP_number_t* numbers,
+        double* scores,
+        size_t* count);
+
+/**
+ * @brief Looks up the names that sound like the query in the target YP
+ * phonebook, in lexicographic order: each word of the query must sound
+ * like a word of the name according to Double Metaphone, e.g. "smith"
+ * finds "Smyth, Jon" and "Schmidt, Johann". The phonebook must have
+ * been configured with a phonetic index ("phonetic_index" : true),
+ * otherwise YP_ERR_OP_UNSUPPORTED is returned. The names should be
+ * freed by the caller.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] query name to look for.
+ * @param[out] names array of at least *count names.
+ * @param[out] numbers array of at least *count numbers.
+ * @param[inout] count max number of records to return, then number returned.
+ *
+ * @return YP_SUCCESS, YP_ERR_NOT_FOUND if no name sounds like the query,
+ * or other error code defined in YP-common.h
+ */
+YP_return_t YP_phonetic_lookup(
+        YP_phonebook_handle_t handle,
+        const char* query,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count);
+
+/**
+ * @brief Starts going through all the records of the target YP
+ * phonebook, in name order for ordered backends (e.g. "btree") and in
+ * no particular order otherwise. The records are transferred in pages
+ * of page_size bytes (1 MiB if 0), and the provider prepares the next
+ * page while the previous one is sent and the next is requested while
+ * the caller goes through the current one. Records inserted or erased
+ * during the scan may or may not be returned. The scan must be ended
+ * with YP_scan_end. A provider keeps at most 64 scans open per
+ * phonebook (YP_ERR_OP_FORBIDDEN is returned past that), and ends
+ * those left unused for a minute.
+ *
+ * @param[in] handle phonebook handle.
+ * @param[in] page_size size of the pages, in bytes.
+ * @param[out] scan scan.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_scan_begin(
+        YP_phonebook_handle_t handle,
+        size_t page_size,
+        YP_scan_t* scan);
+
+/**
+ * @brief Returns the next record of a scan, or sets name to NULL once
+ * all the records have been returned. The name remains valid until the
+ * next call. A record that doesn't fit in a page makes the scan fail
+ * with YP_ERR_INVALID_ARGS. If inserts made the phonebook grow since the
+ * previous page was read, the scan fails with YP_ERR_SCAN_INVALIDATED
+ * and has to be restarted.
+ *
+ * @param[in] scan scan.
+ * @param[out] name name of the record.
+ * @param[out] number number of the record.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_scan_next(
+        YP_scan_t scan,
+        const char** name,
+        YP_number_t* number);
+
+/**
+ * @brief Ends a scan, releasing its resources in the client and the
+ * provider.
+ *
+ * @param[in] scan scan to end.
+ *
+ * @return YP_SUCCESS or error code defined in YP-common.h
+ */
+YP_return_t YP_scan_end(YP_scan_t scan);
+
 #ifdef __cplusplus
 }
 #endif
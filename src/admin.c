@@ -24,6 +24,7 @@ YP_return_t YP_admin_init(margo_instance_id mid, YP_admin_t* admin)
         margo_registered_name(mid, "YP_close_phonebook", &a->close_phonebook_id, &flag);
         margo_registered_name(mid, "YP_destroy_phonebook", &a->destroy_phonebook_id, &flag);
         margo_registered_name(mid, "YP_list_phonebooks", &a->list_phonebooks_id, &flag);
+        margo_registered_name(mid, "YP_snapshot_phonebook", &a->snapshot_phonebook_id, &flag);
         /* Get more existing RPCs... */
     } else {
         a->create_phonebook_id =
@@ -41,6 +42,9 @@ YP_return_t YP_admin_init(margo_instance_id mid, YP_admin_t* admin)
         a->list_phonebooks_id =
             MARGO_REGISTER(mid, "YP_list_phonebooks",
             list_phonebooks_in_t, list_phonebooks_out_t, NULL);
+        a->snapshot_phonebook_id =
+            MARGO_REGISTER(mid, "YP_snapshot_phonebook",
+            snapshot_phonebook_in_t, snapshot_phonebook_out_t, NULL);
         /* Register more RPCs ... */
     }
 
@@ -232,6 +236,47 @@ YP_return_t YP_destroy_phonebook(
     return ret;
 }
 
+YP_return_t YP_snapshot_phonebook(
+        YP_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        YP_phonebook_id_t id,
+        const char* path)
+{
+    hg_handle_t h;
+    snapshot_phonebook_in_t  in;
+    snapshot_phonebook_out_t out;
+    hg_return_t hret;
+    int ret;
+
+    memcpy(&in.id, &id, sizeof(id));
+    in.token  = (char*)token;
+    in.path   = (char*)(path ? path : "");
+
+    hret = margo_create(admin->mid, address, admin->snapshot_phonebook_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
 YP_return_t YP_list_phonebooks(
         YP_admin_t admin,
         hg_addr_t address,
@@ -16,6 +16,7 @@ typedef struct YP_admin {
    hg_id_t           close_phonebook_id;
    hg_id_t           destroy_phonebook_id;
    hg_id_t           list_phonebooks_id;
+   hg_id_t           snapshot_phonebook_id;
 } YP_admin;
 
 #endif
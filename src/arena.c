@@ -0,0 +1,65 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+void arena_init(arena* a, size_t chunk_size)
+{
+    a->chunks     = NULL;
+    a->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    a->live       = 0;
+    a->dead       = 0;
+}
+
+void arena_destroy(arena* a)
+{
+    arena_chunk* chunk = a->chunks;
+    while(chunk) {
+        arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    a->chunks = NULL;
+    a->live   = 0;
+    a->dead   = 0;
+}
+
+void* arena_alloc(arena* a, size_t size, size_t align)
+{
+    arena_chunk* chunk = a->chunks;
+    size_t offset = 0;
+    if(chunk) offset = (chunk->used + align - 1) & ~(align - 1);
+    if(!chunk || offset + size > chunk->size) {
+        /* objects that don't fit in a chunk get their own, placed behind
+         * the current one so that its free space isn't lost */
+        int large = size > a->chunk_size / 4;
+        size_t chunk_size = large ? size : a->chunk_size;
+        arena_chunk* c = (arena_chunk*)malloc(sizeof(*c) + chunk_size);
+        if(!c) return NULL;
+        c->size = chunk_size;
+        c->used = 0;
+        if(large && chunk) {
+            c->next = chunk->next;
+            chunk->next = c;
+        } else {
+            c->next = chunk;
+            a->chunks = c;
+        }
+        chunk  = c;
+        offset = 0;
+    }
+    chunk->used = offset + size;
+    a->live += size;
+    return chunk->data + offset;
+}
+
+char* arena_copy(arena* a, const void* data, size_t size)
+{
+    char* copy = (char*)arena_alloc(a, size, 1);
+    if(copy) memcpy(copy, data, size);
+    return copy;
+}
@@ -0,0 +1,67 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bump allocator for the variable-size data of a phonebook (names,
+ * leaves): objects are carved out of large chunks and never freed one
+ * by one. Releasing an object only counts its bytes as dead; once dead
+ * bytes dominate (arena_should_compact), the owner copies its live
+ * objects into a fresh arena and destroys the old one. Destroying an
+ * arena frees all its chunks at once, so tearing down a phonebook
+ * doesn't need to visit its records.
+ */
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64*1024)
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t              size;
+    size_t              used;
+    char                data[];
+} arena_chunk;
+
+typedef struct arena {
+    arena_chunk* chunks;     // chunk being filled first
+    size_t       chunk_size;
+    size_t       live;       // bytes allocated and not released
+    size_t       dead;       // bytes released
+} arena;
+
+void arena_init(arena* a, size_t chunk_size);
+
+void arena_destroy(arena* a);
+
+/**
+ * @brief Allocates size bytes aligned on align (a power of 2 no larger
+ * than 8), or returns NULL.
+ */
+void* arena_alloc(arena* a, size_t size, size_t align);
+
+/**
+ * @brief Copies size bytes of data into the arena.
+ */
+char* arena_copy(arena* a, const void* data, size_t size);
+
+/**
+ * @brief Accounts for an object of the given size that is no longer used.
+ */
+static inline void arena_release(arena* a, size_t size)
+{
+    a->live -= size;
+    a->dead += size;
+}
+
+static inline int arena_should_compact(const arena* a)
+{
+    return a->dead > a->live && a->dead >= a->chunk_size;
+}
+
+#endif
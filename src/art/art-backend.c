@@ -0,0 +1,184 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "art-backend.h"
+#include "art.h"
+
+typedef struct art_context {
+    struct json_object* config;
+    art_tree            tree;
+} art_context;
+
+static YP_return_t art_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        art_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+        if (!json_object_is_type(config, json_type_object)) {
+            margo_error(provider->mid, "JSON configuration should be an object");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+
+    art_context* ctx = (art_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    art_init(&ctx->tree);
+    ctx->config = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t art_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return art_create_context(provider, config_str, (art_context**)context);
+}
+
+static YP_return_t art_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    /* nothing is persisted, opening is the same as creating */
+    return art_create_context(provider, config_str, (art_context**)context);
+}
+
+static YP_return_t art_close_phonebook(void* ctx)
+{
+    art_context* context = (art_context*)ctx;
+    art_destroy(&context->tree);
+    json_object_put(context->config);
+    free(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t art_destroy_phonebook(void* ctx)
+{
+    return art_close_phonebook(ctx);
+}
+
+static char* art_get_config(void* ctx)
+{
+    art_context* context = (art_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void art_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from ART phonebook\n");
+}
+
+static int32_t art_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t art_backend_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    art_context* context = (art_context*)ctx;
+    return art_insert(&context->tree, name, name_size, number);
+}
+
+static YP_return_t art_backend_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    art_context* context = (art_context*)ctx;
+    uint64_t* value = art_find(&context->tree, name, name_size);
+    if(!value) return YP_ERR_NOT_FOUND;
+    *number = *value;
+    return YP_SUCCESS;
+}
+
+static YP_return_t art_backend_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    art_context* context = (art_context*)ctx;
+    return art_erase(&context->tree, name, name_size);
+}
+
+static YP_return_t art_list_range(
+        void* ctx,
+        const char* lower, size_t lower_size, int inclusive,
+        const char* upper, size_t upper_size,
+        YP_record_fn fn, void* uargs)
+{
+    art_context* context = (art_context*)ctx;
+    art_iterate_range(&context->tree, lower, lower_size, inclusive,
+                      upper, upper_size, fn, uargs);
+    return YP_SUCCESS;
+}
+
+static YP_return_t art_list_prefix(
+        void* ctx,
+        const char* prefix, size_t prefix_size,
+        YP_record_fn fn, void* uargs)
+{
+    art_context* context = (art_context*)ctx;
+    art_iterate_prefix(&context->tree, prefix, prefix_size, fn, uargs);
+    return YP_SUCCESS;
+}
+
+static YP_return_t art_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    return art_list_range(ctx, NULL, 0, 1, NULL, 0, fn, uargs);
+}
+
+static YP_backend_impl art_backend = {
+    .name             = "art",
+
+    .create_phonebook  = art_create_phonebook,
+    .open_phonebook    = art_open_phonebook,
+    .close_phonebook   = art_close_phonebook,
+    .destroy_phonebook = art_destroy_phonebook,
+    .get_config       = art_get_config,
+
+    .hello            = art_say_hello,
+    .sum              = art_compute_sum,
+    .insert           = art_backend_insert,
+    .lookup           = art_backend_lookup,
+    .erase            = art_backend_erase,
+    .list_range       = art_list_range,
+    .list_prefix      = art_list_prefix,
+    .iterate          = art_iterate
+};
+
+YP_return_t YP_provider_register_art_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &art_backend);
+}
@@ -0,0 +1,766 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "art.h"
+
+#define IS_LEAF(p)   ((uintptr_t)(p) & 1)
+#define AS_LEAF(p)   ((art_leaf*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define TAG_LEAF(l)  ((void*)((uintptr_t)(l) | 1))
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static inline size_t leaf_size(size_t key_size)
+{
+    return sizeof(art_leaf) + key_size;
+}
+
+static art_leaf* make_leaf(arena* leaves, const char* key, size_t key_size, uint64_t value)
+{
+    art_leaf* leaf = (art_leaf*)arena_alloc(leaves, leaf_size(key_size), 8);
+    if(!leaf) return NULL;
+    leaf->value    = value;
+    leaf->key_size = (uint32_t)key_size;
+    memcpy(leaf->key, key, key_size);
+    return leaf;
+}
+
+static inline int leaf_matches(const art_leaf* leaf, const char* key, size_t key_size)
+{
+    return leaf->key_size == key_size && memcmp(leaf->key, key, key_size) == 0;
+}
+
+static art_node* new_node(uint8_t type)
+{
+    size_t size = 0;
+    switch(type) {
+    case ART_NODE4:   size = sizeof(art_node4);   break;
+    case ART_NODE16:  size = sizeof(art_node16);  break;
+    case ART_NODE48:  size = sizeof(art_node48);  break;
+    case ART_NODE256: size = sizeof(art_node256); break;
+    }
+    art_node* n = (art_node*)calloc(1, size);
+    if(n) n->type = type;
+    return n;
+}
+
+/* Leaves are freed along with the arena */
+static void free_tree(void* node)
+{
+    if(!node || IS_LEAF(node)) return;
+    art_node* n = (art_node*)node;
+    switch(n->type) {
+    case ART_NODE4:
+        for(unsigned i = 0; i < n->num_children; i++)
+            free_tree(((art_node4*)n)->children[i]);
+        break;
+    case ART_NODE16:
+        for(unsigned i = 0; i < n->num_children; i++)
+            free_tree(((art_node16*)n)->children[i]);
+        break;
+    case ART_NODE48:
+        for(unsigned i = 0; i < 48; i++)
+            free_tree(((art_node48*)n)->children[i]);
+        break;
+    case ART_NODE256:
+        for(unsigned i = 0; i < 256; i++)
+            free_tree(((art_node256*)n)->children[i]);
+        break;
+    }
+    free(n);
+}
+
+void art_init(art_tree* tree)
+{
+    tree->root = NULL;
+    tree->size = 0;
+    arena_init(&tree->leaves, ARENA_DEFAULT_CHUNK_SIZE);
+}
+
+void art_destroy(art_tree* tree)
+{
+    free_tree(tree->root);
+    arena_destroy(&tree->leaves);
+    tree->root = NULL;
+    tree->size = 0;
+}
+
+static art_leaf* move_leaf(art_leaf* leaf, char** dst)
+{
+    art_leaf* copy = (art_leaf*)*dst;
+    memcpy(copy, leaf, leaf_size(leaf->key_size));
+    *dst += (leaf_size(leaf->key_size) + 7) & ~(size_t)7;
+    return copy;
+}
+
+static void move_leaves(void** ref, char** dst)
+{
+    void* node = *ref;
+    if(!node) return;
+    if(IS_LEAF(node)) {
+        *ref = TAG_LEAF(move_leaf(AS_LEAF(node), dst));
+        return;
+    }
+    art_node* n = (art_node*)node;
+    if(n->terminal) n->terminal = move_leaf(n->terminal, dst);
+    switch(n->type) {
+    case ART_NODE4:
+        for(unsigned i = 0; i < n->num_children; i++)
+            move_leaves(&((art_node4*)n)->children[i], dst);
+        break;
+    case ART_NODE16:
+        for(unsigned i = 0; i < n->num_children; i++)
+            move_leaves(&((art_node16*)n)->children[i], dst);
+        break;
+    case ART_NODE48:
+        for(unsigned i = 0; i < 48; i++)
+            move_leaves(&((art_node48*)n)->children[i], dst);
+        break;
+    case ART_NODE256:
+        for(unsigned i = 0; i < 256; i++)
+            move_leaves(&((art_node256*)n)->children[i], dst);
+        break;
+    }
+}
+
+/* Moves the leaves in use to a new arena. They are copied into a single
+ * allocation (with room for their padding), so that the tree is left
+ * untouched if it fails. */
+static void compact_leaves(art_tree* tree)
+{
+    arena leaves;
+    arena_init(&leaves, tree->leaves.chunk_size);
+    char* dst = (char*)arena_alloc(&leaves, tree->leaves.live + 7*tree->size, 8);
+    if(!dst) return;
+    move_leaves(&tree->root, &dst);
+    leaves.live = tree->leaves.live;
+    arena_destroy(&tree->leaves);
+    tree->leaves = leaves;
+}
+
+static void** find_child(art_node* n, unsigned char c)
+{
+    switch(n->type) {
+    case ART_NODE4: {
+        art_node4* n4 = (art_node4*)n;
+        for(unsigned i = 0; i < n->num_children; i++)
+            if(n4->keys[i] == c) return &n4->children[i];
+        break;
+    }
+    case ART_NODE16: {
+        art_node16* n16 = (art_node16*)n;
+#ifdef __SSE2__
+        __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)c),
+                                     _mm_loadu_si128((const __m128i*)n16->keys));
+        unsigned mask = (unsigned)_mm_movemask_epi8(cmp) & ((1u << n->num_children) - 1);
+        if(mask) return &n16->children[__builtin_ctz(mask)];
+#else
+        for(unsigned i = 0; i < n->num_children; i++)
+            if(n16->keys[i] == c) return &n16->children[i];
+#endif
+        break;
+    }
+    case ART_NODE48: {
+        art_node48* n48 = (art_node48*)n;
+        if(n48->index[c]) return &n48->children[n48->index[c] - 1];
+        break;
+    }
+    case ART_NODE256: {
+        art_node256* n256 = (art_node256*)n;
+        if(n256->children[c]) return &n256->children[c];
+        break;
+    }
+    }
+    return NULL;
+}
+
+/* Leaf with the smallest key under node, used to recover the bytes of
+ * prefixes longer than ART_MAX_PREFIX. */
+static art_leaf* minimum(const void* node)
+{
+    while(node && !IS_LEAF(node)) {
+        const art_node* n = (const art_node*)node;
+        if(n->terminal) return n->terminal;
+        switch(n->type) {
+        case ART_NODE4:
+            node = ((const art_node4*)n)->children[0];
+            break;
+        case ART_NODE16:
+            node = ((const art_node16*)n)->children[0];
+            break;
+        case ART_NODE48: {
+            const art_node48* n48 = (const art_node48*)n;
+            unsigned c = 0;
+            while(!n48->index[c]) c++;
+            node = n48->children[n48->index[c] - 1];
+            break;
+        }
+        case ART_NODE256: {
+            const art_node256* n256 = (const art_node256*)n;
+            unsigned c = 0;
+            while(!n256->children[c]) c++;
+            node = n256->children[c];
+            break;
+        }
+        }
+    }
+    return node ? AS_LEAF(node) : NULL;
+}
+
+static inline void copy_header(art_node* dst, const art_node* src)
+{
+    dst->num_children = src->num_children;
+    dst->prefix_len   = src->prefix_len;
+    dst->terminal     = src->terminal;
+    memcpy(dst->prefix, src->prefix, ART_MAX_PREFIX);
+}
+
+/* Inserts c in a sorted array of keys (of node4 and node16), returns its position */
+static inline unsigned insert_sorted(unsigned char* keys, void** children, unsigned n, unsigned char c, void* child)
+{
+    unsigned i = 0;
+    while(i < n && keys[i] < c) i++;
+    memmove(keys + i + 1, keys + i, n - i);
+    memmove(children + i + 1, children + i, (n - i) * sizeof(void*));
+    keys[i]     = c;
+    children[i] = child;
+    return i;
+}
+
+/* Adds a child to n, growing it (and updating *ref) if it is full */
+static YP_return_t add_child(art_node* n, void** ref, unsigned char c, void* child)
+{
+    switch(n->type) {
+    case ART_NODE4: {
+        art_node4* n4 = (art_node4*)n;
+        if(n->num_children < 4) {
+            insert_sorted(n4->keys, n4->children, n->num_children, c, child);
+            n->num_children++;
+            return YP_SUCCESS;
+        }
+        art_node16* n16 = (art_node16*)new_node(ART_NODE16);
+        if(!n16) return YP_ERR_ALLOCATION;
+        copy_header(&n16->base, n);
+        memcpy(n16->keys, n4->keys, 4);
+        memcpy(n16->children, n4->children, 4 * sizeof(void*));
+        *ref = n16;
+        free(n4);
+        return add_child(&n16->base, ref, c, child);
+    }
+    case ART_NODE16: {
+        art_node16* n16 = (art_node16*)n;
+        if(n->num_children < 16) {
+            insert_sorted(n16->keys, n16->children, n->num_children, c, child);
+            n->num_children++;
+            return YP_SUCCESS;
+        }
+        art_node48* n48 = (art_node48*)new_node(ART_NODE48);
+        if(!n48) return YP_ERR_ALLOCATION;
+        copy_header(&n48->base, n);
+        for(unsigned i = 0; i < 16; i++) {
+            n48->index[n16->keys[i]] = (unsigned char)(i + 1);
+            n48->children[i] = n16->children[i];
+        }
+        *ref = n48;
+        free(n16);
+        return add_child(&n48->base, ref, c, child);
+    }
+    case ART_NODE48: {
+        art_node48* n48 = (art_node48*)n;
+        if(n->num_children < 48) {
+            unsigned pos = 0;
+            while(n48->children[pos]) pos++;
+            n48->children[pos] = child;
+            n48->index[c] = (unsigned char)(pos + 1);
+            n->num_children++;
+            return YP_SUCCESS;
+        }
+        art_node256* n256 = (art_node256*)new_node(ART_NODE256);
+        if(!n256) return YP_ERR_ALLOCATION;
+        copy_header(&n256->base, n);
+        for(unsigned i = 0; i < 256; i++)
+            if(n48->index[i])
+                n256->children[i] = n48->children[n48->index[i] - 1];
+        *ref = n256;
+        free(n48);
+        return add_child(&n256->base, ref, c, child);
+    }
+    case ART_NODE256: {
+        art_node256* n256 = (art_node256*)n;
+        n256->children[c] = child;
+        n->num_children++;
+        return YP_SUCCESS;
+    }
+    }
+    return YP_ERR_OTHER;
+}
+
+/* Replaces a node4 that no longer needs to exist: one with only its
+ * terminal leaf left, or with a single child and no terminal, which is
+ * merged with the child (concatenating their prefixes). */
+static void collapse(void** ref)
+{
+    art_node4* n4 = (art_node4*)*ref;
+    art_node*  n  = &n4->base;
+    if(n->num_children == 0 && n->terminal) {
+        *ref = TAG_LEAF(n->terminal);
+        free(n4);
+        return;
+    }
+    if(n->num_children != 1 || n->terminal)
+        return;
+    void* child = n4->children[0];
+    if(!IS_LEAF(child)) {
+        art_node* c = (art_node*)child;
+        uint32_t prefix = n->prefix_len;
+        if(prefix < ART_MAX_PREFIX)
+            n->prefix[prefix++] = n4->keys[0];
+        if(prefix < ART_MAX_PREFIX) {
+            uint32_t sub = MIN(c->prefix_len, ART_MAX_PREFIX - prefix);
+            memcpy(n->prefix + prefix, c->prefix, sub);
+            prefix += sub;
+        }
+        memcpy(c->prefix, n->prefix, MIN(prefix, ART_MAX_PREFIX));
+        c->prefix_len += n->prefix_len + 1;
+    }
+    *ref = child;
+    free(n4);
+}
+
+/* Removes the child in slot of n, shrinking n (and updating *ref) if it
+ * becomes sparse enough */
+static void remove_child(art_node* n, void** ref, unsigned char c, void** slot)
+{
+    switch(n->type) {
+    case ART_NODE4: {
+        art_node4* n4 = (art_node4*)n;
+        unsigned pos = (unsigned)(slot - n4->children);
+        memmove(n4->keys + pos, n4->keys + pos + 1, n->num_children - pos - 1);
+        memmove(n4->children + pos, n4->children + pos + 1,
+                (n->num_children - pos - 1) * sizeof(void*));
+        n->num_children--;
+        collapse(ref);
+        break;
+    }
+    case ART_NODE16: {
+        art_node16* n16 = (art_node16*)n;
+        unsigned pos = (unsigned)(slot - n16->children);
+        memmove(n16->keys + pos, n16->keys + pos + 1, n->num_children - pos - 1);
+        memmove(n16->children + pos, n16->children + pos + 1,
+                (n->num_children - pos - 1) * sizeof(void*));
+        n->num_children--;
+        if(n->num_children == 3) {
+            art_node4* n4 = (art_node4*)new_node(ART_NODE4);
+            if(!n4) break; // keep the sparse node16
+            copy_header(&n4->base, n);
+            memcpy(n4->keys, n16->keys, 3);
+            memcpy(n4->children, n16->children, 3 * sizeof(void*));
+            *ref = n4;
+            free(n16);
+        }
+        break;
+    }
+    case ART_NODE48: {
+        art_node48* n48 = (art_node48*)n;
+        n48->children[n48->index[c] - 1] = NULL;
+        n48->index[c] = 0;
+        n->num_children--;
+        if(n->num_children == 12) {
+            art_node16* n16 = (art_node16*)new_node(ART_NODE16);
+            if(!n16) break;
+            copy_header(&n16->base, n);
+            unsigned k = 0;
+            for(unsigned i = 0; i < 256; i++) {
+                if(!n48->index[i]) continue;
+                n16->keys[k]     = (unsigned char)i;
+                n16->children[k] = n48->children[n48->index[i] - 1];
+                k++;
+            }
+            *ref = n16;
+            free(n48);
+        }
+        break;
+    }
+    case ART_NODE256: {
+        art_node256* n256 = (art_node256*)n;
+        n256->children[c] = NULL;
+        n->num_children--;
+        if(n->num_children == 37) {
+            art_node48* n48 = (art_node48*)new_node(ART_NODE48);
+            if(!n48) break;
+            copy_header(&n48->base, n);
+            unsigned pos = 0;
+            for(unsigned i = 0; i < 256; i++) {
+                if(!n256->children[i]) continue;
+                n48->children[pos] = n256->children[i];
+                n48->index[i] = (unsigned char)(pos + 1);
+                pos++;
+            }
+            *ref = n48;
+            free(n256);
+        }
+        break;
+    }
+    }
+}
+
+/* Number of bytes of the stored prefix of n that match the key */
+static inline uint32_t check_prefix(const art_node* n, const char* key, size_t key_size, size_t depth)
+{
+    uint32_t max = (uint32_t)MIN(MIN(n->prefix_len, ART_MAX_PREFIX), key_size - depth);
+    uint32_t i = 0;
+    while(i < max && n->prefix[i] == (unsigned char)key[depth + i]) i++;
+    return i;
+}
+
+/* Number of bytes of the full prefix of n that match the key */
+static uint32_t prefix_mismatch(const art_node* n, const char* key, size_t key_size, size_t depth)
+{
+    uint32_t i = check_prefix(n, key, key_size, depth);
+    if(i < ART_MAX_PREFIX || n->prefix_len <= ART_MAX_PREFIX)
+        return i;
+    const art_leaf* l = minimum(n);
+    size_t max = MIN(MIN((size_t)l->key_size, key_size) - depth, n->prefix_len);
+    while(i < max && l->key[depth + i] == key[depth + i]) i++;
+    return i;
+}
+
+uint64_t* art_find(
+        const art_tree* tree,
+        const char* key,
+        size_t key_size)
+{
+    void* node = tree->root;
+    size_t depth = 0;
+    while(node) {
+        if(IS_LEAF(node)) {
+            art_leaf* l = AS_LEAF(node);
+            return leaf_matches(l, key, key_size) ? &l->value : NULL;
+        }
+        art_node* n = (art_node*)node;
+        if(n->prefix_len) {
+            /* optimistic: bytes past ART_MAX_PREFIX are checked at the leaf */
+            if(check_prefix(n, key, key_size, depth) != MIN(n->prefix_len, ART_MAX_PREFIX))
+                return NULL;
+            depth += n->prefix_len;
+        }
+        if(depth > key_size) return NULL;
+        if(depth == key_size)
+            return n->terminal && leaf_matches(n->terminal, key, key_size) ?
+                &n->terminal->value : NULL;
+        void** child = find_child(n, (unsigned char)key[depth]);
+        node = child ? *child : NULL;
+        depth += 1;
+    }
+    return NULL;
+}
+
+static YP_return_t insert_rec(
+        arena* leaves, void** ref, const char* key, size_t key_size, size_t depth,
+        uint64_t value, int* inserted)
+{
+    void* node = *ref;
+    if(!node) {
+        art_leaf* leaf = make_leaf(leaves, key, key_size, value);
+        if(!leaf) return YP_ERR_ALLOCATION;
+        *ref = TAG_LEAF(leaf);
+        *inserted = 1;
+        return YP_SUCCESS;
+    }
+
+    if(IS_LEAF(node)) {
+        art_leaf* l = AS_LEAF(node);
+        if(leaf_matches(l, key, key_size)) {
+            l->value = value;
+            return YP_SUCCESS;
+        }
+        /* replace the leaf by a node4 holding both leaves */
+        art_leaf* leaf = make_leaf(leaves, key, key_size, value);
+        art_node* n    = new_node(ART_NODE4);
+        if(!leaf || !n) {
+            if(leaf) arena_release(leaves, leaf_size(key_size));
+            free(n);
+            return YP_ERR_ALLOCATION;
+        }
+        size_t max = MIN((size_t)l->key_size, key_size);
+        size_t common = depth;
+        while(common < max && l->key[common] == key[common]) common++;
+        n->prefix_len = (uint32_t)(common - depth);
+        memcpy(n->prefix, key + depth, MIN(n->prefix_len, ART_MAX_PREFIX));
+        void* nn = n;
+        if(l->key_size == common) n->terminal = l;
+        else add_child(n, &nn, (unsigned char)l->key[common], node);
+        if(key_size == common) n->terminal = leaf;
+        else add_child(n, &nn, (unsigned char)key[common], TAG_LEAF(leaf));
+        *ref = n;
+        *inserted = 1;
+        return YP_SUCCESS;
+    }
+
+    art_node* n = (art_node*)node;
+    if(n->prefix_len) {
+        uint32_t mismatch = prefix_mismatch(n, key, key_size, depth);
+        if(mismatch < n->prefix_len) {
+            /* split the prefix: a new node4 takes its first bytes */
+            art_leaf* leaf = make_leaf(leaves, key, key_size, value);
+            art_node* parent = new_node(ART_NODE4);
+            if(!leaf || !parent) {
+                if(leaf) arena_release(leaves, leaf_size(key_size));
+                free(parent);
+                return YP_ERR_ALLOCATION;
+            }
+            void* pp = parent;
+            parent->prefix_len = mismatch;
+            if(n->prefix_len <= ART_MAX_PREFIX) {
+                memcpy(parent->prefix, n->prefix, MIN(mismatch, ART_MAX_PREFIX));
+                add_child(parent, &pp, n->prefix[mismatch], n);
+                n->prefix_len -= mismatch + 1;
+                memmove(n->prefix, n->prefix + mismatch + 1, MIN(n->prefix_len, ART_MAX_PREFIX));
+            } else {
+                const art_leaf* l = minimum(n);
+                memcpy(parent->prefix, l->key + depth, MIN(mismatch, ART_MAX_PREFIX));
+                add_child(parent, &pp, (unsigned char)l->key[depth + mismatch], n);
+                n->prefix_len -= mismatch + 1;
+                memcpy(n->prefix, l->key + depth + mismatch + 1, MIN(n->prefix_len, ART_MAX_PREFIX));
+            }
+            if(depth + mismatch == key_size) parent->terminal = leaf;
+            else add_child(parent, &pp, (unsigned char)key[depth + mismatch], TAG_LEAF(leaf));
+            *ref = parent;
+            *inserted = 1;
+            return YP_SUCCESS;
+        }
+        depth += n->prefix_len;
+    }
+
+    if(depth == key_size) {
+        if(n->terminal) {
+            n->terminal->value = value;
+            return YP_SUCCESS;
+        }
+        n->terminal = make_leaf(leaves, key, key_size, value);
+        if(!n->terminal) return YP_ERR_ALLOCATION;
+        *inserted = 1;
+        return YP_SUCCESS;
+    }
+
+    void** child = find_child(n, (unsigned char)key[depth]);
+    if(child)
+        return insert_rec(leaves, child, key, key_size, depth + 1, value, inserted);
+
+    art_leaf* leaf = make_leaf(leaves, key, key_size, value);
+    if(!leaf) return YP_ERR_ALLOCATION;
+    YP_return_t ret = add_child(n, ref, (unsigned char)key[depth], TAG_LEAF(leaf));
+    if(ret != YP_SUCCESS) {
+        arena_release(leaves, leaf_size(key_size));
+        return ret;
+    }
+    *inserted = 1;
+    return YP_SUCCESS;
+}
+
+YP_return_t art_insert(
+        art_tree* tree,
+        const char* key,
+        size_t key_size,
+        uint64_t value)
+{
+    if(key_size > UINT32_MAX) return YP_ERR_INVALID_ARGS;
+    int inserted = 0;
+    YP_return_t ret = insert_rec(&tree->leaves, &tree->root, key, key_size, 0, value, &inserted);
+    if(inserted) tree->size += 1;
+    return ret;
+}
+
+static art_leaf* erase_rec(void** ref, const char* key, size_t key_size, size_t depth)
+{
+    void* node = *ref;
+    if(!node) return NULL;
+    if(IS_LEAF(node)) {
+        art_leaf* l = AS_LEAF(node);
+        if(!leaf_matches(l, key, key_size)) return NULL;
+        *ref = NULL;
+        return l;
+    }
+    art_node* n = (art_node*)node;
+    if(n->prefix_len) {
+        if(check_prefix(n, key, key_size, depth) != MIN(n->prefix_len, ART_MAX_PREFIX))
+            return NULL;
+        depth += n->prefix_len;
+    }
+    if(depth > key_size) return NULL;
+    if(depth == key_size) {
+        art_leaf* l = n->terminal;
+        if(!l || !leaf_matches(l, key, key_size)) return NULL;
+        n->terminal = NULL;
+        if(n->type == ART_NODE4) collapse(ref);
+        return l;
+    }
+    unsigned char c = (unsigned char)key[depth];
+    void** child = find_child(n, c);
+    if(!child) return NULL;
+    if(IS_LEAF(*child)) {
+        art_leaf* l = AS_LEAF(*child);
+        if(!leaf_matches(l, key, key_size)) return NULL;
+        remove_child(n, ref, c, child);
+        return l;
+    }
+    return erase_rec(child, key, key_size, depth + 1);
+}
+
+YP_return_t art_erase(
+        art_tree* tree,
+        const char* key,
+        size_t key_size)
+{
+    art_leaf* l = erase_rec(&tree->root, key, key_size, 0);
+    if(!l) return YP_ERR_NOT_FOUND;
+    arena_release(&tree->leaves, leaf_size(l->key_size));
+    tree->size -= 1;
+    if(arena_should_compact(&tree->leaves))
+        compact_leaves(tree);
+    return YP_SUCCESS;
+}
+
+typedef struct art_iterator {
+    art_callback fn;
+    void*        uargs;
+    const char*  lower;
+    size_t       lower_size;
+    int          inclusive;
+    const char*  upper;
+    size_t       upper_size;
+} art_iterator;
+
+static int compare(const art_leaf* l, const char* key, size_t key_size)
+{
+    int c = memcmp(l->key, key, MIN((size_t)l->key_size, key_size));
+    if(c) return c;
+    return l->key_size < key_size ? -1 : (l->key_size > key_size);
+}
+
+/* Returns non-zero to stop the iteration */
+static int emit(const art_leaf* l, const art_iterator* it)
+{
+    if(it->lower) {
+        int c = compare(l, it->lower, it->lower_size);
+        if(c < 0 || (c == 0 && !it->inclusive)) return 0;
+    }
+    if(it->upper && compare(l, it->upper, it->upper_size) >= 0)
+        return 1;
+    return it->fn(it->uargs, l->key, l->key_size, l->value);
+}
+
+static int iterate_from(const void* node, size_t depth, const art_iterator* it);
+
+/* Visits the children of n in order. If c >= 0, children before c are
+ * skipped and the child at c is visited from the lower bound. */
+static int iterate_children(const art_node* n, int c, size_t depth, const art_iterator* it)
+{
+#define VISIT(byte, child) \
+    if((int)(byte) == c) { if(iterate_from(child, depth + 1, it)) return 1; } \
+    else if((int)(byte) > c) { if(iterate_from(child, (size_t)-1, it)) return 1; }
+
+    switch(n->type) {
+    case ART_NODE4: {
+        const art_node4* n4 = (const art_node4*)n;
+        for(unsigned i = 0; i < n->num_children; i++) { VISIT(n4->keys[i], n4->children[i]) }
+        break;
+    }
+    case ART_NODE16: {
+        const art_node16* n16 = (const art_node16*)n;
+        for(unsigned i = 0; i < n->num_children; i++) { VISIT(n16->keys[i], n16->children[i]) }
+        break;
+    }
+    case ART_NODE48: {
+        const art_node48* n48 = (const art_node48*)n;
+        for(unsigned i = c < 0 ? 0 : (unsigned)c; i < 256; i++)
+            if(n48->index[i]) { VISIT(i, n48->children[n48->index[i] - 1]) }
+        break;
+    }
+    case ART_NODE256: {
+        const art_node256* n256 = (const art_node256*)n;
+        for(unsigned i = c < 0 ? 0 : (unsigned)c; i < 256; i++)
+            if(n256->children[i]) { VISIT(i, n256->children[i]) }
+        break;
+    }
+    }
+#undef VISIT
+    return 0;
+}
+
+/* Visits the leaves under node that are not below the lower bound.
+ * A depth of (size_t)-1 means the whole subtree is above the bound. */
+static int iterate_from(const void* node, size_t depth, const art_iterator* it)
+{
+    if(IS_LEAF(node)) return emit(AS_LEAF(node), it);
+    const art_node* n = (const art_node*)node;
+    int bounded = depth != (size_t)-1 && it->lower && depth < it->lower_size;
+    if(bounded && n->prefix_len) {
+        const unsigned char* p = n->prefix_len <= ART_MAX_PREFIX ?
+            n->prefix : (const unsigned char*)minimum(n)->key + depth;
+        size_t len = MIN((size_t)n->prefix_len, it->lower_size - depth);
+        int c = memcmp(p, it->lower + depth, len);
+        if(c < 0) return 0;
+        if(c > 0 || len < n->prefix_len) bounded = 0;
+        else depth += n->prefix_len;
+    }
+    if(n->terminal && emit(n->terminal, it)) return 1;
+    if(!bounded || depth >= it->lower_size)
+        return iterate_children(n, -1, depth, it);
+    return iterate_children(n, (unsigned char)it->lower[depth], depth, it);
+}
+
+void art_iterate_range(
+        const art_tree* tree,
+        const char* lower,
+        size_t lower_size,
+        int inclusive,
+        const char* upper,
+        size_t upper_size,
+        art_callback fn,
+        void* uargs)
+{
+    art_iterator it = { fn, uargs, lower, lower_size, inclusive, upper, upper_size };
+    if(tree->root) iterate_from(tree->root, 0, &it);
+}
+
+void art_iterate_prefix(
+        const art_tree* tree,
+        const char* prefix,
+        size_t prefix_size,
+        art_callback fn,
+        void* uargs)
+{
+    art_iterator it = { fn, uargs, NULL, 0, 1, NULL, 0 };
+    void* node = tree->root;
+    size_t depth = 0;
+    while(node) {
+        if(IS_LEAF(node)) {
+            const art_leaf* l = AS_LEAF(node);
+            if(l->key_size >= prefix_size && memcmp(l->key, prefix, prefix_size) == 0)
+                emit(l, &it);
+            return;
+        }
+        const art_node* n = (const art_node*)node;
+        if(n->prefix_len && depth < prefix_size) {
+            const unsigned char* p = n->prefix_len <= ART_MAX_PREFIX ?
+                n->prefix : (const unsigned char*)minimum(n)->key + depth;
+            if(memcmp(p, prefix + depth, MIN((size_t)n->prefix_len, prefix_size - depth)) != 0)
+                return;
+        }
+        depth += n->prefix_len;
+        if(depth >= prefix_size) {
+            iterate_from(node, (size_t)-1, &it);
+            return;
+        }
+        void** child = find_child((art_node*)n, (unsigned char)prefix[depth]);
+        node = child ? *child : NULL;
+        depth += 1;
+    }
+}
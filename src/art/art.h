@@ -0,0 +1,136 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _ART_H
+#define _ART_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "../arena.h"
+
+/*
+ * Adaptive radix tree (Leis et al., ICDE 2013) mapping names to
+ * numbers. Inner nodes come in four sizes (4, 16, 48 and 256 children)
+ * and are grown or shrunk as children are added or removed; chains of
+ * single-child nodes are collapsed into a prefix stored in the node
+ * (only its first ART_MAX_PREFIX bytes are kept, the rest is checked
+ * against the leaves). A key that ends at an inner node is stored in
+ * that node's "terminal" slot, which sorts before its children.
+ *
+ * Children are tagged pointers: leaves have their lowest bit set.
+ * Leaves are allocated in an arena owned by the tree, compacted as
+ * erased leaves accumulate.
+ */
+
+#define ART_MAX_PREFIX 8
+
+enum {
+    ART_NODE4 = 1,
+    ART_NODE16,
+    ART_NODE48,
+    ART_NODE256
+};
+
+typedef struct art_leaf {
+    uint64_t value;
+    uint32_t key_size;
+    char     key[];
+} art_leaf;
+
+typedef struct art_node {
+    uint8_t       type;
+    uint16_t      num_children;
+    uint32_t      prefix_len;
+    unsigned char prefix[ART_MAX_PREFIX];
+    art_leaf*     terminal;
+} art_node;
+
+typedef struct art_node4 {
+    art_node      base;
+    unsigned char keys[4];
+    void*         children[4];
+} art_node4;
+
+typedef struct art_node16 {
+    art_node      base;
+    unsigned char keys[16];
+    void*         children[16];
+} art_node16;
+
+typedef struct art_node48 {
+    art_node      base;
+    unsigned char index[256]; // 1 + position in children, 0 if absent
+    void*         children[48];
+} art_node48;
+
+typedef struct art_node256 {
+    art_node      base;
+    void*         children[256];
+} art_node256;
+
+typedef struct art_tree {
+    void*  root;
+    size_t size;
+    arena  leaves;
+} art_tree;
+
+/**
+ * @brief Function called on each key listed, in lexicographic order.
+ * Returning a non-zero value stops the listing.
+ */
+typedef int (*art_callback)(void* uargs, const char* key, size_t key_size, uint64_t value);
+
+void art_init(art_tree* tree);
+
+void art_destroy(art_tree* tree);
+
+/**
+ * @brief Inserts a key, or updates its value if already present.
+ */
+YP_return_t art_insert(
+        art_tree* tree,
+        const char* key,
+        size_t key_size,
+        uint64_t value);
+
+/**
+ * @brief Returns a pointer to the value of a key, or NULL.
+ */
+uint64_t* art_find(
+        const art_tree* tree,
+        const char* key,
+        size_t key_size);
+
+YP_return_t art_erase(
+        art_tree* tree,
+        const char* key,
+        size_t key_size);
+
+/**
+ * @brief Lists the keys starting with the provided prefix.
+ */
+void art_iterate_prefix(
+        const art_tree* tree,
+        const char* prefix,
+        size_t prefix_size,
+        art_callback fn,
+        void* uargs);
+
+/**
+ * @brief Lists the keys in [lower, upper), lower being included only
+ * if inclusive is non-zero. NULL bounds are not enforced.
+ */
+void art_iterate_range(
+        const art_tree* tree,
+        const char* lower,
+        size_t lower_size,
+        int inclusive,
+        const char* upper,
+        size_t upper_size,
+        art_callback fn,
+        void* uargs);
+
+#endif
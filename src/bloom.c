@@ -0,0 +1,33 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+YP_return_t bloom_filter_init(bloom_filter* filter, size_t capacity, double bits_per_name)
+{
+    memset(filter, 0, sizeof(*filter));
+    if(capacity < BLOOM_MIN_CAPACITY) capacity = BLOOM_MIN_CAPACITY;
+    double num_bits = bits_per_name * (double)capacity;
+    size_t num_blocks = (size_t)(num_bits / 512.0) + 1;
+    long num_hashes = (long)(bits_per_name * 0.693147 + 0.5); // bits_per_name * ln(2)
+    if(num_hashes < 1)  num_hashes = 1;
+    if(num_hashes > 16) num_hashes = 16;
+    size_t size = num_blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    filter->blocks = (uint64_t*)aligned_alloc(64, size);
+    if(!filter->blocks) return YP_ERR_ALLOCATION;
+    memset(filter->blocks, 0, size);
+    filter->num_blocks = num_blocks;
+    filter->num_hashes = (uint32_t)num_hashes;
+    filter->capacity   = capacity;
+    return YP_SUCCESS;
+}
+
+void bloom_filter_destroy(bloom_filter* filter)
+{
+    free(filter->blocks);
+    memset(filter, 0, sizeof(*filter));
+}
@@ -0,0 +1,91 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _BLOOM_H
+#define _BLOOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "hash.h"
+
+/*
+ * Blocked Bloom filter (Putze et al., 2007) over name hashes: each name
+ * sets num_hashes bits within a single 512-bit block, so that a query
+ * touches one cache line. Names can't be removed; the owner of the
+ * filter is expected to rebuild it once count reaches capacity.
+ * Adding a name whose bits are all set already (such as a name added
+ * before) doesn't count towards the capacity.
+ * Names can be added and queried concurrently.
+ */
+
+#define BLOOM_BLOCK_WORDS    8   // 512 bits
+#define BLOOM_MIN_CAPACITY   1024
+
+typedef struct bloom_filter {
+    uint64_t* blocks;     // num_blocks * BLOOM_BLOCK_WORDS words, 64-byte aligned
+    size_t    num_blocks;
+    uint32_t  num_hashes; // bits set per name
+    size_t    capacity;   // number of names the filter was sized for
+    size_t    count;      // number of names that set at least one bit
+} bloom_filter;
+
+/**
+ * @brief Allocates a filter for capacity names using bits_per_name
+ * bits per name.
+ */
+YP_return_t bloom_filter_init(bloom_filter* filter, size_t capacity, double bits_per_name);
+
+void bloom_filter_destroy(bloom_filter* filter);
+
+/* Calls the code with "bit" set to each bit of the name within its block */
+#define BLOOM_FOREACH_BIT(filter, hash, code) do {                  \
+    uint64_t _x = YP_hash_mix((hash), 0x9E3779B97F4A7C15ull);       \
+    for(uint32_t _i = 0; _i < (filter)->num_hashes; _i++) {         \
+        if(_i && _i % 7 == 0)                                       \
+            _x = YP_hash_mix(_x, 0xA0761D6478BD642Full);            \
+        unsigned bit = (unsigned)(_x & 511);                        \
+        _x >>= 9;                                                   \
+        code;                                                       \
+    }                                                               \
+} while(0)
+
+static inline uint64_t* bloom_filter_block(const bloom_filter* filter, uint64_t hash)
+{
+    size_t b = (size_t)(((YP_uint128_t)hash * filter->num_blocks) >> 64);
+    return filter->blocks + b * BLOOM_BLOCK_WORDS;
+}
+
+/**
+ * @brief Adds a name, given its YP_hash.
+ */
+static inline void bloom_filter_add(bloom_filter* filter, uint64_t hash)
+{
+    uint64_t* block = bloom_filter_block(filter, hash);
+    uint64_t  added = 0;
+    BLOOM_FOREACH_BIT(filter, hash,
+        added |= ~__atomic_fetch_or(&block[bit / 64], 1ull << (bit % 64), __ATOMIC_RELAXED)
+               & (1ull << (bit % 64)));
+    if(added) __atomic_fetch_add(&filter->count, 1, __ATOMIC_RELAXED);
+}
+
+static inline int bloom_filter_is_full(const bloom_filter* filter)
+{
+    return __atomic_load_n(&filter->count, __ATOMIC_RELAXED) >= filter->capacity;
+}
+
+/**
+ * @brief Returns 0 if the name (given its YP_hash) was never added.
+ */
+static inline int bloom_filter_may_contain(const bloom_filter* filter, uint64_t hash)
+{
+    const uint64_t* block = bloom_filter_block(filter, hash);
+    BLOOM_FOREACH_BIT(filter, hash,
+        if(!(__atomic_load_n(&block[bit / 64], __ATOMIC_RELAXED) & (1ull << (bit % 64))))
+            return 0);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "btree-backend.h"
+#include "btree.h"
+
+typedef struct btree_context {
+    struct json_object* config;
+    btree               tree;
+} btree_context;
+
+static YP_return_t btree_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        btree_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+        if (!json_object_is_type(config, json_type_object)) {
+            margo_error(provider->mid, "JSON configuration should be an object");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+
+    btree_context* ctx = (btree_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    YP_return_t ret = btree_init(&ctx->tree);
+    if (ret != YP_SUCCESS) {
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    ctx->config = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t btree_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return btree_create_context(provider, config_str, (btree_context**)context);
+}
+
+static YP_return_t btree_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    /* nothing is persisted, opening is the same as creating */
+    return btree_create_context(provider, config_str, (btree_context**)context);
+}
+
+static YP_return_t btree_close_phonebook(void* ctx)
+{
+    btree_context* context = (btree_context*)ctx;
+    btree_destroy(&context->tree);
+    json_object_put(context->config);
+    free(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t btree_destroy_phonebook(void* ctx)
+{
+    return btree_close_phonebook(ctx);
+}
+
+static char* btree_get_config(void* ctx)
+{
+    btree_context* context = (btree_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void btree_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from B+tree phonebook\n");
+}
+
+static int32_t btree_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t btree_backend_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    btree_context* context = (btree_context*)ctx;
+    return btree_insert(&context->tree, name, name_size, number);
+}
+
+static YP_return_t btree_backend_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    btree_context* context = (btree_context*)ctx;
+    btree_entry* entry = btree_find(&context->tree, name, name_size);
+    if(!entry) return YP_ERR_NOT_FOUND;
+    *number = entry->value;
+    return YP_SUCCESS;
+}
+
+static YP_return_t btree_backend_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    btree_context* context = (btree_context*)ctx;
+    return btree_erase(&context->tree, name, name_size);
+}
+
+static YP_return_t btree_list_range(
+        void* ctx,
+        const char* lower, size_t lower_size, int inclusive,
+        const char* upper, size_t upper_size,
+        YP_record_fn fn, void* uargs)
+{
+    btree_context* context = (btree_context*)ctx;
+    btree_cursor cursor;
+    btree_seek(&context->tree, lower, lower_size, &cursor);
+    if(lower && !inclusive && btree_cursor_valid(&cursor)) {
+        const btree_entry* e = btree_cursor_entry(&cursor);
+        if(btree_compare(e->key, e->key_size, lower, lower_size) == 0)
+            btree_cursor_next(&cursor);
+    }
+    for(; btree_cursor_valid(&cursor); btree_cursor_next(&cursor)) {
+        const btree_entry* e = btree_cursor_entry(&cursor);
+        if(upper && btree_compare(e->key, e->key_size, upper, upper_size) >= 0)
+            break;
+        if(fn(uargs, e->key, e->key_size, e->value)) break;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t btree_list_prefix(
+        void* ctx,
+        const char* prefix, size_t prefix_size,
+        YP_record_fn fn, void* uargs)
+{
+    btree_context* context = (btree_context*)ctx;
+    btree_cursor cursor;
+    btree_seek(&context->tree, prefix, prefix_size, &cursor);
+    for(; btree_cursor_valid(&cursor); btree_cursor_next(&cursor)) {
+        const btree_entry* e = btree_cursor_entry(&cursor);
+        if(e->key_size < prefix_size || memcmp(e->key, prefix, prefix_size) != 0)
+            break;
+        if(fn(uargs, e->key, e->key_size, e->value)) break;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t btree_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    return btree_list_range(ctx, NULL, 0, 1, NULL, 0, fn, uargs);
+}
+
+static YP_backend_impl btree_backend = {
+    .name             = "btree",
+
+    .create_phonebook  = btree_create_phonebook,
+    .open_phonebook    = btree_open_phonebook,
+    .close_phonebook   = btree_close_phonebook,
+    .destroy_phonebook = btree_destroy_phonebook,
+    .get_config       = btree_get_config,
+
+    .hello            = btree_say_hello,
+    .sum              = btree_compute_sum,
+    .insert           = btree_backend_insert,
+    .lookup           = btree_backend_lookup,
+    .erase            = btree_backend_erase,
+    .list_range       = btree_list_range,
+    .list_prefix      = btree_list_prefix,
+    .iterate          = btree_iterate
+};
+
+YP_return_t YP_provider_register_btree_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &btree_backend);
+}
@@ -0,0 +1,13 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _BTREE_BACKEND_H
+#define _BTREE_BACKEND_H
+
+#include "YP/YP-server.h"
+
+YP_return_t YP_provider_register_btree_backend(YP_provider_t provider);
+
+#endif
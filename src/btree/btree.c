@@ -0,0 +1,468 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#include "btree.h"
+
+#define BTREE_PREFIX_PAD INT64_MAX
+
+static inline int64_t key_prefix(const char* key, size_t key_size)
+{
+    unsigned char buf[8] = { 0 };
+    memcpy(buf, key, key_size < 8 ? key_size : 8);
+    uint64_t p = 0;
+    for(unsigned i = 0; i < 8; i++)
+        p = (p << 8) | buf[i];
+    return (int64_t)(p ^ 0x8000000000000000ull);
+}
+
+int btree_compare(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+    int c = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if(c) return c;
+    return a_size < b_size ? -1 : (a_size > b_size);
+}
+
+/* Number of the first n prefixes that are less than (or_equal = 0) or
+ * less than or equal to (or_equal = 1) p. Prefixes past n are padding
+ * and the array is cache-line aligned, so whole vectors can be loaded. */
+static inline unsigned count_prefixes(const int64_t* prefixes, unsigned n, int64_t p, int or_equal)
+{
+    unsigned count = 0;
+#if defined(__AVX2__)
+    __m256i v = _mm256_set1_epi64x(p);
+    for(unsigned i = 0; i < n; i += 4) {
+        __m256i k = _mm256_load_si256((const __m256i*)(prefixes + i));
+        __m256i m = or_equal ? _mm256_cmpgt_epi64(k, v) : _mm256_cmpgt_epi64(v, k);
+        unsigned bits = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m));
+        count += or_equal ? 4 - __builtin_popcount(bits) : __builtin_popcount(bits);
+    }
+#elif defined(__SSE4_2__)
+    __m128i v = _mm_set1_epi64x(p);
+    for(unsigned i = 0; i < n; i += 2) {
+        __m128i k = _mm_load_si128((const __m128i*)(prefixes + i));
+        __m128i m = or_equal ? _mm_cmpgt_epi64(k, v) : _mm_cmpgt_epi64(v, k);
+        unsigned bits = (unsigned)_mm_movemask_pd(_mm_castsi128_pd(m));
+        count += or_equal ? 2 - __builtin_popcount(bits) : __builtin_popcount(bits);
+    }
+#else
+    for(unsigned i = 0; i < n; i++)
+        count += or_equal ? prefixes[i] <= p : prefixes[i] < p;
+#endif
+    return count < n ? count : n;
+}
+
+/* Index of the first key of the node that is greater than (upper = 1)
+ * or greater than or equal to (upper = 0) the provided key. */
+static inline unsigned node_search(
+        const btree_node* node, char* const* keys, size_t key_stride,
+        const uint32_t* sizes, size_t size_stride,
+        const char* key, size_t key_size, int64_t prefix, int upper)
+{
+    unsigned lo = count_prefixes(node->prefixes, node->count, prefix, 0);
+    unsigned hi = count_prefixes(node->prefixes, node->count, prefix, 1);
+    /* keys in [lo, hi) share the prefix of the key */
+    while(lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        const char* k = *(char* const*)((const char*)keys + mid * key_stride);
+        uint32_t    s = *(const uint32_t*)((const char*)sizes + mid * size_stride);
+        int c = btree_compare(k, s, key, key_size);
+        if(c < 0 || (upper && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static inline unsigned leaf_lower_bound(
+        const btree_leaf* leaf, const char* key, size_t key_size, int64_t prefix)
+{
+    return node_search(&leaf->base,
+            &leaf->entries[0].key, sizeof(btree_entry),
+            &leaf->entries[0].key_size, sizeof(btree_entry),
+            key, key_size, prefix, 0);
+}
+
+static inline unsigned inner_child_index(
+        const btree_inner* inner, const char* key, size_t key_size, int64_t prefix)
+{
+    return node_search(&inner->base,
+            inner->keys, sizeof(char*),
+            inner->key_sizes, sizeof(uint32_t),
+            key, key_size, prefix, 1);
+}
+
+static void* new_node(size_t size, int is_leaf)
+{
+    btree_node* node = (btree_node*)aligned_alloc(64, (size + 63) & ~(size_t)63);
+    if(!node) return NULL;
+    memset(node, 0, size);
+    for(unsigned i = 0; i < BTREE_NODE_SIZE; i++)
+        node->prefixes[i] = BTREE_PREFIX_PAD;
+    node->is_leaf = is_leaf;
+    return node;
+}
+
+/* Keys are freed along with the arena */
+static void free_node(btree_node* node)
+{
+    if(!node->is_leaf) {
+        btree_inner* inner = (btree_inner*)node;
+        for(unsigned i = 0; i <= node->count; i++)
+            free_node(inner->children[i]);
+    }
+    free(node);
+}
+
+YP_return_t btree_init(btree* tree)
+{
+    arena_init(&tree->keys, ARENA_DEFAULT_CHUNK_SIZE);
+    tree->root = (btree_node*)new_node(sizeof(btree_leaf), 1);
+    tree->size = 0;
+    return tree->root ? YP_SUCCESS : YP_ERR_ALLOCATION;
+}
+
+void btree_destroy(btree* tree)
+{
+    if(tree->root) free_node(tree->root);
+    arena_destroy(&tree->keys);
+    tree->root = NULL;
+    tree->size = 0;
+}
+
+static void move_keys(btree_node* node, char** dst)
+{
+    if(node->is_leaf) {
+        btree_leaf* leaf = (btree_leaf*)node;
+        for(unsigned i = 0; i < node->count; i++) {
+            btree_entry* e = &leaf->entries[i];
+            memcpy(*dst, e->key, e->key_size);
+            e->key = *dst;
+            *dst += e->key_size;
+        }
+        return;
+    }
+    btree_inner* inner = (btree_inner*)node;
+    for(unsigned i = 0; i < node->count; i++) {
+        memcpy(*dst, inner->keys[i], inner->key_sizes[i]);
+        inner->keys[i] = *dst;
+        *dst += inner->key_sizes[i];
+    }
+    for(unsigned i = 0; i <= node->count; i++)
+        move_keys(inner->children[i], dst);
+}
+
+/* Moves the keys in use to a new arena. They are copied into a single
+ * allocation, so that the tree is left untouched if it fails. */
+static void compact_keys(btree* tree)
+{
+    arena keys;
+    arena_init(&keys, tree->keys.chunk_size);
+    char* dst = (char*)arena_alloc(&keys, tree->keys.live, 1);
+    if(!dst) return;
+    move_keys(tree->root, &dst);
+    arena_destroy(&tree->keys);
+    tree->keys = keys;
+}
+
+btree_entry* btree_find(
+        const btree* tree,
+        const char* key,
+        size_t key_size)
+{
+    int64_t prefix = key_prefix(key, key_size);
+    btree_node* node = tree->root;
+    while(!node->is_leaf) {
+        btree_inner* inner = (btree_inner*)node;
+        node = inner->children[inner_child_index(inner, key, key_size, prefix)];
+    }
+    btree_leaf* leaf = (btree_leaf*)node;
+    unsigned pos = leaf_lower_bound(leaf, key, key_size, prefix);
+    if(pos < node->count
+    && btree_compare(leaf->entries[pos].key, leaf->entries[pos].key_size, key, key_size) == 0)
+        return &leaf->entries[pos];
+    return NULL;
+}
+
+/* Separator produced by splitting a node: ownership of key goes to the parent. */
+typedef struct btree_split {
+    char*       key;
+    uint32_t    key_size;
+    int64_t     prefix;
+    btree_node* right;
+} btree_split;
+
+static void leaf_insert_at(
+        btree_leaf* leaf, unsigned pos, char* key, uint32_t key_size,
+        int64_t prefix, uint64_t value)
+{
+    unsigned n = leaf->base.count;
+    memmove(&leaf->entries[pos+1], &leaf->entries[pos], (n - pos) * sizeof(btree_entry));
+    memmove(&leaf->base.prefixes[pos+1], &leaf->base.prefixes[pos], (n - pos) * sizeof(int64_t));
+    leaf->entries[pos].key      = key;
+    leaf->entries[pos].key_size = key_size;
+    leaf->entries[pos].value    = value;
+    leaf->base.prefixes[pos]    = prefix;
+    leaf->base.count = n + 1;
+}
+
+static void inner_insert_at(
+        btree_inner* inner, unsigned pos, char* key, uint32_t key_size,
+        int64_t prefix, btree_node* right)
+{
+    unsigned n = inner->base.count;
+    memmove(&inner->keys[pos+1], &inner->keys[pos], (n - pos) * sizeof(char*));
+    memmove(&inner->key_sizes[pos+1], &inner->key_sizes[pos], (n - pos) * sizeof(uint32_t));
+    memmove(&inner->base.prefixes[pos+1], &inner->base.prefixes[pos], (n - pos) * sizeof(int64_t));
+    memmove(&inner->children[pos+2], &inner->children[pos+1], (n - pos) * sizeof(btree_node*));
+    inner->keys[pos]          = key;
+    inner->key_sizes[pos]     = key_size;
+    inner->base.prefixes[pos] = prefix;
+    inner->children[pos+1]    = right;
+    inner->base.count = n + 1;
+}
+
+static YP_return_t insert_rec(
+        arena* keys, btree_node* node, const char* key, size_t key_size, int64_t prefix,
+        uint64_t value, btree_split* split, int* inserted)
+{
+    split->right = NULL;
+
+    if(node->is_leaf) {
+        btree_leaf* leaf = (btree_leaf*)node;
+        unsigned pos = leaf_lower_bound(leaf, key, key_size, prefix);
+        if(pos < node->count
+        && btree_compare(leaf->entries[pos].key, leaf->entries[pos].key_size, key, key_size) == 0) {
+            leaf->entries[pos].value = value;
+            *inserted = 0;
+            return YP_SUCCESS;
+        }
+        char* copy = arena_copy(keys, key, key_size);
+        if(!copy) return YP_ERR_ALLOCATION;
+        *inserted = 1;
+        if(node->count < BTREE_NODE_SIZE) {
+            leaf_insert_at(leaf, pos, copy, (uint32_t)key_size, prefix, value);
+            return YP_SUCCESS;
+        }
+        /* split the leaf: the first L of the N+1 entries stay on the left */
+        const unsigned L = (BTREE_NODE_SIZE + 1) / 2;
+        unsigned keep = pos < L ? L - 1 : L; // existing entries staying on the left
+        const char* first      = pos == L ? key : leaf->entries[keep].key;
+        size_t      first_size = pos == L ? key_size : leaf->entries[keep].key_size;
+        btree_leaf* right = (btree_leaf*)new_node(sizeof(btree_leaf), 1);
+        char* sep = right ? arena_copy(keys, first, first_size) : NULL;
+        if(!sep) {
+            free(right);
+            arena_release(keys, key_size);
+            return YP_ERR_ALLOCATION;
+        }
+        unsigned moved = BTREE_NODE_SIZE - keep;
+        memcpy(right->entries, &leaf->entries[keep], moved * sizeof(btree_entry));
+        memcpy(right->base.prefixes, &node->prefixes[keep], moved * sizeof(int64_t));
+        for(unsigned i = keep; i < BTREE_NODE_SIZE; i++)
+            node->prefixes[i] = BTREE_PREFIX_PAD;
+        right->base.count = moved;
+        node->count = keep;
+        if(pos < L)
+            leaf_insert_at(leaf, pos, copy, (uint32_t)key_size, prefix, value);
+        else
+            leaf_insert_at(right, pos - keep, copy, (uint32_t)key_size, prefix, value);
+        right->next = leaf->next;
+        right->prev = leaf;
+        if(leaf->next) leaf->next->prev = right;
+        leaf->next = right;
+        split->key      = sep;
+        split->key_size = (uint32_t)first_size;
+        split->prefix   = right->base.prefixes[0];
+        split->right    = &right->base;
+        return YP_SUCCESS;
+    }
+
+    btree_inner* inner = (btree_inner*)node;
+    unsigned idx = inner_child_index(inner, key, key_size, prefix);
+    /* a full node may have to split once the child returns, and that
+     * cannot fail after the child has already split */
+    btree_inner* right = NULL;
+    if(node->count == BTREE_NODE_SIZE - 1) {
+        right = (btree_inner*)new_node(sizeof(btree_inner), 0);
+        if(!right) return YP_ERR_ALLOCATION;
+    }
+    btree_split child_split;
+    YP_return_t ret = insert_rec(keys, inner->children[idx], key, key_size, prefix,
+                                 value, &child_split, inserted);
+    if(ret != YP_SUCCESS || !child_split.right) {
+        free(right);
+        return ret;
+    }
+
+    if(!right) {
+        inner_insert_at(inner, idx, child_split.key, child_split.key_size,
+                        child_split.prefix, child_split.right);
+        return YP_SUCCESS;
+    }
+    /* split the inner node, the middle key moves up */
+    unsigned n   = node->count;
+    unsigned mid = n / 2;
+    unsigned moved = n - mid - 1;
+    memcpy(right->keys, &inner->keys[mid+1], moved * sizeof(char*));
+    memcpy(right->key_sizes, &inner->key_sizes[mid+1], moved * sizeof(uint32_t));
+    memcpy(right->base.prefixes, &node->prefixes[mid+1], moved * sizeof(int64_t));
+    memcpy(right->children, &inner->children[mid+1], (moved + 1) * sizeof(btree_node*));
+    right->base.count = moved;
+    split->key      = inner->keys[mid];
+    split->key_size = inner->key_sizes[mid];
+    split->prefix   = node->prefixes[mid];
+    split->right    = &right->base;
+    for(unsigned i = mid; i < n; i++)
+        node->prefixes[i] = BTREE_PREFIX_PAD;
+    node->count = mid;
+    if(idx <= mid)
+        inner_insert_at(inner, idx, child_split.key, child_split.key_size,
+                        child_split.prefix, child_split.right);
+    else
+        inner_insert_at(right, idx - mid - 1, child_split.key, child_split.key_size,
+                        child_split.prefix, child_split.right);
+    return YP_SUCCESS;
+}
+
+YP_return_t btree_insert(
+        btree* tree,
+        const char* key,
+        size_t key_size,
+        uint64_t value)
+{
+    if(key_size > UINT32_MAX) return YP_ERR_INVALID_ARGS;
+    btree_node* old_root = tree->root;
+    btree_inner* root = NULL;
+    if(old_root->count == (old_root->is_leaf ? BTREE_NODE_SIZE : BTREE_NODE_SIZE - 1)) {
+        root = (btree_inner*)new_node(sizeof(btree_inner), 0);
+        if(!root) return YP_ERR_ALLOCATION;
+    }
+    btree_split split;
+    int inserted = 0;
+    YP_return_t ret = insert_rec(&tree->keys, old_root, key, key_size,
+                                 key_prefix(key, key_size), value, &split, &inserted);
+    if(ret == YP_SUCCESS && inserted) tree->size += 1;
+    if(ret != YP_SUCCESS || !split.right) {
+        free(root);
+        return ret;
+    }
+    /* the root was split, grow the tree by one level */
+    root->keys[0]          = split.key;
+    root->key_sizes[0]     = split.key_size;
+    root->base.prefixes[0] = split.prefix;
+    root->children[0]      = old_root;
+    root->children[1]      = split.right;
+    root->base.count       = 1;
+    tree->root = &root->base;
+    return YP_SUCCESS;
+}
+
+/* Returns 1 if the node became empty, in which case the caller frees it. */
+static int erase_rec(
+        arena* keys, btree_node* node, const char* key, size_t key_size, int64_t prefix,
+        int* found)
+{
+    if(node->is_leaf) {
+        btree_leaf* leaf = (btree_leaf*)node;
+        unsigned pos = leaf_lower_bound(leaf, key, key_size, prefix);
+        if(pos == node->count
+        || btree_compare(leaf->entries[pos].key, leaf->entries[pos].key_size, key, key_size) != 0) {
+            *found = 0;
+            return 0;
+        }
+        *found = 1;
+        arena_release(keys, leaf->entries[pos].key_size);
+        unsigned n = node->count;
+        memmove(&leaf->entries[pos], &leaf->entries[pos+1], (n - pos - 1) * sizeof(btree_entry));
+        memmove(&node->prefixes[pos], &node->prefixes[pos+1], (n - pos - 1) * sizeof(int64_t));
+        node->prefixes[n-1] = BTREE_PREFIX_PAD;
+        node->count = n - 1;
+        return node->count == 0;
+    }
+
+    btree_inner* inner = (btree_inner*)node;
+    unsigned idx = inner_child_index(inner, key, key_size, prefix);
+    btree_node* child = inner->children[idx];
+    if(!erase_rec(keys, child, key, key_size, prefix, found))
+        return 0;
+
+    if(child->is_leaf) {
+        btree_leaf* leaf = (btree_leaf*)child;
+        if(leaf->prev) leaf->prev->next = leaf->next;
+        if(leaf->next) leaf->next->prev = leaf->prev;
+    }
+    free(child);
+    unsigned n = node->count;
+    if(n == 0) return 1;
+    /* drop the separator on the left of the child (or on its right for the first child) */
+    unsigned k = idx > 0 ? idx - 1 : 0;
+    arena_release(keys, inner->key_sizes[k]);
+    memmove(&inner->keys[k], &inner->keys[k+1], (n - k - 1) * sizeof(char*));
+    memmove(&inner->key_sizes[k], &inner->key_sizes[k+1], (n - k - 1) * sizeof(uint32_t));
+    memmove(&node->prefixes[k], &node->prefixes[k+1], (n - k - 1) * sizeof(int64_t));
+    memmove(&inner->children[idx], &inner->children[idx+1], (n - idx) * sizeof(btree_node*));
+    node->prefixes[n-1] = BTREE_PREFIX_PAD;
+    node->count = n - 1;
+    return 0;
+}
+
+YP_return_t btree_erase(
+        btree* tree,
+        const char* key,
+        size_t key_size)
+{
+    int found = 0;
+    int empty = erase_rec(&tree->keys, tree->root, key, key_size,
+                          key_prefix(key, key_size), &found);
+    if(!found) return YP_ERR_NOT_FOUND;
+    tree->size -= 1;
+    if(empty && !tree->root->is_leaf) {
+        /* everything is gone, start over from an empty leaf */
+        free(tree->root);
+        arena_destroy(&tree->keys);
+        tree->root = (btree_node*)new_node(sizeof(btree_leaf), 1);
+        return tree->root ? YP_SUCCESS : YP_ERR_ALLOCATION;
+    }
+    /* shrink the tree while the root has a single child */
+    while(!tree->root->is_leaf && tree->root->count == 0) {
+        btree_node* old = tree->root;
+        tree->root = ((btree_inner*)old)->children[0];
+        free(old);
+    }
+    if(arena_should_compact(&tree->keys))
+        compact_keys(tree);
+    return YP_SUCCESS;
+}
+
+void btree_seek(
+        const btree* tree,
+        const char* key,
+        size_t key_size,
+        btree_cursor* cursor)
+{
+    btree_node* node = tree->root;
+    if(!key) {
+        while(!node->is_leaf)
+            node = ((btree_inner*)node)->children[0];
+        cursor->leaf = (btree_leaf*)node;
+        cursor->pos  = 0;
+    } else {
+        int64_t prefix = key_prefix(key, key_size);
+        while(!node->is_leaf) {
+            btree_inner* inner = (btree_inner*)node;
+            node = inner->children[inner_child_index(inner, key, key_size, prefix)];
+        }
+        cursor->leaf = (btree_leaf*)node;
+        cursor->pos  = leaf_lower_bound(cursor->leaf, key, key_size, prefix);
+    }
+    if(cursor->pos == node->count) {
+        cursor->leaf = cursor->leaf->next;
+        cursor->pos  = 0;
+    }
+}
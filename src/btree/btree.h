@@ -0,0 +1,123 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _BTREE_H
+#define _BTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "../arena.h"
+
+/*
+ * In-memory B+tree mapping names to numbers in lexicographic order.
+ *
+ * Every node starts with a cache-line aligned array holding the first
+ * 8 bytes of each of its keys, packed big-endian with the sign bit
+ * flipped, so that comparing two of them as signed 64-bit integers
+ * orders them like memcmp would. Finding a key in a node is therefore
+ * a couple of SIMD comparisons over that array, narrowing the search
+ * to the (usually empty) run of keys sharing the 8-byte prefix, which
+ * is then resolved by comparing full keys.
+ *
+ * Erasing follows the "free-at-empty" policy: nodes are never merged,
+ * only freed when they become empty. Leaves are linked so that ranges
+ * can be scanned with a cursor. Keys (including separators) live in an
+ * arena owned by the tree, compacted as erased keys accumulate.
+ */
+
+#define BTREE_NODE_SIZE 64 // max entries per leaf, max children per inner node
+
+typedef struct btree_entry {
+    char*    key;
+    uint32_t key_size;
+    uint64_t value;
+} btree_entry;
+
+typedef struct btree_node {
+    _Alignas(64) int64_t prefixes[BTREE_NODE_SIZE];
+    uint32_t is_leaf;
+    uint32_t count;  // entries of a leaf, separator keys of an inner node
+} btree_node;
+
+typedef struct btree_leaf {
+    btree_node         base;
+    struct btree_leaf* prev;
+    struct btree_leaf* next;
+    btree_entry        entries[BTREE_NODE_SIZE];
+} btree_leaf;
+
+typedef struct btree_inner {
+    btree_node  base;
+    char*       keys[BTREE_NODE_SIZE - 1];
+    uint32_t    key_sizes[BTREE_NODE_SIZE - 1];
+    btree_node* children[BTREE_NODE_SIZE];
+} btree_inner;
+
+typedef struct btree {
+    btree_node* root;
+    size_t      size;
+    arena       keys;
+} btree;
+
+typedef struct btree_cursor {
+    btree_leaf* leaf; // NULL once past the last entry
+    uint32_t    pos;
+} btree_cursor;
+
+YP_return_t btree_init(btree* tree);
+
+void btree_destroy(btree* tree);
+
+/**
+ * @brief Inserts a key, or updates its value if already present.
+ */
+YP_return_t btree_insert(
+        btree* tree,
+        const char* key,
+        size_t key_size,
+        uint64_t value);
+
+btree_entry* btree_find(
+        const btree* tree,
+        const char* key,
+        size_t key_size);
+
+YP_return_t btree_erase(
+        btree* tree,
+        const char* key,
+        size_t key_size);
+
+/**
+ * @brief Positions the cursor on the first key greater than or equal
+ * to the provided one (the first key overall if key is NULL).
+ */
+void btree_seek(
+        const btree* tree,
+        const char* key,
+        size_t key_size,
+        btree_cursor* cursor);
+
+static inline int btree_cursor_valid(const btree_cursor* cursor)
+{
+    return cursor->leaf != NULL;
+}
+
+static inline const btree_entry* btree_cursor_entry(const btree_cursor* cursor)
+{
+    return &cursor->leaf->entries[cursor->pos];
+}
+
+static inline void btree_cursor_next(btree_cursor* cursor)
+{
+    if(++cursor->pos == cursor->leaf->base.count) {
+        cursor->leaf = cursor->leaf->next;
+        cursor->pos  = 0;
+    }
+}
+
+int btree_compare(const char* a, size_t a_size, const char* b, size_t b_size);
+
+#endif
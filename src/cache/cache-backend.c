@@ -0,0 +1,561 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../memory/memory-table.h"
+#include "cache-backend.h"
+
+/*
+ * Decorator caching the lookups of another backend, named by "backend"
+ * and configured by "config", in at most "capacity" entries. Updates
+ * are written through to the inner backend; listings are forwarded.
+ *
+ * Entries are managed with S3-FIFO: a name that misses enters a small
+ * FIFO queue (a tenth of the capacity), and is moved to the main FIFO
+ * queue only if it is hit again before reaching the end of it, so that
+ * names looked up once don't push out the others. Names evicted from
+ * the small queue are remembered (by hash) in a ghost FIFO queue, and
+ * go straight to the main queue if they miss again soon. Entries at
+ * the end of the main queue are reinserted while they have hits left
+ * (at most CACHE_MAX_FREQ), otherwise evicted.
+ *
+ * A mutex protects the cache, and is never held while calling the
+ * inner backend. An update drops the cached entries of its names before
+ * writing them to the inner backend; a miss only fills the cache if no
+ * update started or ended during its inner lookup and none is in
+ * progress, so the cache never holds a number older than the inner
+ * backend's.
+ */
+
+#define CACHE_DEFAULT_CAPACITY 65536
+#define CACHE_MAX_FREQ         3
+#define CACHE_NONE             UINT32_MAX
+
+enum { CACHE_SMALL, CACHE_MAIN, CACHE_NUM_QUEUES };
+
+typedef struct cache_entry {
+    char*       name;      // NULL if the entry is free
+    uint32_t    name_size;
+    uint8_t     queue;
+    uint8_t     freq;
+    uint32_t    prev;      // towards the head of the queue
+    uint32_t    next;      // towards the tail, or next free entry
+    YP_number_t number;
+} cache_entry;
+
+typedef struct cache_queue {
+    uint32_t head; // most recently inserted
+    uint32_t tail; // next to be evicted
+    size_t   size;
+} cache_queue;
+
+typedef struct cache_context {
+    struct json_object* config;
+    YP_backend_impl*    inner;
+    void*               inner_ctx;
+    /* protected by mutex */
+    ABT_mutex           mutex;
+    uint64_t            updates;    // updates started or ended so far
+    size_t              writing;    // updates in progress
+    memory_table        names;      // name -> index in entries
+    cache_entry*        entries;    // capacity entries
+    size_t              capacity;
+    uint32_t            free_entry; // first free entry
+    cache_queue         queues[CACHE_NUM_QUEUES];
+    size_t              small_capacity;
+    memory_table        ghost;      // hash -> occurrences in ghost_fifo
+    uint64_t*           ghost_fifo; // ring of hashes, capacity of the main queue
+    size_t              ghost_start;
+    size_t              ghost_size;
+} cache_context;
+
+static void cache_push(cache_context* ctx, int q, uint32_t i)
+{
+    cache_queue* queue = &ctx->queues[q];
+    cache_entry* e = &ctx->entries[i];
+    e->queue = (uint8_t)q;
+    e->prev  = CACHE_NONE;
+    e->next  = queue->head;
+    if(queue->head != CACHE_NONE) ctx->entries[queue->head].prev = i;
+    else queue->tail = i;
+    queue->head = i;
+    queue->size += 1;
+}
+
+static void cache_unlink(cache_context* ctx, uint32_t i)
+{
+    cache_entry* e = &ctx->entries[i];
+    cache_queue* queue = &ctx->queues[e->queue];
+    if(e->prev != CACHE_NONE) ctx->entries[e->prev].next = e->next;
+    else queue->head = e->next;
+    if(e->next != CACHE_NONE) ctx->entries[e->next].prev = e->prev;
+    else queue->tail = e->prev;
+    queue->size -= 1;
+}
+
+/* Hashes are used as 8-byte names in the ghost table */
+static int cache_ghost_contains(cache_context* ctx, uint64_t hash)
+{
+    return memory_table_find(&ctx->ghost, (const char*)&hash, sizeof(hash),
+                             YP_hash(&hash, sizeof(hash))) != NULL;
+}
+
+static void cache_ghost_add(cache_context* ctx, uint64_t hash)
+{
+    size_t ghost_capacity = ctx->capacity - ctx->small_capacity;
+    if(!ghost_capacity) return;
+    if(ctx->ghost_size == ghost_capacity) {
+        /* forget the oldest hash */
+        uint64_t old = ctx->ghost_fifo[ctx->ghost_start];
+        uint64_t old_hash = YP_hash(&old, sizeof(old));
+        memory_slot* slot = memory_table_find(&ctx->ghost, (const char*)&old,
+                                              sizeof(old), old_hash);
+        if(slot && --slot->value == 0)
+            memory_table_erase_slot(&ctx->ghost, slot);
+        ctx->ghost_start = (ctx->ghost_start + 1) % ghost_capacity;
+        ctx->ghost_size -= 1;
+    }
+    uint64_t ghost_hash = YP_hash(&hash, sizeof(hash));
+    memory_slot* slot = memory_table_find(&ctx->ghost, (const char*)&hash,
+                                          sizeof(hash), ghost_hash);
+    if(slot) {
+        slot->value += 1;
+    } else if(memory_table_insert(&ctx->ghost, (const char*)&hash, sizeof(hash),
+                                  ghost_hash, 1, NULL, NULL) != YP_SUCCESS) {
+        return;
+    }
+    ctx->ghost_fifo[(ctx->ghost_start + ctx->ghost_size) % ghost_capacity] = hash;
+    ctx->ghost_size += 1;
+}
+
+static void cache_free_entry(cache_context* ctx, uint32_t i)
+{
+    cache_entry* e = &ctx->entries[i];
+    memory_table_erase(&ctx->names, e->name, e->name_size, YP_hash(e->name, e->name_size));
+    free(e->name);
+    e->name = NULL;
+    e->next = ctx->free_entry;
+    ctx->free_entry = i;
+}
+
+/* Evicts the tail of the main queue, giving a second chance to the
+ * entries that were hit */
+static void cache_evict_main(cache_context* ctx)
+{
+    cache_queue* main = &ctx->queues[CACHE_MAIN];
+    while(main->tail != CACHE_NONE) {
+        uint32_t i = main->tail;
+        cache_entry* e = &ctx->entries[i];
+        cache_unlink(ctx, i);
+        if(e->freq > 0) {
+            e->freq -= 1;
+            cache_push(ctx, CACHE_MAIN, i);
+        } else {
+            cache_free_entry(ctx, i);
+            return;
+        }
+    }
+}
+
+/* Evicts the tail of the small queue, moving it to the main queue if
+ * it was hit, otherwise remembering it in the ghost queue */
+static void cache_evict_small(cache_context* ctx)
+{
+    cache_queue* small = &ctx->queues[CACHE_SMALL];
+    while(small->tail != CACHE_NONE) {
+        uint32_t i = small->tail;
+        cache_entry* e = &ctx->entries[i];
+        cache_unlink(ctx, i);
+        if(e->freq > 0) {
+            if(ctx->queues[CACHE_MAIN].size >= ctx->capacity - ctx->small_capacity)
+                cache_evict_main(ctx);
+            e->freq = 0;
+            cache_push(ctx, CACHE_MAIN, i);
+        } else {
+            cache_ghost_add(ctx, YP_hash(e->name, e->name_size));
+            cache_free_entry(ctx, i);
+            return;
+        }
+    }
+}
+
+/* Makes room for one more entry */
+static void cache_evict(cache_context* ctx)
+{
+    while(ctx->free_entry == CACHE_NONE) {
+        if(ctx->queues[CACHE_SMALL].size >= ctx->small_capacity
+        || ctx->queues[CACHE_MAIN].size == 0)
+            cache_evict_small(ctx);
+        else
+            cache_evict_main(ctx);
+    }
+}
+
+static void cache_admit(
+        cache_context* ctx, const char* name, size_t name_size,
+        uint64_t hash, YP_number_t number)
+{
+    if(memory_table_find(&ctx->names, name, name_size, hash)) return;
+    char* copy = (char*)malloc(name_size ? name_size : 1);
+    if(!copy) return;
+    memcpy(copy, name, name_size);
+    cache_evict(ctx);
+    uint32_t i = ctx->free_entry;
+    if(memory_table_insert(&ctx->names, name, name_size, hash, i, NULL, NULL) != YP_SUCCESS) {
+        free(copy);
+        return;
+    }
+    cache_entry* e = &ctx->entries[i];
+    ctx->free_entry = e->next;
+    e->name      = copy;
+    e->name_size = (uint32_t)name_size;
+    e->freq      = 0;
+    e->number    = number;
+    cache_push(ctx, cache_ghost_contains(ctx, hash) ? CACHE_MAIN : CACHE_SMALL, i);
+}
+
+static void cache_free_context(cache_context* ctx)
+{
+    if(ctx->entries) {
+        for(size_t i = 0; i < ctx->capacity; i++)
+            free(ctx->entries[i].name);
+        free(ctx->entries);
+    }
+    if(ctx->mutex != ABT_MUTEX_NULL) ABT_mutex_free(&ctx->mutex);
+    if(ctx->names.ctrl) memory_table_destroy(&ctx->names);
+    if(ctx->ghost.ctrl) memory_table_destroy(&ctx->ghost);
+    free(ctx->ghost_fifo);
+    json_object_put(ctx->config);
+    free(ctx);
+}
+
+static YP_return_t cache_init_context(
+        YP_provider_t provider,
+        const char* config_str,
+        int create,
+        cache_context** context)
+{
+    // read JSON config from provided string argument
+    if (!config_str) {
+        margo_error(provider->mid, "cache backend requires a configuration");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    struct json_object* config = json_tokener_parse_ex(
+            tokener, config_str,
+            strlen(config_str));
+    if (!config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+    if (!json_object_is_type(config, json_type_object)) {
+        margo_error(provider->mid, "JSON configuration should be an object");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "backend" is the type of the cached backend
+    struct json_object* jbackend = json_object_object_get(config, "backend");
+    if (!jbackend || !json_object_is_type(jbackend, json_type_string)) {
+        margo_error(provider->mid, "\"backend\" should be a string");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    YP_backend_impl* inner = find_backend_impl(provider, json_object_get_string(jbackend));
+    if (!inner) {
+        margo_error(provider->mid, "Could not find backend of type \"%s\"",
+                    json_object_get_string(jbackend));
+        json_object_put(config);
+        return YP_ERR_INVALID_BACKEND;
+    }
+    // "config" is the configuration of the cached backend
+    struct json_object* jinner = json_object_object_get(config, "config");
+    if (jinner && !json_object_is_type(jinner, json_type_object)) {
+        margo_error(provider->mid, "\"config\" should be an object");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "capacity" is the maximum number of names kept in the cache
+    size_t capacity = CACHE_DEFAULT_CAPACITY;
+    struct json_object* jcapacity = json_object_object_get(config, "capacity");
+    if (jcapacity) {
+        if (!json_object_is_type(jcapacity, json_type_int)
+        ||  json_object_get_int64(jcapacity) < 1
+        ||  json_object_get_int64(jcapacity) >= CACHE_NONE) {
+            margo_error(provider->mid,
+                "\"capacity\" should be a strictly positive integer");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+
+    cache_context* ctx = (cache_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    ctx->config         = config;
+    ctx->inner          = inner;
+    ctx->mutex          = ABT_MUTEX_NULL;
+    ctx->capacity       = capacity;
+    ctx->small_capacity = capacity / 10 ? capacity / 10 : 1;
+    ctx->entries        = (cache_entry*)calloc(capacity, sizeof(*ctx->entries));
+    ctx->ghost_fifo     = (uint64_t*)malloc((capacity - ctx->small_capacity + 1)
+                                            * sizeof(*ctx->ghost_fifo));
+    YP_return_t ret = YP_ERR_ALLOCATION;
+    if (ctx->entries && ctx->ghost_fifo
+    && (ret = memory_table_init(&ctx->names, capacity)) == YP_SUCCESS
+    && (ret = memory_table_init(&ctx->ghost, capacity - ctx->small_capacity)) == YP_SUCCESS
+    && ABT_mutex_create(&ctx->mutex) != ABT_SUCCESS) {
+        ctx->mutex = ABT_MUTEX_NULL;
+        ret = YP_ERR_FROM_ARGOBOTS;
+    }
+    if (ret != YP_SUCCESS) {
+        cache_free_context(ctx);
+        return ret;
+    }
+    for (size_t i = 0; i < capacity; i++)
+        ctx->entries[i].next = i + 1 < capacity ? (uint32_t)(i + 1) : CACHE_NONE;
+    ctx->free_entry = 0;
+    for (int q = 0; q < CACHE_NUM_QUEUES; q++)
+        ctx->queues[q].head = ctx->queues[q].tail = CACHE_NONE;
+
+    const char* inner_config = jinner ? json_object_to_json_string(jinner) : NULL;
+    if (create)
+        ret = inner->create_phonebook(provider, inner_config, &ctx->inner_ctx);
+    else
+        ret = inner->open_phonebook(provider, inner_config, &ctx->inner_ctx);
+    if (ret != YP_SUCCESS) {
+        cache_free_context(ctx);
+        return ret;
+    }
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t cache_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return cache_init_context(provider, config_str, 1, (cache_context**)context);
+}
+
+static YP_return_t cache_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return cache_init_context(provider, config_str, 0, (cache_context**)context);
+}
+
+static YP_return_t cache_close_phonebook(void* ctx)
+{
+    cache_context* context = (cache_context*)ctx;
+    YP_return_t ret = context->inner->close_phonebook(context->inner_ctx);
+    cache_free_context(context);
+    return ret;
+}
+
+static YP_return_t cache_destroy_phonebook(void* ctx)
+{
+    cache_context* context = (cache_context*)ctx;
+    YP_return_t ret = context->inner->destroy_phonebook(context->inner_ctx);
+    cache_free_context(context);
+    return ret;
+}
+
+static char* cache_get_config(void* ctx)
+{
+    cache_context* context = (cache_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void cache_say_hello(void* ctx)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(context->inner->hello) context->inner->hello(context->inner_ctx);
+}
+
+static int32_t cache_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(context->inner->sum) return context->inner->sum(context->inner_ctx, x, y);
+    return x+y;
+}
+
+/* Drops the cached entry of a name. Called with the mutex held. */
+static void cache_invalidate(
+        cache_context* ctx, const char* name, size_t name_size, uint64_t hash)
+{
+    memory_slot* slot = memory_table_find(&ctx->names, name, name_size, hash);
+    if(!slot) return;
+    uint32_t i = (uint32_t)slot->value;
+    cache_unlink(ctx, i);
+    cache_free_entry(ctx, i);
+}
+
+static void cache_begin_update(cache_context* ctx)
+{
+    ctx->updates += 1;
+    ctx->writing += 1;
+}
+
+static void cache_end_update(cache_context* ctx)
+{
+    ABT_mutex_lock(ctx->mutex);
+    ctx->updates += 1;
+    ctx->writing -= 1;
+    ABT_mutex_unlock(ctx->mutex);
+}
+
+static YP_return_t cache_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->insert) return YP_ERR_OP_UNSUPPORTED;
+    ABT_mutex_lock(context->mutex);
+    cache_invalidate(context, name, name_size, YP_hash(name, name_size));
+    cache_begin_update(context);
+    ABT_mutex_unlock(context->mutex);
+    YP_return_t ret = context->inner->insert(context->inner_ctx, name, name_size, number);
+    cache_end_update(context);
+    return ret;
+}
+
+static YP_return_t cache_insert_batch(
+        void* ctx, size_t count, const char* const* names,
+        const size_t* name_sizes, const YP_number_t* numbers)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->insert) return YP_ERR_OP_UNSUPPORTED;
+    ABT_mutex_lock(context->mutex);
+    for(size_t i = 0; i < count; i++)
+        cache_invalidate(context, names[i], name_sizes[i],
+                         YP_hash(names[i], name_sizes[i]));
+    cache_begin_update(context);
+    ABT_mutex_unlock(context->mutex);
+    YP_return_t ret = YP_SUCCESS;
+    if(context->inner->insert_batch) {
+        ret = context->inner->insert_batch(context->inner_ctx, count, names,
+                                           name_sizes, numbers);
+    } else {
+        for(size_t i = 0; i < count && ret == YP_SUCCESS; i++)
+            ret = context->inner->insert(context->inner_ctx, names[i], name_sizes[i], numbers[i]);
+    }
+    cache_end_update(context);
+    return ret;
+}
+
+static YP_return_t cache_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->lookup) return YP_ERR_OP_UNSUPPORTED;
+    uint64_t hash = YP_hash(name, name_size);
+    ABT_mutex_lock(context->mutex);
+    memory_slot* slot = memory_table_find(&context->names, name, name_size, hash);
+    if(slot) {
+        cache_entry* e = &context->entries[slot->value];
+        if(e->freq < CACHE_MAX_FREQ) e->freq += 1;
+        *number = e->number;
+        ABT_mutex_unlock(context->mutex);
+        return YP_SUCCESS;
+    }
+    uint64_t updates = context->updates;
+    ABT_mutex_unlock(context->mutex);
+
+    YP_return_t ret = context->inner->lookup(context->inner_ctx, name, name_size, number);
+    if(ret != YP_SUCCESS) return ret;
+
+    ABT_mutex_lock(context->mutex);
+    if(context->updates == updates && !context->writing)
+        cache_admit(context, name, name_size, hash, *number);
+    ABT_mutex_unlock(context->mutex);
+    return ret;
+}
+
+static YP_return_t cache_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->erase) return YP_ERR_OP_UNSUPPORTED;
+    ABT_mutex_lock(context->mutex);
+    cache_invalidate(context, name, name_size, YP_hash(name, name_size));
+    cache_begin_update(context);
+    ABT_mutex_unlock(context->mutex);
+    YP_return_t ret = context->inner->erase(context->inner_ctx, name, name_size);
+    cache_end_update(context);
+    return ret;
+}
+
+static YP_return_t cache_list_range(
+        void* ctx, const char* lower, size_t lower_size, int inclusive,
+        const char* upper, size_t upper_size, YP_record_fn fn, void* uargs)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->list_range) return YP_ERR_OP_UNSUPPORTED;
+    return context->inner->list_range(context->inner_ctx, lower, lower_size,
+                                      inclusive, upper, upper_size, fn, uargs);
+}
+
+static YP_return_t cache_list_prefix(
+        void* ctx, const char* prefix, size_t prefix_size, YP_record_fn fn, void* uargs)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->list_prefix) return YP_ERR_OP_UNSUPPORTED;
+    return context->inner->list_prefix(context->inner_ctx, prefix, prefix_size, fn, uargs);
+}
+
+static YP_return_t cache_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->iterate) return YP_ERR_OP_UNSUPPORTED;
+    return context->inner->iterate(context->inner_ctx, fn, uargs);
+}
+
+static YP_return_t cache_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    cache_context* context = (cache_context*)ctx;
+    if(!context->inner->scan) return YP_ERR_OP_UNSUPPORTED;
+    return context->inner->scan(context->inner_ctx, position, fn, uargs);
+}
+
+static YP_backend_impl cache_backend = {
+    .name             = "cache",
+
+    .create_phonebook  = cache_create_phonebook,
+    .open_phonebook    = cache_open_phonebook,
+    .close_phonebook   = cache_close_phonebook,
+    .destroy_phonebook = cache_destroy_phonebook,
+    .get_config       = cache_get_config,
+
+    .hello            = cache_say_hello,
+    .sum              = cache_compute_sum,
+    .insert           = cache_insert,
+    .lookup           = cache_lookup,
+    .erase            = cache_erase,
+    .list_range       = cache_list_range,
+    .list_prefix      = cache_list_prefix,
+    .iterate          = cache_iterate,
+    .insert_batch     = cache_insert_batch,
+    .scan             = cache_scan
+};
+
+YP_return_t YP_provider_register_cache_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &cache_backend);
+}
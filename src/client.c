@@ -3,6 +3,7 @@
  *
  * See COPYRIGHT in top-level directory.
  */
+#include <time.h>
 #include "types.h"
 #include "client.h"
 #include "YP/YP-client.h"
@@ -21,10 +22,36 @@ YP_return_t YP_client_init(margo_instance_id mid, YP_client_t* client)
     if(flag == HG_TRUE) {
         margo_registered_name(mid, "YP_sum", &c->sum_id, &flag);
         margo_registered_name(mid, "YP_hello", &c->hello_id, &flag);
+        margo_registered_name(mid, "YP_insert", &c->insert_id, &flag);
+        margo_registered_name(mid, "YP_lookup", &c->lookup_id, &flag);
+        margo_registered_name(mid, "YP_erase", &c->erase_id, &flag);
+        margo_registered_name(mid, "YP_list_range", &c->list_range_id, &flag);
+        margo_registered_name(mid, "YP_list_prefix", &c->list_prefix_id, &flag);
+        margo_registered_name(mid, "YP_lookup_number", &c->lookup_number_id, &flag);
+        margo_registered_name(mid, "YP_fuzzy_search", &c->fuzzy_search_id, &flag);
+        margo_registered_name(mid, "YP_phonetic_lookup", &c->phonetic_lookup_id, &flag);
+        margo_registered_name(mid, "YP_lookup_batch", &c->lookup_batch_id, &flag);
+        margo_registered_name(mid, "YP_insert_batch", &c->insert_batch_id, &flag);
+        margo_registered_name(mid, "YP_scan_begin", &c->scan_begin_id, &flag);
+        margo_registered_name(mid, "YP_scan_next", &c->scan_next_id, &flag);
+        margo_registered_name(mid, "YP_scan_end", &c->scan_end_id, &flag);
     } else {
         c->sum_id = MARGO_REGISTER(mid, "YP_sum", sum_in_t, sum_out_t, NULL);
         c->hello_id = MARGO_REGISTER(mid, "YP_hello", hello_in_t, void, NULL);
         margo_registered_disable_response(mid, c->hello_id, HG_TRUE);
+        c->insert_id = MARGO_REGISTER(mid, "YP_insert", insert_in_t, insert_out_t, NULL);
+        c->lookup_id = MARGO_REGISTER(mid, "YP_lookup", lookup_in_t, lookup_out_t, NULL);
+        c->erase_id = MARGO_REGISTER(mid, "YP_erase", erase_in_t, erase_out_t, NULL);
+        c->list_range_id = MARGO_REGISTER(mid, "YP_list_range", list_range_in_t, list_records_out_t, NULL);
+        c->list_prefix_id = MARGO_REGISTER(mid, "YP_list_prefix", list_prefix_in_t, list_records_out_t, NULL);
+        c->lookup_number_id = MARGO_REGISTER(mid, "YP_lookup_number", lookup_number_in_t, lookup_number_out_t, NULL);
+        c->fuzzy_search_id = MARGO_REGISTER(mid, "YP_fuzzy_search", fuzzy_search_in_t, fuzzy_search_out_t, NULL);
+        c->phonetic_lookup_id = MARGO_REGISTER(mid, "YP_phonetic_lookup", phonetic_lookup_in_t, list_records_out_t, NULL);
+        c->lookup_batch_id = MARGO_REGISTER(mid, "YP_lookup_batch", lookup_batch_in_t, lookup_batch_out_t, NULL);
+        c->insert_batch_id = MARGO_REGISTER(mid, "YP_insert_batch", insert_batch_in_t, insert_batch_out_t, NULL);
+        c->scan_begin_id = MARGO_REGISTER(mid, "YP_scan_begin", scan_begin_in_t, scan_begin_out_t, NULL);
+        c->scan_next_id = MARGO_REGISTER(mid, "YP_scan_next", scan_next_in_t, scan_next_out_t, NULL);
+        c->scan_end_id = MARGO_REGISTER(mid, "YP_scan_end", scan_end_in_t, scan_end_out_t, NULL);
     }
 
     *client = c;
@@ -42,6 +69,18 @@ YP_return_t YP_client_finalize(YP_client_t client)
     return YP_SUCCESS;
 }
 
+YP_return_t YP_client_set_coalescing(
+        YP_client_t client,
+        size_t max_batch,
+        uint64_t max_delay_us)
+{
+    if(client == YP_CLIENT_NULL)
+        return YP_ERR_INVALID_ARGS;
+    client->coalesce_max      = max_batch;
+    client->coalesce_delay_us = max_delay_us;
+    return YP_SUCCESS;
+}
+
 YP_return_t YP_phonebook_handle_create(
         YP_client_t client,
         hg_addr_t addr,
@@ -57,8 +96,20 @@ YP_return_t YP_phonebook_handle_create(
 
     if(!rh) return YP_ERR_ALLOCATION;
 
+    if(ABT_mutex_create(&rh->coalesce_mutex) != ABT_SUCCESS) {
+        free(rh);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    if(ABT_cond_create(&rh->coalesce_cond) != ABT_SUCCESS) {
+        ABT_mutex_free(&rh->coalesce_mutex);
+        free(rh);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+
     hg_return_t ret = margo_addr_dup(client->mid, addr, &(rh->addr));
     if(ret != HG_SUCCESS) {
+        ABT_cond_free(&rh->coalesce_cond);
+        ABT_mutex_free(&rh->coalesce_mutex);
         free(rh);
         return YP_ERR_FROM_MERCURY;
     }
@@ -90,12 +141,119 @@ YP_return_t YP_phonebook_handle_release(YP_phonebook_handle_t handle)
     handle->refcount -= 1;
     if(handle->refcount == 0) {
         margo_addr_free(handle->client->mid, handle->addr);
+        ABT_cond_free(&handle->coalesce_cond);
+        ABT_mutex_free(&handle->coalesce_mutex);
+        if(handle->cache) lookup_cache_destroy(handle->cache);
         handle->client->num_phonebook_handles -= 1;
         free(handle);
     }
     return YP_SUCCESS;
 }
 
+YP_return_t YP_phonebook_handle_set_cache(
+        YP_phonebook_handle_t handle,
+        size_t capacity)
+{
+    if(handle == YP_PHONEBOOK_HANDLE_NULL)
+        return YP_ERR_INVALID_ARGS;
+    lookup_cache* cache = NULL;
+    if(capacity) {
+        YP_return_t ret = lookup_cache_create(capacity, &cache);
+        if(ret != YP_SUCCESS) return ret;
+    }
+    if(handle->cache) lookup_cache_destroy(handle->cache);
+    handle->cache = cache;
+    return YP_SUCCESS;
+}
+
+/* Creates a handle for the RPC and forwards it without waiting; its
+ * output will be read by complete when the request is waited on */
+static YP_return_t forward_async(
+        YP_phonebook_handle_t handle,
+        hg_id_t rpc_id,
+        void* in,
+        YP_return_t (*complete)(YP_request*),
+        void* result,
+        YP_request_t* req)
+{
+    hg_return_t hret;
+
+    if(!req) return YP_ERR_INVALID_ARGS;
+
+    YP_request* r = (YP_request*)calloc(1, sizeof(*r));
+    if(!r) return YP_ERR_ALLOCATION;
+    r->complete = complete;
+    r->result   = result;
+
+    hret = margo_create(handle->client->mid, handle->addr, rpc_id, &r->h);
+    if(hret != HG_SUCCESS) {
+        free(r);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    /* the input is serialized before iforward returns */
+    hret = margo_provider_iforward(handle->provider_id, r->h, in, &r->req);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(r->h);
+        free(r);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    *req = r;
+    return YP_SUCCESS;
+}
+
+/* Reads the output of a request that completed and frees it */
+static YP_return_t finish_request(YP_request* req, hg_return_t hret)
+{
+    YP_return_t ret = hret == HG_SUCCESS ? req->complete(req) : YP_ERR_FROM_MERCURY;
+    margo_destroy(req->h);
+    free(req);
+    return ret;
+}
+
+YP_return_t YP_wait(YP_request_t req)
+{
+    if(req == YP_REQUEST_NULL) return YP_ERR_INVALID_ARGS;
+    return finish_request(req, margo_wait(req->req));
+}
+
+YP_return_t YP_test(YP_request_t req, int* flag)
+{
+    if(req == YP_REQUEST_NULL || !flag) return YP_ERR_INVALID_ARGS;
+    if(margo_test(req->req, flag) != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    return YP_SUCCESS;
+}
+
+YP_return_t YP_wait_any(size_t count, YP_request_t* reqs, size_t* index)
+{
+    if(!reqs || !index) return YP_ERR_INVALID_ARGS;
+
+    margo_request* margo_reqs = (margo_request*)malloc(count*sizeof(*margo_reqs));
+    if(count && !margo_reqs) return YP_ERR_ALLOCATION;
+    size_t pending = 0;
+    for(size_t i = 0; i < count; i++) {
+        margo_reqs[i] = reqs[i] ? reqs[i]->req : MARGO_REQUEST_NULL;
+        if(reqs[i]) pending += 1;
+    }
+    if(!pending) {
+        free(margo_reqs);
+        return YP_ERR_INVALID_ARGS;
+    }
+
+    size_t i = count;
+    hg_return_t hret = margo_wait_any(count, margo_reqs, &i);
+    free(margo_reqs);
+    if(i >= count)
+        return YP_ERR_FROM_MERCURY;
+
+    YP_request_t req = reqs[i];
+    reqs[i] = YP_REQUEST_NULL;
+    *index  = i;
+    return finish_request(req, hret);
+}
+
 YP_return_t YP_say_hello(YP_phonebook_handle_t handle)
 {
     hg_handle_t   h;
@@ -118,44 +276,1036 @@ YP_return_t YP_say_hello(YP_phonebook_handle_t handle)
     return YP_SUCCESS;
 }
 
+static YP_return_t complete_sum(YP_request* req)
+{
+    sum_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    YP_return_t ret = out.ret;
+    if(ret == YP_SUCCESS)
+        *(int32_t*)req->result = out.result;
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+YP_return_t YP_compute_sum_async(
+        YP_phonebook_handle_t handle,
+        int32_t x,
+        int32_t y,
+        int32_t* result,
+        YP_request_t* req)
+{
+    sum_in_t in;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.x = x;
+    in.y = y;
+
+    return forward_async(handle, handle->client->sum_id, &in, complete_sum, result, req);
+}
+
 YP_return_t YP_compute_sum(
         YP_phonebook_handle_t handle,
         int32_t x,
         int32_t y,
         int32_t* result)
+{
+    YP_request_t req;
+    YP_return_t ret = YP_compute_sum_async(handle, x, y, result, &req);
+    if(ret != YP_SUCCESS) return ret;
+    return YP_wait(req);
+}
+
+YP_return_t YP_insert(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number)
+{
+    return YP_insert_with_ttl(handle, name, number, 0);
+}
+
+static YP_return_t complete_insert(YP_request* req)
+{
+    insert_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    YP_return_t ret = out.ret;
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+YP_return_t YP_insert_with_ttl_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        double ttl,
+        YP_request_t* req)
+{
+    insert_in_t in;
+
+    if(!name || !(ttl >= 0)) return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.name   = (char*)name;
+    in.number = number;
+    /* round up to the millisecond, so that a positive ttl isn't 0 */
+    double ttl_ms = ttl*1e3;
+    in.ttl_ms = ttl_ms < (double)UINT64_MAX ? (uint64_t)ttl_ms : UINT64_MAX;
+    if((double)in.ttl_ms < ttl_ms) in.ttl_ms += 1;
+
+    /* a lookup racing with the update may cache the old number again,
+     * but the update waits for the lease granted with it to expire */
+    if(handle->cache) lookup_cache_invalidate(handle->cache, name, strlen(name));
+
+    return forward_async(handle, handle->client->insert_id, &in, complete_insert, NULL, req);
+}
+
+YP_return_t YP_insert_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        YP_request_t* req)
+{
+    return YP_insert_with_ttl_async(handle, name, number, 0, req);
+}
+
+YP_return_t YP_insert_with_ttl(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t number,
+        double ttl)
+{
+    YP_request_t req;
+    YP_return_t ret = YP_insert_with_ttl_async(handle, name, number, ttl, &req);
+    if(ret != YP_SUCCESS) return ret;
+    return YP_wait(req);
+}
+
+YP_return_t YP_insert_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        const YP_number_t* numbers,
+        size_t count)
 {
     hg_handle_t   h;
-    sum_in_t     in;
-    sum_out_t   out;
+    insert_batch_in_t  in;
+    insert_batch_out_t out;
     hg_return_t hret;
     YP_return_t ret;
+    hg_bulk_t bulk = HG_BULK_NULL;
+
+    if(count && (!names || !numbers))
+        return YP_ERR_INVALID_ARGS;
+    if(count == 0)
+        return YP_SUCCESS;
+
+    /* serialize the records, see insert_batch_in_t */
+    size_t size = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!names[i] || strlen(names[i]) > UINT32_MAX)
+            return YP_ERR_INVALID_ARGS;
+        size += sizeof(uint32_t) + strlen(names[i]) + sizeof(YP_number_t);
+    }
+    char* buffer = (char*)malloc(size);
+    if(!buffer) return YP_ERR_ALLOCATION;
+    char* p = buffer;
+    for(size_t i = 0; i < count; i++) {
+        uint32_t name_size = (uint32_t)strlen(names[i]);
+        memcpy(p, &name_size, sizeof(name_size));
+        p += sizeof(name_size);
+        memcpy(p, names[i], name_size);
+        p += name_size;
+        memcpy(p, &numbers[i], sizeof(numbers[i]));
+        p += sizeof(numbers[i]);
+        /* see YP_insert_with_ttl_async */
+        if(handle->cache) lookup_cache_invalidate(handle->cache, names[i], name_size);
+    }
+
+    void* segment = buffer;
+    hg_size_t segment_size = size;
+    hret = margo_bulk_create(handle->client->mid, 1, &segment, &segment_size,
+                             HG_BULK_READ_ONLY, &bulk);
+    if(hret != HG_SUCCESS) {
+        free(buffer);
+        return YP_ERR_FROM_MERCURY;
+    }
 
     memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
-    in.x = x;
-    in.y = y;
+    in.count = count;
+    in.size  = size;
+    in.bulk  = bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->insert_batch_id, &h);
+    if(hret != HG_SUCCESS) {
+        ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    ret = out.ret;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+
+finish:
+    margo_bulk_free(bulk);
+    free(buffer);
+    return ret;
+}
+
+static YP_return_t complete_lookup(YP_request* req)
+{
+    lookup_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    YP_return_t ret = out.ret;
+    if(ret == YP_SUCCESS)
+        *(YP_number_t*)req->result = out.number;
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+YP_return_t YP_lookup_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t* number,
+        YP_request_t* req)
+{
+    lookup_in_t in;
+
+    if(!name) return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.name  = (char*)name;
+    in.lease = 0;
 
-    hret = margo_create(handle->client->mid, handle->addr, handle->client->sum_id, &h);
+    return forward_async(handle, handle->client->lookup_id, &in, complete_lookup, number, req);
+}
+
+/* Result of a lookup along with the lease granted on it */
+typedef struct leased_lookup {
+    YP_number_t number;
+    uint32_t    lease_ms;
+} leased_lookup;
+
+static YP_return_t complete_leased_lookup(YP_request* req)
+{
+    lookup_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
     if(hret != HG_SUCCESS)
         return YP_ERR_FROM_MERCURY;
+    leased_lookup* result = (leased_lookup*)req->result;
+    YP_return_t ret = out.ret;
+    if(ret == YP_SUCCESS)
+        result->number = out.number;
+    result->lease_ms = out.lease_ms;
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+static YP_return_t lookup_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        size_t count,
+        YP_number_t* numbers,
+        YP_return_t* results,
+        uint32_t* leases);
+
+static YP_lookup_group* new_lookup_group(size_t capacity)
+{
+    YP_lookup_group* group = (YP_lookup_group*)calloc(1, sizeof(*group));
+    if(!group) return NULL;
+    group->capacity = capacity;
+    group->names   = (const char**)malloc(capacity*sizeof(*group->names));
+    group->numbers = (YP_number_t*)malloc(capacity*sizeof(*group->numbers));
+    group->results = (YP_return_t*)malloc(capacity*sizeof(*group->results));
+    group->leases  = (uint32_t*)malloc(capacity*sizeof(*group->leases));
+    if(!group->names || !group->numbers || !group->results || !group->leases) {
+        free(group->names);
+        free(group->numbers);
+        free(group->results);
+        free(group->leases);
+        free(group);
+        return NULL;
+    }
+    return group;
+}
+
+static void free_lookup_group(YP_lookup_group* group)
+{
+    free(group->names);
+    free(group->numbers);
+    free(group->results);
+    free(group->leases);
+    free(group);
+}
+
+/* Adds the lookup to the pending group of the handle. The caller that
+ * starts a group waits up to coalesce_delay_us for others to join it,
+ * and the one that fills it or the starter once the delay has expired
+ * sends it with YP_lookup_batch. The names are not copied, since every
+ * caller waits for the results of the group. */
+static YP_return_t coalesced_lookup(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t* number,
+        uint32_t* lease_ms)
+{
+    YP_client_t client = handle->client;
+    int send = 0;
+
+    if(!name) return YP_ERR_INVALID_ARGS;
+
+    ABT_mutex_lock(handle->coalesce_mutex);
+    YP_lookup_group* group = handle->pending_lookups;
+    int starter = !group;
+    if(starter) {
+        group = new_lookup_group(client->coalesce_max);
+        if(!group) {
+            ABT_mutex_unlock(handle->coalesce_mutex);
+            return YP_ERR_ALLOCATION;
+        }
+        handle->pending_lookups = group;
+    }
+    size_t i = group->count++;
+    group->names[i] = name;
+    group->waiting += 1;
+
+    if(group->count == group->capacity) {
+        send = 1;
+    } else if(starter) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + client->coalesce_delay_us*1000;
+        deadline.tv_sec  += (time_t)(ns/1000000000);
+        deadline.tv_nsec  = (long)(ns%1000000000);
+        /* stop waiting early if another caller filled the group */
+        int wret = ABT_SUCCESS;
+        while(group->state == LOOKUP_GROUP_PENDING && wret != ABT_ERR_COND_TIMEDOUT)
+            wret = ABT_cond_timedwait(handle->coalesce_cond, handle->coalesce_mutex, &deadline);
+        send = group->state == LOOKUP_GROUP_PENDING;
+    }
+
+    if(send) {
+        group->state = LOOKUP_GROUP_SENT;
+        handle->pending_lookups = NULL;
+        ABT_cond_broadcast(handle->coalesce_cond);
+        ABT_mutex_unlock(handle->coalesce_mutex);
+        /* leases are only requested by handles that cache their lookups */
+        if(!handle->cache)
+            memset(group->leases, 0, group->count*sizeof(*group->leases));
+        YP_return_t ret = lookup_batch(handle, group->names, group->count,
+                                       group->numbers, group->results,
+                                       handle->cache ? group->leases : NULL);
+        ABT_mutex_lock(handle->coalesce_mutex);
+        for(size_t j = 0; ret != YP_SUCCESS && j < group->count; j++) {
+            group->results[j] = ret;
+            group->leases[j]  = 0;
+        }
+        group->state = LOOKUP_GROUP_DONE;
+        ABT_cond_broadcast(handle->coalesce_cond);
+    } else {
+        while(group->state != LOOKUP_GROUP_DONE)
+            ABT_cond_wait(handle->coalesce_cond, handle->coalesce_mutex);
+    }
+
+    YP_return_t ret = group->results[i];
+    if(ret == YP_SUCCESS)
+        *number = group->numbers[i];
+    *lease_ms = group->leases[i];
+    if(--group->waiting == 0)
+        free_lookup_group(group);
+    ABT_mutex_unlock(handle->coalesce_mutex);
+    return ret;
+}
+
+YP_return_t YP_lookup(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_number_t* number)
+{
+    lookup_cache* cache = handle->cache;
+    YP_return_t ret;
+
+    if(!name) return YP_ERR_INVALID_ARGS;
+
+    size_t name_size = strlen(name);
+    if(cache && lookup_cache_get(cache, name, name_size, &ret, number))
+        return ret;
+
+    /* the lease starts when the provider grants it, after this time */
+    uint64_t sent = lookup_cache_now();
+    uint32_t lease_ms = 0;
+    if(handle->client->coalesce_max > 1) {
+        ret = coalesced_lookup(handle, name, number, &lease_ms);
+    } else {
+        YP_request_t req;
+        leased_lookup result = { 0, 0 };
+        lookup_in_t in;
+        memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+        in.name  = (char*)name;
+        in.lease = cache != NULL;
+        ret = forward_async(handle, handle->client->lookup_id, &in,
+                            complete_leased_lookup, &result, &req);
+        if(ret != YP_SUCCESS) return ret;
+        ret = YP_wait(req);
+        if(ret == YP_SUCCESS) *number = result.number;
+        lease_ms = result.lease_ms;
+    }
+
+    if(cache && lease_ms && (ret == YP_SUCCESS || ret == YP_ERR_NOT_FOUND))
+        lookup_cache_put(cache, name, name_size, ret, ret == YP_SUCCESS ? *number : 0,
+                         sent + (uint64_t)lease_ms*1000000);
+    return ret;
+}
+
+YP_return_t YP_lookup_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        size_t count,
+        YP_number_t* numbers,
+        YP_return_t* results)
+{
+    return lookup_batch(handle, names, count, numbers, results, NULL);
+}
+
+/* Looks up names in one RPC, also requesting a lease on each result
+ * and returning it if leases is not NULL */
+static YP_return_t lookup_batch(
+        YP_phonebook_handle_t handle,
+        const char* const* names,
+        size_t count,
+        YP_number_t* numbers,
+        YP_return_t* results,
+        uint32_t* leases)
+{
+    hg_handle_t   h;
+    lookup_batch_in_t  in;
+    lookup_batch_out_t out;
+    hg_return_t hret;
+    YP_return_t ret;
+    char* packed = NULL;
+    int32_t* rets = NULL;
+    hg_bulk_t bulk = HG_BULK_NULL;
+
+    if(count && (!names || !numbers || !results))
+        return YP_ERR_INVALID_ARGS;
+    if(count == 0)
+        return YP_SUCCESS;
+
+    /* pack the names one after the other with their null terminators */
+    size_t names_size = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!names[i]) return YP_ERR_INVALID_ARGS;
+        names_size += strlen(names[i]) + 1;
+    }
+    packed = (char*)malloc(names_size);
+    /* the return codes, followed by the leases */
+    rets   = (int32_t*)malloc(count*(sizeof(*rets) + sizeof(uint32_t)));
+    if(!packed || !rets) {
+        free(packed);
+        free(rets);
+        return YP_ERR_ALLOCATION;
+    }
+    char* p = packed;
+    for(size_t i = 0; i < count; i++) {
+        size_t size = strlen(names[i]) + 1;
+        memcpy(p, names[i], size);
+        p += size;
+    }
+
+    /* the provider writes the numbers directly into the caller's array */
+    void* segments[3] = { packed, numbers, rets };
+    hg_size_t sizes[3] = { names_size, count*sizeof(*numbers),
+                           count*(sizeof(*rets) + sizeof(uint32_t)) };
+    hret = margo_bulk_create(handle->client->mid, 3, segments, sizes, HG_BULK_READWRITE, &bulk);
+    if(hret != HG_SUCCESS) {
+        free(packed);
+        free(rets);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.count      = count;
+    in.names_size = names_size;
+    in.lease      = leases != NULL;
+    in.bulk       = bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->lookup_batch_id, &h);
+    if(hret != HG_SUCCESS) {
+        ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
 
     hret = margo_provider_forward(handle->provider_id, h, &in);
     if(hret != HG_SUCCESS) {
+        margo_destroy(h);
         ret = YP_ERR_FROM_MERCURY;
         goto finish;
     }
 
     hret = margo_get_output(h, &out);
     if(hret != HG_SUCCESS) {
+        margo_destroy(h);
         ret = YP_ERR_FROM_MERCURY;
         goto finish;
     }
 
     ret = out.ret;
-    if(ret == YP_SUCCESS)
-        *result = out.result;
+    for(size_t i = 0; ret == YP_SUCCESS && i < count; i++)
+        results[i] = (YP_return_t)rets[i];
+    if(ret == YP_SUCCESS && leases)
+        memcpy(leases, rets + count, count*sizeof(*leases));
 
-finish:
     margo_free_output(h, &out);
     margo_destroy(h);
+
+finish:
+    margo_bulk_free(bulk);
+    free(packed);
+    free(rets);
+    return ret;
+}
+
+static YP_return_t complete_erase(YP_request* req)
+{
+    erase_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    YP_return_t ret = out.ret;
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+YP_return_t YP_erase_async(
+        YP_phonebook_handle_t handle,
+        const char* name,
+        YP_request_t* req)
+{
+    erase_in_t in;
+
+    if(!name) return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.name = (char*)name;
+
+    /* see YP_insert_with_ttl_async */
+    if(handle->cache) lookup_cache_invalidate(handle->cache, name, strlen(name));
+
+    return forward_async(handle, handle->client->erase_id, &in, complete_erase, NULL, req);
+}
+
+YP_return_t YP_erase(
+        YP_phonebook_handle_t handle,
+        const char* name)
+{
+    YP_request_t req;
+    YP_return_t ret = YP_erase_async(handle, name, &req);
+    if(ret != YP_SUCCESS) return ret;
+    return YP_wait(req);
+}
+
+/* Copies the records of a list_records_out_t into user-provided arrays */
+static YP_return_t copy_records(
+        const list_records_out_t* out,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count)
+{
+    for(hg_size_t i = 0; i < out->count; i++) {
+        names[i] = strdup(out->names[i]);
+        if(!names[i]) {
+            for(hg_size_t j = 0; j < i; j++) free(names[j]);
+            *count = 0;
+            return YP_ERR_ALLOCATION;
+        }
+    }
+    memcpy(numbers, out->numbers, out->count*sizeof(*numbers));
+    *count = out->count;
+    return YP_SUCCESS;
+}
+
+YP_return_t YP_list_range(
+        YP_phonebook_handle_t handle,
+        const char* lower,
+        int inclusive,
+        const char* upper,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count)
+{
+    hg_handle_t   h;
+    list_range_in_t     in;
+    list_records_out_t  out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(!count || (*count && (!names || !numbers)))
+        return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.lower     = (char*)lower;
+    in.inclusive = inclusive ? HG_TRUE : HG_FALSE;
+    in.upper     = (char*)upper;
+    in.max       = *count;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->list_range_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == YP_SUCCESS)
+        ret = copy_records(&out, names, numbers, count);
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+YP_return_t YP_list_prefix(
+        YP_phonebook_handle_t handle,
+        const char* prefix,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count)
+{
+    hg_handle_t   h;
+    list_prefix_in_t    in;
+    list_records_out_t  out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(!prefix || !count || (*count && (!names || !numbers)))
+        return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.prefix = (char*)prefix;
+    in.max    = *count;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->list_prefix_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == YP_SUCCESS)
+        ret = copy_records(&out, names, numbers, count);
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+YP_return_t YP_lookup_number(
+        YP_phonebook_handle_t handle,
+        YP_number_t number,
+        char** names,
+        size_t* count)
+{
+    hg_handle_t   h;
+    lookup_number_in_t  in;
+    lookup_number_out_t out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(!count || (*count && !names))
+        return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.number = number;
+    in.max    = *count;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->lookup_number_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    *count = 0;
+    for(hg_size_t i = 0; ret == YP_SUCCESS && i < out.count; i++) {
+        names[i] = strdup(out.names[i]);
+        if(!names[i]) {
+            for(hg_size_t j = 0; j < i; j++) free(names[j]);
+            ret = YP_ERR_ALLOCATION;
+        }
+    }
+    if(ret == YP_SUCCESS)
+        *count = out.count;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+YP_return_t YP_fuzzy_search(
+        YP_phonebook_handle_t handle,
+        const char* query,
+        char** names,
+        YP_number_t* numbers,
+        double* scores,
+        size_t* count)
+{
+    hg_handle_t   h;
+    fuzzy_search_in_t  in;
+    fuzzy_search_out_t out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(!query || !count || (*count && (!names || !numbers)))
+        return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.query = (char*)query;
+    in.max   = *count;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->fuzzy_search_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    *count = 0;
+    for(hg_size_t i = 0; ret == YP_SUCCESS && i < out.count; i++) {
+        names[i] = strdup(out.names[i]);
+        if(!names[i]) {
+            for(hg_size_t j = 0; j < i; j++) free(names[j]);
+            ret = YP_ERR_ALLOCATION;
+            break;
+        }
+        numbers[i] = out.numbers[i];
+        if(scores) scores[i] = out.scores[i];
+    }
+    if(ret == YP_SUCCESS)
+        *count = out.count;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+YP_return_t YP_phonetic_lookup(
+        YP_phonebook_handle_t handle,
+        const char* query,
+        char** names,
+        YP_number_t* numbers,
+        size_t* count)
+{
+    hg_handle_t   h;
+    phonetic_lookup_in_t in;
+    list_records_out_t   out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(!query || !count || (*count && (!names || !numbers)))
+        return YP_ERR_INVALID_ARGS;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.query = (char*)query;
+    in.max   = *count;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->phonetic_lookup_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == YP_SUCCESS)
+        ret = copy_records(&out, names, numbers, count);
+    else
+        *count = 0;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+#define SCAN_DEFAULT_PAGE_SIZE (1024*1024)
+
+static YP_return_t complete_scan_next(YP_request* req)
+{
+    scan_next_out_t out;
+    hg_return_t hret = margo_get_output(req->h, &out);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+    YP_scan_page* page = (YP_scan_page*)req->result;
+    YP_return_t ret = out.ret;
+    if(ret == YP_SUCCESS) {
+        page->count = out.count;
+        page->size  = out.size;
+        page->last  = out.last == HG_TRUE;
+    }
+    margo_free_output(req->h, &out);
+    return ret;
+}
+
+/* Asks the provider to write the next page of the scan into pages[i] */
+static YP_return_t request_page(YP_scan* scan, int i)
+{
+    scan_next_in_t in;
+    YP_phonebook_handle_t handle = scan->handle;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.scan_id = scan->id;
+    in.bulk    = scan->bulks[i];
+
+    return forward_async(handle, handle->client->scan_next_id, &in,
+                         complete_scan_next, &scan->results[i], &scan->request);
+}
+
+/* Closes the cursor of a scan in the provider */
+static YP_return_t close_cursor(
+        YP_phonebook_handle_t handle,
+        uint64_t id)
+{
+    hg_handle_t   h;
+    scan_end_in_t  in;
+    scan_end_out_t out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.scan_id = id;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->scan_end_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+static void free_scan(YP_scan* scan)
+{
+    for(int i = 0; i < 2; i++) {
+        if(scan->bulks[i] != HG_BULK_NULL) margo_bulk_free(scan->bulks[i]);
+        free(scan->pages[i]);
+    }
+    YP_phonebook_handle_release(scan->handle);
+    free(scan);
+}
+
+YP_return_t YP_scan_begin(
+        YP_phonebook_handle_t handle,
+        size_t page_size,
+        YP_scan_t* scan)
+{
+    hg_handle_t   h;
+    scan_begin_in_t  in;
+    scan_begin_out_t out;
+    hg_return_t hret;
+    YP_return_t ret;
+
+    if(handle == YP_PHONEBOOK_HANDLE_NULL || !scan)
+        return YP_ERR_INVALID_ARGS;
+    if(page_size == 0)
+        page_size = SCAN_DEFAULT_PAGE_SIZE;
+
+    memcpy(&in.phonebook_id, &(handle->phonebook_id), sizeof(in.phonebook_id));
+    in.page_size = page_size;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->scan_begin_id, &h);
+    if(hret != HG_SUCCESS)
+        return YP_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    uint64_t id = out.scan_id;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    if(ret != YP_SUCCESS) return ret;
+
+    YP_scan* s = (YP_scan*)calloc(1, sizeof(*s));
+    if(!s) {
+        close_cursor(handle, id);
+        return YP_ERR_ALLOCATION;
+    }
+    YP_phonebook_handle_ref_incr(handle);
+    s->handle    = handle;
+    s->id        = id;
+    s->page_size = page_size;
+    s->request   = YP_REQUEST_NULL;
+    s->current   = 1; // empty, the first page goes into pages[0]
+    for(int i = 0; i < 2; i++) {
+        s->bulks[i] = HG_BULK_NULL;
+        s->pages[i] = (char*)malloc(page_size);
+        if(!s->pages[i]) {
+            ret = YP_ERR_ALLOCATION;
+            goto error;
+        }
+        void* segment = s->pages[i];
+        hg_size_t segment_size = page_size;
+        hret = margo_bulk_create(handle->client->mid, 1, &segment, &segment_size,
+                                 HG_BULK_WRITE_ONLY, &s->bulks[i]);
+        if(hret != HG_SUCCESS) {
+            s->bulks[i] = HG_BULK_NULL;
+            ret = YP_ERR_FROM_MERCURY;
+            goto error;
+        }
+    }
+
+    ret = request_page(s, 0);
+    if(ret != YP_SUCCESS) goto error;
+
+    *scan = s;
+    return YP_SUCCESS;
+
+error:
+    close_cursor(handle, id);
+    free_scan(s);
+    return ret;
+}
+
+YP_return_t YP_scan_next(
+        YP_scan_t scan,
+        const char** name,
+        YP_number_t* number)
+{
+    if(scan == YP_SCAN_NULL || !name || !number)
+        return YP_ERR_INVALID_ARGS;
+
+    while(scan->remaining == 0) {
+        if(scan->last) {
+            *name = NULL;
+            return YP_SUCCESS;
+        }
+        if(scan->request == YP_REQUEST_NULL)
+            return scan->ret;
+        YP_return_t ret = YP_wait(scan->request);
+        scan->request = YP_REQUEST_NULL;
+        if(ret != YP_SUCCESS)
+            return scan->ret = ret;
+        /* move on to the page just received, and request the next one
+         * into the page that was just gone through */
+        scan->current  ^= 1;
+        YP_scan_page* page = &scan->results[scan->current];
+        scan->next      = scan->pages[scan->current];
+        scan->remaining = page->count;
+        scan->last      = page->last;
+        if(!scan->last)
+            scan->ret = request_page(scan, scan->current ^ 1);
+    }
+
+    /* see scan_next_in_t */
+    uint32_t name_size;
+    const char* p = scan->next;
+    memcpy(number, p, sizeof(*number));
+    p += sizeof(*number);
+    memcpy(&name_size, p, sizeof(name_size));
+    p += sizeof(name_size);
+    *name = p;
+    scan->next = p + name_size + 1;
+    scan->remaining -= 1;
+    return YP_SUCCESS;
+}
+
+YP_return_t YP_scan_end(YP_scan_t scan)
+{
+    if(scan == YP_SCAN_NULL)
+        return YP_ERR_INVALID_ARGS;
+    /* the provider may still be writing into the other page */
+    if(scan->request != YP_REQUEST_NULL)
+        YP_wait(scan->request);
+    YP_return_t ret = close_cursor(scan->handle, scan->id);
+    free_scan(scan);
     return ret;
 }
@@ -7,6 +7,7 @@
 #define _CLIENT_H
 
 #include "types.h"
+#include "lookup-cache.h"
 #include "YP/YP-client.h"
 #include "YP/YP-phonebook.h"
 
@@ -14,15 +15,81 @@ typedef struct YP_client {
    margo_instance_id mid;
    hg_id_t           hello_id;
    hg_id_t           sum_id;
+   hg_id_t           insert_id;
+   hg_id_t           lookup_id;
+   hg_id_t           erase_id;
+   hg_id_t           list_range_id;
+   hg_id_t           list_prefix_id;
+   hg_id_t           lookup_number_id;
+   hg_id_t           fuzzy_search_id;
+   hg_id_t           phonetic_lookup_id;
+   hg_id_t           lookup_batch_id;
+   hg_id_t           insert_batch_id;
+   hg_id_t           scan_begin_id;
+   hg_id_t           scan_next_id;
+   hg_id_t           scan_end_id;
    uint64_t          num_phonebook_handles;
+   size_t            coalesce_max;      // see YP_client_set_coalescing
+   uint64_t          coalesce_delay_us;
 } YP_client;
 
+typedef struct YP_request {
+    hg_handle_t   h;
+    margo_request req;
+    YP_return_t (*complete)(struct YP_request*); // reads the output
+    void*         result;                         // where complete stores the result
+} YP_request;
+
+#define LOOKUP_GROUP_PENDING 0 // accepting lookups
+#define LOOKUP_GROUP_SENT    1 // batch sent, results not yet in
+#define LOOKUP_GROUP_DONE    2 // results available
+
+/* Concurrent YP_lookup calls sent together as one batch */
+typedef struct YP_lookup_group {
+    size_t        capacity;
+    size_t        count;   // lookups in the group
+    size_t        waiting; // callers that haven't read their result
+    int           state;
+    const char**  names;
+    YP_number_t*  numbers;
+    YP_return_t*  results;
+    uint32_t*     leases;
+} YP_lookup_group;
+
 typedef struct YP_phonebook_handle {
     YP_client_t      client;
     hg_addr_t           addr;
     uint16_t            provider_id;
     uint64_t            refcount;
     YP_phonebook_id_t phonebook_id;
+    /* lookups waiting to be coalesced, protected by coalesce_mutex */
+    ABT_mutex           coalesce_mutex;
+    ABT_cond            coalesce_cond;
+    YP_lookup_group*    pending_lookups;
+    lookup_cache*       cache; // see YP_phonebook_handle_set_cache
 } YP_phonebook_handle;
 
+/* Page of a scan, as described by the provider */
+typedef struct YP_scan_page {
+    hg_size_t count;
+    hg_size_t size;
+    int       last;
+} YP_scan_page;
+
+/* The records are read from one page while the other is requested */
+typedef struct YP_scan {
+    YP_phonebook_handle_t handle;
+    uint64_t              id;        // cursor in the provider
+    size_t                page_size;
+    char*                 pages[2];
+    hg_bulk_t             bulks[2];
+    YP_scan_page          results[2];
+    YP_request_t          request;   // request for the other page, if any
+    YP_return_t           ret;       // error of the last request
+    int                   current;   // page being read
+    const char*           next;      // next record of the current page
+    size_t                remaining; // records left in the current page
+    int                   last;      // no pages come after the current one
+} YP_scan;
+
 #endif
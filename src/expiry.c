@@ -0,0 +1,286 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "provider.h"
+#include "hash.h"
+#include "timer-wheel.h"
+#include "memory/memory-table.h"
+#include "expiry.h"
+
+/* number of locks the names of a phonebook are spread over */
+#define EXPIRY_NAME_LOCKS 64
+
+typedef struct expiry_timer {
+    timer_entry entry;     // first, so that entries convert to timers
+    int         expired;   // out of the wheel and in the expired list
+    size_t      name_size;
+    char        name[];
+} expiry_timer;
+
+struct expiry_task {
+    YP_provider_t provider;
+    double        tick;
+    double        start;  // time of tick 0
+    expire_fn     fn;
+    void*         uargs;
+    /* protected by mutex */
+    timer_wheel   wheel;
+    timer_entry   expired; // timers whose record is to be erased
+    memory_table  timers;  // name -> expiry_timer*
+    size_t        count;   // timers, also read without the mutex
+    ABT_mutex     mutex;
+    ABT_mutex     names[EXPIRY_NAME_LOCKS];
+    ABT_cond      cond;
+    int           stop;
+    ABT_thread    ult;
+};
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static uint64_t current_tick(const expiry_task* task)
+{
+    return (uint64_t)((now() - task->start)/task->tick);
+}
+
+static ABT_mutex name_lock(expiry_task* task, const char* name, size_t name_size)
+{
+    return task->names[YP_hash(name, name_size) % EXPIRY_NAME_LOCKS];
+}
+
+static void unlink_expired(expiry_timer* timer)
+{
+    timer->entry.prev->next = timer->entry.next;
+    timer->entry.next->prev = timer->entry.prev;
+    timer->expired = 0;
+}
+
+/* Moves a timer out of the wheel into the expired list; its record is
+ * erased later by expire_records, unless it is updated in between */
+static void expire_timer(void* uargs, timer_entry* entry)
+{
+    expiry_task*  task  = (expiry_task*)uargs;
+    expiry_timer* timer = (expiry_timer*)entry;
+    timer->expired    = 1;
+    entry->prev       = task->expired.prev;
+    entry->next       = &task->expired;
+    entry->prev->next = entry;
+    task->expired.prev = entry;
+}
+
+/* Erases the records of the expired timers. The name lock of each one
+ * is taken before the task's mutex, as by updates, so that an update
+ * that set or cancelled the deadline of a record since it expired
+ * isn't undone. Called with the task's mutex held. */
+static void expire_records(expiry_task* task)
+{
+    char*  name = NULL;
+    size_t name_capacity = 0;
+    while(!task->stop && task->expired.next != &task->expired) {
+        expiry_timer* timer = (expiry_timer*)task->expired.next;
+        size_t name_size = timer->name_size;
+        if(name_size > name_capacity) {
+            char* new_name = (char*)realloc(name, name_size);
+            if(!new_name) break; // retried on the next tick
+            name = new_name;
+            name_capacity = name_size;
+        }
+        memcpy(name, timer->name, name_size);
+        ABT_mutex_unlock(task->mutex);
+        ABT_mutex lock = name_lock(task, name, name_size);
+        ABT_mutex_lock(lock);
+        ABT_mutex_lock(task->mutex);
+        uint64_t hash = YP_hash(name, name_size);
+        memory_slot* slot = memory_table_find(&task->timers, name, name_size, hash);
+        timer = slot ? (expiry_timer*)(uintptr_t)slot->value : NULL;
+        if(timer && timer->expired) {
+            unlink_expired(timer);
+            memory_table_erase_slot(&task->timers, slot);
+            __atomic_sub_fetch(&task->count, 1, __ATOMIC_RELAXED);
+            free(timer);
+            ABT_mutex_unlock(task->mutex);
+            task->fn(task->uargs, name, name_size);
+            ABT_mutex_lock(task->mutex);
+        }
+        ABT_mutex_unlock(lock);
+    }
+    free(name);
+}
+
+static void expiry_ult(void* args)
+{
+    expiry_task* task = (expiry_task*)args;
+    ABT_mutex_lock(task->mutex);
+    while(!task->stop) {
+        /* wake up at the start of the next tick */
+        double next = task->start + (double)(current_tick(task) + 1)*task->tick;
+        double t = next - now();
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        t += (double)deadline.tv_sec + deadline.tv_nsec*1e-9;
+        deadline.tv_sec  = (time_t)t;
+        deadline.tv_nsec = (long)((t - (double)deadline.tv_sec)*1e9);
+        int ret = ABT_SUCCESS;
+        while(!task->stop && ret != ABT_ERR_COND_TIMEDOUT)
+            ret = ABT_cond_timedwait(task->cond, task->mutex, &deadline);
+        if(task->stop) break;
+        timer_wheel_advance(&task->wheel, current_tick(task), expire_timer, task);
+        expire_records(task);
+    }
+    ABT_mutex_unlock(task->mutex);
+}
+
+static void free_task(expiry_task* task)
+{
+    if(task->mutex != ABT_MUTEX_NULL) ABT_mutex_free(&task->mutex);
+    if(task->cond != ABT_COND_NULL) ABT_cond_free(&task->cond);
+    for(int i = 0; i < EXPIRY_NAME_LOCKS; i++)
+        if(task->names[i] != ABT_MUTEX_NULL) ABT_mutex_free(&task->names[i]);
+    for(size_t i = 0; i < task->timers.capacity; i++)
+        if(memory_table_slot_is_full(&task->timers, i))
+            free((expiry_timer*)(uintptr_t)task->timers.slots[i].value);
+    memory_table_destroy(&task->timers);
+    free(task);
+}
+
+YP_return_t expiry_task_start(
+        YP_provider_t provider,
+        double tick,
+        expire_fn fn,
+        void* uargs,
+        expiry_task** out)
+{
+    expiry_task* task = (expiry_task*)calloc(1, sizeof(*task));
+    if(!task) return YP_ERR_ALLOCATION;
+    task->provider = provider;
+    task->tick     = tick;
+    task->start    = now();
+    task->fn       = fn;
+    task->uargs    = uargs;
+    task->mutex    = ABT_MUTEX_NULL;
+    task->cond     = ABT_COND_NULL;
+    for(int i = 0; i < EXPIRY_NAME_LOCKS; i++)
+        task->names[i] = ABT_MUTEX_NULL;
+    timer_wheel_init(&task->wheel, 0);
+    task->expired.prev = task->expired.next = &task->expired;
+    YP_return_t ret = memory_table_init(&task->timers, 0);
+    if(ret != YP_SUCCESS) {
+        free(task);
+        return ret;
+    }
+    if(ABT_mutex_create(&task->mutex) != ABT_SUCCESS
+    || ABT_cond_create(&task->cond) != ABT_SUCCESS) {
+        free_task(task);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    for(int i = 0; i < EXPIRY_NAME_LOCKS; i++) {
+        if(ABT_mutex_create(&task->names[i]) != ABT_SUCCESS) {
+            free_task(task);
+            return YP_ERR_FROM_ARGOBOTS;
+        }
+    }
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    if(ABT_thread_create(pool, expiry_ult, task,
+                         ABT_THREAD_ATTR_NULL, &task->ult) != ABT_SUCCESS) {
+        free_task(task);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = task;
+    return YP_SUCCESS;
+}
+
+void expiry_task_stop(expiry_task* task)
+{
+    ABT_mutex_lock(task->mutex);
+    task->stop = 1;
+    ABT_cond_signal(task->cond);
+    ABT_mutex_unlock(task->mutex);
+    ABT_thread_join(task->ult);
+    ABT_thread_free(&task->ult);
+    free_task(task);
+}
+
+void expiry_lock_name(expiry_task* task, const char* name, size_t name_size)
+{
+    ABT_mutex_lock(name_lock(task, name, name_size));
+}
+
+void expiry_unlock_name(expiry_task* task, const char* name, size_t name_size)
+{
+    ABT_mutex_unlock(name_lock(task, name, name_size));
+}
+
+/* Takes a timer out of the wheel, or out of the expired list */
+static void remove_timer(expiry_task* task, expiry_timer* timer)
+{
+    if(timer->expired) unlink_expired(timer);
+    else timer_wheel_remove(&task->wheel, &timer->entry);
+}
+
+YP_return_t expiry_set(
+        expiry_task* task,
+        const char* name,
+        size_t name_size,
+        double ttl)
+{
+    /* timers of the name are only added and removed under its lock, so
+     * it can't have one if there are none, and the wheel isn't touched */
+    if(ttl <= 0 && !__atomic_load_n(&task->count, __ATOMIC_RELAXED))
+        return YP_SUCCESS;
+    YP_return_t ret = YP_SUCCESS;
+    uint64_t hash = YP_hash(name, name_size);
+    ABT_mutex_lock(task->mutex);
+    memory_slot* slot = memory_table_find(&task->timers, name, name_size, hash);
+    expiry_timer* timer = slot ? (expiry_timer*)(uintptr_t)slot->value : NULL;
+    if(ttl <= 0) {
+        if(timer) {
+            remove_timer(task, timer);
+            memory_table_erase_slot(&task->timers, slot);
+            __atomic_sub_fetch(&task->count, 1, __ATOMIC_RELAXED);
+            free(timer);
+        }
+        goto finish;
+    }
+    /* round up, a record never expires before its time to live */
+    double ticks = (now() - task->start + ttl)/task->tick;
+    uint64_t deadline = UINT64_MAX;
+    if(ticks < (double)(UINT64_MAX/2)) {
+        deadline = (uint64_t)ticks;
+        if((double)deadline < ticks) deadline += 1;
+    }
+    if(timer) {
+        remove_timer(task, timer);
+    } else {
+        timer = (expiry_timer*)malloc(sizeof(*timer) + name_size);
+        if(!timer) {
+            ret = YP_ERR_ALLOCATION;
+            goto finish;
+        }
+        timer->expired   = 0;
+        timer->name_size = name_size;
+        memcpy(timer->name, name, name_size);
+        ret = memory_table_insert(&task->timers, name, name_size, hash,
+                                  (uint64_t)(uintptr_t)timer, NULL, NULL);
+        if(ret != YP_SUCCESS) {
+            free(timer);
+            goto finish;
+        }
+        __atomic_add_fetch(&task->count, 1, __ATOMIC_RELAXED);
+    }
+    timer_wheel_add(&task->wheel, &timer->entry, deadline);
+
+finish:
+    ABT_mutex_unlock(task->mutex);
+    return ret;
+}
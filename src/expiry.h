@@ -0,0 +1,70 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _EXPIRY_H
+#define _EXPIRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-backend.h"
+
+/*
+ * Expiry of the records of a phonebook inserted with a time to live.
+ * Each such record has a timer in a hierarchical timer wheel, found by
+ * name in a hash table so that it can be reset when the record is
+ * updated or erased. A ULT in the provider's pool advances the wheel
+ * every tick and calls back the provider to erase the expired records.
+ *
+ * The wheel is under a mutex held only while timers are set or fire.
+ * Updates of a record and of its deadline are instead serialized with
+ * its expiry by a lock on its name (one of a fixed set of mutexes the
+ * names are hashed to), so that writes of other names aren't held up.
+ *
+ * Deadlines are only kept in memory, so the provider doesn't enable
+ * expiry on phonebooks whose records survive a restart.
+ */
+
+typedef struct expiry_task expiry_task;
+
+/* Erases an expired record, called with the lock on its name held */
+typedef void (*expire_fn)(void* uargs, const char* name, size_t name_size);
+
+/**
+ * @brief Starts a ULT in the provider's pool expiring records every
+ * tick seconds by calling fn.
+ */
+YP_return_t expiry_task_start(
+        YP_provider_t provider,
+        double tick,
+        expire_fn fn,
+        void* uargs,
+        expiry_task** task);
+
+/**
+ * @brief Stops the ULT and forgets the pending deadlines.
+ */
+void expiry_task_stop(expiry_task* task);
+
+/**
+ * @brief Prevents a record from expiring until expiry_unlock_name is
+ * called. A record and its deadline should be updated under this lock,
+ * so that a record that was just updated doesn't expire under its
+ * previous deadline.
+ */
+void expiry_lock_name(expiry_task* task, const char* name, size_t name_size);
+
+void expiry_unlock_name(expiry_task* task, const char* name, size_t name_size);
+
+/**
+ * @brief Makes a record expire in ttl seconds, or never if ttl is 0,
+ * replacing its previous deadline. Its name must be locked.
+ */
+YP_return_t expiry_set(
+        expiry_task* task,
+        const char* name,
+        size_t name_size,
+        double ttl);
+
+#endif
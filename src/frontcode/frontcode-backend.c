@@ -0,0 +1,198 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "frontcode-backend.h"
+#include "frontcode.h"
+
+typedef struct frontcode_context {
+    struct json_object* config;
+    frontcode_dict      dict;
+} frontcode_context;
+
+static YP_return_t frontcode_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        frontcode_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+        if (!json_object_is_type(config, json_type_object)) {
+            margo_error(provider->mid, "JSON configuration should be an object");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+    // "block_size" is the number of names per front-coded block
+    uint32_t block_size = FRONTCODE_DEFAULT_BLOCK_SIZE;
+    struct json_object* jblock_size = json_object_object_get(config, "block_size");
+    if (jblock_size) {
+        if (!json_object_is_type(jblock_size, json_type_int)
+        ||  json_object_get_int64(jblock_size) < 1
+        ||  json_object_get_int64(jblock_size) > 65536) {
+            margo_error(provider->mid,
+                "\"block_size\" should be an integer between 1 and 65536");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        block_size = (uint32_t)json_object_get_int64(jblock_size);
+    }
+
+    frontcode_context* ctx = (frontcode_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    YP_return_t ret = frontcode_init(&ctx->dict, block_size);
+    if (ret != YP_SUCCESS) {
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    ctx->config = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t frontcode_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return frontcode_create_context(provider, config_str, (frontcode_context**)context);
+}
+
+static YP_return_t frontcode_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    /* nothing is persisted, opening is the same as creating */
+    return frontcode_create_context(provider, config_str, (frontcode_context**)context);
+}
+
+static YP_return_t frontcode_close_phonebook(void* ctx)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    frontcode_destroy(&context->dict);
+    json_object_put(context->config);
+    free(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t frontcode_destroy_phonebook(void* ctx)
+{
+    return frontcode_close_phonebook(ctx);
+}
+
+static char* frontcode_get_config(void* ctx)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void frontcode_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from front-coded phonebook\n");
+}
+
+static int32_t frontcode_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t frontcode_backend_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return frontcode_insert(&context->dict, name, name_size, number);
+}
+
+static YP_return_t frontcode_backend_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return frontcode_find(&context->dict, name, name_size, number);
+}
+
+static YP_return_t frontcode_backend_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return frontcode_erase(&context->dict, name, name_size);
+}
+
+static YP_return_t frontcode_list_range(
+        void* ctx,
+        const char* lower, size_t lower_size, int inclusive,
+        const char* upper, size_t upper_size,
+        YP_record_fn fn, void* uargs)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return frontcode_iterate_range(&context->dict, lower, lower_size, inclusive,
+                                   upper, upper_size, fn, uargs);
+}
+
+static YP_return_t frontcode_list_prefix(
+        void* ctx,
+        const char* prefix, size_t prefix_size,
+        YP_record_fn fn, void* uargs)
+{
+    frontcode_context* context = (frontcode_context*)ctx;
+    return frontcode_iterate_prefix(&context->dict, prefix, prefix_size, fn, uargs);
+}
+
+static YP_return_t frontcode_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    return frontcode_list_range(ctx, NULL, 0, 1, NULL, 0, fn, uargs);
+}
+
+static YP_backend_impl frontcode_backend = {
+    .name             = "frontcode",
+
+    .create_phonebook  = frontcode_create_phonebook,
+    .open_phonebook    = frontcode_open_phonebook,
+    .close_phonebook   = frontcode_close_phonebook,
+    .destroy_phonebook = frontcode_destroy_phonebook,
+    .get_config       = frontcode_get_config,
+
+    .hello            = frontcode_say_hello,
+    .sum              = frontcode_compute_sum,
+    .insert           = frontcode_backend_insert,
+    .lookup           = frontcode_backend_lookup,
+    .erase            = frontcode_backend_erase,
+    .list_range       = frontcode_list_range,
+    .list_prefix      = frontcode_list_prefix,
+    .iterate          = frontcode_iterate
+};
+
+YP_return_t YP_provider_register_frontcode_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &frontcode_backend);
+}
@@ -0,0 +1,520 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "../hash.h"
+#include "frontcode.h"
+
+#define FRONTCODE_ERASED 1 // meta of a tombstone in the delta table
+
+/* The delta table is merged once it holds more than this many entries
+ * plus an eighth of the number of names in the blocks */
+#define FRONTCODE_MIN_DELTA 256
+
+#define FRONTCODE_MAX_VARINT 10
+
+static inline size_t put_varint(char* p, uint64_t v)
+{
+    size_t n = 0;
+    while(v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+static inline const char* get_varint(const char* p, uint64_t* v)
+{
+    uint64_t r = 0;
+    unsigned shift = 0;
+    uint8_t b;
+    do {
+        b = (uint8_t)*p++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while(b & 0x80);
+    *v = r;
+    return p;
+}
+
+static inline int compare(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+    size_t n = a_size < b_size ? a_size : b_size;
+    /* empty names may come with NULL pointers */
+    int c = n ? memcmp(a, b, n) : 0;
+    if(c) return c;
+    return a_size < b_size ? -1 : (a_size > b_size);
+}
+
+static inline size_t common_prefix(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+    size_t n = a_size < b_size ? a_size : b_size;
+    size_t i = 0;
+    while(i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+static inline const char* block_end(const frontcode_dict* dict, size_t block)
+{
+    return dict->data + (block + 1 < dict->num_blocks ?
+            dict->blocks[block + 1] : dict->data_size);
+}
+
+/* Index of the last block whose first name is <= key, or 0 */
+static size_t find_block(const frontcode_dict* dict, const char* key, size_t key_size)
+{
+    size_t lo = 0, hi = dict->num_blocks;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t size;
+        const char* first = get_varint(dict->data + dict->blocks[mid], &size);
+        if(compare(first, size, key, key_size) <= 0) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Looks a name up in the blocks without decoding them: match is the
+ * length of the prefix the previous name shares with the key, and the
+ * previous name is known to be smaller than the key, so the length of
+ * the prefix shared by a name with the previous one is enough to know
+ * whether it is smaller or greater than the key, unless they are equal,
+ * in which case only its suffix needs comparing. */
+static int base_find(const frontcode_dict* dict, const char* key, size_t key_size, uint64_t* value)
+{
+    if(!dict->num_blocks) return 0;
+    size_t block = find_block(dict, key, key_size);
+    const char* p   = dict->data + dict->blocks[block];
+    const char* end = block_end(dict, block);
+    uint64_t size, v;
+    p = get_varint(p, &size);
+    const char* first = p;
+    p = get_varint(p + size, &v);
+    size_t match = common_prefix(first, size, key, key_size);
+    if(match == size && match == key_size) {
+        *value = v;
+        return 1;
+    }
+    if(match < size && (match == key_size || (uint8_t)first[match] > (uint8_t)key[match]))
+        return 0;
+    while(p < end) {
+        uint64_t shared, suffix_size;
+        p = get_varint(p, &shared);
+        p = get_varint(p, &suffix_size);
+        const char* suffix = p;
+        p = get_varint(p + suffix_size, &v);
+        if(shared < match) return 0;
+        if(shared > match) continue;
+        size_t m = common_prefix(suffix, suffix_size, key + match, key_size - match);
+        if(m == suffix_size && match + m == key_size) {
+            *value = v;
+            return 1;
+        }
+        if(m < suffix_size && (match + m == key_size
+        || (uint8_t)suffix[m] > (uint8_t)key[match + m]))
+            return 0;
+        match += m;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Building blocks                                                     */
+/* ------------------------------------------------------------------ */
+
+typedef struct frontcode_builder {
+    char*       data;
+    size_t      data_size;
+    size_t      data_capacity;
+    size_t*     blocks;
+    size_t      num_blocks;
+    size_t      blocks_capacity;
+    size_t      count;
+    uint32_t    block_size;
+    char*       prev;
+    size_t      prev_size;
+    size_t      prev_capacity;
+    YP_return_t ret;
+} frontcode_builder;
+
+static int builder_append(void* uargs, const char* key, size_t key_size, uint64_t value)
+{
+    frontcode_builder* b = (frontcode_builder*)uargs;
+    int first = b->count % b->block_size == 0;
+    size_t needed = b->data_size + key_size + 3*FRONTCODE_MAX_VARINT;
+    if(needed > b->data_capacity) {
+        size_t capacity = b->data_capacity ? 2*b->data_capacity : 4096;
+        while(capacity < needed) capacity *= 2;
+        char* data = (char*)realloc(b->data, capacity);
+        if(!data) goto error;
+        b->data = data;
+        b->data_capacity = capacity;
+    }
+    if(first && b->num_blocks == b->blocks_capacity) {
+        size_t capacity = b->blocks_capacity ? 2*b->blocks_capacity : 64;
+        size_t* blocks = (size_t*)realloc(b->blocks, capacity*sizeof(size_t));
+        if(!blocks) goto error;
+        b->blocks = blocks;
+        b->blocks_capacity = capacity;
+    }
+    if(key_size > b->prev_capacity) {
+        size_t capacity = b->prev_capacity ? 2*b->prev_capacity : 64;
+        while(capacity < key_size) capacity *= 2;
+        char* prev = (char*)realloc(b->prev, capacity);
+        if(!prev) goto error;
+        b->prev = prev;
+        b->prev_capacity = capacity;
+    }
+
+    char* p = b->data + b->data_size;
+    if(first) {
+        b->blocks[b->num_blocks++] = b->data_size;
+        p += put_varint(p, key_size);
+        if(key_size) memcpy(p, key, key_size);
+        p += key_size;
+    } else {
+        size_t shared = common_prefix(b->prev, b->prev_size, key, key_size);
+        p += put_varint(p, shared);
+        p += put_varint(p, key_size - shared);
+        if(key_size > shared) memcpy(p, key + shared, key_size - shared);
+        p += key_size - shared;
+    }
+    p += put_varint(p, value);
+    b->data_size = (size_t)(p - b->data);
+    if(key_size) memcpy(b->prev, key, key_size);
+    b->prev_size = key_size;
+    b->count += 1;
+    return 0;
+
+error:
+    b->ret = YP_ERR_ALLOCATION;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Merged iteration over the blocks and the delta table                */
+/* ------------------------------------------------------------------ */
+
+typedef struct frontcode_bounds {
+    const char* lower;
+    size_t      lower_size;
+    int         inclusive;
+    const char* upper;
+    size_t      upper_size;
+    const char* prefix;
+    size_t      prefix_size;
+} frontcode_bounds;
+
+static inline int below_lower(const frontcode_bounds* b, const char* key, size_t key_size)
+{
+    if(!b->lower) return 0;
+    int c = compare(key, key_size, b->lower, b->lower_size);
+    return c < 0 || (c == 0 && !b->inclusive);
+}
+
+static inline int past_upper(const frontcode_bounds* b, const char* key, size_t key_size)
+{
+    if(b->upper && compare(key, key_size, b->upper, b->upper_size) >= 0)
+        return 1;
+    if(b->prefix && b->prefix_size && (key_size < b->prefix_size
+    || memcmp(key, b->prefix, b->prefix_size) != 0))
+        return 1;
+    return 0;
+}
+
+typedef struct frontcode_cursor {
+    const frontcode_dict* dict;
+    size_t      block;
+    const char* pos;
+    const char* end;
+    int         first;  // next entry is the first of its block
+    int         valid;
+    char*       key;
+    size_t      key_size;
+    size_t      key_capacity;
+    uint64_t    value;
+} frontcode_cursor;
+
+static void cursor_load_block(frontcode_cursor* c, size_t block)
+{
+    c->block = block;
+    c->pos   = c->dict->data + c->dict->blocks[block];
+    c->end   = block_end(c->dict, block);
+    c->first = 1;
+}
+
+static YP_return_t cursor_next(frontcode_cursor* c)
+{
+    if(c->pos == c->end) {
+        if(c->block + 1 >= c->dict->num_blocks) {
+            c->valid = 0;
+            return YP_SUCCESS;
+        }
+        cursor_load_block(c, c->block + 1);
+    }
+    uint64_t shared = 0, suffix_size;
+    if(!c->first) c->pos = get_varint(c->pos, &shared);
+    c->pos = get_varint(c->pos, &suffix_size);
+    size_t key_size = shared + suffix_size;
+    if(key_size > c->key_capacity) {
+        size_t capacity = c->key_capacity ? 2*c->key_capacity : 64;
+        while(capacity < key_size) capacity *= 2;
+        char* key = (char*)realloc(c->key, capacity);
+        if(!key) return YP_ERR_ALLOCATION;
+        c->key = key;
+        c->key_capacity = capacity;
+    }
+    if(suffix_size) memcpy(c->key + shared, c->pos, suffix_size);
+    c->key_size = key_size;
+    c->pos = get_varint(c->pos + suffix_size, &c->value);
+    c->first = 0;
+    c->valid = 1;
+    return YP_SUCCESS;
+}
+
+static YP_return_t cursor_seek(frontcode_cursor* c, const frontcode_bounds* b)
+{
+    c->valid = 0;
+    if(!c->dict->num_blocks) return YP_SUCCESS;
+    cursor_load_block(c, b->lower ? find_block(c->dict, b->lower, b->lower_size) : 0);
+    YP_return_t ret;
+    do {
+        ret = cursor_next(c);
+    } while(ret == YP_SUCCESS && c->valid && below_lower(b, c->key, c->key_size));
+    return ret;
+}
+
+static YP_return_t frontcode_merge(
+        const frontcode_dict* dict,
+        const frontcode_bounds* bounds,
+        frontcode_callback fn,
+        void* uargs)
+{
+    YP_return_t ret = YP_SUCCESS;
+    frontcode_cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    cursor.dict = dict;
+
+    /* first change of the delta table within bounds */
+    btree_cursor changes;
+    btree_seek(&dict->delta_order, bounds->lower, bounds->lower_size, &changes);
+    while(btree_cursor_valid(&changes)) {
+        const btree_entry* e = btree_cursor_entry(&changes);
+        if(!below_lower(bounds, e->key, e->key_size)) break;
+        btree_cursor_next(&changes);
+    }
+
+    ret = cursor_seek(&cursor, bounds);
+    while(ret == YP_SUCCESS) {
+        int has_base = cursor.valid && !past_upper(bounds, cursor.key, cursor.key_size);
+        const btree_entry* change = btree_cursor_valid(&changes) ?
+            btree_cursor_entry(&changes) : NULL;
+        if(change && past_upper(bounds, change->key, change->key_size))
+            change = NULL;
+        if(!has_base && !change) break;
+        int stop = 0;
+        int c = !has_base ? 1 : !change ? -1 :
+            compare(cursor.key, cursor.key_size, change->key, change->key_size);
+        if(c < 0) {
+            stop = fn(uargs, cursor.key, cursor.key_size, cursor.value);
+            ret = cursor_next(&cursor);
+        } else {
+            if(c == 0) ret = cursor_next(&cursor);
+            memory_slot* slot = memory_table_find(&dict->delta, change->key,
+                    change->key_size, YP_hash(change->key, change->key_size));
+            if(slot->meta != FRONTCODE_ERASED)
+                stop = fn(uargs, change->key, change->key_size, slot->value);
+            btree_cursor_next(&changes);
+        }
+        if(stop) break;
+    }
+    free(cursor.key);
+    return ret;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public functions                                                    */
+/* ------------------------------------------------------------------ */
+
+YP_return_t frontcode_init(frontcode_dict* dict, uint32_t block_size)
+{
+    memset(dict, 0, sizeof(*dict));
+    dict->block_size = block_size ? block_size : FRONTCODE_DEFAULT_BLOCK_SIZE;
+    YP_return_t ret = memory_table_init(&dict->delta, 0);
+    if(ret != YP_SUCCESS) return ret;
+    ret = btree_init(&dict->delta_order);
+    if(ret != YP_SUCCESS) memory_table_destroy(&dict->delta);
+    return ret;
+}
+
+void frontcode_destroy(frontcode_dict* dict)
+{
+    free(dict->data);
+    free(dict->blocks);
+    memory_table_destroy(&dict->delta);
+    btree_destroy(&dict->delta_order);
+    memset(dict, 0, sizeof(*dict));
+}
+
+YP_return_t frontcode_compact(frontcode_dict* dict)
+{
+    if(!dict->delta.size) return YP_SUCCESS;
+    frontcode_builder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.block_size = dict->block_size;
+    frontcode_bounds bounds;
+    memset(&bounds, 0, sizeof(bounds));
+
+    YP_return_t ret = frontcode_merge(dict, &bounds, builder_append, &builder);
+    if(ret == YP_SUCCESS) ret = builder.ret;
+    memory_table delta;
+    btree delta_order;
+    if(ret == YP_SUCCESS) ret = memory_table_init(&delta, 0);
+    if(ret == YP_SUCCESS) {
+        ret = btree_init(&delta_order);
+        if(ret != YP_SUCCESS) memory_table_destroy(&delta);
+    }
+    free(builder.prev);
+    if(ret != YP_SUCCESS) {
+        free(builder.data);
+        free(builder.blocks);
+        return ret;
+    }
+    /* give back the slack of the buffers */
+    char* data = (char*)realloc(builder.data, builder.data_size ? builder.data_size : 1);
+    if(data) builder.data = data;
+
+    free(dict->data);
+    free(dict->blocks);
+    memory_table_destroy(&dict->delta);
+    btree_destroy(&dict->delta_order);
+    dict->data        = builder.data;
+    dict->data_size   = builder.data_size;
+    dict->blocks      = builder.blocks;
+    dict->num_blocks  = builder.num_blocks;
+    dict->num_entries = builder.count;
+    dict->delta       = delta;
+    dict->delta_order = delta_order;
+    return YP_SUCCESS;
+}
+
+static void maybe_compact(frontcode_dict* dict)
+{
+    if(dict->delta.size <= FRONTCODE_MIN_DELTA + dict->num_entries / 8)
+        return;
+    /* on failure the delta table just keeps growing until next time */
+    frontcode_compact(dict);
+}
+
+YP_return_t frontcode_insert(
+        frontcode_dict* dict,
+        const char* key,
+        size_t key_size,
+        uint64_t value)
+{
+    uint64_t hash = YP_hash(key, key_size);
+    memory_slot* slot = memory_table_find(&dict->delta, key, key_size, hash);
+    if(slot) {
+        if(slot->meta == FRONTCODE_ERASED) {
+            slot->meta = 0;
+            dict->size += 1;
+        }
+        slot->value = value;
+        return YP_SUCCESS;
+    }
+    uint64_t old;
+    int exists = base_find(dict, key, key_size, &old);
+    YP_return_t ret = memory_table_insert(&dict->delta, key, key_size, hash, value, &slot, NULL);
+    if(ret != YP_SUCCESS) return ret;
+    ret = btree_insert(&dict->delta_order, key, key_size, 0);
+    if(ret != YP_SUCCESS) {
+        memory_table_erase_slot(&dict->delta, slot);
+        return ret;
+    }
+    slot->meta = 0;
+    if(!exists) dict->size += 1;
+    maybe_compact(dict);
+    return YP_SUCCESS;
+}
+
+YP_return_t frontcode_find(
+        const frontcode_dict* dict,
+        const char* key,
+        size_t key_size,
+        uint64_t* value)
+{
+    if(dict->delta.size) {
+        memory_slot* slot = memory_table_find(&dict->delta, key, key_size, YP_hash(key, key_size));
+        if(slot) {
+            if(slot->meta == FRONTCODE_ERASED) return YP_ERR_NOT_FOUND;
+            *value = slot->value;
+            return YP_SUCCESS;
+        }
+    }
+    return base_find(dict, key, key_size, value) ? YP_SUCCESS : YP_ERR_NOT_FOUND;
+}
+
+YP_return_t frontcode_erase(
+        frontcode_dict* dict,
+        const char* key,
+        size_t key_size)
+{
+    uint64_t hash = YP_hash(key, key_size);
+    uint64_t old;
+    memory_slot* slot = memory_table_find(&dict->delta, key, key_size, hash);
+    if(slot) {
+        if(slot->meta == FRONTCODE_ERASED) return YP_ERR_NOT_FOUND;
+        if(base_find(dict, key, key_size, &old)) slot->meta = FRONTCODE_ERASED;
+        else {
+            memory_table_erase_slot(&dict->delta, slot);
+            btree_erase(&dict->delta_order, key, key_size);
+        }
+        dict->size -= 1;
+        return YP_SUCCESS;
+    }
+    if(!base_find(dict, key, key_size, &old)) return YP_ERR_NOT_FOUND;
+    YP_return_t ret = memory_table_insert(&dict->delta, key, key_size, hash, 0, &slot, NULL);
+    if(ret != YP_SUCCESS) return ret;
+    ret = btree_insert(&dict->delta_order, key, key_size, 0);
+    if(ret != YP_SUCCESS) {
+        memory_table_erase_slot(&dict->delta, slot);
+        return ret;
+    }
+    slot->meta = FRONTCODE_ERASED;
+    dict->size -= 1;
+    maybe_compact(dict);
+    return YP_SUCCESS;
+}
+
+YP_return_t frontcode_iterate_range(
+        const frontcode_dict* dict,
+        const char* lower,
+        size_t lower_size,
+        int inclusive,
+        const char* upper,
+        size_t upper_size,
+        frontcode_callback fn,
+        void* uargs)
+{
+    frontcode_bounds bounds = {
+        lower, lower_size, inclusive, upper, upper_size, NULL, 0
+    };
+    return frontcode_merge(dict, &bounds, fn, uargs);
+}
+
+YP_return_t frontcode_iterate_prefix(
+        const frontcode_dict* dict,
+        const char* prefix,
+        size_t prefix_size,
+        frontcode_callback fn,
+        void* uargs)
+{
+    frontcode_bounds bounds = {
+        prefix, prefix_size, 1, NULL, 0, prefix, prefix_size
+    };
+    return frontcode_merge(dict, &bounds, fn, uargs);
+}
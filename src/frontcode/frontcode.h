@@ -0,0 +1,107 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _FRONTCODE_H
+#define _FRONTCODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "../memory/memory-table.h"
+#include "../btree/btree.h"
+
+/*
+ * Sorted dictionary mapping names to numbers, with names front-coded:
+ * names are grouped in blocks of block_size consecutive names, the
+ * first name of a block is stored in full and every other name as the
+ * length of the prefix it shares with the previous one followed by the
+ * rest of its bytes. Lengths and numbers are LEB128 varints. A sparse
+ * index holding the offset of each block is binary-searched on the
+ * first names of the blocks, after which at most one block is decoded.
+ *
+ * The blocks are immutable; changes go to a small delta table (erased
+ * names are kept there as tombstones) that is merged into a new set of
+ * blocks once it grows past a fraction of the dictionary. The names of
+ * the delta table are also kept in a B+tree, so that listings start
+ * from their lower bound instead of sorting the whole delta.
+ */
+
+#define FRONTCODE_DEFAULT_BLOCK_SIZE 16
+
+typedef struct frontcode_dict {
+    char*        data;        // front-coded blocks
+    size_t       data_size;
+    size_t*      blocks;      // offset of each block in data
+    size_t       num_blocks;
+    size_t       num_entries; // names in the blocks, erased or not
+    uint32_t     block_size;
+    memory_table delta;       // changes since the blocks were built
+    btree        delta_order; // names of the delta table, sorted
+    size_t       size;        // number of names
+} frontcode_dict;
+
+/**
+ * @brief Function called on each name listed, in lexicographic order.
+ * Returning a non-zero value stops the listing.
+ */
+typedef int (*frontcode_callback)(void* uargs, const char* key, size_t key_size, uint64_t value);
+
+YP_return_t frontcode_init(frontcode_dict* dict, uint32_t block_size);
+
+void frontcode_destroy(frontcode_dict* dict);
+
+/**
+ * @brief Inserts a name, or updates its number if already present.
+ */
+YP_return_t frontcode_insert(
+        frontcode_dict* dict,
+        const char* key,
+        size_t key_size,
+        uint64_t value);
+
+/**
+ * @brief Looks up a name, returns YP_ERR_NOT_FOUND if it is absent.
+ */
+YP_return_t frontcode_find(
+        const frontcode_dict* dict,
+        const char* key,
+        size_t key_size,
+        uint64_t* value);
+
+YP_return_t frontcode_erase(
+        frontcode_dict* dict,
+        const char* key,
+        size_t key_size);
+
+/**
+ * @brief Merges the delta table into the blocks.
+ */
+YP_return_t frontcode_compact(frontcode_dict* dict);
+
+/**
+ * @brief Lists the names in [lower, upper), lower being included only
+ * if inclusive is non-zero. NULL bounds are not enforced.
+ */
+YP_return_t frontcode_iterate_range(
+        const frontcode_dict* dict,
+        const char* lower,
+        size_t lower_size,
+        int inclusive,
+        const char* upper,
+        size_t upper_size,
+        frontcode_callback fn,
+        void* uargs);
+
+/**
+ * @brief Lists the names starting with the provided prefix.
+ */
+YP_return_t frontcode_iterate_prefix(
+        const frontcode_dict* dict,
+        const char* prefix,
+        size_t prefix_size,
+        frontcode_callback fn,
+        void* uargs);
+
+#endif
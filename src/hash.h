@@ -0,0 +1,103 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Small, fast 64-bit hash for short byte strings (names), derived from
+ * wyhash. Backends use it to index their tables; the value must NOT be
+ * persisted unless the backend also records YP_HASH_VERSION, since the
+ * function may be tuned in the future.
+ */
+
+#define YP_HASH_VERSION 1
+
+__extension__ typedef unsigned __int128 YP_uint128_t;
+
+static inline uint64_t YP_hash_mix(uint64_t a, uint64_t b)
+{
+    YP_uint128_t r = (YP_uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t YP_hash_read8(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t YP_hash_read4(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t YP_hash_seeded(const void* data, size_t size, uint64_t seed)
+{
+    static const uint64_t s0 = 0xa0761d6478bd642full;
+    static const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t s2 = 0x8ebc6af09c88c6e3ull;
+    static const uint64_t s3 = 0x589965cc75374cc3ull;
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t a, b;
+    seed ^= YP_hash_mix(seed ^ s0, s1);
+    if(size <= 16) {
+        if(size >= 4) {
+            a = (YP_hash_read4(p) << 32) | YP_hash_read4(p + ((size >> 3) << 2));
+            b = (YP_hash_read4(p + size - 4) << 32)
+              | YP_hash_read4(p + size - 4 - ((size >> 3) << 2));
+        } else if(size > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) | p[size - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = size;
+        if(i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = YP_hash_mix(YP_hash_read8(p) ^ s1, YP_hash_read8(p + 8) ^ seed);
+                see1 = YP_hash_mix(YP_hash_read8(p + 16) ^ s2, YP_hash_read8(p + 24) ^ see1);
+                see2 = YP_hash_mix(YP_hash_read8(p + 32) ^ s3, YP_hash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16) {
+            seed = YP_hash_mix(YP_hash_read8(p) ^ s1, YP_hash_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = YP_hash_read8(p + i - 16);
+        b = YP_hash_read8(p + i - 8);
+    }
+    a ^= s1;
+    b ^= seed;
+    YP_uint128_t r = (YP_uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return YP_hash_mix(a ^ s0 ^ size, b ^ s1);
+}
+
+static inline uint64_t YP_hash(const void* data, size_t size)
+{
+    return YP_hash_seeded(data, size, 0);
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <time.h>
+#include "provider.h"
+#include "hash.h"
+#include "memory/memory-table.h"
+#include "lease.h"
+
+#define LEASE_MIN_SWEEP_SIZE 1024
+
+/* Each slot maps a name to the deadline of its last lease, and its
+ * meta field counts the updates blocking new leases on the name */
+struct lease_table {
+    margo_instance_id mid;
+    uint32_t          duration_ms;
+    uint64_t          start_ms; // monotonic time of deadline 0
+    ABT_mutex         mutex;
+    memory_table      leases;
+    size_t            sweep_size;
+};
+
+static uint64_t now_ms(const lease_table* table)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000 + (uint64_t)t.tv_nsec/1000000 - table->start_ms;
+}
+
+YP_return_t lease_table_create(
+        YP_provider_t provider,
+        double duration,
+        lease_table** out)
+{
+    lease_table* table = (lease_table*)calloc(1, sizeof(*table));
+    if(!table) return YP_ERR_ALLOCATION;
+    table->mid         = provider->mid;
+    table->duration_ms = duration*1e3 < (double)UINT32_MAX ? (uint32_t)(duration*1e3) : UINT32_MAX;
+    if(!table->duration_ms) table->duration_ms = 1;
+    table->start_ms    = now_ms(table);
+    table->sweep_size  = LEASE_MIN_SWEEP_SIZE;
+    YP_return_t ret = memory_table_init(&table->leases, 0);
+    if(ret != YP_SUCCESS) {
+        free(table);
+        return ret;
+    }
+    if(ABT_mutex_create(&table->mutex) != ABT_SUCCESS) {
+        memory_table_destroy(&table->leases);
+        free(table);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = table;
+    return YP_SUCCESS;
+}
+
+void lease_table_destroy(lease_table* table)
+{
+    ABT_mutex_free(&table->mutex);
+    memory_table_destroy(&table->leases);
+    free(table);
+}
+
+/* Forgets the names whose leases expired and that no update blocks */
+static void sweep(lease_table* table, uint64_t now)
+{
+    memory_table* leases = &table->leases;
+    for(size_t i = 0; i < leases->capacity; i++) {
+        if(!memory_table_slot_is_full(leases, i)) continue;
+        memory_slot* slot = &leases->slots[i];
+        if(slot->meta == 0 && slot->value <= now)
+            memory_table_erase_slot(leases, slot);
+    }
+    table->sweep_size = 2*leases->size;
+    if(table->sweep_size < LEASE_MIN_SWEEP_SIZE)
+        table->sweep_size = LEASE_MIN_SWEEP_SIZE;
+}
+
+uint32_t lease_grant(
+        lease_table* table,
+        const char* name,
+        size_t name_size)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    uint32_t granted = 0;
+    ABT_mutex_lock(table->mutex);
+    uint64_t now = now_ms(table);
+    memory_slot* slot = memory_table_find(&table->leases, name, name_size, hash);
+    if(slot) {
+        if(slot->meta == 0) {
+            slot->value = now + table->duration_ms;
+            granted = table->duration_ms;
+        }
+    } else {
+        if(table->leases.size >= table->sweep_size)
+            sweep(table, now);
+        if(memory_table_insert(&table->leases, name, name_size, hash,
+                               now + table->duration_ms, NULL, NULL) == YP_SUCCESS)
+            granted = table->duration_ms;
+    }
+    ABT_mutex_unlock(table->mutex);
+    return granted;
+}
+
+YP_return_t lease_block(
+        lease_table* table,
+        size_t count,
+        const char* const* names,
+        const size_t* name_sizes)
+{
+    YP_return_t ret = YP_SUCCESS;
+    uint64_t deadline = 0;
+    size_t i;
+    ABT_mutex_lock(table->mutex);
+    for(i = 0; i < count; i++) {
+        uint64_t hash = YP_hash(names[i], name_sizes[i]);
+        memory_slot* slot = memory_table_find(&table->leases, names[i], name_sizes[i], hash);
+        if(!slot) {
+            /* remember the name anyway, so that it isn't leased until
+             * lease_unblock */
+            ret = memory_table_insert(&table->leases, names[i], name_sizes[i], hash,
+                                      0, &slot, NULL);
+            if(ret != YP_SUCCESS) break;
+        }
+        slot->meta += 1;
+        if(slot->value > deadline) deadline = slot->value;
+    }
+    uint64_t now = now_ms(table);
+    ABT_mutex_unlock(table->mutex);
+    if(ret != YP_SUCCESS) {
+        lease_unblock(table, i, names, name_sizes);
+        return ret;
+    }
+    /* no lease can be granted on the names meanwhile, so one wait is
+     * enough */
+    if(deadline > now)
+        margo_thread_sleep(table->mid, (double)(deadline - now));
+    return YP_SUCCESS;
+}
+
+void lease_unblock(
+        lease_table* table,
+        size_t count,
+        const char* const* names,
+        const size_t* name_sizes)
+{
+    ABT_mutex_lock(table->mutex);
+    for(size_t i = 0; i < count; i++) {
+        memory_slot* slot = memory_table_find(&table->leases, names[i], name_sizes[i],
+                                              YP_hash(names[i], name_sizes[i]));
+        if(slot && slot->meta > 0) slot->meta -= 1;
+    }
+    ABT_mutex_unlock(table->mutex);
+}
@@ -0,0 +1,64 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _LEASE_H
+#define _LEASE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-backend.h"
+
+/*
+ * Leases granted to the lookup caches of clients. A client may keep
+ * the result of a lookup until its lease expires, and the provider
+ * doesn't update a name until the leases granted on it have expired,
+ * so a cached result is never older than the last completed update.
+ * While an update waits, no new lease is granted on the name.
+ *
+ * The table only remembers the last deadline of each name; names
+ * whose leases expired are swept when the table doubles in size.
+ */
+
+typedef struct lease_table lease_table;
+
+/**
+ * @brief Creates a table granting leases of the given duration, in
+ * seconds.
+ */
+YP_return_t lease_table_create(
+        YP_provider_t provider,
+        double duration,
+        lease_table** table);
+
+void lease_table_destroy(lease_table* table);
+
+/**
+ * @brief Grants a lease on a name, to be done before reading its
+ * record. Returns the duration of the lease in milliseconds, or 0 if
+ * an update of the name is waiting.
+ */
+uint32_t lease_grant(
+        lease_table* table,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Stops granting leases on the names and waits for the current
+ * ones to expire, to be done before updating their records. If it
+ * succeeds, lease_unblock must be called on the same names afterwards.
+ */
+YP_return_t lease_block(
+        lease_table* table,
+        size_t count,
+        const char* const* names,
+        const size_t* name_sizes);
+
+void lease_unblock(
+        lease_table* table,
+        size_t count,
+        const char* const* names,
+        const size_t* name_sizes);
+
+#endif
@@ -0,0 +1,833 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../scan.h"
+#include "../memory/memory-table.h"
+#include "log-backend.h"
+
+/*
+ * Log-structured backend: every insert and erase is appended to the
+ * active segment file of the phonebook's directory, and an in-memory
+ * table maps each name to the location (segment, offset) of its latest
+ * record. Segments are sealed once they reach "segment_size" bytes; a
+ * ULT running in the provider's pool rewrites the live records of
+ * sealed segments whose fraction of live bytes falls below
+ * "compaction_threshold" into the active segment, then deletes them.
+ * On open, segments are replayed in order to rebuild the index.
+ *
+ * The index and segments are protected by a rwlock: lookups and
+ * listings read records with pread under the read lock, so they run
+ * concurrently with each other, while appends and compaction moves
+ * take the write lock.
+ */
+
+#define LOG_INSERT 1
+#define LOG_ERASE  2
+
+#define LOG_DEFAULT_SEGMENT_SIZE (64*1024*1024)
+#define LOG_DEFAULT_THRESHOLD    0.5
+
+/* locations are packed as segment id (24 bits) and offset (40 bits) */
+#define LOG_OFFSET_BITS 40
+#define LOG_LOCATION(seg, off) (((uint64_t)(seg) << LOG_OFFSET_BITS) | (off))
+#define LOG_SEGMENT_OF(loc)    ((loc) >> LOG_OFFSET_BITS)
+#define LOG_OFFSET_OF(loc)     ((loc) & ((1ull << LOG_OFFSET_BITS) - 1))
+
+typedef struct log_record_header {
+    uint32_t checksum;  // of the rest of the header and of the name
+    uint32_t name_size;
+    uint64_t number;
+    uint8_t  type;
+    uint8_t  reserved[7];
+} log_record_header;
+
+typedef struct log_segment {
+    uint64_t id;
+    int      fd;
+    uint64_t size;       // bytes written
+    uint64_t live_bytes; // bytes of records still referenced by the index
+    uint64_t tombstone_bytes; // bytes of erase records
+} log_segment;
+
+typedef struct log_context {
+    struct json_object* config;
+    margo_instance_id   mid;
+    char*               path;
+    uint64_t            segment_size;
+    double              threshold;
+    int                 sync;
+    /* index and segments, protected by lock */
+    ABT_rwlock          lock;
+    memory_table        index;
+    log_segment**       segments;     // indexed by segment id, NULL once removed
+    uint64_t            num_segments; // 1 + id of the active segment
+    /* compaction, protected by mutex (taken after lock, if both are) */
+    ABT_mutex           mutex;
+    ABT_cond            cond;
+    ABT_thread          compaction_ult;
+    int                 compact;      // a segment may need compaction
+    int                 shutdown;
+} log_context;
+
+static inline size_t record_size(size_t name_size)
+{
+    return sizeof(log_record_header) + name_size;
+}
+
+static uint32_t record_checksum(const log_record_header* h, const char* name)
+{
+    uint64_t seed = YP_hash(&h->name_size, sizeof(*h) - offsetof(log_record_header, name_size));
+    return (uint32_t)YP_hash_seeded(name, h->name_size, seed);
+}
+
+static void segment_path(char* out, size_t size, const char* dir, uint64_t id)
+{
+    snprintf(out, size, "%s/segment.%08llu", dir, (unsigned long long)id);
+}
+
+static YP_return_t new_segment(log_context* ctx, uint64_t id, int flags, log_segment** out)
+{
+    char path[1024];
+    segment_path(path, sizeof(path), ctx->path, id);
+    int fd = open(path, O_RDWR | flags, 0644);
+    if(fd < 0) return YP_ERR_IO;
+    log_segment* seg = (log_segment*)calloc(1, sizeof(*seg));
+    if(!seg) goto error;
+    seg->id = id;
+    seg->fd = fd;
+    if(id >= ctx->num_segments) {
+        log_segment** segments = (log_segment**)realloc(ctx->segments,
+                                                        (id + 1) * sizeof(*segments));
+        if(!segments) goto error;
+        memset(segments + ctx->num_segments, 0,
+               (id + 1 - ctx->num_segments) * sizeof(*segments));
+        ctx->segments     = segments;
+        ctx->num_segments = id + 1;
+    }
+    ctx->segments[id] = seg;
+    if(out) *out = seg;
+    return YP_SUCCESS;
+
+error:
+    free(seg);
+    close(fd);
+    if(flags & O_CREAT) unlink(path);
+    return YP_ERR_ALLOCATION;
+}
+
+static void remove_segment(log_context* ctx, log_segment* seg, int unlink_file)
+{
+    char path[1024];
+    ctx->segments[seg->id] = NULL;
+    close(seg->fd);
+    if(unlink_file) {
+        segment_path(path, sizeof(path), ctx->path, seg->id);
+        unlink(path);
+    }
+    free(seg);
+}
+
+static inline log_segment* active_segment(log_context* ctx)
+{
+    return ctx->segments[ctx->num_segments - 1];
+}
+
+static inline int is_oldest_segment(const log_context* ctx, const log_segment* seg)
+{
+    for(uint64_t i = 0; i < seg->id; i++)
+        if(ctx->segments[i]) return 0;
+    return 1;
+}
+
+/* Returns a sealed segment that would benefit from compaction, if any.
+ * Tombstones count as live data except in the oldest segment, since
+ * they may still shadow a record in an older segment. */
+static log_segment* find_segment_to_compact(log_context* ctx)
+{
+    int oldest = 1;
+    for(uint64_t i = 0; i + 1 < ctx->num_segments; i++) {
+        log_segment* seg = ctx->segments[i];
+        if(!seg) continue;
+        uint64_t live = seg->live_bytes + (oldest ? 0 : seg->tombstone_bytes);
+        if(live < ctx->threshold * seg->size)
+            return seg;
+        oldest = 0;
+    }
+    return NULL;
+}
+
+/* Wakes up the compaction ULT to look for a segment to compact */
+static void request_compaction(log_context* ctx)
+{
+    ABT_mutex_lock(ctx->mutex);
+    ctx->compact = 1;
+    ABT_cond_signal(ctx->cond);
+    ABT_mutex_unlock(ctx->mutex);
+}
+
+/* Marks the record at the given location as dead. */
+static inline void release_location(log_context* ctx, uint64_t location, size_t name_size)
+{
+    log_segment* seg = ctx->segments[LOG_SEGMENT_OF(location)];
+    if(seg) seg->live_bytes -= record_size(name_size);
+}
+
+/* Appends a record to the active segment, rolling over to a new segment
+ * if needed. Must be called with the write lock held. */
+static YP_return_t append_record(
+        log_context* ctx, uint8_t type,
+        const char* name, size_t name_size, uint64_t number,
+        uint64_t* location)
+{
+    log_segment* seg = active_segment(ctx);
+    if(seg->size >= ctx->segment_size) {
+        YP_return_t ret = new_segment(ctx, seg->id + 1, O_CREAT | O_EXCL, &seg);
+        if(ret != YP_SUCCESS) return ret;
+        request_compaction(ctx);
+    }
+    if(seg->size + record_size(name_size) >= (1ull << LOG_OFFSET_BITS))
+        return YP_ERR_INVALID_ARGS;
+
+    log_record_header h;
+    memset(&h, 0, sizeof(h));
+    h.name_size = (uint32_t)name_size;
+    h.number    = number;
+    h.type      = type;
+    h.checksum  = record_checksum(&h, name);
+
+    struct iovec iov[2] = {
+        { .iov_base = &h,           .iov_len = sizeof(h) },
+        { .iov_base = (void*)name,  .iov_len = name_size }
+    };
+    ssize_t written = pwritev(seg->fd, iov, 2, (off_t)seg->size);
+    if(written != (ssize_t)record_size(name_size))
+        return YP_ERR_IO;
+    if(ctx->sync && fdatasync(seg->fd) != 0)
+        return YP_ERR_IO;
+    *location = LOG_LOCATION(seg->id, seg->size);
+    seg->size += record_size(name_size);
+    return YP_SUCCESS;
+}
+
+/* Removes the last record appended, at the given location, after
+ * failing to apply it. Must be called with the write lock held. */
+static void undo_append(log_context* ctx, uint64_t location)
+{
+    log_segment* seg = ctx->segments[LOG_SEGMENT_OF(location)];
+    if(ftruncate(seg->fd, (off_t)LOG_OFFSET_OF(location)) != 0) {
+        margo_error(ctx->mid, "Could not remove a record from segment %llu of %s",
+                    (unsigned long long)seg->id, ctx->path);
+        return;
+    }
+    seg->size = LOG_OFFSET_OF(location);
+}
+
+/* Applies a record to the index. The record lives at the given location
+ * (used for inserts). Nothing is changed if it fails. Must be called
+ * with the write lock held. */
+static YP_return_t apply_record(
+        log_context* ctx, uint8_t type,
+        const char* name, size_t name_size, uint64_t location)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    memory_slot* slot = memory_table_find(&ctx->index, name, name_size, hash);
+    if(type == LOG_ERASE) {
+        ctx->segments[LOG_SEGMENT_OF(location)]->tombstone_bytes += record_size(name_size);
+        if(slot) {
+            release_location(ctx, slot->value, name_size);
+            memory_table_erase_slot(&ctx->index, slot);
+        }
+        return YP_SUCCESS;
+    }
+    if(slot) {
+        release_location(ctx, slot->value, name_size);
+        slot->value = location;
+    } else {
+        YP_return_t ret = memory_table_insert(&ctx->index, name, name_size, hash,
+                                              location, NULL, NULL);
+        if(ret != YP_SUCCESS) return ret;
+    }
+    ctx->segments[LOG_SEGMENT_OF(location)]->live_bytes += record_size(name_size);
+    return YP_SUCCESS;
+}
+
+/* Replays a segment into the index. A torn record at the end of the last
+ * segment (e.g. after a crash) is truncated away. */
+static YP_return_t replay_segment(log_context* ctx, log_segment* seg, int is_last)
+{
+    struct stat st;
+    if(fstat(seg->fd, &st) != 0) return YP_ERR_IO;
+    size_t size = (size_t)st.st_size;
+    if(size == 0) return YP_SUCCESS;
+    char* data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, seg->fd, 0);
+    if(data == MAP_FAILED) return YP_ERR_IO;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    YP_return_t ret = YP_SUCCESS;
+    size_t offset = 0;
+    while(offset + sizeof(log_record_header) <= size) {
+        log_record_header h;
+        memcpy(&h, data + offset, sizeof(h));
+        const char* name = data + offset + sizeof(h);
+        if(offset + record_size(h.name_size) > size
+        || (h.type != LOG_INSERT && h.type != LOG_ERASE)
+        || record_checksum(&h, name) != h.checksum)
+            break;
+        seg->size = offset;
+        ret = apply_record(ctx, h.type, name, h.name_size, LOG_LOCATION(seg->id, offset));
+        if(ret != YP_SUCCESS) break;
+        offset += record_size(h.name_size);
+    }
+    munmap(data, size);
+    seg->size = offset;
+    if(ret == YP_SUCCESS && offset != size) {
+        if(!is_last) {
+            margo_error(ctx->mid, "Corrupted record in segment %llu of %s",
+                        (unsigned long long)seg->id, ctx->path);
+            return YP_ERR_IO;
+        }
+        margo_warning(ctx->mid, "Truncating incomplete record at the end of segment %llu of %s",
+                      (unsigned long long)seg->id, ctx->path);
+        if(ftruncate(seg->fd, (off_t)offset) != 0) return YP_ERR_IO;
+    }
+    return ret;
+}
+
+/* Rewrites the live records of a sealed segment into the active one and
+ * deletes it. The write lock is only held while handling one record, so
+ * RPCs keep being served during compaction. */
+static YP_return_t compact_segment(log_context* ctx, log_segment* seg)
+{
+    size_t size = seg->size;
+    char* data = NULL;
+    if(size) {
+        data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, seg->fd, 0);
+        if(data == MAP_FAILED) {
+            margo_error(ctx->mid, "Could not map segment %llu for compaction",
+                        (unsigned long long)seg->id);
+            return YP_ERR_IO;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    size_t offset = 0, count = 0;
+    YP_return_t ret = YP_SUCCESS;
+    ABT_rwlock_rdlock(ctx->lock);
+    int oldest = is_oldest_segment(ctx, seg);
+    uint64_t first = active_segment(ctx)->id; // first segment records are moved to
+    ABT_rwlock_unlock(ctx->lock);
+    while(offset < size && ret == YP_SUCCESS) {
+        log_record_header h;
+        memcpy(&h, data + offset, sizeof(h));
+        const char* name = data + offset + sizeof(h);
+        uint64_t hash = YP_hash(name, h.name_size);
+        uint64_t location = LOG_LOCATION(seg->id, offset);
+
+        ABT_rwlock_wrlock(ctx->lock);
+        memory_slot* slot = memory_table_find(&ctx->index, name, h.name_size, hash);
+        if(h.type == LOG_INSERT && slot && slot->value == location) {
+            /* live record, move it */
+            uint64_t new_location;
+            ret = append_record(ctx, LOG_INSERT, name, h.name_size, h.number, &new_location);
+            if(ret == YP_SUCCESS) {
+                seg->live_bytes -= record_size(h.name_size);
+                ctx->segments[LOG_SEGMENT_OF(new_location)]->live_bytes += record_size(h.name_size);
+                slot->value = new_location;
+            }
+        } else if(h.type == LOG_ERASE && !slot && !oldest) {
+            /* the tombstone may still shadow a record in an older segment */
+            uint64_t new_location;
+            ret = append_record(ctx, LOG_ERASE, name, h.name_size, 0, &new_location);
+            if(ret == YP_SUCCESS)
+                ctx->segments[LOG_SEGMENT_OF(new_location)]->tombstone_bytes += record_size(h.name_size);
+        }
+        ABT_rwlock_unlock(ctx->lock);
+
+        offset += record_size(h.name_size);
+        if(++count % 1024 == 0) ABT_thread_yield();
+    }
+    if(data) munmap(data, size);
+
+    if(ret != YP_SUCCESS) {
+        margo_error(ctx->mid, "Compaction of segment %llu failed (error %d)",
+                    (unsigned long long)seg->id, ret);
+        return ret;
+    }
+    /* the active segment may have been sealed while records were moved,
+     * so every segment they may have gone to must be durable before the
+     * source segment is removed */
+    ABT_rwlock_wrlock(ctx->lock);
+    for(uint64_t i = first; !ctx->sync && i < ctx->num_segments && ret == YP_SUCCESS; i++) {
+        if(ctx->segments[i] && fdatasync(ctx->segments[i]->fd) != 0)
+            ret = YP_ERR_IO;
+    }
+    if(ret == YP_SUCCESS)
+        remove_segment(ctx, seg, 1);
+    else
+        margo_error(ctx->mid, "Could not sync the records moved out of segment %llu",
+                    (unsigned long long)seg->id);
+    ABT_rwlock_unlock(ctx->lock);
+    return ret;
+}
+
+static void compaction_ult(void* arg)
+{
+    log_context* ctx = (log_context*)arg;
+    ABT_mutex_lock(ctx->mutex);
+    while(!ctx->shutdown) {
+        if(!ctx->compact) {
+            ABT_cond_wait(ctx->cond, ctx->mutex);
+            continue;
+        }
+        ctx->compact = 0;
+        ABT_mutex_unlock(ctx->mutex);
+        /* only this ULT removes segments, so seg stays valid unlocked */
+        ABT_rwlock_rdlock(ctx->lock);
+        log_segment* seg = find_segment_to_compact(ctx);
+        ABT_rwlock_unlock(ctx->lock);
+        if(seg) {
+            margo_debug(ctx->mid, "Compacting segment %llu of %s",
+                        (unsigned long long)seg->id, ctx->path);
+            /* look for another segment right away after a success, but
+             * don't retry a failed one until something changes */
+            if(compact_segment(ctx, seg) == YP_SUCCESS) {
+                ABT_mutex_lock(ctx->mutex);
+                ctx->compact = 1;
+                continue;
+            }
+        }
+        ABT_mutex_lock(ctx->mutex);
+    }
+    ABT_mutex_unlock(ctx->mutex);
+}
+
+static YP_return_t log_parse_config(
+        YP_provider_t provider,
+        const char* config_str,
+        log_context* ctx)
+{
+    struct json_object* config = NULL;
+    if (!config_str) {
+        margo_error(provider->mid, "log backend requires a configuration");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    config = json_tokener_parse_ex(
+            tokener, config_str,
+            strlen(config_str));
+    if (!config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+    if (!json_object_is_type(config, json_type_object)) {
+        margo_error(provider->mid, "JSON configuration should be an object");
+        goto error;
+    }
+
+    struct json_object* jpath = json_object_object_get(config, "path");
+    if (!jpath || !json_object_is_type(jpath, json_type_string)) {
+        margo_error(provider->mid, "\"path\" should be a string");
+        goto error;
+    }
+    ctx->segment_size = LOG_DEFAULT_SEGMENT_SIZE;
+    struct json_object* jsize = json_object_object_get(config, "segment_size");
+    if (jsize) {
+        if (!json_object_is_type(jsize, json_type_int) || json_object_get_int64(jsize) <= 0) {
+            margo_error(provider->mid, "\"segment_size\" should be a positive integer");
+            goto error;
+        }
+        ctx->segment_size = (uint64_t)json_object_get_int64(jsize);
+    }
+    ctx->threshold = LOG_DEFAULT_THRESHOLD;
+    struct json_object* jthreshold = json_object_object_get(config, "compaction_threshold");
+    if (jthreshold) {
+        if (!json_object_is_type(jthreshold, json_type_double)
+        &&  !json_object_is_type(jthreshold, json_type_int)) {
+            margo_error(provider->mid, "\"compaction_threshold\" should be a number");
+            goto error;
+        }
+        ctx->threshold = json_object_get_double(jthreshold);
+        if (ctx->threshold < 0.0 || ctx->threshold > 1.0) {
+            margo_error(provider->mid, "\"compaction_threshold\" should be between 0 and 1");
+            goto error;
+        }
+    }
+    struct json_object* jsync = json_object_object_get(config, "sync");
+    if (jsync) {
+        if (!json_object_is_type(jsync, json_type_boolean)) {
+            margo_error(provider->mid, "\"sync\" should be a boolean");
+            goto error;
+        }
+        ctx->sync = json_object_get_boolean(jsync);
+    }
+
+    ctx->config = config;
+    ctx->path   = strdup(json_object_get_string(jpath));
+    ctx->mid    = provider->mid;
+    return YP_SUCCESS;
+
+error:
+    json_object_put(config);
+    return YP_ERR_INVALID_CONFIG;
+}
+
+static YP_return_t log_start_compaction(YP_provider_t provider, log_context* ctx)
+{
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    int ret = ABT_thread_create(pool, compaction_ult, ctx,
+                                ABT_THREAD_ATTR_NULL, &ctx->compaction_ult);
+    return ret == ABT_SUCCESS ? YP_SUCCESS : YP_ERR_FROM_ARGOBOTS;
+}
+
+static void log_free_context(log_context* ctx)
+{
+    for(uint64_t i = 0; i < ctx->num_segments; i++)
+        if(ctx->segments[i]) remove_segment(ctx, ctx->segments[i], 0);
+    free(ctx->segments);
+    memory_table_destroy(&ctx->index);
+    if(ctx->cond != ABT_COND_NULL) ABT_cond_free(&ctx->cond);
+    if(ctx->mutex != ABT_MUTEX_NULL) ABT_mutex_free(&ctx->mutex);
+    if(ctx->lock != ABT_RWLOCK_NULL) ABT_rwlock_free(&ctx->lock);
+    json_object_put(ctx->config);
+    free(ctx->path);
+    free(ctx);
+}
+
+static YP_return_t log_new_context(
+        YP_provider_t provider,
+        const char* config_str,
+        log_context** context)
+{
+    log_context* ctx = (log_context*)calloc(1, sizeof(*ctx));
+    if(!ctx) return YP_ERR_ALLOCATION;
+    YP_return_t ret = log_parse_config(provider, config_str, ctx);
+    if(ret != YP_SUCCESS) {
+        free(ctx);
+        return ret;
+    }
+    ret = memory_table_init(&ctx->index, 0);
+    if(ret != YP_SUCCESS) {
+        json_object_put(ctx->config);
+        free(ctx->path);
+        free(ctx);
+        return ret;
+    }
+    ABT_rwlock_create(&ctx->lock);
+    ABT_mutex_create(&ctx->mutex);
+    ABT_cond_create(&ctx->cond);
+    ctx->compact = 1;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t log_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    log_context* ctx = NULL;
+    YP_return_t ret = log_new_context(provider, config_str, &ctx);
+    if(ret != YP_SUCCESS) return ret;
+
+    if(mkdir(ctx->path, 0755) != 0 && errno != EEXIST) {
+        margo_error(provider->mid, "Could not create directory %s", ctx->path);
+        log_free_context(ctx);
+        return YP_ERR_IO;
+    }
+    ret = new_segment(ctx, 0, O_CREAT | O_EXCL, NULL);
+    if(ret != YP_SUCCESS) {
+        margo_error(provider->mid,
+            "Could not create log phonebook in %s (it may already exist)", ctx->path);
+        log_free_context(ctx);
+        return ret;
+    }
+    ret = log_start_compaction(provider, ctx);
+    if(ret != YP_SUCCESS) {
+        log_free_context(ctx);
+        return ret;
+    }
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static int compare_ids(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : (x > y);
+}
+
+static YP_return_t log_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    log_context* ctx = NULL;
+    YP_return_t ret = log_new_context(provider, config_str, &ctx);
+    if(ret != YP_SUCCESS) return ret;
+
+    /* find the segments */
+    DIR* dir = opendir(ctx->path);
+    if(!dir) {
+        margo_error(provider->mid, "Could not open directory %s", ctx->path);
+        log_free_context(ctx);
+        return YP_ERR_IO;
+    }
+    uint64_t* ids = NULL;
+    size_t num_ids = 0;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        unsigned long long id;
+        char extra;
+        if(sscanf(entry->d_name, "segment.%llu%c", &id, &extra) != 1) continue;
+        uint64_t* more = (uint64_t*)realloc(ids, (num_ids + 1) * sizeof(*ids));
+        if(!more) {
+            ret = YP_ERR_ALLOCATION;
+            break;
+        }
+        ids = more;
+        ids[num_ids++] = id;
+    }
+    closedir(dir);
+    if(ret != YP_SUCCESS) {
+        free(ids);
+        log_free_context(ctx);
+        return ret;
+    }
+    if(num_ids == 0) {
+        margo_error(provider->mid, "No log phonebook found in %s", ctx->path);
+        log_free_context(ctx);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    qsort(ids, num_ids, sizeof(*ids), compare_ids);
+
+    /* replay them in order */
+    for(size_t i = 0; i < num_ids && ret == YP_SUCCESS; i++) {
+        log_segment* seg = NULL;
+        ret = new_segment(ctx, ids[i], 0, &seg);
+        if(ret == YP_SUCCESS)
+            ret = replay_segment(ctx, seg, i + 1 == num_ids);
+    }
+    free(ids);
+    if(ret == YP_SUCCESS)
+        ret = log_start_compaction(provider, ctx);
+    if(ret != YP_SUCCESS) {
+        margo_error(provider->mid, "Could not open log phonebook in %s", ctx->path);
+        log_free_context(ctx);
+        return ret;
+    }
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static void log_stop_compaction(log_context* ctx)
+{
+    ABT_mutex_lock(ctx->mutex);
+    ctx->shutdown = 1;
+    ABT_cond_signal(ctx->cond);
+    ABT_mutex_unlock(ctx->mutex);
+    ABT_thread_join(ctx->compaction_ult);
+    ABT_thread_free(&ctx->compaction_ult);
+}
+
+static YP_return_t log_close_phonebook(void* ctx)
+{
+    log_context* context = (log_context*)ctx;
+    log_stop_compaction(context);
+    YP_return_t ret = YP_SUCCESS;
+    if(fdatasync(active_segment(context)->fd) != 0)
+        ret = YP_ERR_IO;
+    log_free_context(context);
+    return ret;
+}
+
+static YP_return_t log_destroy_phonebook(void* ctx)
+{
+    log_context* context = (log_context*)ctx;
+    log_stop_compaction(context);
+    for(uint64_t i = 0; i < context->num_segments; i++)
+        if(context->segments[i]) remove_segment(context, context->segments[i], 1);
+    rmdir(context->path); // only succeeds if nothing else lives there
+    log_free_context(context);
+    return YP_SUCCESS;
+}
+
+static char* log_get_config(void* ctx)
+{
+    log_context* context = (log_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void log_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from Log phonebook\n");
+}
+
+static int32_t log_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t log_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    log_context* context = (log_context*)ctx;
+    uint64_t location;
+    ABT_rwlock_wrlock(context->lock);
+    YP_return_t ret = append_record(context, LOG_INSERT, name, name_size, number, &location);
+    if(ret != YP_SUCCESS)
+        goto finish;
+    ret = apply_record(context, LOG_INSERT, name, name_size, location);
+    if(ret != YP_SUCCESS) {
+        /* a record left in the segment would come back on replay */
+        undo_append(context, location);
+        goto finish;
+    }
+    if(find_segment_to_compact(context))
+        request_compaction(context);
+finish:
+    ABT_rwlock_unlock(context->lock);
+    return ret;
+}
+
+static YP_return_t log_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    log_context* context = (log_context*)ctx;
+    YP_return_t ret = YP_SUCCESS;
+    ABT_rwlock_rdlock(context->lock);
+    memory_slot* slot = memory_table_find(&context->index, name, name_size,
+                                          YP_hash(name, name_size));
+    if(!slot) {
+        ret = YP_ERR_NOT_FOUND;
+    } else {
+        log_segment* seg = context->segments[LOG_SEGMENT_OF(slot->value)];
+        off_t offset = (off_t)(LOG_OFFSET_OF(slot->value) + offsetof(log_record_header, number));
+        if(pread(seg->fd, number, sizeof(*number), offset) != sizeof(*number))
+            ret = YP_ERR_IO;
+    }
+    ABT_rwlock_unlock(context->lock);
+    return ret;
+}
+
+static YP_return_t log_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    log_context* context = (log_context*)ctx;
+    YP_return_t ret;
+    uint64_t location;
+    ABT_rwlock_wrlock(context->lock);
+    if(!memory_table_find(&context->index, name, name_size, YP_hash(name, name_size))) {
+        ret = YP_ERR_NOT_FOUND;
+        goto finish;
+    }
+    ret = append_record(context, LOG_ERASE, name, name_size, 0, &location);
+    if(ret == YP_SUCCESS)
+        ret = apply_record(context, LOG_ERASE, name, name_size, location);
+    if(ret == YP_SUCCESS && find_segment_to_compact(context))
+        request_compaction(context);
+finish:
+    ABT_rwlock_unlock(context->lock);
+    return ret;
+}
+
+static YP_return_t log_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    log_context* context = (log_context*)ctx;
+    YP_return_t ret = YP_SUCCESS;
+    ABT_rwlock_rdlock(context->lock);
+    const memory_table* index = &context->index;
+    for(size_t i = 0; i < index->capacity; i++) {
+        if(!memory_table_slot_is_full(index, i)) continue;
+        const memory_slot* slot = &index->slots[i];
+        log_segment* seg = context->segments[LOG_SEGMENT_OF(slot->value)];
+        off_t offset = (off_t)(LOG_OFFSET_OF(slot->value) + offsetof(log_record_header, number));
+        uint64_t number;
+        if(pread(seg->fd, &number, sizeof(number), offset) != sizeof(number)) {
+            ret = YP_ERR_IO;
+            break;
+        }
+        if(fn(uargs, memory_slot_key(slot), slot->key_size, number))
+            break;
+    }
+    ABT_rwlock_unlock(context->lock);
+    return ret;
+}
+
+static YP_return_t log_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    log_context* context = (log_context*)ctx;
+    YP_return_t ret = YP_SUCCESS;
+    uint64_t i;
+    ABT_rwlock_rdlock(context->lock);
+    const memory_table* index = &context->index;
+    ret = scan_slot_resume(*position, index->rehashes, &i);
+    if(ret != YP_SUCCESS) goto finish;
+    for(; i < index->capacity; i++) {
+        if(!memory_table_slot_is_full(index, i)) continue;
+        const memory_slot* slot = &index->slots[i];
+        log_segment* seg = context->segments[LOG_SEGMENT_OF(slot->value)];
+        off_t offset = (off_t)(LOG_OFFSET_OF(slot->value) + offsetof(log_record_header, number));
+        uint64_t number;
+        if(pread(seg->fd, &number, sizeof(number), offset) != sizeof(number)) {
+            ret = YP_ERR_IO;
+            break;
+        }
+        if(fn(uargs, memory_slot_key(slot), slot->key_size, number))
+            break;
+    }
+    *position = i < index->capacity ? scan_slot_position(index->rehashes, i) : UINT64_MAX;
+finish:
+    ABT_rwlock_unlock(context->lock);
+    return ret;
+}
+
+static YP_backend_impl log_backend = {
+    .name             = "log",
+
+    .create_phonebook  = log_create_phonebook,
+    .open_phonebook    = log_open_phonebook,
+    .close_phonebook   = log_close_phonebook,
+    .destroy_phonebook = log_destroy_phonebook,
+    .get_config       = log_get_config,
+
+    .hello            = log_say_hello,
+    .sum              = log_compute_sum,
+    .insert           = log_insert,
+    .lookup           = log_lookup,
+    .erase            = log_erase,
+    .iterate          = log_iterate,
+    .scan             = log_scan
+};
+
+YP_return_t YP_provider_register_log_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &log_backend);
+}
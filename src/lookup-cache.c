@@ -0,0 +1,175 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <abt.h>
+#include "hash.h"
+#include "memory/memory-table.h"
+#include "lookup-cache.h"
+
+typedef struct lookup_cache_entry {
+    char*       name;       // NULL if the entry is free
+    size_t      name_size;
+    uint64_t    deadline;   // end of the lease, see lookup_cache_now
+    YP_number_t number;
+    YP_return_t result;
+    int         referenced; // hit since the clock hand last passed
+} lookup_cache_entry;
+
+struct lookup_cache {
+    ABT_mutex           mutex;
+    memory_table        names;   // name -> index in entries
+    lookup_cache_entry* entries;
+    size_t              capacity;
+    size_t              hand;    // next entry considered for eviction
+};
+
+uint64_t lookup_cache_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000000 + (uint64_t)t.tv_nsec;
+}
+
+YP_return_t lookup_cache_create(size_t capacity, lookup_cache** out)
+{
+    if(capacity == 0) return YP_ERR_INVALID_ARGS;
+    lookup_cache* cache = (lookup_cache*)calloc(1, sizeof(*cache));
+    if(!cache) return YP_ERR_ALLOCATION;
+    cache->capacity = capacity;
+    cache->entries  = (lookup_cache_entry*)calloc(capacity, sizeof(*cache->entries));
+    if(!cache->entries) {
+        free(cache);
+        return YP_ERR_ALLOCATION;
+    }
+    YP_return_t ret = memory_table_init(&cache->names, capacity);
+    if(ret != YP_SUCCESS) {
+        free(cache->entries);
+        free(cache);
+        return ret;
+    }
+    if(ABT_mutex_create(&cache->mutex) != ABT_SUCCESS) {
+        memory_table_destroy(&cache->names);
+        free(cache->entries);
+        free(cache);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = cache;
+    return YP_SUCCESS;
+}
+
+void lookup_cache_destroy(lookup_cache* cache)
+{
+    for(size_t i = 0; i < cache->capacity; i++)
+        free(cache->entries[i].name);
+    ABT_mutex_free(&cache->mutex);
+    memory_table_destroy(&cache->names);
+    free(cache->entries);
+    free(cache);
+}
+
+static void free_entry(lookup_cache* cache, lookup_cache_entry* e)
+{
+    memory_table_erase(&cache->names, e->name, e->name_size,
+                       YP_hash(e->name, e->name_size));
+    free(e->name);
+    e->name = NULL;
+}
+
+/* Returns a free entry, evicting the first entry that the clock hand
+ * finds expired or not referenced since it last passed */
+static lookup_cache_entry* evict(lookup_cache* cache, uint64_t now)
+{
+    while(1) {
+        lookup_cache_entry* e = &cache->entries[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        if(!e->name) return e;
+        if(e->referenced && e->deadline > now) {
+            e->referenced = 0;
+            continue;
+        }
+        free_entry(cache, e);
+        return e;
+    }
+}
+
+int lookup_cache_get(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size,
+        YP_return_t* result,
+        YP_number_t* number)
+{
+    int found = 0;
+    uint64_t now = lookup_cache_now();
+    ABT_mutex_lock(cache->mutex);
+    memory_slot* slot = memory_table_find(&cache->names, name, name_size,
+                                          YP_hash(name, name_size));
+    if(slot) {
+        lookup_cache_entry* e = &cache->entries[slot->value];
+        if(e->deadline > now) {
+            e->referenced = 1;
+            *result = e->result;
+            if(e->result == YP_SUCCESS) *number = e->number;
+            found = 1;
+        } else {
+            free_entry(cache, e);
+        }
+    }
+    ABT_mutex_unlock(cache->mutex);
+    return found;
+}
+
+void lookup_cache_put(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size,
+        YP_return_t result,
+        YP_number_t number,
+        uint64_t deadline)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    ABT_mutex_lock(cache->mutex);
+    memory_slot* slot = memory_table_find(&cache->names, name, name_size, hash);
+    lookup_cache_entry* e = NULL;
+    if(slot) {
+        e = &cache->entries[slot->value];
+        /* keep the most recent lease */
+        if(e->deadline > deadline) goto finish;
+    } else {
+        char* copy = (char*)malloc(name_size ? name_size : 1);
+        if(!copy) goto finish;
+        memcpy(copy, name, name_size);
+        e = evict(cache, lookup_cache_now());
+        if(memory_table_insert(&cache->names, name, name_size, hash,
+                               (uint64_t)(e - cache->entries), NULL, NULL) != YP_SUCCESS) {
+            free(copy);
+            goto finish;
+        }
+        e->name       = copy;
+        e->name_size  = name_size;
+        e->referenced = 0;
+    }
+    e->deadline = deadline;
+    e->result   = result;
+    e->number   = number;
+
+finish:
+    ABT_mutex_unlock(cache->mutex);
+}
+
+void lookup_cache_invalidate(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size)
+{
+    ABT_mutex_lock(cache->mutex);
+    memory_slot* slot = memory_table_find(&cache->names, name, name_size,
+                                          YP_hash(name, name_size));
+    if(slot) free_entry(cache, &cache->entries[slot->value]);
+    ABT_mutex_unlock(cache->mutex);
+}
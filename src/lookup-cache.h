@@ -0,0 +1,64 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _LOOKUP_CACHE_H
+#define _LOOKUP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "YP/YP-number.h"
+
+/*
+ * Cache of the results of the lookups of a phonebook handle, kept
+ * until the leases granted by the provider expire (see lease.h).
+ * Results that are not found are cached too. It holds at most
+ * capacity names, evicted in CLOCK order, and is safe to use from
+ * several ULTs.
+ */
+
+typedef struct lookup_cache lookup_cache;
+
+YP_return_t lookup_cache_create(size_t capacity, lookup_cache** cache);
+
+void lookup_cache_destroy(lookup_cache* cache);
+
+/**
+ * @brief Returns the current time in nanoseconds, from which leases
+ * are counted.
+ */
+uint64_t lookup_cache_now(void);
+
+/**
+ * @brief Returns 1 and sets result (YP_SUCCESS or YP_ERR_NOT_FOUND)
+ * and number if the lease on the name hasn't expired, 0 otherwise.
+ */
+int lookup_cache_get(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size,
+        YP_return_t* result,
+        YP_number_t* number);
+
+/**
+ * @brief Caches the result of a lookup until the given deadline.
+ */
+void lookup_cache_put(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size,
+        YP_return_t result,
+        YP_number_t number,
+        uint64_t deadline);
+
+/**
+ * @brief Drops the result of a lookup, if cached.
+ */
+void lookup_cache_invalidate(
+        lookup_cache* cache,
+        const char* name,
+        size_t name_size);
+
+#endif
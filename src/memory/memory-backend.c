@@ -0,0 +1,420 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../scan.h"
+#include "../wal.h"
+#include "memory-backend.h"
+#include "memory-table.h"
+
+/*
+ * In-memory phonebook. If a "wal" path is provided, updates are made
+ * durable in a write-ahead log that is replayed when the phonebook is
+ * opened. The table is then guarded by an ABT_rwlock: an update is
+ * applied and its record appended under the write lock, so the log
+ * holds updates in the order they were applied, and the lock is
+ * released before waiting for the record to be synced. Readers may
+ * therefore see an update before it is durable; if its sync fails, the
+ * table is rebuilt from the records that were synced. Once the log has
+ * doubled in size it is checkpointed into the current content of the
+ * table.
+ */
+
+typedef struct memory_context {
+    struct json_object* config;
+    memory_table        table;
+    wal*                wal;
+    ABT_rwlock          lock;     // ABT_RWLOCK_NULL without a log
+    int                 reloaded; // set once the table was rebuilt from the log
+} memory_context;
+
+static inline void memory_rdlock(memory_context* context)
+{
+    if(context->lock != ABT_RWLOCK_NULL) ABT_rwlock_rdlock(context->lock);
+}
+
+static inline void memory_unlock(memory_context* context)
+{
+    if(context->lock != ABT_RWLOCK_NULL) ABT_rwlock_unlock(context->lock);
+}
+
+static int memory_replay(
+        void* uargs, int type, const char* name, size_t name_size, uint64_t number)
+{
+    memory_table* table = (memory_table*)uargs;
+    uint64_t hash = YP_hash(name, name_size);
+    if(type == WAL_ERASE) {
+        memory_table_erase(table, name, name_size, hash);
+        return 0;
+    }
+    return memory_table_insert(table, name, name_size, hash, number, NULL, NULL) != YP_SUCCESS;
+}
+
+static YP_return_t memory_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        int create,
+        memory_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+        if (!json_object_is_type(config, json_type_object)) {
+            margo_error(provider->mid, "JSON configuration should be an object");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+
+    // "initial_capacity" lets the user pre-size the table
+    size_t capacity = 0;
+    struct json_object* jcapacity = json_object_object_get(config, "initial_capacity");
+    if (jcapacity) {
+        if (!json_object_is_type(jcapacity, json_type_int)
+        ||  json_object_get_int64(jcapacity) < 0) {
+            margo_error(provider->mid,
+                "\"initial_capacity\" should be a positive integer");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+    // "wal" is the path of the write-ahead log, if any
+    struct json_object* jwal = json_object_object_get(config, "wal");
+    if (jwal && !json_object_is_type(jwal, json_type_string)) {
+        margo_error(provider->mid, "\"wal\" should be a string");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+
+    memory_context* ctx = (memory_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    ctx->lock = ABT_RWLOCK_NULL;
+    YP_return_t ret = memory_table_init(&ctx->table, capacity);
+    if (ret != YP_SUCCESS) {
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    if (jwal) {
+        if (ABT_rwlock_create(&ctx->lock) != ABT_SUCCESS) {
+            memory_table_destroy(&ctx->table);
+            json_object_put(config);
+            free(ctx);
+            return YP_ERR_FROM_ARGOBOTS;
+        }
+        ret = wal_open(provider, json_object_get_string(jwal), create,
+                       memory_replay, &ctx->table, &ctx->wal);
+        if (ret != YP_SUCCESS) {
+            ABT_rwlock_free(&ctx->lock);
+            memory_table_destroy(&ctx->table);
+            json_object_put(config);
+            free(ctx);
+            return ret;
+        }
+    }
+    ctx->config = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t memory_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return memory_create_context(provider, config_str, 1, (memory_context**)context);
+}
+
+static YP_return_t memory_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return memory_create_context(provider, config_str, 0, (memory_context**)context);
+}
+
+static void memory_free_context(memory_context* context)
+{
+    if(context->lock != ABT_RWLOCK_NULL)
+        ABT_rwlock_free(&context->lock);
+    memory_table_destroy(&context->table);
+    json_object_put(context->config);
+    free(context);
+}
+
+static YP_return_t memory_close_phonebook(void* ctx)
+{
+    memory_context* context = (memory_context*)ctx;
+    if(context->wal) wal_close(context->wal);
+    memory_free_context(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t memory_destroy_phonebook(void* ctx)
+{
+    memory_context* context = (memory_context*)ctx;
+    if(context->wal) wal_destroy(context->wal);
+    memory_free_context(context);
+    return YP_SUCCESS;
+}
+
+static char* memory_get_config(void* ctx)
+{
+    memory_context* context = (memory_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void memory_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from Memory phonebook\n");
+}
+
+static int32_t memory_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+/* Applies an insertion and appends its record, undoing the insertion
+ * if the record can't be appended. Called with the write lock held. */
+static YP_return_t memory_log_insert(
+        memory_context* context, const char* name, size_t name_size,
+        YP_number_t number, wal_ticket* ticket)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    memory_slot* slot = memory_table_find(&context->table, name, name_size, hash);
+    uint64_t old = slot ? slot->value : 0;
+    int inserted;
+    YP_return_t ret = memory_table_insert(&context->table, name, name_size,
+                                          hash, number, &slot, &inserted);
+    if(ret != YP_SUCCESS) return ret;
+    ret = wal_append(context->wal, WAL_INSERT, name, name_size, number, ticket);
+    if(ret != YP_SUCCESS) {
+        if(inserted) memory_table_erase_slot(&context->table, slot);
+        else slot->value = old;
+    }
+    return ret;
+}
+
+/* Rebuilds the table from the records that were synced, dropping the
+ * updates whose batch failed. The first caller does it, later ones
+ * find the log failed and the table already rebuilt. */
+static void memory_reload(memory_context* context)
+{
+    ABT_rwlock_wrlock(context->lock);
+    if(!context->reloaded) {
+        memory_table table;
+        if(memory_table_init(&table, context->table.size) == YP_SUCCESS) {
+            if(wal_reload(context->wal, memory_replay, &table) == YP_SUCCESS) {
+                memory_table_destroy(&context->table);
+                context->table    = table;
+                context->reloaded = 1;
+            } else {
+                memory_table_destroy(&table);
+            }
+        }
+    }
+    ABT_rwlock_unlock(context->lock);
+}
+
+static int memory_dump(void* uargs, wal_replay_fn fn, void* fn_args)
+{
+    const memory_table* table = (const memory_table*)uargs;
+    for(size_t i = 0; i < table->capacity; i++) {
+        if(!memory_table_slot_is_full(table, i)) continue;
+        const memory_slot* slot = &table->slots[i];
+        if(fn(fn_args, WAL_INSERT, memory_slot_key(slot), slot->key_size, slot->value))
+            return 1;
+    }
+    return 0;
+}
+
+/* Waits for the records to be durable, then rebuilds the table if one
+ * of them couldn't be, or checkpoints the log if it has grown enough */
+static YP_return_t memory_sync(memory_context* context, wal_ticket* tickets, size_t count)
+{
+    YP_return_t ret = YP_SUCCESS;
+    for(size_t i = 0; i < count; i++) {
+        YP_return_t sync_ret = wal_wait(tickets[i]);
+        if(ret == YP_SUCCESS) ret = sync_ret;
+    }
+    if(ret != YP_SUCCESS) {
+        memory_reload(context);
+    } else if(wal_should_checkpoint(context->wal)) {
+        ABT_rwlock_wrlock(context->lock);
+        if(wal_should_checkpoint(context->wal))
+            wal_checkpoint(context->wal, memory_dump, &context->table);
+        ABT_rwlock_unlock(context->lock);
+    }
+    return ret;
+}
+
+static YP_return_t memory_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    memory_context* context = (memory_context*)ctx;
+    if(!context->wal)
+        return memory_table_insert(&context->table, name, name_size,
+                                   YP_hash(name, name_size), number, NULL, NULL);
+    wal_ticket ticket;
+    ABT_rwlock_wrlock(context->lock);
+    YP_return_t ret = memory_log_insert(context, name, name_size, number, &ticket);
+    ABT_rwlock_unlock(context->lock);
+    if(ret != YP_SUCCESS) return ret;
+    return memory_sync(context, &ticket, 1);
+}
+
+static YP_return_t memory_insert_batch(
+        void* ctx, size_t count, const char* const* names,
+        const size_t* name_sizes, const YP_number_t* numbers)
+{
+    memory_context* context = (memory_context*)ctx;
+    YP_return_t ret = YP_SUCCESS;
+    size_t i;
+    if(!context->wal) {
+        ret = memory_table_reserve(&context->table, context->table.size + count);
+        for(i = 0; i < count && ret == YP_SUCCESS; i++)
+            ret = memory_table_insert(&context->table, names[i], name_sizes[i],
+                                      YP_hash(names[i], name_sizes[i]), numbers[i],
+                                      NULL, NULL);
+        return ret;
+    }
+    wal_ticket* tickets = (wal_ticket*)malloc(count*sizeof(*tickets));
+    if(!tickets) return YP_ERR_ALLOCATION;
+    ABT_rwlock_wrlock(context->lock);
+    ret = memory_table_reserve(&context->table, context->table.size + count);
+    for(i = 0; i < count && ret == YP_SUCCESS; i++) {
+        ret = memory_log_insert(context, names[i], name_sizes[i], numbers[i], &tickets[i]);
+        if(ret != YP_SUCCESS) break;
+    }
+    ABT_rwlock_unlock(context->lock);
+    /* the records were appended to few batches, so most waits return
+     * immediately */
+    YP_return_t sync_ret = memory_sync(context, tickets, i);
+    if(ret == YP_SUCCESS) ret = sync_ret;
+    free(tickets);
+    return ret;
+}
+
+static YP_return_t memory_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    memory_context* context = (memory_context*)ctx;
+    YP_return_t ret = YP_SUCCESS;
+    memory_rdlock(context);
+    memory_slot* slot = memory_table_find(&context->table, name, name_size,
+                                          YP_hash(name, name_size));
+    if(slot) *number = slot->value;
+    else ret = YP_ERR_NOT_FOUND;
+    memory_unlock(context);
+    return ret;
+}
+
+static YP_return_t memory_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    memory_context* context = (memory_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    if(!context->wal)
+        return memory_table_erase(&context->table, name, name_size, hash);
+    wal_ticket ticket;
+    YP_return_t ret = YP_ERR_NOT_FOUND;
+    ABT_rwlock_wrlock(context->lock);
+    memory_slot* slot = memory_table_find(&context->table, name, name_size, hash);
+    if(slot) {
+        ret = wal_append(context->wal, WAL_ERASE, name, name_size, 0, &ticket);
+        if(ret == YP_SUCCESS) memory_table_erase_slot(&context->table, slot);
+    }
+    ABT_rwlock_unlock(context->lock);
+    if(ret != YP_SUCCESS) return ret;
+    return memory_sync(context, &ticket, 1);
+}
+
+static YP_return_t memory_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    memory_context* context = (memory_context*)ctx;
+    memory_rdlock(context);
+    const memory_table* table = &context->table;
+    for(size_t i = 0; i < table->capacity; i++) {
+        if(!memory_table_slot_is_full(table, i)) continue;
+        const memory_slot* slot = &table->slots[i];
+        if(fn(uargs, memory_slot_key(slot), slot->key_size, slot->value))
+            break;
+    }
+    memory_unlock(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t memory_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    memory_context* context = (memory_context*)ctx;
+    memory_rdlock(context);
+    const memory_table* table = &context->table;
+    uint64_t i;
+    YP_return_t ret = scan_slot_resume(*position, table->rehashes, &i);
+    if(ret != YP_SUCCESS) goto finish;
+    for(; i < table->capacity; i++) {
+        if(!memory_table_slot_is_full(table, i)) continue;
+        const memory_slot* slot = &table->slots[i];
+        if(fn(uargs, memory_slot_key(slot), slot->key_size, slot->value))
+            break;
+    }
+    *position = i < table->capacity ? scan_slot_position(table->rehashes, i) : UINT64_MAX;
+finish:
+    memory_unlock(context);
+    return ret;
+}
+
+static YP_backend_impl memory_backend = {
+    .name             = "memory",
+
+    .create_phonebook  = memory_create_phonebook,
+    .open_phonebook    = memory_open_phonebook,
+    .close_phonebook   = memory_close_phonebook,
+    .destroy_phonebook = memory_destroy_phonebook,
+    .get_config       = memory_get_config,
+
+    .hello            = memory_say_hello,
+    .sum              = memory_compute_sum,
+    .insert           = memory_insert,
+    .lookup           = memory_lookup,
+    .erase            = memory_erase,
+    .iterate          = memory_iterate,
+    .insert_batch     = memory_insert_batch,
+    .scan             = memory_scan
+};
+
+YP_return_t YP_provider_register_memory_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &memory_backend);
+}
@@ -0,0 +1,213 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "memory-table.h"
+#include "../hash.h"
+#include "../swiss-group.h"
+
+static inline int slot_key_equals(
+        const memory_slot* slot, const char* key, size_t key_size)
+{
+    if(slot->key_size != key_size) return 0;
+    if(key_size <= MEMORY_TABLE_INLINE_KEY)
+        return memcmp(slot->key.inline_key, key, key_size) == 0;
+    return memcmp(slot->key.ext.prefix, key, 8) == 0
+        && memcmp(slot->key.ext.data + 8, key + 8, key_size - 8) == 0;
+}
+
+static YP_return_t allocate(memory_table* table, size_t capacity)
+{
+    table->ctrl  = (uint8_t*)malloc(capacity + SWISS_MIN_CAPACITY);
+    table->slots = (memory_slot*)malloc(capacity * sizeof(memory_slot));
+    if(!table->ctrl || !table->slots) {
+        free(table->ctrl);
+        free(table->slots);
+        return YP_ERR_ALLOCATION;
+    }
+    memset(table->ctrl, SWISS_CTRL_EMPTY, capacity + SWISS_MIN_CAPACITY);
+    table->capacity    = capacity;
+    table->size        = 0;
+    table->growth_left = swiss_max_growth(capacity);
+    return YP_SUCCESS;
+}
+
+/* Moves every entry into freshly allocated arrays of the given capacity,
+ * dropping tombstones. */
+static YP_return_t resize(memory_table* table, size_t capacity)
+{
+    memory_table old = *table;
+    YP_return_t ret = allocate(table, capacity);
+    if(ret != YP_SUCCESS) {
+        *table = old;
+        return ret;
+    }
+    for(size_t i = 0; i < old.capacity; i++) {
+        if(!memory_table_slot_is_full(&old, i)) continue;
+        memory_slot slot = old.slots[i];
+        /* the full hash is not kept, recompute it from the name */
+        uint64_t hash = YP_hash(memory_slot_key(&slot), slot.key_size);
+        size_t j = swiss_find_first_non_full(table->ctrl, table->capacity, hash);
+        swiss_set_ctrl(table->ctrl, capacity, j, old.ctrl[i]);
+        table->slots[j] = slot;
+    }
+    table->size        = old.size;
+    table->growth_left = swiss_max_growth(capacity) - old.size;
+    table->rehashes   += 1;
+    free(old.ctrl);
+    free(old.slots);
+    return YP_SUCCESS;
+}
+
+/* Moves the names in use to a new arena. They are copied into a single
+ * allocation, so that the table is left untouched if it fails. */
+static void compact_keys(memory_table* table)
+{
+    arena keys;
+    arena_init(&keys, table->keys.chunk_size);
+    char* dst = (char*)arena_alloc(&keys, table->keys.live, 1);
+    if(!dst) return;
+    for(size_t i = 0; i < table->capacity; i++) {
+        if(!memory_table_slot_is_full(table, i)) continue;
+        memory_slot* slot = &table->slots[i];
+        if(slot->key_size <= MEMORY_TABLE_INLINE_KEY) continue;
+        memcpy(dst, slot->key.ext.data, slot->key_size);
+        slot->key.ext.data = dst;
+        dst += slot->key_size;
+    }
+    arena_destroy(&table->keys);
+    table->keys = keys;
+}
+
+YP_return_t memory_table_init(memory_table* table, size_t capacity)
+{
+    memset(table, 0, sizeof(*table));
+    arena_init(&table->keys, ARENA_DEFAULT_CHUNK_SIZE);
+    return allocate(table, swiss_capacity_for(capacity));
+}
+
+void memory_table_destroy(memory_table* table)
+{
+    arena_destroy(&table->keys);
+    free(table->ctrl);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+YP_return_t memory_table_reserve(memory_table* table, size_t count)
+{
+    if(count <= table->size + table->growth_left)
+        return YP_SUCCESS;
+    return resize(table, swiss_capacity_for(count));
+}
+
+memory_slot* memory_table_find(
+        const memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash)
+{
+    size_t  mask = table->capacity - 1;
+    size_t  pos  = SWISS_H1(hash) & mask;
+    size_t  step = 0;
+    uint8_t h2   = SWISS_H2(hash);
+    while(1) {
+        swiss_group_t g = swiss_group_load(table->ctrl + pos);
+        swiss_mask_t  m = swiss_group_match(g, h2);
+        while(m) {
+            memory_slot* slot = &table->slots[(pos + swiss_mask_trailing(m)) & mask];
+            if(slot_key_equals(slot, key, key_size))
+                return slot;
+            m &= m - 1;
+        }
+        if(swiss_group_match_empty(g))
+            return NULL;
+        step += SWISS_GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+YP_return_t memory_table_insert(
+        memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash,
+        uint64_t value,
+        memory_slot** slot,
+        int* inserted)
+{
+    if(key_size > UINT32_MAX)
+        return YP_ERR_INVALID_ARGS;
+
+    memory_slot* existing = memory_table_find(table, key, key_size, hash);
+    if(existing) {
+        existing->value = value;
+        if(slot) *slot = existing;
+        if(inserted) *inserted = 0;
+        return YP_SUCCESS;
+    }
+
+    size_t i = swiss_find_first_non_full(table->ctrl, table->capacity, hash);
+    if(table->growth_left == 0 && table->ctrl[i] != SWISS_CTRL_DELETED) {
+        /* grow if the table is really full, otherwise just get rid
+         * of the tombstones */
+        size_t capacity = table->capacity;
+        if(table->size > swiss_max_growth(capacity) / 2)
+            capacity *= 2;
+        YP_return_t ret = resize(table, capacity);
+        if(ret != YP_SUCCESS) return ret;
+        i = swiss_find_first_non_full(table->ctrl, table->capacity, hash);
+    }
+
+    memory_slot* s = &table->slots[i];
+    if(key_size <= MEMORY_TABLE_INLINE_KEY) {
+        memcpy(s->key.inline_key, key, key_size);
+    } else {
+        if(arena_should_compact(&table->keys))
+            compact_keys(table);
+        char* data = arena_copy(&table->keys, key, key_size);
+        if(!data) return YP_ERR_ALLOCATION;
+        memcpy(s->key.ext.prefix, key, 8);
+        s->key.ext.data = data;
+    }
+    s->key_size = (uint32_t)key_size;
+    s->value    = value;
+    s->meta     = 0;
+
+    if(table->ctrl[i] == SWISS_CTRL_EMPTY)
+        table->growth_left -= 1;
+    swiss_set_ctrl(table->ctrl, table->capacity, i, SWISS_H2(hash));
+    table->size += 1;
+
+    if(slot) *slot = s;
+    if(inserted) *inserted = 1;
+    return YP_SUCCESS;
+}
+
+void memory_table_erase_slot(memory_table* table, memory_slot* slot)
+{
+    size_t i = (size_t)(slot - table->slots);
+
+    if(slot->key_size > MEMORY_TABLE_INLINE_KEY)
+        arena_release(&table->keys, slot->key_size);
+
+    uint8_t h = swiss_erased_ctrl(table->ctrl, table->capacity, i);
+    swiss_set_ctrl(table->ctrl, table->capacity, i, h);
+    if(h == SWISS_CTRL_EMPTY) table->growth_left += 1;
+    table->size -= 1;
+}
+
+YP_return_t memory_table_erase(
+        memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash)
+{
+    memory_slot* slot = memory_table_find(table, key, key_size, hash);
+    if(!slot) return YP_ERR_NOT_FOUND;
+    memory_table_erase_slot(table, slot);
+    return YP_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _MEMORY_TABLE_H
+#define _MEMORY_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "../arena.h"
+
+/*
+ * Open-addressing hash table mapping names to 64-bit values, laid out
+ * like a Swiss table: one control byte per slot holds 7 bits of the
+ * hash (or an EMPTY/DELETED marker), and lookups compare a whole group
+ * of control bytes at once (SSE2 when available, SWAR otherwise) before
+ * touching any slot. Names of up to MEMORY_TABLE_INLINE_KEY bytes are
+ * stored inside the slot; longer names go to an arena owned by the
+ * table, so no entry ever needs its own malloc.
+ */
+
+#define MEMORY_TABLE_INLINE_KEY 16
+
+typedef struct memory_slot {
+    uint64_t value;     // value associated with the name
+    uint32_t key_size;  // size of the name
+    uint32_t meta;      // free for use by the owner of the table
+    union {
+        char inline_key[MEMORY_TABLE_INLINE_KEY];
+        struct {
+            char  prefix[8]; // first bytes of the name
+            char* data;      // full name, in the arena
+        } ext;
+    } key;
+} memory_slot;
+
+typedef struct memory_table {
+    uint8_t*          ctrl;           // capacity + SWISS_MIN_CAPACITY control bytes
+    memory_slot*      slots;          // capacity slots
+    size_t            capacity;       // always a power of 2
+    size_t            size;           // number of entries
+    size_t            growth_left;    // inserts left before a rehash
+    uint64_t          rehashes;       // times the entries were moved
+    arena             keys;           // names that are not inlined
+} memory_table;
+
+YP_return_t memory_table_init(memory_table* table, size_t capacity);
+
+void memory_table_destroy(memory_table* table);
+
+/**
+ * @brief Makes sure count entries can be held without rehashing.
+ */
+YP_return_t memory_table_reserve(memory_table* table, size_t count);
+
+/**
+ * @brief Returns the slot holding the name, or NULL. The hash must be
+ * YP_hash(key, key_size).
+ */
+memory_slot* memory_table_find(
+        const memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash);
+
+/**
+ * @brief Inserts or updates the value associated with a name. If slot
+ * is not NULL, it is set to the slot holding the entry and inserted
+ * is set to 1 if the entry did not exist before.
+ */
+YP_return_t memory_table_insert(
+        memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash,
+        uint64_t value,
+        memory_slot** slot,
+        int* inserted);
+
+YP_return_t memory_table_erase(
+        memory_table* table,
+        const char* key,
+        size_t key_size,
+        uint64_t hash);
+
+void memory_table_erase_slot(memory_table* table, memory_slot* slot);
+
+static inline const char* memory_slot_key(const memory_slot* slot)
+{
+    return slot->key_size <= MEMORY_TABLE_INLINE_KEY ?
+        slot->key.inline_key : slot->key.ext.data;
+}
+
+static inline int memory_table_slot_is_full(const memory_table* table, size_t i)
+{
+    return !(table->ctrl[i] & 0x80);
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../scan.h"
+#include "mmap-backend.h"
+#include "mmap-store.h"
+
+typedef struct mmap_context {
+    struct json_object* config;
+    mmap_store          store;
+} mmap_context;
+
+static YP_return_t mmap_parse_config(
+        YP_provider_t provider,
+        const char* config_str,
+        struct json_object** config)
+{
+    // read JSON config from provided string argument
+    if (!config_str) {
+        margo_error(provider->mid, "mmap backend requires a configuration");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    *config = json_tokener_parse_ex(
+            tokener, config_str,
+            strlen(config_str));
+    if (!*config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+    if (!json_object_is_type(*config, json_type_object)) {
+        margo_error(provider->mid, "JSON configuration should be an object");
+        json_object_put(*config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "path" is the directory in which the files of the phonebook live
+    struct json_object* jpath = json_object_object_get(*config, "path");
+    if (!jpath || !json_object_is_type(jpath, json_type_string)) {
+        margo_error(provider->mid, "\"path\" should be a string");
+        json_object_put(*config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t mmap_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    struct json_object* config = NULL;
+    YP_return_t ret = mmap_parse_config(provider, config_str, &config);
+    if (ret != YP_SUCCESS) return ret;
+
+    size_t capacity = 0;
+    struct json_object* jcapacity = json_object_object_get(config, "initial_capacity");
+    if (jcapacity) {
+        if (!json_object_is_type(jcapacity, json_type_int)
+        ||  json_object_get_int64(jcapacity) < 0) {
+            margo_error(provider->mid,
+                "\"initial_capacity\" should be a positive integer");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+
+    mmap_context* ctx = (mmap_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    const char* path = json_object_get_string(json_object_object_get(config, "path"));
+    ret = mmap_store_create(&ctx->store, path, capacity);
+    if (ret != YP_SUCCESS) {
+        margo_error(provider->mid,
+            "Could not create mmap phonebook in %s (it may already exist)", path);
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    ctx->config = config;
+    *context = (void*)ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t mmap_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    struct json_object* config = NULL;
+    YP_return_t ret = mmap_parse_config(provider, config_str, &config);
+    if (ret != YP_SUCCESS) return ret;
+
+    mmap_context* ctx = (mmap_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    const char* path = json_object_get_string(json_object_object_get(config, "path"));
+    ret = mmap_store_open(&ctx->store, path);
+    if (ret != YP_SUCCESS) {
+        margo_error(provider->mid, "Could not open mmap phonebook in %s", path);
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    ctx->config = config;
+    *context = (void*)ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t mmap_close_phonebook(void* ctx)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    YP_return_t ret = mmap_store_close(&context->store);
+    json_object_put(context->config);
+    free(context);
+    return ret;
+}
+
+static YP_return_t mmap_destroy_phonebook(void* ctx)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    YP_return_t ret = mmap_store_destroy(&context->store);
+    json_object_put(context->config);
+    free(context);
+    return ret;
+}
+
+static char* mmap_get_config(void* ctx)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void mmap_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from Mmap phonebook\n");
+}
+
+static int32_t mmap_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t mmap_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    return mmap_store_insert(&context->store, name, name_size,
+                             YP_hash(name, name_size), number);
+}
+
+static YP_return_t mmap_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    mmap_slot* slot = mmap_store_find(&context->store, name, name_size,
+                                      YP_hash(name, name_size));
+    if(!slot) return YP_ERR_NOT_FOUND;
+    *number = slot->value;
+    return YP_SUCCESS;
+}
+
+static YP_return_t mmap_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    return mmap_store_erase(&context->store, name, name_size,
+                            YP_hash(name, name_size));
+}
+
+static YP_return_t mmap_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    const mmap_store* store = &context->store;
+    for(size_t i = 0; i < store->header->capacity; i++) {
+        if(!mmap_store_slot_is_full(store, i)) continue;
+        const mmap_slot* slot = &store->slots[i];
+        const char* name = mmap_slot_key(store, slot);
+        if(!name) continue;
+        if(fn(uargs, name, slot->key_size, slot->value))
+            break;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t mmap_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    mmap_context* context = (mmap_context*)ctx;
+    const mmap_store* store = &context->store;
+    uint64_t i;
+    YP_return_t ret = scan_slot_resume(*position, store->rehashes, &i);
+    if(ret != YP_SUCCESS) return ret;
+    for(; i < store->header->capacity; i++) {
+        if(!mmap_store_slot_is_full(store, i)) continue;
+        const mmap_slot* slot = &store->slots[i];
+        const char* name = mmap_slot_key(store, slot);
+        if(!name) continue;
+        if(fn(uargs, name, slot->key_size, slot->value)) {
+            *position = scan_slot_position(store->rehashes, i);
+            return YP_SUCCESS;
+        }
+    }
+    *position = UINT64_MAX;
+    return YP_SUCCESS;
+}
+
+static YP_backend_impl mmap_backend = {
+    .name             = "mmap",
+
+    .create_phonebook  = mmap_create_phonebook,
+    .open_phonebook    = mmap_open_phonebook,
+    .close_phonebook   = mmap_close_phonebook,
+    .destroy_phonebook = mmap_destroy_phonebook,
+    .get_config       = mmap_get_config,
+
+    .hello            = mmap_say_hello,
+    .sum              = mmap_compute_sum,
+    .insert           = mmap_insert,
+    .lookup           = mmap_lookup,
+    .erase            = mmap_erase,
+    .iterate          = mmap_iterate,
+    .scan             = mmap_scan
+};
+
+YP_return_t YP_provider_register_mmap_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &mmap_backend);
+}
@@ -0,0 +1,477 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap-store.h"
+#include "../hash.h"
+#include "../swiss-group.h"
+
+#define MMAP_STORE_MAGIC      "YPMMAP\0"
+#define MMAP_STORE_VERSION    1
+#define MMAP_STORE_BYTE_ORDER 0x0102030405060708ull
+
+#define NAMES_MIN_SIZE (64*1024)
+
+_Static_assert(sizeof(mmap_header) == 128, "unexpected mmap_header size");
+_Static_assert(sizeof(mmap_slot) == 32, "unexpected mmap_slot size");
+
+static inline size_t ctrl_offset(void)
+{
+    return sizeof(mmap_header);
+}
+
+static inline size_t slots_offset(size_t capacity)
+{
+    size_t end_of_ctrl = ctrl_offset() + capacity + SWISS_MIN_CAPACITY;
+    return (end_of_ctrl + 63) & ~(size_t)63;
+}
+
+static inline size_t index_file_size(size_t capacity)
+{
+    return slots_offset(capacity) + capacity * sizeof(mmap_slot);
+}
+
+static void make_path(char* out, size_t size, const char* dir, const char* name)
+{
+    snprintf(out, size, "%s/%s", dir, name);
+}
+
+static void make_names_path(char* out, size_t size, const char* dir, uint64_t generation)
+{
+    snprintf(out, size, "%s/names.%llu", dir, (unsigned long long)generation);
+}
+
+static void set_index_pointers(mmap_store* store)
+{
+    char* base    = (char*)store->header;
+    store->ctrl  = (uint8_t*)(base + ctrl_offset());
+    store->slots = (mmap_slot*)(base + slots_offset(store->header->capacity));
+}
+
+/* Creates (truncating) and maps an index file able to hold capacity slots. */
+static YP_return_t create_index_file(
+        const char* path, size_t capacity,
+        int* fd, mmap_header** header, size_t* map_size)
+{
+    size_t size = index_file_size(capacity);
+    int f = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(f < 0) return YP_ERR_IO;
+    if(ftruncate(f, (off_t)size) != 0) {
+        close(f);
+        unlink(path);
+        return YP_ERR_IO;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if(map == MAP_FAILED) {
+        close(f);
+        unlink(path);
+        return YP_ERR_IO;
+    }
+    mmap_header* h = (mmap_header*)map;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, MMAP_STORE_MAGIC, sizeof(h->magic));
+    h->version      = MMAP_STORE_VERSION;
+    h->hash_version = YP_HASH_VERSION;
+    h->byte_order   = MMAP_STORE_BYTE_ORDER;
+    h->capacity     = capacity;
+    h->growth_left  = swiss_max_growth(capacity);
+    memset((char*)map + ctrl_offset(), SWISS_CTRL_EMPTY, capacity + SWISS_MIN_CAPACITY);
+    *fd       = f;
+    *header   = h;
+    *map_size = size;
+    return YP_SUCCESS;
+}
+
+/* Creates (truncating) and maps a names file of at least min_size bytes. */
+static YP_return_t create_names_file(
+        const char* path, size_t min_size,
+        int* fd, char** names, size_t* map_size)
+{
+    size_t size = NAMES_MIN_SIZE;
+    while(size < min_size) size *= 2;
+    int f = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(f < 0) return YP_ERR_IO;
+    if(ftruncate(f, (off_t)size) != 0) {
+        close(f);
+        unlink(path);
+        return YP_ERR_IO;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if(map == MAP_FAILED) {
+        close(f);
+        unlink(path);
+        return YP_ERR_IO;
+    }
+    *fd       = f;
+    *names    = (char*)map;
+    *map_size = size;
+    return YP_SUCCESS;
+}
+
+/* Appends a name to the names file, growing it if needed. */
+static YP_return_t append_name(
+        mmap_store* store, const char* key, size_t key_size, uint64_t* offset)
+{
+    size_t needed = store->header->names_size + key_size;
+    if(needed > store->names_map_size) {
+        size_t size = store->names_map_size;
+        while(size < needed) size *= 2;
+        if(ftruncate(store->names_fd, (off_t)size) != 0)
+            return YP_ERR_IO;
+        void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->names_fd, 0);
+        if(map == MAP_FAILED)
+            return YP_ERR_IO;
+        munmap(store->names, store->names_map_size);
+        store->names          = (char*)map;
+        store->names_map_size = size;
+    }
+    *offset = store->header->names_size;
+    memcpy(store->names + *offset, key, key_size);
+    store->header->names_size += key_size;
+    return YP_SUCCESS;
+}
+
+static inline int slot_key_equals(
+        const mmap_store* store, const mmap_slot* slot,
+        const char* key, size_t key_size)
+{
+    if(slot->key_size != key_size) return 0;
+    if(key_size <= MMAP_STORE_INLINE_KEY)
+        return memcmp(slot->key.inline_key, key, key_size) == 0;
+    if(memcmp(slot->key.ext.prefix, key, 8) != 0) return 0;
+    const char* name = mmap_slot_key(store, slot);
+    return name && memcmp(name + 8, key + 8, key_size - 8) == 0;
+}
+
+/* Rebuilds the index with the given capacity into a new file, dropping
+ * tombstones, and renames it over the current one. The names are moved
+ * to a new generation of the names file if more than half of them are
+ * dead. */
+static YP_return_t resize(mmap_store* store, size_t capacity)
+{
+    char index_path[1024], tmp_path[1024], names_path[1024];
+    make_path(index_path, sizeof(index_path), store->path, "index");
+    make_path(tmp_path, sizeof(tmp_path), store->path, "index.new");
+
+    int          fd;
+    mmap_header* header;
+    size_t       map_size;
+    YP_return_t  ret = create_index_file(tmp_path, capacity, &fd, &header, &map_size);
+    if(ret != YP_SUCCESS) return ret;
+
+    mmap_header* old = store->header;
+    int compact = old->names_dead > old->names_size / 2;
+    int    names_fd = store->names_fd;
+    char*  names = store->names;
+    size_t names_map_size = store->names_map_size;
+    size_t names_size = old->names_size;
+    uint64_t generation = old->names_generation;
+    if(compact) {
+        generation += 1;
+        names_size = 0;
+        make_names_path(names_path, sizeof(names_path), store->path, generation);
+        ret = create_names_file(names_path, old->names_size - old->names_dead,
+                                &names_fd, &names, &names_map_size);
+        if(ret != YP_SUCCESS) goto error;
+    }
+
+    /* the entries are counted rather than trusted from the old header,
+     * which may be off after a crash in the middle of an update; slots
+     * whose name was lost are dropped */
+    uint8_t*   ctrl  = (uint8_t*)((char*)header + ctrl_offset());
+    mmap_slot* slots = (mmap_slot*)((char*)header + slots_offset(capacity));
+    uint64_t   count = 0;
+    for(size_t i = 0; i < old->capacity; i++) {
+        if(!mmap_store_slot_is_full(store, i)) continue;
+        mmap_slot   slot = store->slots[i];
+        const char* key  = mmap_slot_key(store, &slot);
+        if(!key) continue;
+        if(compact && slot.key_size > MMAP_STORE_INLINE_KEY) {
+            memcpy(names + names_size, key, slot.key_size);
+            slot.key.ext.offset = names_size;
+            names_size += slot.key_size;
+        }
+        uint64_t hash = YP_hash(key, slot.key_size);
+        size_t j = swiss_find_first_non_full(ctrl, capacity, hash);
+        swiss_set_ctrl(ctrl, capacity, j, store->ctrl[i]);
+        slots[j] = slot;
+        count += 1;
+    }
+    header->size             = count;
+    header->growth_left      = swiss_max_growth(capacity) - count;
+    header->names_generation = generation;
+    header->names_size       = names_size;
+    header->names_dead       = compact ? 0 : old->names_dead;
+
+    if(compact && msync(names, names_map_size, MS_SYNC) != 0) {
+        ret = YP_ERR_IO;
+        goto error;
+    }
+    if(msync(header, map_size, MS_SYNC) != 0
+    || rename(tmp_path, index_path) != 0) {
+        ret = YP_ERR_IO;
+        goto error;
+    }
+
+    munmap(store->header, store->index_map_size);
+    close(store->index_fd);
+    store->index_fd       = fd;
+    store->header         = header;
+    store->index_map_size = map_size;
+    store->rehashes      += 1;
+    set_index_pointers(store);
+    if(compact) {
+        munmap(store->names, store->names_map_size);
+        close(store->names_fd);
+        make_names_path(names_path, sizeof(names_path), store->path, generation - 1);
+        unlink(names_path);
+        store->names_fd       = names_fd;
+        store->names          = names;
+        store->names_map_size = names_map_size;
+    }
+    return YP_SUCCESS;
+
+error:
+    if(compact && names != store->names) {
+        munmap(names, names_map_size);
+        close(names_fd);
+        make_names_path(names_path, sizeof(names_path), store->path, generation);
+        unlink(names_path);
+    }
+    munmap(header, map_size);
+    close(fd);
+    unlink(tmp_path);
+    return ret;
+}
+
+YP_return_t mmap_store_create(mmap_store* store, const char* path, size_t capacity)
+{
+    char index_path[1024], names_path[1024];
+    YP_return_t ret;
+
+    memset(store, 0, sizeof(*store));
+    store->index_fd = store->names_fd = -1;
+
+    if(mkdir(path, 0755) != 0 && errno != EEXIST)
+        return YP_ERR_IO;
+    make_path(index_path, sizeof(index_path), path, "index");
+    if(access(index_path, F_OK) == 0)
+        return YP_ERR_INVALID_CONFIG;
+
+    store->path = strdup(path);
+    make_names_path(names_path, sizeof(names_path), path, 0);
+    ret = create_names_file(names_path, 0,
+            &store->names_fd, &store->names, &store->names_map_size);
+    if(ret != YP_SUCCESS) goto error;
+
+    ret = create_index_file(index_path, swiss_capacity_for(capacity),
+            &store->index_fd, &store->header, &store->index_map_size);
+    if(ret != YP_SUCCESS) {
+        munmap(store->names, store->names_map_size);
+        close(store->names_fd);
+        unlink(names_path);
+        goto error;
+    }
+    set_index_pointers(store);
+    return YP_SUCCESS;
+
+error:
+    free(store->path);
+    store->path = NULL;
+    return ret;
+}
+
+YP_return_t mmap_store_open(mmap_store* store, const char* path)
+{
+    char index_path[1024], names_path[1024];
+    struct stat st;
+    YP_return_t ret = YP_ERR_IO;
+
+    memset(store, 0, sizeof(*store));
+    store->index_fd = store->names_fd = -1;
+
+    make_path(index_path, sizeof(index_path), path, "index");
+    store->index_fd = open(index_path, O_RDWR);
+    if(store->index_fd < 0) return YP_ERR_IO;
+    if(fstat(store->index_fd, &st) != 0 || (size_t)st.st_size < sizeof(mmap_header))
+        goto error;
+    store->index_map_size = (size_t)st.st_size;
+    void* map = mmap(NULL, store->index_map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, store->index_fd, 0);
+    if(map == MAP_FAILED) goto error;
+    store->header = (mmap_header*)map;
+
+    /* make sure the file was written by a compatible version */
+    mmap_header* h = store->header;
+    if(memcmp(h->magic, MMAP_STORE_MAGIC, sizeof(h->magic)) != 0
+    || h->version != MMAP_STORE_VERSION
+    || h->hash_version != YP_HASH_VERSION
+    || h->byte_order != MMAP_STORE_BYTE_ORDER
+    || h->capacity < SWISS_MIN_CAPACITY
+    || (h->capacity & (h->capacity - 1)) != 0
+    || index_file_size(h->capacity) > store->index_map_size) {
+        ret = YP_ERR_INVALID_CONFIG;
+        goto error;
+    }
+    set_index_pointers(store);
+
+    make_names_path(names_path, sizeof(names_path), path, h->names_generation);
+    store->names_fd = open(names_path, O_RDWR);
+    if(store->names_fd < 0) goto error;
+    if(fstat(store->names_fd, &st) != 0 || (size_t)st.st_size < h->names_size
+    || st.st_size == 0)
+        goto error;
+    store->names_map_size = (size_t)st.st_size;
+    map = mmap(NULL, store->names_map_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED, store->names_fd, 0);
+    if(map == MAP_FAILED) goto error;
+    store->names = (char*)map;
+
+    store->path = strdup(path);
+    return YP_SUCCESS;
+
+error:
+    if(store->names) munmap(store->names, store->names_map_size);
+    if(store->header) munmap(store->header, store->index_map_size);
+    if(store->index_fd >= 0) close(store->index_fd);
+    if(store->names_fd >= 0) close(store->names_fd);
+    memset(store, 0, sizeof(*store));
+    return ret;
+}
+
+YP_return_t mmap_store_close(mmap_store* store)
+{
+    YP_return_t ret = YP_SUCCESS;
+    if(msync(store->names, store->names_map_size, MS_SYNC) != 0
+    || msync(store->header, store->index_map_size, MS_SYNC) != 0)
+        ret = YP_ERR_IO;
+    munmap(store->names, store->names_map_size);
+    munmap(store->header, store->index_map_size);
+    close(store->names_fd);
+    close(store->index_fd);
+    free(store->path);
+    memset(store, 0, sizeof(*store));
+    return ret;
+}
+
+YP_return_t mmap_store_destroy(mmap_store* store)
+{
+    char index_path[1024], names_path[1024];
+    make_path(index_path, sizeof(index_path), store->path, "index");
+    make_names_path(names_path, sizeof(names_path), store->path,
+                    store->header->names_generation);
+    munmap(store->names, store->names_map_size);
+    munmap(store->header, store->index_map_size);
+    close(store->names_fd);
+    close(store->index_fd);
+    YP_return_t ret = YP_SUCCESS;
+    if(unlink(index_path) != 0 || unlink(names_path) != 0)
+        ret = YP_ERR_IO;
+    rmdir(store->path); // only succeeds if nothing else lives there
+    free(store->path);
+    memset(store, 0, sizeof(*store));
+    return ret;
+}
+
+mmap_slot* mmap_store_find(
+        const mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash)
+{
+    size_t  mask = store->header->capacity - 1;
+    size_t  pos  = SWISS_H1(hash) & mask;
+    size_t  step = 0;
+    uint8_t h2   = SWISS_H2(hash);
+    while(1) {
+        swiss_group_t g = swiss_group_load(store->ctrl + pos);
+        swiss_mask_t  m = swiss_group_match(g, h2);
+        while(m) {
+            mmap_slot* slot = &store->slots[(pos + swiss_mask_trailing(m)) & mask];
+            if(slot_key_equals(store, slot, key, key_size))
+                return slot;
+            m &= m - 1;
+        }
+        if(swiss_group_match_empty(g))
+            return NULL;
+        step += SWISS_GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+YP_return_t mmap_store_insert(
+        mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash,
+        uint64_t value)
+{
+    if(key_size > UINT32_MAX)
+        return YP_ERR_INVALID_ARGS;
+
+    mmap_slot* existing = mmap_store_find(store, key, key_size, hash);
+    if(existing) {
+        existing->value = value;
+        return YP_SUCCESS;
+    }
+
+    mmap_header* header = store->header;
+    size_t i = swiss_find_first_non_full(store->ctrl, header->capacity, hash);
+    if(header->growth_left == 0 && store->ctrl[i] != SWISS_CTRL_DELETED) {
+        size_t capacity = header->capacity;
+        if(header->size > swiss_max_growth(capacity) / 2)
+            capacity *= 2;
+        YP_return_t ret = resize(store, capacity);
+        if(ret != YP_SUCCESS) return ret;
+        header = store->header;
+        i = swiss_find_first_non_full(store->ctrl, header->capacity, hash);
+    }
+
+    mmap_slot slot;
+    memset(&slot, 0, sizeof(slot));
+    if(key_size <= MMAP_STORE_INLINE_KEY) {
+        memcpy(slot.key.inline_key, key, key_size);
+    } else {
+        YP_return_t ret = append_name(store, key, key_size, &slot.key.ext.offset);
+        if(ret != YP_SUCCESS) return ret;
+        memcpy(slot.key.ext.prefix, key, 8);
+    }
+    slot.key_size = (uint32_t)key_size;
+    slot.value    = value;
+    store->slots[i] = slot;
+
+    if(store->ctrl[i] == SWISS_CTRL_EMPTY)
+        header->growth_left -= 1;
+    swiss_set_ctrl(store->ctrl, header->capacity, i, SWISS_H2(hash));
+    header->size += 1;
+    return YP_SUCCESS;
+}
+
+YP_return_t mmap_store_erase(
+        mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash)
+{
+    mmap_slot* slot = mmap_store_find(store, key, key_size, hash);
+    if(!slot) return YP_ERR_NOT_FOUND;
+
+    mmap_header* header = store->header;
+    size_t i = (size_t)(slot - store->slots);
+    if(slot->key_size > MMAP_STORE_INLINE_KEY)
+        header->names_dead += slot->key_size;
+    uint8_t h = swiss_erased_ctrl(store->ctrl, header->capacity, i);
+    swiss_set_ctrl(store->ctrl, header->capacity, i, h);
+    if(h == SWISS_CTRL_EMPTY) header->growth_left += 1;
+    if(header->size) header->size -= 1;
+    return YP_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _MMAP_STORE_H
+#define _MMAP_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+
+/*
+ * File-backed name->number table whose on-disk layout is the table
+ * itself, so opening it is just a couple of mmap calls and pages are
+ * faulted in lazily by lookups. A store is a directory holding:
+ *
+ * - "index": a header, followed by the control bytes and the slots of
+ *   a Swiss table (see swiss-group.h);
+ * - "names.<generation>": the names that do not fit in a slot,
+ *   appended one after the other and referenced by offset.
+ *
+ * Growing the table (or compacting the names) writes a new index file
+ * and atomically renames it over the old one. The files are synced
+ * when the store is closed.
+ */
+
+#define MMAP_STORE_INLINE_KEY 16
+
+typedef struct mmap_header {
+    char     magic[8];         // MMAP_STORE_MAGIC
+    uint32_t version;          // MMAP_STORE_VERSION
+    uint32_t hash_version;     // YP_HASH_VERSION used to build the index
+    uint64_t byte_order;       // MMAP_STORE_BYTE_ORDER, as written
+    uint64_t capacity;         // number of slots (power of 2)
+    uint64_t size;             // number of entries
+    uint64_t growth_left;      // inserts left before a rehash
+    uint64_t names_generation; // suffix of the names file
+    uint64_t names_size;       // bytes used in the names file
+    uint64_t names_dead;       // bytes left by erased names
+    uint8_t  reserved[56];
+} mmap_header;
+
+typedef struct mmap_slot {
+    uint64_t value;
+    uint32_t key_size;
+    uint32_t reserved;
+    union {
+        char inline_key[MMAP_STORE_INLINE_KEY];
+        struct {
+            char     prefix[8];
+            uint64_t offset; // offset of the full name in the names file
+        } ext;
+    } key;
+} mmap_slot;
+
+typedef struct mmap_store {
+    char*        path;            // directory of the store
+    int          index_fd;
+    size_t       index_map_size;
+    mmap_header* header;          // start of the mapped index file
+    uint8_t*     ctrl;
+    mmap_slot*   slots;
+    int          names_fd;
+    size_t       names_map_size;  // mapped (physical) size of the names file
+    char*        names;
+    uint64_t     rehashes;        // times the slots were moved since opened
+} mmap_store;
+
+/**
+ * @brief Creates a new store in the given directory (created if needed).
+ * Fails if the directory already holds a store.
+ */
+YP_return_t mmap_store_create(mmap_store* store, const char* path, size_t capacity);
+
+/**
+ * @brief Opens an existing store. Returns YP_ERR_INVALID_CONFIG if its
+ * header doesn't match this version. Slots are not validated here: see
+ * mmap_slot_key.
+ */
+YP_return_t mmap_store_open(mmap_store* store, const char* path);
+
+/**
+ * @brief Syncs and unmaps the store.
+ */
+YP_return_t mmap_store_close(mmap_store* store);
+
+/**
+ * @brief Unmaps the store and removes its files.
+ */
+YP_return_t mmap_store_destroy(mmap_store* store);
+
+mmap_slot* mmap_store_find(
+        const mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash);
+
+YP_return_t mmap_store_insert(
+        mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash,
+        uint64_t value);
+
+YP_return_t mmap_store_erase(
+        mmap_store* store,
+        const char* key,
+        size_t key_size,
+        uint64_t hash);
+
+/**
+ * @brief Returns the name of a full slot, or NULL if it lies past the
+ * used part of the names file (the store was truncated or corrupted).
+ */
+static inline const char* mmap_slot_key(const mmap_store* store, const mmap_slot* slot)
+{
+    if(slot->key_size <= MMAP_STORE_INLINE_KEY)
+        return slot->key.inline_key;
+    uint64_t names_size = store->header->names_size;
+    if(slot->key.ext.offset > names_size
+    || slot->key_size > names_size - slot->key.ext.offset)
+        return NULL;
+    return store->names + slot->key.ext.offset;
+}
+
+static inline int mmap_store_slot_is_full(const mmap_store* store, size_t i)
+{
+    return !(store->ctrl[i] & 0x80);
+}
+
+#endif
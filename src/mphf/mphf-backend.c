@@ -0,0 +1,446 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "mphf-backend.h"
+#include "mphf.h"
+
+/*
+ * Read-only phonebook built when the phonebook is created, from a
+ * "source" file of "name,number" lines (the name being everything
+ * before the last comma). Each name is mapped by a minimal perfect
+ * hash function to a slot holding its number and a 32-bit fingerprint
+ * of the name; names are kept in a separate blob and are only compared
+ * on lookup if "verify" is true (the default). With "verify" set to
+ * false, a lookup reads a single slot and a name that is not in the
+ * phonebook is reported as missing with a probability of 1 - 2^-32.
+ */
+
+typedef struct mphf_slot {
+    uint64_t number;
+    uint32_t fingerprint;
+    uint32_t key_offset; // offset of the name in the key blob
+} mphf_slot;
+
+typedef struct mphf_context {
+    struct json_object* config;
+    mphf                function;
+    mphf_slot*          slots;
+    char*               keys;   // uint32_t size followed by the name, for each slot
+    int                 verify;
+} mphf_context;
+
+static inline uint32_t mphf_fingerprint(const char* name, size_t name_size)
+{
+    return (uint32_t)(YP_hash(name, name_size) >> 32);
+}
+
+static YP_return_t mphf_read_file(const char* path, char** content, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file) return YP_ERR_IO;
+    YP_return_t ret = YP_SUCCESS;
+    size_t capacity = 4096, used = 0;
+    char* buffer = (char*)malloc(capacity);
+    while(buffer) {
+        if(used + 1 == capacity) {
+            char* b = (char*)realloc(buffer, capacity *= 2);
+            if(!b) {
+                free(buffer);
+                buffer = NULL;
+                break;
+            }
+            buffer = b;
+        }
+        size_t n = fread(buffer + used, 1, capacity - used - 1, file);
+        used += n;
+        if(n == 0) break;
+    }
+    if(!buffer) ret = YP_ERR_ALLOCATION;
+    else if(ferror(file)) {
+        free(buffer);
+        ret = YP_ERR_IO;
+    } else {
+        buffer[used] = '\0';
+        *content = buffer;
+        *size    = used;
+    }
+    fclose(file);
+    return ret;
+}
+
+typedef struct mphf_source {
+    char*      content;
+    size_t     count;
+    size_t     capacity;
+    char**     names;
+    uint32_t*  name_sizes;
+    uint64_t*  numbers;
+} mphf_source;
+
+static void mphf_source_free(mphf_source* source)
+{
+    free(source->content);
+    free(source->names);
+    free(source->name_sizes);
+    free(source->numbers);
+}
+
+static YP_return_t mphf_source_parse(
+        YP_provider_t provider,
+        const char* path,
+        mphf_source* source)
+{
+    size_t size = 0;
+    memset(source, 0, sizeof(*source));
+    YP_return_t ret = mphf_read_file(path, &source->content, &size);
+    if(ret == YP_ERR_IO)
+        margo_error(provider->mid, "Could not read %s: %s", path, strerror(errno));
+    if(ret != YP_SUCCESS) return ret;
+
+    char* line = source->content;
+    size_t line_number = 0;
+    while(line < source->content + size) {
+        line_number += 1;
+        char* end = strchr(line, '\n');
+        if(!end) end = source->content + size;
+        char* next = end < source->content + size ? end + 1 : end;
+        if(end > line && end[-1] == '\r') end--;
+        *end = '\0';
+        if(end == line) { // empty line
+            line = next;
+            continue;
+        }
+        char* comma = strrchr(line, ',');
+        char* last = NULL;
+        errno = 0;
+        unsigned long long number = comma ? strtoull(comma + 1, &last, 10) : 0;
+        if(!comma || comma == line || last == comma + 1 || *last != '\0'
+        || errno || comma[1] == '-' || (size_t)(comma - line) > UINT32_MAX) {
+            margo_error(provider->mid,
+                "%s:%zu: expected \"name,number\"", path, line_number);
+            mphf_source_free(source);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        if(source->count == source->capacity) {
+            size_t capacity = source->capacity ? 2*source->capacity : 1024;
+            char** names = (char**)realloc(source->names, capacity*sizeof(char*));
+            if(names) source->names = names;
+            uint32_t* sizes = (uint32_t*)realloc(source->name_sizes, capacity*sizeof(uint32_t));
+            if(sizes) source->name_sizes = sizes;
+            uint64_t* numbers = (uint64_t*)realloc(source->numbers, capacity*sizeof(uint64_t));
+            if(numbers) source->numbers = numbers;
+            if(!names || !sizes || !numbers) {
+                mphf_source_free(source);
+                return YP_ERR_ALLOCATION;
+            }
+            source->capacity = capacity;
+        }
+        source->names[source->count]      = line;
+        source->name_sizes[source->count] = (uint32_t)(comma - line);
+        source->numbers[source->count]    = number;
+        source->count += 1;
+        line = next;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t mphf_build_context(
+        YP_provider_t provider,
+        mphf_context* ctx,
+        const mphf_source* source,
+        double gamma)
+{
+    YP_return_t ret = mphf_build(&ctx->function, source->count,
+            (const char* const*)source->names, source->name_sizes, gamma);
+    if(ret != YP_SUCCESS) return ret;
+
+    /* when a name appears several times, the last occurrence wins */
+    size_t num_slots = mphf_size(&ctx->function);
+    size_t* owners = (size_t*)malloc((num_slots ? num_slots : 1) * sizeof(size_t));
+    ctx->slots = (mphf_slot*)calloc(num_slots ? num_slots : 1, sizeof(mphf_slot));
+    if(!owners || !ctx->slots) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(size_t i = 0; i < source->count; i++) {
+        uint64_t index = mphf_lookup(&ctx->function,
+                source->names[i], source->name_sizes[i]);
+        owners[index] = i;
+    }
+    size_t blob_size = 0;
+    for(size_t s = 0; s < num_slots; s++)
+        blob_size += sizeof(uint32_t) + source->name_sizes[owners[s]];
+    if(blob_size > UINT32_MAX) {
+        margo_error(provider->mid, "mphf backend is limited to 4GB of names");
+        ret = YP_ERR_INVALID_CONFIG;
+        goto finish;
+    }
+    ctx->keys = (char*)malloc(blob_size ? blob_size : 1);
+    if(!ctx->keys) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    size_t offset = 0;
+    for(size_t s = 0; s < num_slots; s++) {
+        size_t i = owners[s];
+        uint32_t name_size = source->name_sizes[i];
+        ctx->slots[s].number      = source->numbers[i];
+        ctx->slots[s].fingerprint = mphf_fingerprint(source->names[i], name_size);
+        ctx->slots[s].key_offset  = (uint32_t)offset;
+        memcpy(ctx->keys + offset, &name_size, sizeof(name_size));
+        memcpy(ctx->keys + offset + sizeof(name_size), source->names[i], name_size);
+        offset += sizeof(name_size) + name_size;
+    }
+
+finish:
+    free(owners);
+    return ret;
+}
+
+static YP_return_t mphf_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        mphf_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (!config_str) {
+        margo_error(provider->mid, "mphf backend requires a configuration");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    config = json_tokener_parse_ex(
+            tokener, config_str,
+            strlen(config_str));
+    if (!config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+    if (!json_object_is_type(config, json_type_object)) {
+        margo_error(provider->mid, "JSON configuration should be an object");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "source" is the file the phonebook is built from
+    struct json_object* jsource = json_object_object_get(config, "source");
+    if (!jsource || !json_object_is_type(jsource, json_type_string)) {
+        margo_error(provider->mid, "\"source\" should be a string");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    int verify = 1;
+    struct json_object* jverify = json_object_object_get(config, "verify");
+    if (jverify) {
+        if (!json_object_is_type(jverify, json_type_boolean)) {
+            margo_error(provider->mid, "\"verify\" should be a boolean");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        verify = json_object_get_boolean(jverify);
+    }
+    double gamma = 2.0;
+    struct json_object* jgamma = json_object_object_get(config, "gamma");
+    if (jgamma) {
+        if (!(json_object_is_type(jgamma, json_type_double)
+           || json_object_is_type(jgamma, json_type_int))
+        ||  json_object_get_double(jgamma) < 1.0) {
+            margo_error(provider->mid, "\"gamma\" should be a number >= 1");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        gamma = json_object_get_double(jgamma);
+    }
+
+    mphf_source source;
+    YP_return_t ret = mphf_source_parse(provider,
+            json_object_get_string(jsource), &source);
+    if (ret != YP_SUCCESS) {
+        json_object_put(config);
+        return ret;
+    }
+
+    mphf_context* ctx = (mphf_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        mphf_source_free(&source);
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    ret = mphf_build_context(provider, ctx, &source, gamma);
+    mphf_source_free(&source);
+    if (ret != YP_SUCCESS) {
+        mphf_destroy(&ctx->function);
+        free(ctx->slots);
+        free(ctx->keys);
+        free(ctx);
+        json_object_put(config);
+        return ret;
+    }
+    ctx->verify = verify;
+    ctx->config = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t mphf_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return mphf_create_context(provider, config_str, (mphf_context**)context);
+}
+
+static YP_return_t mphf_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    /* nothing is persisted besides the source, which is imported again */
+    return mphf_create_context(provider, config_str, (mphf_context**)context);
+}
+
+static YP_return_t mphf_close_phonebook(void* ctx)
+{
+    mphf_context* context = (mphf_context*)ctx;
+    mphf_destroy(&context->function);
+    free(context->slots);
+    free(context->keys);
+    json_object_put(context->config);
+    free(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t mphf_destroy_phonebook(void* ctx)
+{
+    return mphf_close_phonebook(ctx);
+}
+
+static char* mphf_get_config(void* ctx)
+{
+    mphf_context* context = (mphf_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void mphf_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from MPHF phonebook\n");
+}
+
+static int32_t mphf_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t mphf_backend_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)ctx;
+    (void)name;
+    (void)name_size;
+    (void)number;
+    return YP_ERR_OP_FORBIDDEN;
+}
+
+static YP_return_t mphf_backend_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    mphf_context* context = (mphf_context*)ctx;
+    uint64_t index = mphf_lookup(&context->function, name, name_size);
+    if(index == MPHF_NOT_FOUND) return YP_ERR_NOT_FOUND;
+    const mphf_slot* slot = &context->slots[index];
+    if(slot->fingerprint != mphf_fingerprint(name, name_size))
+        return YP_ERR_NOT_FOUND;
+    if(context->verify) {
+        const char* key = context->keys + slot->key_offset;
+        uint32_t key_size;
+        memcpy(&key_size, key, sizeof(key_size));
+        if(key_size != name_size
+        || memcmp(key + sizeof(key_size), name, name_size) != 0)
+            return YP_ERR_NOT_FOUND;
+    }
+    *number = slot->number;
+    return YP_SUCCESS;
+}
+
+static YP_return_t mphf_backend_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    (void)ctx;
+    (void)name;
+    (void)name_size;
+    return YP_ERR_OP_FORBIDDEN;
+}
+
+static YP_return_t mphf_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    mphf_context* context = (mphf_context*)ctx;
+    for(uint64_t i = 0; i < mphf_size(&context->function); i++) {
+        const mphf_slot* slot = &context->slots[i];
+        const char* key = context->keys + slot->key_offset;
+        uint32_t key_size;
+        memcpy(&key_size, key, sizeof(key_size));
+        if(fn(uargs, key + sizeof(key_size), key_size, slot->number))
+            break;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t mphf_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    mphf_context* context = (mphf_context*)ctx;
+    for(uint64_t i = *position; i < mphf_size(&context->function); i++) {
+        const mphf_slot* slot = &context->slots[i];
+        const char* key = context->keys + slot->key_offset;
+        uint32_t key_size;
+        memcpy(&key_size, key, sizeof(key_size));
+        if(fn(uargs, key + sizeof(key_size), key_size, slot->number)) {
+            *position = i;
+            return YP_SUCCESS;
+        }
+    }
+    *position = UINT64_MAX;
+    return YP_SUCCESS;
+}
+
+static YP_backend_impl mphf_backend = {
+    .name             = "mphf",
+
+    .create_phonebook  = mphf_create_phonebook,
+    .open_phonebook    = mphf_open_phonebook,
+    .close_phonebook   = mphf_close_phonebook,
+    .destroy_phonebook = mphf_destroy_phonebook,
+    .get_config       = mphf_get_config,
+
+    .hello            = mphf_say_hello,
+    .sum              = mphf_compute_sum,
+    .insert           = mphf_backend_insert,
+    .lookup           = mphf_backend_lookup,
+    .erase            = mphf_backend_erase,
+    .list_range       = NULL,
+    .list_prefix      = NULL,
+    .iterate          = mphf_iterate,
+    .scan             = mphf_scan
+};
+
+YP_return_t YP_provider_register_mphf_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &mphf_backend);
+}
@@ -0,0 +1,154 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "../hash.h"
+#include "mphf.h"
+
+static inline uint64_t level_seed(uint32_t level)
+{
+    return 0x9E3779B97F4A7C15ull * (level + 1);
+}
+
+/* Position of a key in a level of the given number of bits */
+static inline uint64_t level_position(const char* key, size_t key_size, uint32_t level, uint64_t num_bits)
+{
+    uint64_t h = YP_hash_seeded(key, key_size, level_seed(level));
+    return (uint64_t)(((YP_uint128_t)h * num_bits) >> 64);
+}
+
+static inline int test_bit(const uint64_t* bits, uint64_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t* bits, uint64_t i)
+{
+    bits[i / 64] |= 1ull << (i % 64);
+}
+
+YP_return_t mphf_build(
+        mphf* f,
+        size_t n,
+        const char* const* keys,
+        const uint32_t* key_sizes,
+        double gamma)
+{
+    YP_return_t ret = YP_SUCCESS;
+    memset(f, 0, sizeof(*f));
+    if(gamma < 1.0) gamma = 1.0;
+
+    size_t* remaining = (size_t*)malloc((n ? n : 1) * sizeof(*remaining));
+    if(!remaining) return YP_ERR_ALLOCATION;
+    for(size_t i = 0; i < n; i++) remaining[i] = i;
+    size_t num_remaining = n;
+
+    /* the levels are built in a scratch array of collision bits, then
+     * appended to f->bits once the colliding bits are cleared */
+    uint64_t* collisions = NULL;
+    uint32_t level;
+    for(level = 0; level < MPHF_MAX_LEVELS && num_remaining; level++) {
+        uint64_t num_bits  = ((uint64_t)(gamma * num_remaining) + 63) & ~63ull;
+        uint64_t num_words = num_bits / 64;
+        uint64_t offset    = f->level_offsets[level] / 64;
+        uint64_t* bits = (uint64_t*)realloc(f->bits, (offset + num_words) * sizeof(uint64_t));
+        uint64_t* coll = (uint64_t*)realloc(collisions, num_words * sizeof(uint64_t));
+        if(bits) f->bits = bits;
+        if(coll) collisions = coll;
+        if(!bits || !coll) {
+            ret = YP_ERR_ALLOCATION;
+            goto finish;
+        }
+        uint64_t* level_bits = f->bits + offset;
+        memset(level_bits, 0, num_words * sizeof(uint64_t));
+        memset(collisions, 0, num_words * sizeof(uint64_t));
+
+        for(size_t i = 0; i < num_remaining; i++) {
+            size_t k = remaining[i];
+            uint64_t p = level_position(keys[k], key_sizes[k], level, num_bits);
+            if(test_bit(level_bits, p)) set_bit(collisions, p);
+            else set_bit(level_bits, p);
+        }
+        size_t next = 0;
+        for(size_t i = 0; i < num_remaining; i++) {
+            size_t k = remaining[i];
+            uint64_t p = level_position(keys[k], key_sizes[k], level, num_bits);
+            if(test_bit(collisions, p)) remaining[next++] = k;
+        }
+        for(uint64_t w = 0; w < num_words; w++)
+            level_bits[w] &= ~collisions[w];
+        f->num_ranked += num_remaining - next;
+        num_remaining = next;
+        f->level_offsets[level + 1] = f->level_offsets[level] + num_bits;
+    }
+    f->num_levels = level;
+
+    /* rank samples */
+    uint64_t total_bits = f->level_offsets[level];
+    uint64_t num_blocks = total_bits / MPHF_RANK_BLOCK + 1;
+    f->ranks = (uint64_t*)malloc(num_blocks * sizeof(uint64_t));
+    if(!f->ranks) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    uint64_t count = 0;
+    for(uint64_t w = 0; w < total_bits / 64; w++) {
+        if(w % (MPHF_RANK_BLOCK / 64) == 0)
+            f->ranks[w / (MPHF_RANK_BLOCK / 64)] = count;
+        count += (uint64_t)__builtin_popcountll(f->bits[w]);
+    }
+    if((total_bits / 64) % (MPHF_RANK_BLOCK / 64) == 0)
+        f->ranks[total_bits / MPHF_RANK_BLOCK] = count;
+
+    /* keys that never found a bit of their own */
+    ret = memory_table_init(&f->fallback, num_remaining);
+    if(ret != YP_SUCCESS) goto finish;
+    for(size_t i = 0; i < num_remaining && ret == YP_SUCCESS; i++) {
+        size_t k = remaining[i];
+        uint64_t hash = YP_hash(keys[k], key_sizes[k]);
+        if(memory_table_find(&f->fallback, keys[k], key_sizes[k], hash))
+            continue; // duplicate
+        ret = memory_table_insert(&f->fallback, keys[k], key_sizes[k], hash,
+                                  f->num_ranked + f->fallback.size, NULL, NULL);
+    }
+
+finish:
+    free(collisions);
+    free(remaining);
+    if(ret != YP_SUCCESS) mphf_destroy(f);
+    return ret;
+}
+
+void mphf_destroy(mphf* f)
+{
+    free(f->bits);
+    free(f->ranks);
+    if(f->fallback.ctrl) memory_table_destroy(&f->fallback);
+    memset(f, 0, sizeof(*f));
+}
+
+static inline uint64_t rank(const mphf* f, uint64_t i)
+{
+    uint64_t r = f->ranks[i / MPHF_RANK_BLOCK];
+    uint64_t w = (i / MPHF_RANK_BLOCK) * (MPHF_RANK_BLOCK / 64);
+    for(; w < i / 64; w++)
+        r += (uint64_t)__builtin_popcountll(f->bits[w]);
+    return r + (uint64_t)__builtin_popcountll(f->bits[w] & ((1ull << (i % 64)) - 1));
+}
+
+uint64_t mphf_lookup(const mphf* f, const char* key, size_t key_size)
+{
+    for(uint32_t level = 0; level < f->num_levels; level++) {
+        uint64_t offset   = f->level_offsets[level];
+        uint64_t num_bits = f->level_offsets[level + 1] - offset;
+        uint64_t p = offset + level_position(key, key_size, level, num_bits);
+        if(test_bit(f->bits, p))
+            return rank(f, p);
+    }
+    if(!f->fallback.size) return MPHF_NOT_FOUND;
+    memory_slot* slot = memory_table_find(&f->fallback, key, key_size, YP_hash(key, key_size));
+    return slot ? slot->value : MPHF_NOT_FOUND;
+}
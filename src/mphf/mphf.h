@@ -0,0 +1,67 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _MPHF_H
+#define _MPHF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "../memory/memory-table.h"
+
+/*
+ * Minimal perfect hash function in the style of BBHash (Limasset et
+ * al., 2017). Level i is a bit array of gamma times the number of keys
+ * that reached it; each key is hashed into every level until it lands
+ * on a bit that no other key of that level hit. The index of a key is
+ * the rank of its bit across the concatenated levels. Keys still
+ * colliding after MPHF_MAX_LEVELS levels (including duplicates) are
+ * kept in a small fallback table and numbered after the others.
+ *
+ * Keys that were not part of the build map to an arbitrary index, so
+ * callers must check for membership themselves.
+ */
+
+#define MPHF_MAX_LEVELS  24
+#define MPHF_RANK_BLOCK  512 // bits per rank sample
+#define MPHF_NOT_FOUND   UINT64_MAX
+
+typedef struct mphf {
+    uint32_t     num_levels;
+    uint64_t     level_offsets[MPHF_MAX_LEVELS + 1]; // in bits, multiples of 64
+    uint64_t*    bits;
+    uint64_t*    ranks;      // number of set bits before each rank block
+    uint64_t     num_ranked; // keys placed in the levels
+    memory_table fallback;   // key -> index
+} mphf;
+
+/**
+ * @brief Builds the function over n keys. gamma (>= 1) trades space
+ * (gamma bits per key and level) for fewer levels.
+ */
+YP_return_t mphf_build(
+        mphf* f,
+        size_t n,
+        const char* const* keys,
+        const uint32_t* key_sizes,
+        double gamma);
+
+void mphf_destroy(mphf* f);
+
+/**
+ * @brief Number of distinct indices, i.e. of distinct keys.
+ */
+static inline uint64_t mphf_size(const mphf* f)
+{
+    return f->num_ranked + f->fallback.size;
+}
+
+/**
+ * @brief Returns the index of a key, or MPHF_NOT_FOUND if the key is
+ * known not to be part of the set.
+ */
+uint64_t mphf_lookup(const mphf* f, const char* key, size_t key_size);
+
+#endif
@@ -0,0 +1,730 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "phonetic-index.h"
+
+#define PHONETIC_MAX_WORD  64 // letters of a word that are encoded
+#define PHONETIC_PADDING   5  // spaces after a word, for look-ahead
+#define PHONETIC_MAX_KEYS  (2*PHONETIC_MAX_WORDS)
+
+/*
+ * Double Metaphone, after Lawrence Philips' original algorithm. The
+ * word is upper-cased and followed by spaces, so that look-ahead never
+ * runs past it and rules matching the end of a word ("IER ") work.
+ */
+typedef struct metaphone {
+    char   word[PHONETIC_MAX_WORD + PHONETIC_PADDING + 1];
+    int    length;
+    int    last;
+    char   primary[PHONETIC_KEY_SIZE + 1];
+    char   alternate[PHONETIC_KEY_SIZE + 1];
+    size_t primary_size;
+    size_t alternate_size;
+} metaphone;
+
+static char get_at(const metaphone* m, int pos)
+{
+    return (pos < 0 || pos >= m->length + PHONETIC_PADDING) ? '\0' : m->word[pos];
+}
+
+static int is_vowel(const metaphone* m, int pos)
+{
+    char c = get_at(m, pos);
+    return c == 'A' || c == 'E' || c == 'I' || c == 'O' || c == 'U' || c == 'Y';
+}
+
+/* Checks whether one of the (null-terminated list of) strings of the
+ * given length appears at pos */
+static int string_at(const metaphone* m, int pos, int length, ...)
+{
+    if(pos < 0 || pos + length > m->length + PHONETIC_PADDING) return 0;
+    va_list args;
+    va_start(args, length);
+    const char* s;
+    int found = 0;
+    while(!found && (s = va_arg(args, const char*)))
+        found = memcmp(m->word + pos, s, (size_t)length) == 0;
+    va_end(args);
+    return found;
+}
+
+static void append(char* key, size_t* size, const char* s)
+{
+    for(; *s && *size < PHONETIC_KEY_SIZE; s++)
+        key[(*size)++] = *s;
+    key[*size] = '\0';
+}
+
+static void add(metaphone* m, const char* primary, const char* alternate)
+{
+    append(m->primary, &m->primary_size, primary);
+    append(m->alternate, &m->alternate_size, alternate ? alternate : primary);
+}
+
+static int slavo_germanic(const metaphone* m)
+{
+    for(int i = 0; i < m->length; i++) {
+        if(m->word[i] == 'W' || m->word[i] == 'K') return 1;
+        if(string_at(m, i, 2, "CZ", NULL)) return 1;
+        if(string_at(m, i, 4, "WITZ", NULL)) return 1;
+    }
+    return 0;
+}
+
+static int encode_c(metaphone* m, int current)
+{
+    /* various germanic */
+    if(current > 1 && !is_vowel(m, current - 2)
+    && string_at(m, current - 1, 3, "ACH", NULL)
+    && get_at(m, current + 2) != 'I'
+    && (get_at(m, current + 2) != 'E'
+        || string_at(m, current - 2, 6, "BACHER", "MACHER", NULL))) {
+        add(m, "K", NULL);
+        return 2;
+    }
+    /* special case 'caesar' */
+    if(current == 0 && string_at(m, current, 6, "CAESAR", NULL)) {
+        add(m, "S", NULL);
+        return 2;
+    }
+    /* italian 'chianti' */
+    if(string_at(m, current, 4, "CHIA", NULL)) {
+        add(m, "K", NULL);
+        return 2;
+    }
+    if(string_at(m, current, 2, "CH", NULL)) {
+        /* 'michael' */
+        if(current > 0 && string_at(m, current, 4, "CHAE", NULL)) {
+            add(m, "K", "X");
+            return 2;
+        }
+        /* greek roots, e.g. 'chemistry', 'chorus' */
+        if(current == 0
+        && (string_at(m, current + 1, 5, "HARAC", "HARIS", NULL)
+            || string_at(m, current + 1, 3, "HOR", "HYM", "HIA", "HEM", NULL))
+        && !string_at(m, 0, 5, "CHORE", NULL)) {
+            add(m, "K", NULL);
+            return 2;
+        }
+        /* germanic, greek, or otherwise 'ch' for 'kh' sound */
+        if(string_at(m, 0, 4, "VAN ", "VON ", NULL) || string_at(m, 0, 3, "SCH", NULL)
+        /* 'architect' but not 'arch', 'orchestra', 'orchid' */
+        || string_at(m, current - 2, 6, "ORCHES", "ARCHIT", "ORCHID", NULL)
+        || string_at(m, current + 2, 1, "T", "S", NULL)
+        || ((string_at(m, current - 1, 1, "A", "O", "U", "E", NULL) || current == 0)
+            /* 'wachtler', 'wechsler', but not 'tichner' */
+            && string_at(m, current + 2, 1, "L", "R", "N", "M", "B", "H", "F", "V", "W", " ", NULL))) {
+            add(m, "K", NULL);
+        } else if(current > 0) {
+            /* 'mchugh' */
+            if(string_at(m, 0, 2, "MC", NULL)) add(m, "K", NULL);
+            else add(m, "X", "K");
+        } else {
+            add(m, "X", NULL);
+        }
+        return 2;
+    }
+    /* 'czerny' */
+    if(string_at(m, current, 2, "CZ", NULL) && !string_at(m, current - 2, 4, "WICZ", NULL)) {
+        add(m, "S", "X");
+        return 2;
+    }
+    /* 'focaccia' */
+    if(string_at(m, current + 1, 3, "CIA", NULL)) {
+        add(m, "X", NULL);
+        return 3;
+    }
+    /* double 'C', but not if e.g. 'mcclellan' */
+    if(string_at(m, current, 2, "CC", NULL) && !(current == 1 && get_at(m, 0) == 'M')) {
+        /* 'bellocchio' but not 'bacchus' */
+        if(string_at(m, current + 2, 1, "I", "E", "H", NULL)
+        && !string_at(m, current + 2, 2, "HU", NULL)) {
+            /* 'accident', 'accede', 'succeed' */
+            if((current == 1 && get_at(m, current - 1) == 'A')
+            || string_at(m, current - 1, 5, "UCCEE", "UCCES", NULL))
+                add(m, "KS", NULL);
+            /* 'bacci', 'bertucci', other italian */
+            else
+                add(m, "X", NULL);
+            return 3;
+        }
+        /* Pierce's rule */
+        add(m, "K", NULL);
+        return 2;
+    }
+    if(string_at(m, current, 2, "CK", "CG", "CQ", NULL)) {
+        add(m, "K", NULL);
+        return 2;
+    }
+    if(string_at(m, current, 2, "CI", "CE", "CY", NULL)) {
+        /* italian vs. english */
+        if(string_at(m, current, 3, "CIO", "CIE", "CIA", NULL)) add(m, "S", "X");
+        else add(m, "S", NULL);
+        return 2;
+    }
+    add(m, "K", NULL);
+    /* 'mac caffrey', 'mac gregor' */
+    if(string_at(m, current + 1, 2, " C", " Q", " G", NULL))
+        return 3;
+    if(string_at(m, current + 1, 1, "C", "K", "Q", NULL)
+    && !string_at(m, current + 1, 2, "CE", "CI", NULL))
+        return 2;
+    return 1;
+}
+
+static int encode_g(metaphone* m, int current, int slavo)
+{
+    if(get_at(m, current + 1) == 'H') {
+        if(current > 0 && !is_vowel(m, current - 1)) {
+            add(m, "K", NULL);
+            return 2;
+        }
+        /* 'ghislane', 'ghiradelli' */
+        if(current == 0) {
+            if(get_at(m, current + 2) == 'I') add(m, "J", NULL);
+            else add(m, "K", NULL);
+            return 2;
+        }
+        /* Parker's rule (with some further refinements), e.g. 'hugh',
+         * 'bough', 'broughton' */
+        if((current > 1 && string_at(m, current - 2, 1, "B", "H", "D", NULL))
+        || (current > 2 && string_at(m, current - 3, 1, "B", "H", "D", NULL))
+        || (current > 3 && string_at(m, current - 4, 1, "B", "H", NULL)))
+            return 2;
+        /* 'laugh', 'mclaughlin', 'cough', 'gough', 'rough', 'tough' */
+        if(current > 2 && get_at(m, current - 1) == 'U'
+        && string_at(m, current - 3, 1, "C", "G", "L", "R", "T", NULL))
+            add(m, "F", NULL);
+        else if(get_at(m, current - 1) != 'I')
+            add(m, "K", NULL);
+        return 2;
+    }
+    if(get_at(m, current + 1) == 'N') {
+        if(current == 1 && is_vowel(m, 0) && !slavo)
+            add(m, "KN", "N");
+        /* not e.g. 'cagney' */
+        else if(!string_at(m, current + 2, 2, "EY", NULL)
+             && get_at(m, current + 1) != 'Y' && !slavo)
+            add(m, "N", "KN");
+        else
+            add(m, "KN", NULL);
+        return 2;
+    }
+    /* 'tagliaro' */
+    if(string_at(m, current + 1, 2, "LI", NULL) && !slavo) {
+        add(m, "KL", "L");
+        return 2;
+    }
+    /* -ges-, -gep-, -gel-, -gie- at beginning */
+    if(current == 0
+    && (get_at(m, current + 1) == 'Y'
+        || string_at(m, current + 1, 2, "ES", "EP", "EB", "EL", "EY", "IB",
+                     "IL", "IN", "IE", "EI", "ER", NULL))) {
+        add(m, "K", "J");
+        return 2;
+    }
+    /* -ger-, -gy- */
+    if((string_at(m, current + 1, 2, "ER", NULL) || get_at(m, current + 1) == 'Y')
+    && !string_at(m, 0, 6, "DANGER", "RANGER", "MANGER", NULL)
+    && !string_at(m, current - 1, 1, "E", "I", NULL)
+    && !string_at(m, current - 1, 3, "RGY", "OGY", NULL)) {
+        add(m, "K", "J");
+        return 2;
+    }
+    /* italian, e.g. 'biaggi' */
+    if(string_at(m, current + 1, 1, "E", "I", "Y", NULL)
+    || string_at(m, current - 1, 4, "AGGI", "OGGI", NULL)) {
+        /* obvious germanic */
+        if(string_at(m, 0, 4, "VAN ", "VON ", NULL) || string_at(m, 0, 3, "SCH", NULL)
+        || string_at(m, current + 1, 2, "ET", NULL))
+            add(m, "K", NULL);
+        /* always soft if french ending */
+        else if(string_at(m, current + 1, 4, "IER ", NULL))
+            add(m, "J", NULL);
+        else
+            add(m, "J", "K");
+        return 2;
+    }
+    add(m, "K", NULL);
+    return get_at(m, current + 1) == 'G' ? 2 : 1;
+}
+
+static int encode_s(metaphone* m, int current, int slavo)
+{
+    /* 'island', 'isle', 'carlisle', 'carlysle' */
+    if(string_at(m, current - 1, 3, "ISL", "YSL", NULL))
+        return 1;
+    /* 'sugar-' */
+    if(current == 0 && string_at(m, current, 5, "SUGAR", NULL)) {
+        add(m, "X", "S");
+        return 1;
+    }
+    if(string_at(m, current, 2, "SH", NULL)) {
+        /* germanic */
+        if(string_at(m, current + 1, 4, "HEIM", "HOEK", "HOLM", "HOLZ", NULL))
+            add(m, "S", NULL);
+        else
+            add(m, "X", NULL);
+        return 2;
+    }
+    /* italian & armenian */
+    if(string_at(m, current, 3, "SIO", "SIA", NULL) || string_at(m, current, 4, "SIAN", NULL)) {
+        if(!slavo) add(m, "S", "X");
+        else add(m, "S", NULL);
+        return 3;
+    }
+    /* german & anglicisations, e.g. 'smith' matches 'schmidt', 'snider'
+     * matches 'schneider', also -sz- in slavic languages */
+    if((current == 0 && string_at(m, current + 1, 1, "M", "N", "L", "W", NULL))
+    || string_at(m, current + 1, 1, "Z", NULL)) {
+        add(m, "S", "X");
+        return string_at(m, current + 1, 1, "Z", NULL) ? 2 : 1;
+    }
+    if(string_at(m, current, 2, "SC", NULL)) {
+        /* Schlesinger's rule */
+        if(get_at(m, current + 2) == 'H') {
+            /* dutch origin, e.g. 'school', 'schooner' */
+            if(string_at(m, current + 3, 2, "OO", "ER", "EN", "UY", "ED", "EM", NULL)) {
+                /* 'schermerhorn', 'schenker' */
+                if(string_at(m, current + 3, 2, "ER", "EN", NULL)) add(m, "X", "SK");
+                else add(m, "SK", NULL);
+                return 3;
+            }
+            if(current == 0 && !is_vowel(m, 3) && get_at(m, 3) != 'W')
+                add(m, "X", "S");
+            else
+                add(m, "X", NULL);
+            return 3;
+        }
+        if(string_at(m, current + 2, 1, "I", "E", "Y", NULL))
+            add(m, "S", NULL);
+        else
+            add(m, "SK", NULL);
+        return 3;
+    }
+    /* french, e.g. 'resnais', 'artois' */
+    if(current == m->last && string_at(m, current - 2, 2, "AI", "OI", NULL))
+        add(m, "", "S");
+    else
+        add(m, "S", NULL);
+    return string_at(m, current + 1, 1, "S", "Z", NULL) ? 2 : 1;
+}
+
+static int encode_other(metaphone* m, int current, int slavo)
+{
+    char c = get_at(m, current);
+    switch(c) {
+    case 'A': case 'E': case 'I': case 'O': case 'U': case 'Y':
+        /* vowels are only kept at the beginning */
+        if(current == 0) add(m, "A", NULL);
+        return 1;
+    case 'B':
+        add(m, "P", NULL);
+        return get_at(m, current + 1) == 'B' ? 2 : 1;
+    case 'D':
+        if(string_at(m, current, 2, "DG", NULL)) {
+            /* 'edge' */
+            if(string_at(m, current + 2, 1, "I", "E", "Y", NULL)) {
+                add(m, "J", NULL);
+                return 3;
+            }
+            /* 'edgar' */
+            add(m, "TK", NULL);
+            return 2;
+        }
+        add(m, "T", NULL);
+        return string_at(m, current, 2, "DT", "DD", NULL) ? 2 : 1;
+    case 'F': case 'K': case 'N': case 'Q': case 'V':
+        add(m, c == 'F' || c == 'V' ? "F" : c == 'N' ? "N" : "K", NULL);
+        return get_at(m, current + 1) == c ? 2 : 1;
+    case 'H':
+        /* only kept if first or between vowels, this also skips 'HH' */
+        if((current == 0 || is_vowel(m, current - 1)) && is_vowel(m, current + 1)) {
+            add(m, "H", NULL);
+            return 2;
+        }
+        return 1;
+    case 'J':
+        /* obvious spanish, 'jose', 'san jacinto' */
+        if(string_at(m, current, 4, "JOSE", NULL) || string_at(m, 0, 4, "SAN ", NULL)) {
+            if((current == 0 && get_at(m, current + 4) == ' ')
+            || string_at(m, 0, 4, "SAN ", NULL))
+                add(m, "H", NULL);
+            else
+                add(m, "J", "H");
+            return 1;
+        }
+        /* 'yankelovich' / 'jankelowicz' */
+        if(current == 0)
+            add(m, "J", "A");
+        /* spanish pronunciation of e.g. 'bajador' */
+        else if(is_vowel(m, current - 1) && !slavo
+             && (get_at(m, current + 1) == 'A' || get_at(m, current + 1) == 'O'))
+            add(m, "J", "H");
+        else if(current == m->last)
+            add(m, "J", "");
+        else if(!string_at(m, current + 1, 1, "L", "T", "K", "S", "N", "M", "B", "Z", NULL)
+             && !string_at(m, current - 1, 1, "S", "K", "L", NULL))
+            add(m, "J", NULL);
+        return get_at(m, current + 1) == 'J' ? 2 : 1;
+    case 'L':
+        if(get_at(m, current + 1) == 'L') {
+            /* spanish, e.g. 'cabrillo', 'gallegos' */
+            if((current == m->length - 3
+                && string_at(m, current - 1, 4, "ILLO", "ILLA", "ALLE", NULL))
+            || ((string_at(m, m->last - 1, 2, "AS", "OS", NULL)
+                 || string_at(m, m->last, 1, "A", "O", NULL))
+                && string_at(m, current - 1, 4, "ALLE", NULL))) {
+                add(m, "L", "");
+                return 2;
+            }
+            add(m, "L", NULL);
+            return 2;
+        }
+        add(m, "L", NULL);
+        return 1;
+    case 'M':
+        add(m, "M", NULL);
+        /* 'dumb', 'thumb' */
+        if((string_at(m, current - 1, 3, "UMB", NULL)
+            && (current + 1 == m->last || string_at(m, current + 2, 2, "ER", NULL)))
+        || get_at(m, current + 1) == 'M')
+            return 2;
+        return 1;
+    case 'P':
+        if(get_at(m, current + 1) == 'H') {
+            add(m, "F", NULL);
+            return 2;
+        }
+        add(m, "P", NULL);
+        /* also accounts for 'campbell', 'raspberry' */
+        return string_at(m, current + 1, 1, "P", "B", NULL) ? 2 : 1;
+    case 'R':
+        /* french, e.g. 'rogier', but not 'hochmeier' */
+        if(current == m->last && !slavo
+        && string_at(m, current - 2, 2, "IE", NULL)
+        && !string_at(m, current - 4, 2, "ME", "MA", NULL))
+            add(m, "", "R");
+        else
+            add(m, "R", NULL);
+        return get_at(m, current + 1) == 'R' ? 2 : 1;
+    case 'T':
+        if(string_at(m, current, 4, "TION", NULL)
+        || string_at(m, current, 3, "TIA", "TCH", NULL)) {
+            add(m, "X", NULL);
+            return 3;
+        }
+        if(string_at(m, current, 2, "TH", NULL) || string_at(m, current, 3, "TTH", NULL)) {
+            /* 'thomas', 'thames' or germanic */
+            if(string_at(m, current + 2, 2, "OM", "AM", NULL)
+            || string_at(m, 0, 4, "VAN ", "VON ", NULL) || string_at(m, 0, 3, "SCH", NULL))
+                add(m, "T", NULL);
+            else
+                add(m, "0", "T");
+            return 2;
+        }
+        add(m, "T", NULL);
+        return string_at(m, current + 1, 1, "T", "D", NULL) ? 2 : 1;
+    case 'W':
+        if(string_at(m, current, 2, "WR", NULL)) {
+            add(m, "R", NULL);
+            return 2;
+        }
+        if(current == 0 && (is_vowel(m, current + 1) || string_at(m, current, 2, "WH", NULL))) {
+            /* 'wasserman' matches 'vasserman', 'womo' matches 'uomo' */
+            if(is_vowel(m, current + 1)) add(m, "A", "F");
+            else add(m, "A", NULL);
+        }
+        /* 'arnow' matches 'arnoff' */
+        if((current == m->last && is_vowel(m, current - 1))
+        || string_at(m, current - 1, 5, "EWSKI", "EWSKY", "OWSKI", "OWSKY", NULL)
+        || string_at(m, 0, 3, "SCH", NULL)) {
+            add(m, "", "F");
+            return 1;
+        }
+        /* polish, e.g. 'filipowicz' */
+        if(string_at(m, current, 4, "WICZ", "WITZ", NULL)) {
+            add(m, "TS", "FX");
+            return 4;
+        }
+        return 1;
+    case 'X':
+        /* french, e.g. 'breaux' */
+        if(!(current == m->last
+             && (string_at(m, current - 3, 3, "IAU", "EAU", NULL)
+                 || string_at(m, current - 2, 2, "AU", "OU", NULL))))
+            add(m, "KS", NULL);
+        return string_at(m, current + 1, 1, "C", "X", NULL) ? 2 : 1;
+    case 'Z':
+        /* chinese pinyin, e.g. 'zhao' */
+        if(get_at(m, current + 1) == 'H') {
+            add(m, "J", NULL);
+            return 2;
+        }
+        if(string_at(m, current + 1, 2, "ZO", "ZI", "ZA", NULL)
+        || (slavo && current > 0 && get_at(m, current - 1) != 'T'))
+            add(m, "S", "TS");
+        else
+            add(m, "S", NULL);
+        return get_at(m, current + 1) == 'Z' ? 2 : 1;
+    default:
+        return 1;
+    }
+}
+
+/* Computes the primary and alternate keys of a word made of letters */
+static void double_metaphone(const char* word, size_t size, metaphone* m)
+{
+    if(size > PHONETIC_MAX_WORD) size = PHONETIC_MAX_WORD;
+    for(size_t i = 0; i < size; i++) {
+        char c = word[i];
+        m->word[i] = (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+    }
+    memset(m->word + size, ' ', PHONETIC_PADDING);
+    m->word[size + PHONETIC_PADDING] = '\0';
+    m->length = (int)size;
+    m->last   = m->length - 1;
+    m->primary[0] = m->alternate[0] = '\0';
+    m->primary_size = m->alternate_size = 0;
+
+    int slavo = slavo_germanic(m);
+    int current = 0;
+    /* skip these when at the start of a word */
+    if(string_at(m, 0, 2, "GN", "KN", "PN", "WR", "PS", NULL))
+        current += 1;
+    /* initial 'X' is pronounced 'Z', e.g. 'xavier' */
+    if(get_at(m, 0) == 'X') {
+        add(m, "S", NULL);
+        current += 1;
+    }
+    while(current < m->length
+    && (m->primary_size < PHONETIC_KEY_SIZE || m->alternate_size < PHONETIC_KEY_SIZE)) {
+        switch(get_at(m, current)) {
+        case 'C': current += encode_c(m, current); break;
+        case 'G': current += encode_g(m, current, slavo); break;
+        case 'S': current += encode_s(m, current, slavo); break;
+        default:  current += encode_other(m, current, slavo); break;
+        }
+    }
+}
+
+static uint64_t pack_key(const char* key, size_t size)
+{
+    uint64_t packed = 0;
+    for(size_t i = 0; i < PHONETIC_KEY_SIZE; i++)
+        packed = (packed << 8) | (i < size ? (unsigned char)key[i] : 0);
+    return packed << (64 - 8*PHONETIC_KEY_SIZE);
+}
+
+static int is_letter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* Appends the keys of a word to keys, unless already there */
+static void add_keys(const metaphone* m, uint64_t* keys, size_t* num_keys)
+{
+    uint64_t k[2] = {
+        pack_key(m->primary, m->primary_size),
+        pack_key(m->alternate, m->alternate_size)
+    };
+    for(int i = 0; i < 2; i++) {
+        if(!k[i]) continue;
+        size_t j = 0;
+        for(; j < *num_keys && keys[j] != k[i]; j++);
+        if(j == *num_keys) keys[(*num_keys)++] = k[i];
+    }
+}
+
+/* Calls fn on the words of a text, at most PHONETIC_MAX_WORDS of them */
+static void for_each_word(
+        const char* text,
+        size_t size,
+        void (*fn)(void*, const char*, size_t),
+        void* uargs)
+{
+    unsigned num_words = 0;
+    for(size_t i = 0; i < size && num_words < PHONETIC_MAX_WORDS;) {
+        if(!is_letter(text[i])) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        for(; i < size && is_letter(text[i]); i++);
+        fn(uargs, text + start, i - start);
+        num_words += 1;
+    }
+}
+
+typedef struct key_set {
+    uint64_t keys[PHONETIC_MAX_KEYS];
+    size_t   num_keys;
+} key_set;
+
+static void add_word_keys(void* uargs, const char* word, size_t size)
+{
+    key_set* set = (key_set*)uargs;
+    metaphone m;
+    double_metaphone(word, size, &m);
+    add_keys(&m, set->keys, &set->num_keys);
+}
+
+/* Computes the keys of all the words of a name, without duplicates */
+static void name_keys(const char* name, size_t size, key_set* set)
+{
+    set->num_keys = 0;
+    for_each_word(name, size, add_word_keys, set);
+}
+
+YP_return_t phonetic_index_init(phonetic_index* index)
+{
+    return reverse_index_init(&index->keys);
+}
+
+void phonetic_index_destroy(phonetic_index* index)
+{
+    reverse_index_destroy(&index->keys);
+}
+
+YP_return_t phonetic_index_add(
+        phonetic_index* index,
+        const char* name,
+        size_t name_size)
+{
+    key_set set;
+    name_keys(name, name_size, &set);
+    for(size_t i = 0; i < set.num_keys; i++) {
+        YP_return_t ret = reverse_index_add(&index->keys, set.keys[i], name, name_size);
+        if(ret != YP_SUCCESS) {
+            while(i--) reverse_index_remove(&index->keys, set.keys[i], name, name_size);
+            return ret;
+        }
+    }
+    return YP_SUCCESS;
+}
+
+YP_return_t phonetic_index_remove(
+        phonetic_index* index,
+        const char* name,
+        size_t name_size)
+{
+    key_set set;
+    name_keys(name, name_size, &set);
+    YP_return_t ret = YP_ERR_NOT_FOUND;
+    for(size_t i = 0; i < set.num_keys; i++)
+        if(reverse_index_remove(&index->keys, set.keys[i], name, name_size) == YP_SUCCESS)
+            ret = YP_SUCCESS;
+    return ret;
+}
+
+/* Names found under the keys of the first word of a query */
+typedef struct candidate {
+    const char* name;
+    size_t      size;
+} candidate;
+
+typedef struct candidate_list {
+    candidate*  items;
+    size_t      count;
+    size_t      capacity;
+    YP_return_t ret;
+} candidate_list;
+
+static int add_candidate(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)number;
+    candidate_list* list = (candidate_list*)uargs;
+    if(list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2*list->capacity : 16;
+        candidate* items = (candidate*)realloc(list->items, capacity*sizeof(*items));
+        if(!items) {
+            list->ret = YP_ERR_ALLOCATION;
+            return 1;
+        }
+        list->items    = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count].name = name;
+    list->items[list->count].size = name_size;
+    list->count += 1;
+    return 0;
+}
+
+static int compare_candidates(const void* a, const void* b)
+{
+    const candidate* x = (const candidate*)a;
+    const candidate* y = (const candidate*)b;
+    int c = memcmp(x->name, y->name, x->size < y->size ? x->size : y->size);
+    if(c) return c;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+/* Keys of each word of a query */
+typedef struct query_keys {
+    uint64_t keys[PHONETIC_MAX_WORDS][2];
+    size_t   num_words;
+} query_keys;
+
+static void add_query_word(void* uargs, const char* word, size_t size)
+{
+    query_keys* q = (query_keys*)uargs;
+    metaphone m;
+    double_metaphone(word, size, &m);
+    q->keys[q->num_words][0] = pack_key(m.primary, m.primary_size);
+    q->keys[q->num_words][1] = pack_key(m.alternate, m.alternate_size);
+    q->num_words += 1;
+}
+
+/* Checks that each word of the query sounds like a word of the name */
+static int matches_query(const query_keys* q, const candidate* c)
+{
+    key_set set;
+    name_keys(c->name, c->size, &set);
+    for(size_t w = 1; w < q->num_words; w++) {
+        int found = 0;
+        for(size_t i = 0; !found && i < set.num_keys; i++)
+            found = set.keys[i] == q->keys[w][0] || set.keys[i] == q->keys[w][1];
+        if(!found) return 0;
+    }
+    return 1;
+}
+
+YP_return_t phonetic_index_find(
+        const phonetic_index* index,
+        const char* query,
+        size_t query_size,
+        YP_record_fn fn,
+        void* uargs)
+{
+    query_keys q;
+    q.num_words = 0;
+    for_each_word(query, query_size, add_query_word, &q);
+    if(!q.num_words) return YP_SUCCESS;
+
+    /* names sounding like the first word, each listed once */
+    candidate_list list = { NULL, 0, 0, YP_SUCCESS };
+    reverse_index_find(&index->keys, q.keys[0][0], add_candidate, &list);
+    if(list.ret == YP_SUCCESS && q.keys[0][1] != q.keys[0][0])
+        reverse_index_find(&index->keys, q.keys[0][1], add_candidate, &list);
+    if(list.ret != YP_SUCCESS) {
+        free(list.items);
+        return list.ret;
+    }
+    qsort(list.items, list.count, sizeof(*list.items), compare_candidates);
+
+    for(size_t i = 0; i < list.count; i++) {
+        if(i && compare_candidates(&list.items[i-1], &list.items[i]) == 0)
+            continue;
+        if(!matches_query(&q, &list.items[i]))
+            continue;
+        if(fn(uargs, list.items[i].name, list.items[i].size, 0))
+            break;
+    }
+    free(list.items);
+    return YP_SUCCESS;
+}
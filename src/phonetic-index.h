@@ -0,0 +1,64 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _PHONETIC_INDEX_H
+#define _PHONETIC_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-backend.h"
+#include "reverse-index.h"
+
+/*
+ * Secondary index mapping the Double Metaphone keys of the words of
+ * the names to the names, so that sound-alikes ("Smith", "Smyth",
+ * "Schmidt") are found by seeking to a key rather than scanning the
+ * phonebook. Each word has a primary and an alternate key of at most
+ * 4 characters, packed into 64 bits and stored in a reverse index.
+ * The index is not thread-safe, the provider serializes its updates
+ * with those of the phonebook.
+ */
+
+#define PHONETIC_KEY_SIZE  4  // characters of a Double Metaphone key
+#define PHONETIC_MAX_WORDS 16 // words of a name or query that are indexed
+
+typedef struct phonetic_index {
+    reverse_index keys;
+} phonetic_index;
+
+YP_return_t phonetic_index_init(phonetic_index* index);
+
+void phonetic_index_destroy(phonetic_index* index);
+
+/**
+ * @brief Adds a name to the index under the keys of its words.
+ */
+YP_return_t phonetic_index_add(
+        phonetic_index* index,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Removes a name from the index, returns YP_ERR_NOT_FOUND if it
+ * wasn't there.
+ */
+YP_return_t phonetic_index_remove(
+        phonetic_index* index,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Calls fn (with a number of 0) on each name having, for every
+ * word of the query, a word that sounds alike, in lexicographic order,
+ * until it returns a non-zero value.
+ */
+YP_return_t phonetic_index_find(
+        const phonetic_index* index,
+        const char* query,
+        size_t query_size,
+        YP_record_fn fn,
+        void* uargs);
+
+#endif
@@ -3,12 +3,31 @@
  *
  * See COPYRIGHT in top-level directory.
  */
+#include <unistd.h>
 #include "YP/YP-server.h"
 #include "provider.h"
 #include "types.h"
+#include "hash.h"
+#include "snapshot.h"
+#include "reverse-index.h"
+#include "trigram-index.h"
+#include "phonetic-index.h"
+#include "expiry.h"
+#include "lease.h"
+#include "scan.h"
 
 // backends that we want to add at compile time
 #include "dummy/dummy-backend.h"
+#include "memory/memory-backend.h"
+#include "mmap/mmap-backend.h"
+#include "log/log-backend.h"
+#include "btree/btree-backend.h"
+#include "art/art-backend.h"
+#include "mphf/mphf-backend.h"
+#include "frontcode/frontcode-backend.h"
+#include "tiered/tiered-backend.h"
+#include "sharded/sharded-backend.h"
+#include "cache/cache-backend.h"
 
 static void YP_finalize_provider(void* p);
 
@@ -24,16 +43,149 @@ static inline YP_return_t add_phonebook(
 static inline YP_return_t remove_phonebook(
         YP_provider_t provider,
         const YP_phonebook_id_t* id,
-        int close_phonebook);
+        int destroy);
 
 static inline void remove_all_phonebooks(
         YP_provider_t provider);
 
-/* Functions to manipulate the list of backend types */
-static inline YP_backend_impl* find_backend_impl(
+/* Options of a phonebook implemented by the provider on top of its
+ * backend, read from the configuration of the phonebook */
+typedef struct phonebook_features {
+    double filter_bits;       // 0 for no filter
+    size_t filter_capacity;
+    char*  snapshot_path;     // NULL for no snapshots
+    double snapshot_interval;
+    int    indexes;           // INDEX_* flags
+    double expiry_tick;       // 0 for no expiry
+    double lease_duration;    // 0 for no leases
+} phonebook_features;
+
+/* Functions to set up the features of a phonebook */
+static YP_return_t parse_phonebook_features(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        const char* config,
+        phonebook_features* features);
+
+static void free_phonebook_features(
+        phonebook_features* features);
+
+static YP_return_t phonebook_attach_features(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        phonebook_features* features);
+
+static void phonebook_detach_features(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int destroy);
+
+static YP_return_t setup_phonebook(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        void* context,
+        phonebook_features* features,
+        YP_phonebook_id_t* id);
+
+/* Functions to manage the optional filter of a phonebook */
+static YP_return_t parse_filter_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        double* bits_per_name,
+        size_t* capacity);
+
+static void build_filter(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        size_t capacity);
+
+static void rebuild_filter(
+        YP_provider_t provider,
+        YP_phonebook* phonebook);
+
+static void destroy_filter(
+        YP_phonebook* phonebook);
+
+/* Functions to manage the optional snapshots of a phonebook */
+static YP_return_t parse_snapshot_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        char** path,
+        double* interval);
+
+static YP_return_t start_snapshots(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        double interval);
+
+static void stop_snapshots(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int destroy);
+
+/* Functions to manage the optional indexes of a phonebook */
+#define INDEX_REVERSE 1 // names by number
+#define INDEX_FUZZY   2 // names by trigram
+#define INDEX_PHONETIC 4 // names by Double Metaphone key
+
+static YP_return_t parse_index_config(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        struct json_object* jconfig,
+        int* indexes);
+
+static YP_return_t build_indexes(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int indexes);
+
+static YP_return_t add_to_indexes(
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number,
+        int known_name);
+
+static void remove_from_indexes(
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number,
+        int keep_name);
+
+static void destroy_indexes(
+        YP_phonebook* phonebook);
+
+/* Functions to manage the expiry of records inserted with a TTL */
+static YP_return_t parse_expiry_config(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        struct json_object* jconfig,
+        double* tick);
+
+static YP_return_t start_expiry(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        double tick);
+
+static void stop_expiry(
+        YP_phonebook* phonebook);
+
+/* Functions to manage the leases granted to the caches of clients */
+static YP_return_t parse_lease_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        double* duration);
+
+static YP_return_t start_leases(
         YP_provider_t provider,
-        const char* name);
+        YP_phonebook* phonebook,
+        double duration);
+
+static void destroy_leases(
+        YP_phonebook* phonebook);
 
+/* Functions to manipulate the list of backend types */
 static inline YP_return_t add_backend_impl(
         YP_provider_t provider,
         YP_backend_impl* backend);
@@ -55,12 +207,40 @@ static DECLARE_MARGO_RPC_HANDLER(YP_destroy_phonebook_ult)
 static void YP_destroy_phonebook_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(YP_list_phonebooks_ult)
 static void YP_list_phonebooks_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_snapshot_phonebook_ult)
+static void YP_snapshot_phonebook_ult(hg_handle_t h);
 
 /* Client RPCs */
 static DECLARE_MARGO_RPC_HANDLER(YP_hello_ult)
 static void YP_hello_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(YP_sum_ult)
 static void YP_sum_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_insert_ult)
+static void YP_insert_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_lookup_ult)
+static void YP_lookup_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_erase_ult)
+static void YP_erase_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_list_range_ult)
+static void YP_list_range_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_list_prefix_ult)
+static void YP_list_prefix_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_lookup_number_ult)
+static void YP_lookup_number_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_fuzzy_search_ult)
+static void YP_fuzzy_search_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_phonetic_lookup_ult)
+static void YP_phonetic_lookup_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_lookup_batch_ult)
+static void YP_lookup_batch_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_insert_batch_ult)
+static void YP_insert_batch_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_scan_begin_ult)
+static void YP_scan_begin_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_scan_next_ult)
+static void YP_scan_next_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(YP_scan_end_ult)
+static void YP_scan_end_ult(hg_handle_t h);
 
 /* add other RPC declarations here */
 
@@ -159,6 +339,12 @@ YP_return_t YP_provider_register(
     margo_register_data(mid, id, (void*)p, NULL);
     p->list_phonebooks_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_snapshot_phonebook",
+            snapshot_phonebook_in_t, snapshot_phonebook_out_t,
+            YP_snapshot_phonebook_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->snapshot_phonebook_id = id;
+
     /* Client RPCs */
 
     id = MARGO_REGISTER_PROVIDER(mid, "YP_hello",
@@ -174,11 +360,99 @@ YP_return_t YP_provider_register(
     margo_register_data(mid, id, (void*)p, NULL);
     p->sum_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_insert",
+            insert_in_t, insert_out_t,
+            YP_insert_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->insert_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_lookup",
+            lookup_in_t, lookup_out_t,
+            YP_lookup_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->lookup_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_erase",
+            erase_in_t, erase_out_t,
+            YP_erase_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->erase_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_list_range",
+            list_range_in_t, list_records_out_t,
+            YP_list_range_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->list_range_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_list_prefix",
+            list_prefix_in_t, list_records_out_t,
+            YP_list_prefix_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->list_prefix_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_lookup_number",
+            lookup_number_in_t, lookup_number_out_t,
+            YP_lookup_number_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->lookup_number_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_fuzzy_search",
+            fuzzy_search_in_t, fuzzy_search_out_t,
+            YP_fuzzy_search_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->fuzzy_search_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_phonetic_lookup",
+            phonetic_lookup_in_t, list_records_out_t,
+            YP_phonetic_lookup_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->phonetic_lookup_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_lookup_batch",
+            lookup_batch_in_t, lookup_batch_out_t,
+            YP_lookup_batch_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->lookup_batch_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_insert_batch",
+            insert_batch_in_t, insert_batch_out_t,
+            YP_insert_batch_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->insert_batch_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_scan_begin",
+            scan_begin_in_t, scan_begin_out_t,
+            YP_scan_begin_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->scan_begin_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_scan_next",
+            scan_next_in_t, scan_next_out_t,
+            YP_scan_next_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->scan_next_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "YP_scan_end",
+            scan_end_in_t, scan_end_out_t,
+            YP_scan_end_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->scan_end_id = id;
+
     /* add other RPC registration here */
     /* ... */
 
     /* add backends available at compiler time (e.g. default/dummy backends) */
     YP_provider_register_dummy_backend(p); // function from "dummy/dummy-backend.h"
+    YP_provider_register_memory_backend(p); // function from "memory/memory-backend.h"
+    YP_provider_register_mmap_backend(p); // function from "mmap/mmap-backend.h"
+    YP_provider_register_log_backend(p); // function from "log/log-backend.h"
+    YP_provider_register_btree_backend(p); // function from "btree/btree-backend.h"
+    YP_provider_register_art_backend(p); // function from "art/art-backend.h"
+    YP_provider_register_mphf_backend(p); // function from "mphf/mphf-backend.h"
+    YP_provider_register_frontcode_backend(p); // function from "frontcode/frontcode-backend.h"
+    YP_provider_register_tiered_backend(p); // function from "tiered/tiered-backend.h"
+    YP_provider_register_sharded_backend(p); // function from "sharded/sharded-backend.h"
+    YP_provider_register_cache_backend(p); // function from "cache/cache-backend.h"
 
     /* read the configuration to add defined phonebooks */
     struct json_object* phonebooks_array = json_object_object_get(config, "phonebooks");
@@ -195,28 +469,38 @@ YP_return_t YP_provider_register(
             }
             const char* type = json_object_get_string(phonebook_type);
             struct json_object* phonebook_config = json_object_object_get(phonebook, "config");
+            const char* phonebook_config_str = json_object_to_json_string(phonebook_config);
             YP_backend_impl* backend         = find_backend_impl(p, type);
             if(!backend) {
                 margo_error(mid, "Could not find backend of type \"%s\"", type);
                 continue;
             }
-            /* create a uuid for the new phonebook */
-            YP_phonebook_id_t id;
-            uuid_generate(id.uuid);
-            /* create the new phonebook's context */
+            /* read the configuration of the features of the phonebook */
+            phonebook_features features;
+            if(parse_phonebook_features(p, backend, phonebook_config_str,
+                                        &features) != YP_SUCCESS)
+                continue;
+            /* open the phonebook if a previous run of the provider left
+             * its data behind, create it otherwise (backends refuse to
+             * create a phonebook over existing data) */
             void* context = NULL;
-            int ret = backend->create_phonebook(p, json_object_to_json_string(phonebook_config), &context);
+            int ret = backend->open_phonebook(p, phonebook_config_str, &context);
+            if(ret != YP_SUCCESS) {
+                margo_debug(mid, "Could not open phonebook of type \"%s\", creating it", type);
+                ret = backend->create_phonebook(p, phonebook_config_str, &context);
+            }
             if(ret != YP_SUCCESS) {
                 margo_error(mid, "Could not create phonebook, backend returned %d", ret);
+                free_phonebook_features(&features);
+                continue;
+            }
+            /* set up the phonebook and add it to the provider */
+            YP_phonebook_id_t id;
+            ret = setup_phonebook(p, backend, context, &features, &id);
+            if(ret != YP_SUCCESS) {
+                margo_error(mid, "Could not add phonebook to the provider (error %d)", ret);
                 continue;
             }
-
-            /* allocate a phonebook, set it up, and add it to the provider */
-            YP_phonebook* phonebook_data = (YP_phonebook*)calloc(1, sizeof(*phonebook_data));
-            phonebook_data->fn  = backend;
-            phonebook_data->ctx = context;
-            phonebook_data->id  = id;
-            add_phonebook(p, phonebook_data);
 
             char id_str[37];
             YP_phonebook_id_to_string(id, id_str);
@@ -242,8 +526,22 @@ static void YP_finalize_provider(void* p)
     margo_deregister(provider->mid, provider->close_phonebook_id);
     margo_deregister(provider->mid, provider->destroy_phonebook_id);
     margo_deregister(provider->mid, provider->list_phonebooks_id);
+    margo_deregister(provider->mid, provider->snapshot_phonebook_id);
     margo_deregister(provider->mid, provider->hello_id);
     margo_deregister(provider->mid, provider->sum_id);
+    margo_deregister(provider->mid, provider->insert_id);
+    margo_deregister(provider->mid, provider->lookup_id);
+    margo_deregister(provider->mid, provider->erase_id);
+    margo_deregister(provider->mid, provider->list_range_id);
+    margo_deregister(provider->mid, provider->list_prefix_id);
+    margo_deregister(provider->mid, provider->lookup_number_id);
+    margo_deregister(provider->mid, provider->fuzzy_search_id);
+    margo_deregister(provider->mid, provider->phonetic_lookup_id);
+    margo_deregister(provider->mid, provider->lookup_batch_id);
+    margo_deregister(provider->mid, provider->insert_batch_id);
+    margo_deregister(provider->mid, provider->scan_begin_id);
+    margo_deregister(provider->mid, provider->scan_next_id);
+    margo_deregister(provider->mid, provider->scan_end_id);
     /* deregister other RPC ids ... */
     remove_all_phonebooks(provider);
     free(provider->backend_types);
@@ -337,9 +635,13 @@ static void YP_create_phonebook_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* create a uuid for the new phonebook */
-    YP_phonebook_id_t id;
-    uuid_generate(id.uuid);
+    /* read the configuration of the features of the phonebook */
+    phonebook_features features;
+    ret = parse_phonebook_features(provider, backend, in.config, &features);
+    if(ret != YP_SUCCESS) {
+        out.ret = ret;
+        goto finish;
+    }
 
     /* create the new phonebook's context */
     void* context = NULL;
@@ -347,15 +649,17 @@ static void YP_create_phonebook_ult(hg_handle_t h)
     if(ret != YP_SUCCESS) {
         out.ret = ret;
         margo_error(provider->mid, "Could not create phonebook, backend returned %d", ret);
+        free_phonebook_features(&features);
         goto finish;
     }
 
-    /* allocate a phonebook, set it up, and add it to the provider */
-    YP_phonebook* phonebook = (YP_phonebook*)calloc(1, sizeof(*phonebook));
-    phonebook->fn  = backend;
-    phonebook->ctx = context;
-    phonebook->id  = id;
-    add_phonebook(provider, phonebook);
+    /* set up the phonebook and add it to the provider */
+    YP_phonebook_id_t id;
+    ret = setup_phonebook(provider, backend, context, &features, &id);
+    if(ret != YP_SUCCESS) {
+        out.ret = ret;
+        goto finish;
+    }
 
     /* set the response */
     out.ret = YP_SUCCESS;
@@ -409,9 +713,13 @@ static void YP_open_phonebook_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* create a uuid for the new phonebook */
-    YP_phonebook_id_t id;
-    uuid_generate(id.uuid);
+    /* read the configuration of the features of the phonebook */
+    phonebook_features features;
+    ret = parse_phonebook_features(provider, backend, in.config, &features);
+    if(ret != YP_SUCCESS) {
+        out.ret = ret;
+        goto finish;
+    }
 
     /* create the new phonebook's context */
     void* context = NULL;
@@ -419,15 +727,17 @@ static void YP_open_phonebook_ult(hg_handle_t h)
     if(ret != YP_SUCCESS) {
         margo_error(mid, "Backend failed to open phonebook");
         out.ret = ret;
+        free_phonebook_features(&features);
         goto finish;
     }
 
-    /* allocate a phonebook, set it up, and add it to the provider */
-    YP_phonebook* phonebook = (YP_phonebook*)calloc(1, sizeof(*phonebook));
-    phonebook->fn  = backend;
-    phonebook->ctx = context;
-    phonebook->id  = id;
-    add_phonebook(provider, phonebook);
+    /* set up the phonebook and add it to the provider */
+    YP_phonebook_id_t id;
+    ret = setup_phonebook(provider, backend, context, &features, &id);
+    if(ret != YP_SUCCESS) {
+        out.ret = ret;
+        goto finish;
+    }
 
     /* set the response */
     out.ret = YP_SUCCESS;
@@ -475,7 +785,7 @@ static void YP_close_phonebook_ult(hg_handle_t h)
 
     /* remove the phonebook from the provider
      * (its close function will be called) */
-    ret = remove_phonebook(provider, &in.id, 1);
+    ret = remove_phonebook(provider, &in.id, 0);
     out.ret = ret;
 
     char id_str[37];
@@ -517,20 +827,10 @@ static void YP_destroy_phonebook_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* find the phonebook */
-    YP_phonebook* phonebook = find_phonebook(provider, &in.id);
-    if(!phonebook) {
-        margo_error(mid, "Could not find phonebook");
-        out.ret = YP_ERR_INVALID_PHONEBOOK;
-        goto finish;
-    }
-
-    /* destroy the phonebook's context */
-    phonebook->fn->destroy_phonebook(phonebook->ctx);
-
-    /* remove the phonebook from the provider
-     * (its close function will NOT be called) */
-    out.ret = remove_phonebook(provider, &in.id, 0);
+    /* remove the phonebook from the provider, its snapshot, and
+     * destroy the phonebook's context (its close function will NOT
+     * be called) */
+    out.ret = remove_phonebook(provider, &in.id, 1);
 
     if(out.ret == YP_SUCCESS) {
         char id_str[37];
@@ -599,6 +899,58 @@ finish:
 }
 static DEFINE_MARGO_RPC_HANDLER(YP_list_phonebooks_ult)
 
+static void YP_snapshot_phonebook_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    snapshot_phonebook_in_t  in;
+    snapshot_phonebook_out_t out;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* check the token sent by the admin */
+    if(!check_token(provider, in.token)) {
+        margo_error(mid, "Invalid token");
+        out.ret = YP_ERR_INVALID_TOKEN;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    /* an empty path means the one from the phonebook's configuration */
+    const char* path = (in.path && strlen(in.path)) ? in.path : phonebook->snapshot_path;
+    if(!path) {
+        margo_error(mid, "No path provided for the snapshot");
+        out.ret = YP_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    out.ret = snapshot_write(provider, phonebook->fn, phonebook->ctx, path);
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_snapshot_phonebook_ult)
+
 static void YP_hello_ult(hg_handle_t h)
 {
     hg_return_t hret;
@@ -677,87 +1029,1937 @@ finish:
 }
 static DEFINE_MARGO_RPC_HANDLER(YP_sum_ult)
 
-static inline YP_phonebook* find_phonebook(
+/* Inserts a record, keeping the filter of the phonebook up to date */
+static YP_return_t insert_record(
         YP_provider_t provider,
-        const YP_phonebook_id_t* id)
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number)
 {
-    YP_phonebook* phonebook = NULL;
-    HASH_FIND(hh, provider->phonebooks, id, sizeof(YP_phonebook_id_t), phonebook);
-    return phonebook;
+    if(phonebook->filter_lock == ABT_RWLOCK_NULL)
+        return phonebook->fn->insert(phonebook->ctx, name, name_size, number);
+    /* add the name to the filter first, so that concurrent lookups
+     * can't miss it once it is in the phonebook, and hold the lock
+     * so that the filter isn't rebuilt in between */
+    ABT_rwlock_rdlock(phonebook->filter_lock);
+    bloom_filter* filter = phonebook->filter;
+    if(filter && bloom_filter_is_full(filter)) {
+        ABT_rwlock_unlock(phonebook->filter_lock);
+        rebuild_filter(provider, phonebook);
+        ABT_rwlock_rdlock(phonebook->filter_lock);
+        filter = phonebook->filter;
+    }
+    if(filter) bloom_filter_add(filter, YP_hash(name, name_size));
+    YP_return_t ret = phonebook->fn->insert(phonebook->ctx, name, name_size, number);
+    ABT_rwlock_unlock(phonebook->filter_lock);
+    return ret;
 }
 
-static inline YP_return_t add_phonebook(
+/* Inserts or updates a record, keeping the indexes of the phonebook
+ * up to date */
+static YP_return_t update_record(
         YP_provider_t provider,
-        YP_phonebook* phonebook)
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number)
 {
-    YP_phonebook* existing = find_phonebook(provider, &(phonebook->id));
-    if(existing) {
-        return YP_ERR_INVALID_PHONEBOOK;
+    YP_return_t ret;
+    if(phonebook->index_lock != ABT_RWLOCK_NULL) {
+        /* no other update may run between those of the phonebook and
+         * of its indexes, so that they stay consistent */
+        ABT_rwlock_wrlock(phonebook->index_lock);
+        YP_number_t old_number = 0;
+        int replaced = phonebook->fn->lookup(phonebook->ctx, name, name_size,
+                                             &old_number) == YP_SUCCESS;
+        if(replaced && old_number == number) {
+            ret = insert_record(provider, phonebook, name, name_size, number);
+        } else {
+            /* index the record first so that failing to do so leaves
+             * the phonebook untouched, and undo it if the insert fails */
+            ret = add_to_indexes(phonebook, name, name_size, number, replaced);
+            if(ret == YP_SUCCESS) {
+                ret = insert_record(provider, phonebook, name, name_size, number);
+                if(ret != YP_SUCCESS)
+                    remove_from_indexes(phonebook, name, name_size, number, replaced);
+                else if(replaced)
+                    remove_from_indexes(phonebook, name, name_size, old_number, 1);
+            }
+        }
+        ABT_rwlock_unlock(phonebook->index_lock);
+    } else {
+        ret = insert_record(provider, phonebook, name, name_size, number);
     }
-    HASH_ADD(hh, provider->phonebooks, id, sizeof(YP_phonebook_id_t), phonebook);
-    provider->num_phonebooks += 1;
-    return YP_SUCCESS;
+    return ret;
 }
 
-static inline YP_return_t remove_phonebook(
+/* Inserts or updates a record that expires after ttl_ms (0 for never),
+ * or returns YP_ERR_OP_UNSUPPORTED if the phonebook can't expire it */
+static YP_return_t insert_with_ttl(
         YP_provider_t provider,
-        const YP_phonebook_id_t* id,
-        int close_phonebook)
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number,
+        uint64_t ttl_ms)
 {
-    YP_phonebook* phonebook = find_phonebook(provider, id);
-    if(!phonebook) {
-        return YP_ERR_INVALID_PHONEBOOK;
-    }
-    YP_return_t ret = YP_SUCCESS;
-    if(close_phonebook) {
-        ret = phonebook->fn->close_phonebook(phonebook->ctx);
-    }
-    HASH_DEL(provider->phonebooks, phonebook);
-    free(phonebook);
-    provider->num_phonebooks -= 1;
+    YP_return_t ret;
+    if(!phonebook->expiry_task)
+        return ttl_ms ? YP_ERR_OP_UNSUPPORTED
+                      : update_record(provider, phonebook, name, name_size, number);
+    /* the record must not expire under its previous deadline between
+     * its update and that of its deadline; only its name is locked, so
+     * updates of other names (and their WAL waits) proceed concurrently */
+    expiry_lock_name(phonebook->expiry_task, name, name_size);
+    ret = update_record(provider, phonebook, name, name_size, number);
+    if(ret == YP_SUCCESS)
+        ret = expiry_set(phonebook->expiry_task, name, name_size,
+                         (double)ttl_ms*1e-3);
+    expiry_unlock_name(phonebook->expiry_task, name, name_size);
     return ret;
 }
 
-static inline void remove_all_phonebooks(
-        YP_provider_t provider)
+/* Inserts or updates a batch of records. Records of phonebooks with
+ * indexes or expiry are inserted one at a time, since those need to
+ * see the previous number of each name; otherwise the whole batch is
+ * handed to the backend. */
+static YP_return_t insert_records(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        size_t count,
+        const char* const* names,
+        const size_t* name_sizes,
+        const YP_number_t* numbers)
 {
-    YP_phonebook *r, *tmp;
-    HASH_ITER(hh, provider->phonebooks, r, tmp) {
-        HASH_DEL(provider->phonebooks, r);
-        r->fn->close_phonebook(r->ctx);
-        free(r);
+    YP_return_t ret = YP_SUCCESS;
+    if(phonebook->index_lock != ABT_RWLOCK_NULL || phonebook->expiry_task
+    || !phonebook->fn->insert_batch) {
+        for(size_t i = 0; i < count && ret == YP_SUCCESS; i++)
+            ret = insert_with_ttl(provider, phonebook, names[i], name_sizes[i], numbers[i], 0);
+        return ret;
     }
-    provider->num_phonebooks = 0;
+    if(phonebook->filter_lock == ABT_RWLOCK_NULL)
+        return phonebook->fn->insert_batch(phonebook->ctx, count, names, name_sizes, numbers);
+    /* see insert_record; the filter may go over its capacity, in which
+     * case it is rebuilt once the batch is in the phonebook */
+    ABT_rwlock_rdlock(phonebook->filter_lock);
+    bloom_filter* filter = phonebook->filter;
+    if(filter) {
+        for(size_t i = 0; i < count; i++)
+            bloom_filter_add(filter, YP_hash(names[i], name_sizes[i]));
+    }
+    ret = phonebook->fn->insert_batch(phonebook->ctx, count, names, name_sizes, numbers);
+    int full = filter && bloom_filter_is_full(filter);
+    ABT_rwlock_unlock(phonebook->filter_lock);
+    if(full) rebuild_filter(provider, phonebook);
+    return ret;
 }
 
-static inline YP_backend_impl* find_backend_impl(
-        YP_provider_t provider,
-        const char* name)
+static void YP_insert_ult(hg_handle_t h)
 {
-    size_t i;
-    for(i = 0; i < provider->num_backend_types; i++) {
-        YP_backend_impl* impl = provider->backend_types[i];
-        if(strcmp(name, impl->name) == 0)
-            return impl;
+    hg_return_t hret;
+    insert_in_t  in;
+    insert_out_t out;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
     }
-    return NULL;
-}
 
-static inline YP_return_t add_backend_impl(
-        YP_provider_t provider,
-        YP_backend_impl* backend)
-{
-    provider->num_backend_types += 1;
-    provider->backend_types = realloc(provider->backend_types,
-                                      provider->num_backend_types);
-    provider->backend_types[provider->num_backend_types-1] = backend;
-    return YP_SUCCESS;
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->insert) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    const char* name = in.name;
+    size_t name_size = strlen(in.name);
+    if(phonebook->leases) {
+        /* the caches of the clients must drop the record first */
+        out.ret = lease_block(phonebook->leases, 1, &name, &name_size);
+        if(out.ret != YP_SUCCESS) goto finish;
+    }
+    out.ret = insert_with_ttl(provider, phonebook, name, name_size,
+                              in.number, in.ttl_ms);
+    if(phonebook->leases)
+        lease_unblock(phonebook->leases, 1, &name, &name_size);
+
+    margo_debug(mid, "Called insert RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
 }
+static DEFINE_MARGO_RPC_HANDLER(YP_insert_ult)
 
-static inline int check_token(
-        YP_provider_t provider,
-        const char* token)
+static void YP_insert_batch_ult(hg_handle_t h)
 {
-    if(!provider->token) return 1;
+    hg_return_t hret;
+    insert_batch_in_t  in;
+    insert_batch_out_t out;
+    char* buffer = NULL;
+    const char** names = NULL;
+    size_t* name_sizes = NULL;
+    YP_number_t* numbers = NULL;
+    hg_bulk_t bulk = HG_BULK_NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->insert) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* each record takes at least its name size and number */
+    const size_t min_record_size = sizeof(uint32_t) + sizeof(YP_number_t);
+    if(in.count == 0 || in.size/min_record_size < in.count) {
+        out.ret = YP_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    buffer     = (char*)malloc(in.size);
+    names      = (const char**)malloc(in.count*sizeof(*names));
+    name_sizes = (size_t*)malloc(in.count*sizeof(*name_sizes));
+    numbers    = (YP_number_t*)malloc(in.count*sizeof(*numbers));
+    if(!buffer || !names || !name_sizes || !numbers) {
+        out.ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    void* segment = buffer;
+    hg_size_t segment_size = in.size;
+    hret = margo_bulk_create(mid, 1, &segment, &segment_size, HG_BULK_WRITE_ONLY, &bulk);
+    if(hret != HG_SUCCESS) {
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.bulk, 0,
+                               bulk, 0, in.size);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not pull records (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* the records point into the buffer, see insert_batch_in_t */
+    size_t offset = 0;
+    for(hg_size_t i = 0; i < in.count; i++) {
+        uint32_t name_size;
+        if(in.size - offset < min_record_size) {
+            out.ret = YP_ERR_INVALID_ARGS;
+            goto finish;
+        }
+        memcpy(&name_size, buffer + offset, sizeof(name_size));
+        offset += sizeof(name_size);
+        if(in.size - offset - sizeof(YP_number_t) < name_size) {
+            out.ret = YP_ERR_INVALID_ARGS;
+            goto finish;
+        }
+        names[i]      = buffer + offset;
+        name_sizes[i] = name_size;
+        offset += name_size;
+        memcpy(&numbers[i], buffer + offset, sizeof(numbers[i]));
+        offset += sizeof(numbers[i]);
+    }
+    if(offset != in.size) {
+        out.ret = YP_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    if(phonebook->leases) {
+        /* see YP_insert_ult */
+        out.ret = lease_block(phonebook->leases, in.count, names, name_sizes);
+        if(out.ret != YP_SUCCESS) goto finish;
+    }
+    out.ret = insert_records(provider, phonebook, in.count, names, name_sizes, numbers);
+    if(phonebook->leases)
+        lease_unblock(phonebook->leases, in.count, names, name_sizes);
+
+    margo_debug(mid, "Called insert_batch RPC");
+
+finish:
+    if(bulk != HG_BULK_NULL) margo_bulk_free(bulk);
+    free(buffer);
+    free(names);
+    free(name_sizes);
+    free(numbers);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_insert_batch_ult)
+
+static void YP_lookup_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    lookup_in_t  in;
+    lookup_out_t out;
+    out.number   = 0;
+    out.lease_ms = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->lookup) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* names that were never added to the filter are not in the phonebook */
+    size_t name_size = strlen(in.name);
+    if(phonebook->filter_lock != ABT_RWLOCK_NULL) {
+        ABT_rwlock_rdlock(phonebook->filter_lock);
+        int absent = phonebook->filter
+                  && !bloom_filter_may_contain(phonebook->filter, YP_hash(in.name, name_size));
+        ABT_rwlock_unlock(phonebook->filter_lock);
+        if(absent) {
+            out.ret = YP_ERR_NOT_FOUND;
+            goto finish;
+        }
+    }
+
+    /* the lease must be granted before reading the record, so that an
+     * update can't be applied in between */
+    if(phonebook->leases && in.lease)
+        out.lease_ms = lease_grant(phonebook->leases, in.name, name_size);
+
+    /* call lookup on the phonebook's context */
+    out.ret = phonebook->fn->lookup(phonebook->ctx, in.name, name_size, &out.number);
+
+    margo_debug(mid, "Called lookup RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_lookup_ult)
+
+static void YP_lookup_batch_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    lookup_batch_in_t  in;
+    lookup_batch_out_t out;
+    char* names = NULL;
+    YP_number_t* numbers = NULL;
+    hg_bulk_t bulk = HG_BULK_NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->lookup) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* each name takes at least its null terminator */
+    if(in.count == 0 || in.names_size < in.count
+    || in.count > SIZE_MAX/(sizeof(YP_number_t) + sizeof(int32_t) + sizeof(uint32_t))) {
+        out.ret = YP_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    /* the numbers, return codes and leases are pushed back in one transfer */
+    size_t results_size = in.count*(sizeof(YP_number_t) + sizeof(int32_t) + sizeof(uint32_t));
+    names   = (char*)malloc(in.names_size);
+    numbers = (YP_number_t*)malloc(results_size);
+    if(!names || !numbers) {
+        out.ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    int32_t*  rets   = (int32_t*)(numbers + in.count);
+    uint32_t* leases = (uint32_t*)(rets + in.count);
+
+    void* segments[2] = { names, numbers };
+    hg_size_t sizes[2] = { in.names_size, results_size };
+    hret = margo_bulk_create(mid, 2, segments, sizes, HG_BULK_READWRITE, &bulk);
+    if(hret != HG_SUCCESS) {
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.bulk, 0,
+                               bulk, 0, in.names_size);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not pull names (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* names that were never added to the filter are not in the phonebook;
+     * the filter can't be replaced while the batch is being looked up */
+    if(phonebook->filter_lock != ABT_RWLOCK_NULL)
+        ABT_rwlock_rdlock(phonebook->filter_lock);
+    bloom_filter* filter = phonebook->filter;
+    const char* name = names;
+    const char* end  = names + in.names_size;
+    out.ret = YP_SUCCESS;
+    for(hg_size_t i = 0; i < in.count; i++) {
+        const char* nul = name < end ? (const char*)memchr(name, '\0', (size_t)(end - name)) : NULL;
+        if(!nul) {
+            out.ret = YP_ERR_INVALID_ARGS;
+            break;
+        }
+        size_t name_size = (size_t)(nul - name);
+        numbers[i] = 0;
+        leases[i]  = 0;
+        if(filter && !bloom_filter_may_contain(filter, YP_hash(name, name_size))) {
+            rets[i] = YP_ERR_NOT_FOUND;
+        } else {
+            /* see YP_lookup_ult */
+            if(phonebook->leases && in.lease)
+                leases[i] = lease_grant(phonebook->leases, name, name_size);
+            rets[i] = phonebook->fn->lookup(phonebook->ctx, name, name_size, &numbers[i]);
+        }
+        name = nul + 1;
+    }
+    if(phonebook->filter_lock != ABT_RWLOCK_NULL)
+        ABT_rwlock_unlock(phonebook->filter_lock);
+    if(out.ret != YP_SUCCESS) goto finish;
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, in.names_size,
+                               bulk, in.names_size, results_size);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not push results (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    out.ret = YP_SUCCESS;
+
+    margo_debug(mid, "Called lookup_batch RPC");
+
+finish:
+    if(bulk != HG_BULK_NULL) margo_bulk_free(bulk);
+    free(names);
+    free(numbers);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_lookup_batch_ult)
+
+/* Erases a record, keeping the indexes of the phonebook up to date */
+static YP_return_t erase_record(
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size)
+{
+    YP_return_t ret;
+    if(phonebook->index_lock != ABT_RWLOCK_NULL) {
+        /* see update_record */
+        ABT_rwlock_wrlock(phonebook->index_lock);
+        YP_number_t number = 0;
+        ret = phonebook->fn->lookup(phonebook->ctx, name, name_size, &number);
+        if(ret == YP_SUCCESS)
+            ret = phonebook->fn->erase(phonebook->ctx, name, name_size);
+        if(ret == YP_SUCCESS)
+            remove_from_indexes(phonebook, name, name_size, number, 0);
+        ABT_rwlock_unlock(phonebook->index_lock);
+    } else {
+        /* call erase on the phonebook's context */
+        ret = phonebook->fn->erase(phonebook->ctx, name, name_size);
+    }
+    return ret;
+}
+
+static void YP_erase_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    erase_in_t  in;
+    erase_out_t out;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->erase) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    const char* name = in.name;
+    size_t name_size = strlen(in.name);
+    if(phonebook->leases) {
+        /* see YP_insert_ult */
+        out.ret = lease_block(phonebook->leases, 1, &name, &name_size);
+        if(out.ret != YP_SUCCESS) goto finish;
+    }
+    if(phonebook->expiry_task) {
+        /* see insert_with_ttl */
+        expiry_lock_name(phonebook->expiry_task, name, name_size);
+        out.ret = erase_record(phonebook, name, name_size);
+        if(out.ret == YP_SUCCESS)
+            expiry_set(phonebook->expiry_task, name, name_size, 0);
+        expiry_unlock_name(phonebook->expiry_task, name, name_size);
+    } else {
+        out.ret = erase_record(phonebook, name, name_size);
+    }
+    if(phonebook->leases)
+        lease_unblock(phonebook->leases, 1, &name, &name_size);
+
+    margo_debug(mid, "Called erase RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_erase_ult)
+
+/* Accumulates the records listed by a backend into a list_records_out_t */
+typedef struct record_collector {
+    list_records_out_t* out;
+    hg_size_t           max;
+    hg_size_t           capacity;
+} record_collector;
+
+static int collect_record(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    record_collector*   c   = (record_collector*)uargs;
+    list_records_out_t* out = c->out;
+    if(out->count == c->capacity) {
+        hg_size_t capacity = c->capacity ? 2*c->capacity : 16;
+        if(capacity > c->max) capacity = c->max;
+        hg_string_t* names = (hg_string_t*)realloc(out->names, capacity*sizeof(*names));
+        if(names) out->names = names;
+        YP_number_t* numbers = (YP_number_t*)realloc(out->numbers, capacity*sizeof(*numbers));
+        if(numbers) out->numbers = numbers;
+        if(!names || !numbers) {
+            out->ret = YP_ERR_ALLOCATION;
+            return 1;
+        }
+        c->capacity = capacity;
+    }
+    char* copy = (char*)malloc(name_size + 1);
+    if(!copy) {
+        out->ret = YP_ERR_ALLOCATION;
+        return 1;
+    }
+    memcpy(copy, name, name_size);
+    copy[name_size] = '\0';
+    out->names[out->count]   = copy;
+    out->numbers[out->count] = number;
+    out->count += 1;
+    return out->count == c->max;
+}
+
+static void free_records(list_records_out_t* out)
+{
+    for(hg_size_t i = 0; i < out->count; i++)
+        free(out->names[i]);
+    free(out->names);
+    free(out->numbers);
+}
+
+static void YP_list_range_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    list_range_in_t    in;
+    list_records_out_t out;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->list_range) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* call list_range on the phonebook's context */
+    if(in.max) {
+        record_collector collector = { &out, in.max, 0 };
+        YP_return_t ret = phonebook->fn->list_range(phonebook->ctx,
+                in.lower, in.lower ? strlen(in.lower) : 0, in.inclusive,
+                in.upper, in.upper ? strlen(in.upper) : 0,
+                collect_record, &collector);
+        if(out.ret == YP_SUCCESS) out.ret = ret;
+    }
+
+    margo_debug(mid, "Called list_range RPC");
+
+finish:
+    if(out.ret != YP_SUCCESS) {
+        /* don't send partial results */
+        free_records(&out);
+        out.count   = 0;
+        out.names   = NULL;
+        out.numbers = NULL;
+    }
+    hret = margo_respond(h, &out);
+    free_records(&out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_list_range_ult)
+
+static void YP_list_prefix_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    list_prefix_in_t   in;
+    list_records_out_t out;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fn->list_prefix) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* call list_prefix on the phonebook's context */
+    if(in.max) {
+        record_collector collector = { &out, in.max, 0 };
+        YP_return_t ret = phonebook->fn->list_prefix(phonebook->ctx,
+                in.prefix, in.prefix ? strlen(in.prefix) : 0,
+                collect_record, &collector);
+        if(out.ret == YP_SUCCESS) out.ret = ret;
+    }
+
+    margo_debug(mid, "Called list_prefix RPC");
+
+finish:
+    if(out.ret != YP_SUCCESS) {
+        /* don't send partial results */
+        free_records(&out);
+        out.count   = 0;
+        out.names   = NULL;
+        out.numbers = NULL;
+    }
+    hret = margo_respond(h, &out);
+    free_records(&out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_list_prefix_ult)
+
+/* Accumulates the names found in a reverse index into a lookup_number_out_t */
+typedef struct name_collector {
+    lookup_number_out_t* out;
+    hg_size_t            max;
+    hg_size_t            capacity;
+} name_collector;
+
+static int collect_name(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)number;
+    name_collector*      c   = (name_collector*)uargs;
+    lookup_number_out_t* out = c->out;
+    if(out->count == c->capacity) {
+        hg_size_t capacity = c->capacity ? 2*c->capacity : 4;
+        if(capacity > c->max) capacity = c->max;
+        hg_string_t* names = (hg_string_t*)realloc(out->names, capacity*sizeof(*names));
+        if(!names) {
+            out->ret = YP_ERR_ALLOCATION;
+            return 1;
+        }
+        out->names  = names;
+        c->capacity = capacity;
+    }
+    char* copy = (char*)malloc(name_size + 1);
+    if(!copy) {
+        out->ret = YP_ERR_ALLOCATION;
+        return 1;
+    }
+    memcpy(copy, name, name_size);
+    copy[name_size] = '\0';
+    out->names[out->count] = copy;
+    out->count += 1;
+    return out->count == c->max;
+}
+
+static void YP_lookup_number_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    lookup_number_in_t  in;
+    lookup_number_out_t out;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->reverse_index) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* look the number up in the reverse index */
+    if(in.max) {
+        name_collector collector = { &out, in.max, 0 };
+        ABT_rwlock_rdlock(phonebook->index_lock);
+        reverse_index_find(phonebook->reverse_index, in.number, collect_name, &collector);
+        ABT_rwlock_unlock(phonebook->index_lock);
+        if(out.ret == YP_SUCCESS && out.count == 0)
+            out.ret = YP_ERR_NOT_FOUND;
+    }
+
+    margo_debug(mid, "Called lookup_number RPC");
+
+finish:
+    if(out.ret != YP_SUCCESS) {
+        /* don't send partial results */
+        for(hg_size_t i = 0; i < out.count; i++)
+            free(out.names[i]);
+        free(out.names);
+        out.count = 0;
+        out.names = NULL;
+    }
+    hret = margo_respond(h, &out);
+    for(hg_size_t i = 0; i < out.count; i++)
+        free(out.names[i]);
+    free(out.names);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_lookup_number_ult)
+
+/* Upper bound on the matches of a fuzzy search, whatever the client asks */
+#define FUZZY_SEARCH_MAX 1024
+
+static void YP_fuzzy_search_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    fuzzy_search_in_t  in;
+    fuzzy_search_out_t out;
+    trigram_match* matches = NULL;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->fuzzy_index) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    size_t max = in.max < FUZZY_SEARCH_MAX ? in.max : FUZZY_SEARCH_MAX;
+    if(max) {
+        matches     = (trigram_match*)malloc(max*sizeof(*matches));
+        out.names   = (hg_string_t*)calloc(max, sizeof(*out.names));
+        out.numbers = (YP_number_t*)malloc(max*sizeof(*out.numbers));
+        out.scores  = (double*)malloc(max*sizeof(*out.scores));
+        if(!matches || !out.names || !out.numbers || !out.scores) {
+            out.ret = YP_ERR_ALLOCATION;
+            goto finish;
+        }
+        /* the matches point into the index, so they are copied, along
+         * with their numbers, before any update can invalidate them */
+        ABT_rwlock_rdlock(phonebook->index_lock);
+        size_t count = max;
+        out.ret = trigram_index_search(phonebook->fuzzy_index, in.query,
+                                       strlen(in.query), matches, &count);
+        for(size_t i = 0; out.ret == YP_SUCCESS && i < count; i++) {
+            YP_number_t number;
+            if(phonebook->fn->lookup(phonebook->ctx, matches[i].name,
+                                     matches[i].name_size, &number) != YP_SUCCESS)
+                continue;
+            char* copy = (char*)malloc(matches[i].name_size + 1);
+            if(!copy) {
+                out.ret = YP_ERR_ALLOCATION;
+                break;
+            }
+            memcpy(copy, matches[i].name, matches[i].name_size);
+            copy[matches[i].name_size] = '\0';
+            out.names[out.count]   = copy;
+            out.numbers[out.count] = number;
+            out.scores[out.count]  = matches[i].score;
+            out.count += 1;
+        }
+        ABT_rwlock_unlock(phonebook->index_lock);
+    }
+
+    margo_debug(mid, "Called fuzzy_search RPC");
+
+finish:
+    if(out.ret != YP_SUCCESS) {
+        /* don't send partial results */
+        for(hg_size_t i = 0; i < out.count; i++)
+            free(out.names[i]);
+        out.count = 0;
+    }
+    hret = margo_respond(h, &out);
+    for(hg_size_t i = 0; i < out.count; i++)
+        free(out.names[i]);
+    free(out.names);
+    free(out.numbers);
+    free(out.scores);
+    free(matches);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_fuzzy_search_ult)
+
+/* Adds the names found in a phonetic index, with their numbers, to a
+ * record_collector */
+typedef struct phonetic_collector {
+    YP_phonebook*    phonebook;
+    record_collector records;
+} phonetic_collector;
+
+static int collect_phonetic_match(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    phonetic_collector* c = (phonetic_collector*)uargs;
+    if(c->phonebook->fn->lookup(c->phonebook->ctx, name, name_size, &number) != YP_SUCCESS)
+        return 0;
+    return collect_record(&c->records, name, name_size, number);
+}
+
+static void YP_phonetic_lookup_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    phonetic_lookup_in_t in;
+    list_records_out_t   out;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(!phonebook->phonetic_index) {
+        out.ret = YP_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* look the query up in the phonetic index */
+    if(in.max) {
+        phonetic_collector collector = { phonebook, { &out, in.max, 0 } };
+        ABT_rwlock_rdlock(phonebook->index_lock);
+        YP_return_t ret = phonetic_index_find(phonebook->phonetic_index,
+                in.query, strlen(in.query), collect_phonetic_match, &collector);
+        ABT_rwlock_unlock(phonebook->index_lock);
+        if(out.ret == YP_SUCCESS) out.ret = ret;
+        if(out.ret == YP_SUCCESS && out.count == 0)
+            out.ret = YP_ERR_NOT_FOUND;
+    }
+
+    margo_debug(mid, "Called phonetic_lookup RPC");
+
+finish:
+    if(out.ret != YP_SUCCESS) {
+        /* don't send partial results */
+        free_records(&out);
+        out.count   = 0;
+        out.names   = NULL;
+        out.numbers = NULL;
+    }
+    hret = margo_respond(h, &out);
+    free_records(&out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_phonetic_lookup_ult)
+
+#define SCAN_MAX_PAGE_SIZE (64*1024*1024)
+
+static void YP_scan_begin_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    scan_begin_in_t  in;
+    scan_begin_out_t out;
+    out.scan_id = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    if(in.page_size == 0 || in.page_size > SCAN_MAX_PAGE_SIZE) {
+        out.ret = YP_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    /* the first page is read while the response is sent */
+    out.ret = scan_open(phonebook->scans, in.page_size, &out.scan_id);
+
+    margo_debug(mid, "Called scan_begin RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_scan_begin_ult)
+
+static void YP_scan_next_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    scan_next_in_t  in;
+    scan_next_out_t out;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    /* take the page read in advance */
+    scan_cursor* cursor;
+    scan_page page;
+    out.ret = scan_acquire(phonebook->scans, in.scan_id, &cursor, &page);
+    if(out.ret != YP_SUCCESS) goto finish;
+
+    /* pages fit in the page_size bytes exposed by the client */
+    if(page.size) {
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0,
+                                   page.bulk, 0, page.size);
+        if(hret != HG_SUCCESS) {
+            margo_error(mid, "Could not push records (mercury error %d)", hret);
+            out.ret = YP_ERR_FROM_MERCURY;
+        }
+    }
+    if(out.ret == YP_SUCCESS) {
+        out.count = page.count;
+        out.size  = page.size;
+        out.last  = page.last ? HG_TRUE : HG_FALSE;
+    }
+
+    /* read the next page while the client goes through this one */
+    scan_release(phonebook->scans, cursor);
+
+    margo_debug(mid, "Called scan_next RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_scan_next_ult)
+
+static void YP_scan_end_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    scan_end_in_t  in;
+    scan_end_out_t out;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    YP_provider_t provider = (YP_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = YP_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* find the phonebook */
+    YP_phonebook* phonebook = find_phonebook(provider, &in.phonebook_id);
+    if(!phonebook) {
+        margo_error(mid, "Could not find requested phonebook");
+        out.ret = YP_ERR_INVALID_PHONEBOOK;
+        goto finish;
+    }
+
+    out.ret = scan_close(phonebook->scans, in.scan_id);
+
+    margo_debug(mid, "Called scan_end RPC");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(YP_scan_end_ult)
+
+static inline YP_phonebook* find_phonebook(
+        YP_provider_t provider,
+        const YP_phonebook_id_t* id)
+{
+    YP_phonebook* phonebook = NULL;
+    HASH_FIND(hh, provider->phonebooks, id, sizeof(YP_phonebook_id_t), phonebook);
+    return phonebook;
+}
+
+static inline YP_return_t add_phonebook(
+        YP_provider_t provider,
+        YP_phonebook* phonebook)
+{
+    YP_phonebook* existing = find_phonebook(provider, &(phonebook->id));
+    if(existing) {
+        return YP_ERR_INVALID_PHONEBOOK;
+    }
+    YP_return_t ret = scan_table_create(provider, phonebook->fn, phonebook->ctx,
+                                        &phonebook->scans);
+    if(ret != YP_SUCCESS) {
+        return ret;
+    }
+    HASH_ADD(hh, provider->phonebooks, id, sizeof(YP_phonebook_id_t), phonebook);
+    provider->num_phonebooks += 1;
+    return YP_SUCCESS;
+}
+
+static inline YP_return_t remove_phonebook(
+        YP_provider_t provider,
+        const YP_phonebook_id_t* id,
+        int destroy)
+{
+    YP_phonebook* phonebook = find_phonebook(provider, id);
+    if(!phonebook) {
+        return YP_ERR_INVALID_PHONEBOOK;
+    }
+    YP_return_t ret = YP_SUCCESS;
+    HASH_DEL(provider->phonebooks, phonebook);
+    /* cursors and the expiry task may be reading the backend */
+    scan_table_destroy(phonebook->scans);
+    phonebook_detach_features(provider, phonebook, destroy);
+    if(destroy)
+        ret = phonebook->fn->destroy_phonebook(phonebook->ctx);
+    else
+        ret = phonebook->fn->close_phonebook(phonebook->ctx);
+    free(phonebook);
+    provider->num_phonebooks -= 1;
+    return ret;
+}
+
+static inline void remove_all_phonebooks(
+        YP_provider_t provider)
+{
+    YP_phonebook *r, *tmp;
+    HASH_ITER(hh, provider->phonebooks, r, tmp) {
+        HASH_DEL(provider->phonebooks, r);
+        scan_table_destroy(r->scans);
+        phonebook_detach_features(provider, r, 0);
+        r->fn->close_phonebook(r->ctx);
+        free(r);
+    }
+    provider->num_phonebooks = 0;
+}
+
+static YP_return_t parse_phonebook_features(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        const char* config,
+        phonebook_features* features)
+{
+    memset(features, 0, sizeof(*features));
+    /* an invalid configuration is reported by the backend */
+    struct json_object* jconfig = config ? json_tokener_parse(config) : NULL;
+    if(!jconfig) return YP_SUCCESS;
+    YP_return_t ret = YP_SUCCESS;
+    if(!json_object_is_type(jconfig, json_type_object))
+        goto finish;
+    ret = parse_filter_config(provider, jconfig, &features->filter_bits,
+                              &features->filter_capacity);
+    if(ret == YP_SUCCESS)
+        ret = parse_snapshot_config(provider, jconfig, &features->snapshot_path,
+                                    &features->snapshot_interval);
+    if(ret == YP_SUCCESS)
+        ret = parse_index_config(provider, backend, jconfig, &features->indexes);
+    if(ret == YP_SUCCESS)
+        ret = parse_expiry_config(provider, backend, jconfig, &features->expiry_tick);
+    if(ret == YP_SUCCESS)
+        ret = parse_lease_config(provider, jconfig, &features->lease_duration);
+    if(ret != YP_SUCCESS)
+        free_phonebook_features(features);
+
+finish:
+    json_object_put(jconfig);
+    return ret;
+}
+
+static void free_phonebook_features(
+        phonebook_features* features)
+{
+    free(features->snapshot_path);
+    features->snapshot_path = NULL;
+}
+
+/* Sets up the features of a phonebook that is not yet visible to RPCs,
+ * taking over the snapshot path. The features that were set up are
+ * torn down on failure; failing to build the filter only disables it. */
+static YP_return_t phonebook_attach_features(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        phonebook_features* features)
+{
+    phonebook->filter_bits   = features->filter_bits;
+    phonebook->snapshot_path = features->snapshot_path;
+    features->snapshot_path  = NULL;
+    YP_return_t ret = start_snapshots(provider, phonebook, features->snapshot_interval);
+    if(ret != YP_SUCCESS) {
+        /* don't replace a snapshot that could not be loaded */
+        free(phonebook->snapshot_path);
+        phonebook->snapshot_path = NULL;
+        return ret;
+    }
+    ret = build_indexes(provider, phonebook, features->indexes);
+    if(ret == YP_SUCCESS)
+        ret = start_leases(provider, phonebook, features->lease_duration);
+    if(ret == YP_SUCCESS)
+        ret = start_expiry(provider, phonebook, features->expiry_tick);
+    if(ret != YP_SUCCESS) {
+        phonebook_detach_features(provider, phonebook, 0);
+        return ret;
+    }
+    build_filter(provider, phonebook, features->filter_capacity);
+    return YP_SUCCESS;
+}
+
+/* Tears down the features of a phonebook that is no longer visible to
+ * RPCs, before its backend is closed (after a last snapshot) or
+ * destroyed (along with its snapshot) */
+static void phonebook_detach_features(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int destroy)
+{
+    stop_expiry(phonebook);
+    stop_snapshots(provider, phonebook, destroy);
+    destroy_filter(phonebook);
+    destroy_indexes(phonebook);
+    destroy_leases(phonebook);
+}
+
+/* Sets up a phonebook around the context opened by its backend and adds
+ * it to the provider under a new id. The features are released, and the
+ * context is closed on failure. */
+static YP_return_t setup_phonebook(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        void* context,
+        phonebook_features* features,
+        YP_phonebook_id_t* id)
+{
+    YP_return_t ret;
+    YP_phonebook* phonebook = (YP_phonebook*)calloc(1, sizeof(*phonebook));
+    if(!phonebook) {
+        ret = YP_ERR_ALLOCATION;
+        goto error;
+    }
+    phonebook->fn  = backend;
+    phonebook->ctx = context;
+    uuid_generate(phonebook->id.uuid);
+    ret = phonebook_attach_features(provider, phonebook, features);
+    if(ret != YP_SUCCESS)
+        goto error;
+    ret = add_phonebook(provider, phonebook);
+    if(ret != YP_SUCCESS) {
+        phonebook_detach_features(provider, phonebook, 0);
+        goto error;
+    }
+    *id = phonebook->id;
+    return YP_SUCCESS;
+
+error:
+    free_phonebook_features(features);
+    backend->close_phonebook(context);
+    free(phonebook);
+    return ret;
+}
+
+static YP_return_t parse_filter_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        double* bits_per_name,
+        size_t* capacity)
+{
+    *bits_per_name = 0;
+    *capacity      = 0;
+    struct json_object* jfilter = NULL;
+    if(!json_object_object_get_ex(jconfig, "filter", &jfilter))
+        return YP_SUCCESS;
+
+    /* "filter" is either a boolean or an object with optional
+     * "bits_per_name" and "capacity" fields */
+    if(json_object_is_type(jfilter, json_type_boolean)) {
+        if(json_object_get_boolean(jfilter)) *bits_per_name = 10;
+        return YP_SUCCESS;
+    }
+    if(!json_object_is_type(jfilter, json_type_object)) {
+        margo_error(provider->mid, "\"filter\" should be a boolean or an object");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    *bits_per_name = 10;
+    struct json_object* jbits = json_object_object_get(jfilter, "bits_per_name");
+    if(jbits) {
+        if(!(json_object_is_type(jbits, json_type_int)
+          || json_object_is_type(jbits, json_type_double))
+        || json_object_get_double(jbits) < 1
+        || json_object_get_double(jbits) > 64) {
+            margo_error(provider->mid,
+                "\"bits_per_name\" should be a number between 1 and 64");
+            return YP_ERR_INVALID_CONFIG;
+        }
+        *bits_per_name = json_object_get_double(jbits);
+    }
+    struct json_object* jcapacity = json_object_object_get(jfilter, "capacity");
+    if(jcapacity) {
+        if(!json_object_is_type(jcapacity, json_type_int)
+        || json_object_get_int64(jcapacity) < 0) {
+            margo_error(provider->mid, "\"capacity\" should be a positive integer");
+            return YP_ERR_INVALID_CONFIG;
+        }
+        *capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+    return YP_SUCCESS;
+}
+
+static int count_record(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)name;
+    (void)name_size;
+    (void)number;
+    *(size_t*)uargs += 1;
+    return 0;
+}
+
+static int add_record_to_filter(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)number;
+    bloom_filter_add((bloom_filter*)uargs, YP_hash(name, name_size));
+    return 0;
+}
+
+/* Creates a filter holding the records of a phonebook, sized for at
+ * least twice their number, or returns NULL */
+static bloom_filter* new_filter(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        size_t capacity)
+{
+    size_t count = 0;
+    bloom_filter* filter = NULL;
+    YP_return_t ret = phonebook->fn->iterate(phonebook->ctx, count_record, &count);
+    if(ret != YP_SUCCESS) goto error;
+    if(capacity < 2*count) capacity = 2*count;
+
+    filter = (bloom_filter*)malloc(sizeof(*filter));
+    if(!filter) {
+        ret = YP_ERR_ALLOCATION;
+        goto error;
+    }
+    ret = bloom_filter_init(filter, capacity, phonebook->filter_bits);
+    if(ret != YP_SUCCESS) {
+        free(filter);
+        filter = NULL;
+        goto error;
+    }
+    ret = phonebook->fn->iterate(phonebook->ctx, add_record_to_filter, filter);
+    if(ret != YP_SUCCESS) goto error;
+    return filter;
+
+error:
+    if(filter) {
+        bloom_filter_destroy(filter);
+        free(filter);
+    }
+    margo_warning(provider->mid, "Could not build filter (error %d), filter disabled", ret);
+    return NULL;
+}
+
+/* Sets up the filter of a phonebook that is not yet visible to RPCs.
+ * On failure the phonebook is left without a filter, which only makes
+ * lookups slower. */
+static void build_filter(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        size_t capacity)
+{
+    if(!phonebook->filter_bits) return;
+    if(!phonebook->fn->iterate) {
+        margo_warning(provider->mid,
+            "Backend \"%s\" can't list its records, filter disabled",
+            phonebook->fn->name);
+        phonebook->filter_bits = 0;
+        return;
+    }
+    if(ABT_rwlock_create(&phonebook->filter_lock) != ABT_SUCCESS) {
+        margo_warning(provider->mid, "Could not create filter lock, filter disabled");
+        phonebook->filter_lock = ABT_RWLOCK_NULL;
+        phonebook->filter_bits = 0;
+        return;
+    }
+    phonebook->filter = new_filter(provider, phonebook, capacity);
+}
+
+/* Replaces a full filter. Lookups and inserts use the filter with the
+ * lock held as readers, so the old one can be freed right away. */
+static void rebuild_filter(
+        YP_provider_t provider,
+        YP_phonebook* phonebook)
+{
+    ABT_rwlock_wrlock(phonebook->filter_lock);
+    bloom_filter* old = phonebook->filter;
+    if(old && bloom_filter_is_full(old)) {
+        phonebook->filter = new_filter(provider, phonebook, 0);
+        bloom_filter_destroy(old);
+        free(old);
+    }
+    ABT_rwlock_unlock(phonebook->filter_lock);
+}
+
+static void destroy_filter(
+        YP_phonebook* phonebook)
+{
+    if(phonebook->filter) {
+        bloom_filter_destroy(phonebook->filter);
+        free(phonebook->filter);
+        phonebook->filter = NULL;
+    }
+    if(phonebook->filter_lock != ABT_RWLOCK_NULL)
+        ABT_rwlock_free(&phonebook->filter_lock);
+}
+
+static YP_return_t parse_snapshot_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        char** path,
+        double* interval)
+{
+    *path     = NULL;
+    *interval = 0;
+    struct json_object* jsnapshot = NULL;
+    struct json_object* jpath = NULL;
+    if(!json_object_object_get_ex(jconfig, "snapshot", &jsnapshot))
+        return YP_SUCCESS;
+
+    /* "snapshot" is either a path or an object with a "path" field
+     * and an optional "interval" in seconds */
+    if(json_object_is_type(jsnapshot, json_type_string)) {
+        jpath = jsnapshot;
+    } else if(json_object_is_type(jsnapshot, json_type_object)) {
+        jpath = json_object_object_get(jsnapshot, "path");
+        struct json_object* jinterval = json_object_object_get(jsnapshot, "interval");
+        if(jinterval) {
+            if(!(json_object_is_type(jinterval, json_type_int)
+              || json_object_is_type(jinterval, json_type_double))
+            || json_object_get_double(jinterval) < 0) {
+                margo_error(provider->mid, "\"interval\" should be a positive number");
+                return YP_ERR_INVALID_CONFIG;
+            }
+            *interval = json_object_get_double(jinterval);
+        }
+    }
+    if(!jpath || !json_object_is_type(jpath, json_type_string)) {
+        margo_error(provider->mid,
+            "\"snapshot\" should be a path or an object with a \"path\" field");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    *path = strdup(json_object_get_string(jpath));
+    return *path ? YP_SUCCESS : YP_ERR_ALLOCATION;
+}
+
+static int is_not_empty(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    (void)name;
+    (void)name_size;
+    (void)number;
+    *(int*)uargs = 1;
+    return 1;
+}
+
+/* Loads the snapshot of a phonebook that is not yet visible to RPCs,
+ * unless its backend already holds records (e.g. replayed from its own
+ * files), then starts its periodic snapshots */
+static YP_return_t start_snapshots(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        double interval)
+{
+    if(!phonebook->snapshot_path) return YP_SUCCESS;
+    if(!phonebook->fn->iterate || !phonebook->fn->insert) {
+        margo_error(provider->mid, "Backend \"%s\" doesn't support snapshots",
+                    phonebook->fn->name);
+        return YP_ERR_OP_UNSUPPORTED;
+    }
+    int not_empty = 0;
+    YP_return_t ret = phonebook->fn->iterate(phonebook->ctx, is_not_empty, &not_empty);
+    if(ret != YP_SUCCESS) return ret;
+    if(!not_empty) {
+        ret = snapshot_load(provider, phonebook->fn, phonebook->ctx,
+                            phonebook->snapshot_path);
+        if(ret != YP_SUCCESS && ret != YP_ERR_NOT_FOUND) return ret;
+    }
+    if(interval > 0)
+        return snapshot_task_start(provider, phonebook->fn, phonebook->ctx,
+                                   phonebook->snapshot_path, interval,
+                                   &phonebook->snapshot_task);
+    return YP_SUCCESS;
+}
+
+/* Stops the periodic snapshots of a phonebook, then writes a last
+ * snapshot if it's being closed, or removes it if it's being destroyed */
+static void stop_snapshots(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int destroy)
+{
+    if(phonebook->snapshot_task) {
+        snapshot_task_stop(phonebook->snapshot_task);
+        phonebook->snapshot_task = NULL;
+    }
+    if(!phonebook->snapshot_path) return;
+    if(destroy)
+        unlink(phonebook->snapshot_path);
+    else
+        snapshot_write(provider, phonebook->fn, phonebook->ctx,
+                       phonebook->snapshot_path);
+    free(phonebook->snapshot_path);
+    phonebook->snapshot_path = NULL;
+}
+
+static YP_return_t parse_index_config(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        struct json_object* jconfig,
+        int* indexes)
+{
+    *indexes = 0;
+    const char* keys[] = { "reverse_index", "fuzzy_index", "phonetic_index" };
+    const int   flags[] = { INDEX_REVERSE, INDEX_FUZZY, INDEX_PHONETIC };
+    for(unsigned i = 0; i < 3; i++) {
+        struct json_object* jindex = NULL;
+        if(!json_object_object_get_ex(jconfig, keys[i], &jindex))
+            continue;
+        if(!json_object_is_type(jindex, json_type_boolean)) {
+            margo_error(provider->mid, "\"%s\" should be a boolean", keys[i]);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        if(json_object_get_boolean(jindex)) *indexes |= flags[i];
+    }
+    /* indexes are built by listing the records, and kept up to date
+     * by looking up the number a name had before an update */
+    if(*indexes && (!backend->iterate || !backend->lookup)) {
+        margo_error(provider->mid, "Backend \"%s\" doesn't support indexing",
+                    backend->name);
+        return YP_ERR_OP_UNSUPPORTED;
+    }
+    return YP_SUCCESS;
+}
+
+/* Tracks the result of adding listed records to the indexes */
+typedef struct index_builder {
+    YP_phonebook* phonebook;
+    YP_return_t   ret;
+} index_builder;
+
+static int add_record_to_indexes(void* uargs, const char* name, size_t name_size, YP_number_t number)
+{
+    index_builder* b = (index_builder*)uargs;
+    b->ret = add_to_indexes(b->phonebook, name, name_size, number, 0);
+    return b->ret != YP_SUCCESS;
+}
+
+/* Builds the indexes of a phonebook that is not yet visible to RPCs */
+static YP_return_t build_indexes(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        int indexes)
+{
+    if(!indexes) return YP_SUCCESS;
+    YP_return_t ret = YP_SUCCESS;
+    if(indexes & INDEX_REVERSE) {
+        phonebook->reverse_index = (reverse_index*)malloc(sizeof(reverse_index));
+        ret = phonebook->reverse_index ? reverse_index_init(phonebook->reverse_index)
+                                       : YP_ERR_ALLOCATION;
+        if(ret != YP_SUCCESS) {
+            free(phonebook->reverse_index);
+            phonebook->reverse_index = NULL;
+            goto finish;
+        }
+    }
+    if(indexes & INDEX_FUZZY) {
+        phonebook->fuzzy_index = (trigram_index*)malloc(sizeof(trigram_index));
+        ret = phonebook->fuzzy_index ? trigram_index_init(phonebook->fuzzy_index)
+                                     : YP_ERR_ALLOCATION;
+        if(ret != YP_SUCCESS) {
+            free(phonebook->fuzzy_index);
+            phonebook->fuzzy_index = NULL;
+            goto finish;
+        }
+    }
+    if(indexes & INDEX_PHONETIC) {
+        phonebook->phonetic_index = (phonetic_index*)malloc(sizeof(phonetic_index));
+        ret = phonebook->phonetic_index ? phonetic_index_init(phonebook->phonetic_index)
+                                        : YP_ERR_ALLOCATION;
+        if(ret != YP_SUCCESS) {
+            free(phonebook->phonetic_index);
+            phonebook->phonetic_index = NULL;
+            goto finish;
+        }
+    }
+    index_builder b = { phonebook, YP_SUCCESS };
+    ret = phonebook->fn->iterate(phonebook->ctx, add_record_to_indexes, &b);
+    if(ret == YP_SUCCESS) ret = b.ret;
+    if(ret == YP_SUCCESS && ABT_rwlock_create(&phonebook->index_lock) != ABT_SUCCESS) {
+        phonebook->index_lock = ABT_RWLOCK_NULL;
+        ret = YP_ERR_FROM_ARGOBOTS;
+    }
+
+finish:
+    if(ret != YP_SUCCESS) {
+        margo_error(provider->mid, "Could not build indexes (error %d)", ret);
+        destroy_indexes(phonebook);
+    }
+    return ret;
+}
+
+/* Adds a record to the indexes of a phonebook. If known_name is set,
+ * the name is already in the phonebook with another number. */
+static YP_return_t add_to_indexes(
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number,
+        int known_name)
+{
+    YP_return_t ret = YP_SUCCESS;
+    if(phonebook->reverse_index) {
+        ret = reverse_index_add(phonebook->reverse_index, number, name, name_size);
+        if(ret != YP_SUCCESS) return ret;
+    }
+    if(phonebook->fuzzy_index && !known_name) {
+        ret = trigram_index_add(phonebook->fuzzy_index, name, name_size);
+        if(ret != YP_SUCCESS) goto undo_reverse;
+    }
+    if(phonebook->phonetic_index && !known_name) {
+        ret = phonetic_index_add(phonebook->phonetic_index, name, name_size);
+        if(ret != YP_SUCCESS) goto undo_fuzzy;
+    }
+    return YP_SUCCESS;
+
+undo_fuzzy:
+    if(phonebook->fuzzy_index)
+        trigram_index_remove(phonebook->fuzzy_index, name, name_size);
+undo_reverse:
+    if(phonebook->reverse_index)
+        reverse_index_remove(phonebook->reverse_index, number, name, name_size);
+    return ret;
+}
+
+/* Removes a record from the indexes of a phonebook. If keep_name is
+ * set, the name stays in the phonebook with another number. */
+static void remove_from_indexes(
+        YP_phonebook* phonebook,
+        const char* name,
+        size_t name_size,
+        YP_number_t number,
+        int keep_name)
+{
+    if(phonebook->reverse_index)
+        reverse_index_remove(phonebook->reverse_index, number, name, name_size);
+    if(phonebook->fuzzy_index && !keep_name)
+        trigram_index_remove(phonebook->fuzzy_index, name, name_size);
+    if(phonebook->phonetic_index && !keep_name)
+        phonetic_index_remove(phonebook->phonetic_index, name, name_size);
+}
+
+static void destroy_indexes(
+        YP_phonebook* phonebook)
+{
+    if(phonebook->reverse_index) {
+        reverse_index_destroy(phonebook->reverse_index);
+        free(phonebook->reverse_index);
+        phonebook->reverse_index = NULL;
+    }
+    if(phonebook->fuzzy_index) {
+        trigram_index_destroy(phonebook->fuzzy_index);
+        free(phonebook->fuzzy_index);
+        phonebook->fuzzy_index = NULL;
+    }
+    if(phonebook->phonetic_index) {
+        phonetic_index_destroy(phonebook->phonetic_index);
+        free(phonebook->phonetic_index);
+        phonebook->phonetic_index = NULL;
+    }
+    if(phonebook->index_lock != ABT_RWLOCK_NULL)
+        ABT_rwlock_free(&phonebook->index_lock);
+}
+
+YP_backend_impl* find_backend_impl(
+        YP_provider_t provider,
+        const char* name)
+{
+    size_t i;
+    for(i = 0; i < provider->num_backend_types; i++) {
+        YP_backend_impl* impl = provider->backend_types[i];
+        if(strcmp(name, impl->name) == 0)
+            return impl;
+    }
+    return NULL;
+}
+
+static inline YP_return_t add_backend_impl(
+        YP_provider_t provider,
+        YP_backend_impl* backend)
+{
+    provider->num_backend_types += 1;
+    provider->backend_types = realloc(provider->backend_types,
+                                      provider->num_backend_types
+                                      * sizeof(*provider->backend_types));
+    provider->backend_types[provider->num_backend_types-1] = backend;
+    return YP_SUCCESS;
+}
+
+static inline int check_token(
+        YP_provider_t provider,
+        const char* token)
+{
+    if(!provider->token) return 1;
     return !strcmp(provider->token, token);
 }
+
+/* Tells whether the records of a phonebook survive a restart, from the
+ * persistence options of the provider and of the backends, including
+ * those of the backend wrapped by a decorator ("config") */
+static int is_persistent_config(struct json_object* jconfig)
+{
+    while(jconfig && json_object_is_type(jconfig, json_type_object)) {
+        if(json_object_object_get_ex(jconfig, "snapshot", NULL)
+        || json_object_object_get_ex(jconfig, "wal", NULL)
+        || json_object_object_get_ex(jconfig, "path", NULL))
+            return 1;
+        jconfig = json_object_object_get(jconfig, "config");
+    }
+    return 0;
+}
+
+static YP_return_t parse_expiry_config(
+        YP_provider_t provider,
+        YP_backend_impl* backend,
+        struct json_object* jconfig,
+        double* tick)
+{
+    *tick = 0;
+    struct json_object* jexpiry = NULL;
+    if(!json_object_object_get_ex(jconfig, "expiry", &jexpiry))
+        return YP_SUCCESS;
+
+    /* "expiry" is either a boolean or an object with an optional
+     * "tick" in seconds, the resolution of the deadlines */
+    if(json_object_is_type(jexpiry, json_type_boolean)) {
+        if(json_object_get_boolean(jexpiry)) *tick = 1.0;
+    } else if(json_object_is_type(jexpiry, json_type_object)) {
+        *tick = 1.0;
+        struct json_object* jtick = json_object_object_get(jexpiry, "tick");
+        if(jtick) {
+            if(!(json_object_is_type(jtick, json_type_int)
+              || json_object_is_type(jtick, json_type_double))
+            || json_object_get_double(jtick) <= 0) {
+                margo_error(provider->mid, "\"tick\" should be a positive number");
+                return YP_ERR_INVALID_CONFIG;
+            }
+            *tick = json_object_get_double(jtick);
+        }
+    } else {
+        margo_error(provider->mid, "\"expiry\" should be a boolean or an object");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    if(*tick > 0 && !backend->erase) {
+        margo_error(provider->mid, "Backend \"%s\" doesn't support expiry",
+                    backend->name);
+        return YP_ERR_OP_UNSUPPORTED;
+    }
+    if(*tick > 0 && is_persistent_config(jconfig)) {
+        /* deadlines are only kept in memory, records with a time to
+         * live would come back as permanent after a restart */
+        margo_error(provider->mid, "\"expiry\" can't be used with a phonebook "
+                    "that is persisted (\"snapshot\", \"wal\" or \"path\")");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    return YP_SUCCESS;
+}
+
+static void expire_record(void* uargs, const char* name, size_t name_size)
+{
+    erase_record((YP_phonebook*)uargs, name, name_size);
+}
+
+static YP_return_t start_expiry(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        double tick)
+{
+    if(tick <= 0) return YP_SUCCESS;
+    return expiry_task_start(provider, tick, expire_record, phonebook,
+                             &phonebook->expiry_task);
+}
+
+/* Stops the expiry of the records of a phonebook, those that didn't
+ * expire yet are kept */
+static void stop_expiry(
+        YP_phonebook* phonebook)
+{
+    if(!phonebook->expiry_task) return;
+    expiry_task_stop(phonebook->expiry_task);
+    phonebook->expiry_task = NULL;
+}
+
+static YP_return_t parse_lease_config(
+        YP_provider_t provider,
+        struct json_object* jconfig,
+        double* duration)
+{
+    *duration = 0;
+    struct json_object* jlease = NULL;
+    if(!json_object_object_get_ex(jconfig, "lease", &jlease))
+        return YP_SUCCESS;
+
+    /* "lease" is the duration of the leases in seconds */
+    if(!(json_object_is_type(jlease, json_type_int)
+      || json_object_is_type(jlease, json_type_double))
+    || json_object_get_double(jlease) <= 0) {
+        margo_error(provider->mid, "\"lease\" should be a positive number");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    *duration = json_object_get_double(jlease);
+    return YP_SUCCESS;
+}
+
+static YP_return_t start_leases(
+        YP_provider_t provider,
+        YP_phonebook* phonebook,
+        double duration)
+{
+    if(duration <= 0) return YP_SUCCESS;
+    return lease_table_create(provider, duration, &phonebook->leases);
+}
+
+static void destroy_leases(
+        YP_phonebook* phonebook)
+{
+    if(!phonebook->leases) return;
+    lease_table_destroy(phonebook->leases);
+    phonebook->leases = NULL;
+}
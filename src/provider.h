@@ -11,11 +11,24 @@
 #include <json-c/json.h>
 #include "YP/YP-backend.h"
 #include "uthash.h"
+#include "bloom.h"
 
 typedef struct YP_phonebook {
     YP_backend_impl* fn;  // pointer to function mapping for this backend
     void*               ctx; // context required by the backend
     YP_phonebook_id_t id;  // identifier of the backend
+    bloom_filter*       filter;          // filter of the names, NULL if disabled
+    double              filter_bits;     // bits per name of the filter, 0 if disabled
+    ABT_rwlock          filter_lock;     // held to use the filter, exclusively to replace it
+    char*               snapshot_path;   // where snapshots are written, NULL if none
+    struct snapshot_task* snapshot_task; // periodic snapshots, NULL if disabled
+    struct reverse_index* reverse_index; // names by number, NULL if disabled
+    struct trigram_index* fuzzy_index;   // names by trigram, NULL if disabled
+    struct phonetic_index* phonetic_index; // names by sound, NULL if disabled
+    ABT_rwlock          index_lock;      // held exclusively to update an indexed phonebook
+    struct expiry_task* expiry_task;     // expiry of records with a TTL, NULL if disabled
+    struct lease_table* leases;          // leases granted to client caches, NULL if disabled
+    struct scan_table*  scans;           // cursors of the open scans
     UT_hash_handle      hh;  // handle for uthash
 } YP_phonebook;
 
@@ -36,10 +49,29 @@ typedef struct YP_provider {
     hg_id_t close_phonebook_id;
     hg_id_t destroy_phonebook_id;
     hg_id_t list_phonebooks_id;
+    hg_id_t snapshot_phonebook_id;
     /* RPC identifiers for clients */
     hg_id_t hello_id;
     hg_id_t sum_id;
+    hg_id_t insert_id;
+    hg_id_t lookup_id;
+    hg_id_t erase_id;
+    hg_id_t list_range_id;
+    hg_id_t list_prefix_id;
+    hg_id_t lookup_number_id;
+    hg_id_t fuzzy_search_id;
+    hg_id_t phonetic_lookup_id;
+    hg_id_t lookup_batch_id;
+    hg_id_t insert_batch_id;
+    hg_id_t scan_begin_id;
+    hg_id_t scan_next_id;
+    hg_id_t scan_end_id;
     /* ... add other RPC identifiers here ... */
 } YP_provider;
 
+/* Returns the backend type registered under name, or NULL */
+YP_backend_impl* find_backend_impl(
+        YP_provider_t provider,
+        const char* name);
+
 #endif
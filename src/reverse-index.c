@@ -0,0 +1,92 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "reverse-index.h"
+
+#define REVERSE_INDEX_NUMBER_SIZE 8
+#define REVERSE_INDEX_STACK_KEY   256
+
+static void put_number(char* key, YP_number_t number)
+{
+    for(int i = REVERSE_INDEX_NUMBER_SIZE - 1; i >= 0; i--, number >>= 8)
+        key[i] = (char)(number & 0xff);
+}
+
+/* Builds the key of a (number, name) pair in buffer if it fits,
+ * otherwise in a new allocation that the caller must free */
+static char* make_key(
+        char buffer[REVERSE_INDEX_STACK_KEY],
+        YP_number_t number,
+        const char* name,
+        size_t name_size)
+{
+    size_t size = REVERSE_INDEX_NUMBER_SIZE + name_size;
+    char* key = size <= REVERSE_INDEX_STACK_KEY ? buffer : (char*)malloc(size);
+    if(!key) return NULL;
+    put_number(key, number);
+    memcpy(key + REVERSE_INDEX_NUMBER_SIZE, name, name_size);
+    return key;
+}
+
+YP_return_t reverse_index_init(reverse_index* index)
+{
+    return btree_init(&index->entries);
+}
+
+void reverse_index_destroy(reverse_index* index)
+{
+    btree_destroy(&index->entries);
+}
+
+YP_return_t reverse_index_add(
+        reverse_index* index,
+        YP_number_t number,
+        const char* name,
+        size_t name_size)
+{
+    char buffer[REVERSE_INDEX_STACK_KEY];
+    char* key = make_key(buffer, number, name, name_size);
+    if(!key) return YP_ERR_ALLOCATION;
+    YP_return_t ret = btree_insert(&index->entries, key,
+            REVERSE_INDEX_NUMBER_SIZE + name_size, 0);
+    if(key != buffer) free(key);
+    return ret;
+}
+
+YP_return_t reverse_index_remove(
+        reverse_index* index,
+        YP_number_t number,
+        const char* name,
+        size_t name_size)
+{
+    char buffer[REVERSE_INDEX_STACK_KEY];
+    char* key = make_key(buffer, number, name, name_size);
+    if(!key) return YP_ERR_ALLOCATION;
+    YP_return_t ret = btree_erase(&index->entries, key,
+            REVERSE_INDEX_NUMBER_SIZE + name_size);
+    if(key != buffer) free(key);
+    return ret;
+}
+
+void reverse_index_find(
+        const reverse_index* index,
+        YP_number_t number,
+        YP_record_fn fn,
+        void* uargs)
+{
+    char prefix[REVERSE_INDEX_NUMBER_SIZE];
+    put_number(prefix, number);
+    btree_cursor cursor;
+    btree_seek(&index->entries, prefix, sizeof(prefix), &cursor);
+    for(; btree_cursor_valid(&cursor); btree_cursor_next(&cursor)) {
+        const btree_entry* e = btree_cursor_entry(&cursor);
+        if(e->key_size < sizeof(prefix) || memcmp(e->key, prefix, sizeof(prefix)) != 0)
+            break;
+        if(fn(uargs, e->key + sizeof(prefix), e->key_size - sizeof(prefix), number))
+            break;
+    }
+}
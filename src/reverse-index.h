@@ -0,0 +1,61 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _REVERSE_INDEX_H
+#define _REVERSE_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-backend.h"
+#include "btree/btree.h"
+
+/*
+ * Secondary index mapping numbers to the names they are associated
+ * with. Several names may share a number, so the index is a B+tree
+ * keyed by the big-endian number followed by the name: the names of a
+ * number are the keys starting with its 8 bytes, listed in order.
+ * The index is not thread-safe, the provider serializes its updates
+ * with those of the phonebook.
+ */
+
+typedef struct reverse_index {
+    btree entries;
+} reverse_index;
+
+YP_return_t reverse_index_init(reverse_index* index);
+
+void reverse_index_destroy(reverse_index* index);
+
+/**
+ * @brief Associates the name with the number (in addition to the
+ * names already associated with it).
+ */
+YP_return_t reverse_index_add(
+        reverse_index* index,
+        YP_number_t number,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Removes the association between the name and the number,
+ * returns YP_ERR_NOT_FOUND if there was none.
+ */
+YP_return_t reverse_index_remove(
+        reverse_index* index,
+        YP_number_t number,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Calls fn on each name associated with the number, in
+ * lexicographic order, until it returns a non-zero value.
+ */
+void reverse_index_find(
+        const reverse_index* index,
+        YP_number_t number,
+        YP_record_fn fn,
+        void* uargs);
+
+#endif
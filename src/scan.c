@@ -0,0 +1,342 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "provider.h"
+#include "scan.h"
+
+/* cursors a phonebook may have open at once */
+#define SCAN_MAX_CURSORS 64
+/* cursors unused for this long (in seconds) are closed */
+#define SCAN_IDLE_TIMEOUT 60.0
+
+struct scan_cursor {
+    uint64_t       id;
+    scan_table*    table;
+    int            ordered;        // resumes after last_name with list_range
+    uint64_t       position;       // resumes from here with scan otherwise
+    char*          last_name;      // NULL until a page is read
+    size_t         last_name_size;
+    /* page read in advance */
+    char*          page;
+    size_t         capacity;
+    hg_bulk_t      bulk;
+    size_t         size;
+    size_t         count;
+    size_t         last_record;    // offset of the last record of the page
+    int            full;           // a record didn't fit in the page
+    int            last;           // no records come after the page
+    YP_return_t    ret;
+    ABT_thread     reader;         // ULT reading the page, until joined
+    /* protected by the mutex of the table */
+    int            in_use;         // page acquired and not yet released
+    int            closed;         // to be freed once released
+    double         last_used;      // when the page was last released
+    struct scan_cursor* expired;   // next in the list of idle cursors to free
+    UT_hash_handle hh;
+};
+
+struct scan_table {
+    YP_provider_t    provider;
+    YP_backend_impl* fn;
+    void*            ctx;
+    ABT_mutex        mutex;
+    uint64_t         next_id;
+    scan_cursor*     cursors;  // hash of cursors by id
+};
+
+static int add_record(
+        void* uargs,
+        const char* name,
+        size_t name_size,
+        YP_number_t number)
+{
+    scan_cursor* c = (scan_cursor*)uargs;
+    uint32_t size = (uint32_t)name_size;
+    size_t record_size = sizeof(number) + sizeof(size) + name_size + 1;
+    if(name_size > UINT32_MAX || record_size > c->capacity - c->size) {
+        c->full = 1;
+        return 1;
+    }
+    char* p = c->page + c->size;
+    memcpy(p, &number, sizeof(number));
+    p += sizeof(number);
+    memcpy(p, &size, sizeof(size));
+    p += sizeof(size);
+    memcpy(p, name, name_size);
+    p[name_size] = '\0';
+    c->last_record = c->size;
+    c->size  += record_size;
+    c->count += 1;
+    return 0;
+}
+
+/* Reads the page following the one last read. Errors are final. */
+static void read_page(scan_cursor* c)
+{
+    scan_table* table = c->table;
+    YP_return_t ret = YP_SUCCESS;
+
+    if(c->ret != YP_SUCCESS) return;
+
+    /* ordered cursors resume after the last name of the previous page */
+    if(c->ordered && c->count) {
+        const char* record = c->page + c->last_record + sizeof(YP_number_t);
+        uint32_t size;
+        memcpy(&size, record, sizeof(size));
+        char* name = (char*)realloc(c->last_name, size + 1);
+        if(!name) {
+            c->ret = YP_ERR_ALLOCATION;
+            return;
+        }
+        memcpy(name, record + sizeof(size), size);
+        c->last_name      = name;
+        c->last_name_size = size;
+    }
+    c->size  = 0;
+    c->count = 0;
+    c->full  = 0;
+    if(c->last) return;
+
+    if(!c->ordered) {
+        ret = table->fn->scan(table->ctx, &c->position, add_record, c);
+        if(ret == YP_ERR_OP_UNSUPPORTED && c->position == 0 && table->fn->list_range) {
+            /* e.g. a cache over an ordered backend */
+            c->ordered = 1;
+            c->size    = 0;
+            c->count   = 0;
+            c->full    = 0;
+        } else {
+            c->last = c->position == UINT64_MAX;
+        }
+    }
+    if(c->ordered) {
+        ret = table->fn->list_range(table->ctx,
+                c->last_name, c->last_name_size, !c->last_name,
+                NULL, 0, add_record, c);
+        c->last = !c->full;
+    }
+    if(ret == YP_SUCCESS && c->full && c->count == 0) {
+        /* the record doesn't fit in an empty page */
+        ret = YP_ERR_INVALID_ARGS;
+    }
+    c->ret = ret;
+}
+
+static void read_page_ult(void* args)
+{
+    read_page((scan_cursor*)args);
+}
+
+static void start_reading(scan_cursor* c)
+{
+    YP_provider_t provider = c->table->provider;
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    if(ABT_thread_create(pool, read_page_ult, c,
+                         ABT_THREAD_ATTR_NULL, &c->reader) != ABT_SUCCESS) {
+        /* read it now instead */
+        c->reader = ABT_THREAD_NULL;
+        read_page(c);
+    }
+}
+
+static void wait_reader(scan_cursor* c)
+{
+    if(c->reader == ABT_THREAD_NULL) return;
+    ABT_thread_join(c->reader);
+    ABT_thread_free(&c->reader);
+    c->reader = ABT_THREAD_NULL;
+}
+
+static void free_cursor(scan_cursor* c)
+{
+    wait_reader(c);
+    if(c->bulk != HG_BULK_NULL) margo_bulk_free(c->bulk);
+    free(c->page);
+    free(c->last_name);
+    free(c);
+}
+
+YP_return_t scan_table_create(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        scan_table** out)
+{
+    scan_table* table = (scan_table*)calloc(1, sizeof(*table));
+    if(!table) return YP_ERR_ALLOCATION;
+    table->provider = provider;
+    table->fn       = fn;
+    table->ctx      = ctx;
+    if(ABT_mutex_create(&table->mutex) != ABT_SUCCESS) {
+        free(table);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = table;
+    return YP_SUCCESS;
+}
+
+void scan_table_destroy(scan_table* table)
+{
+    scan_cursor *c, *tmp;
+    HASH_ITER(hh, table->cursors, c, tmp) {
+        HASH_DEL(table->cursors, c);
+        free_cursor(c);
+    }
+    ABT_mutex_free(&table->mutex);
+    free(table);
+}
+
+/* Closes the cursors that weren't used for SCAN_IDLE_TIMEOUT seconds,
+ * e.g. left open by clients that died, and returns how many remain */
+static size_t close_idle_cursors(scan_table* table)
+{
+    scan_cursor *c, *tmp, *expired = NULL;
+    double now = ABT_get_wtime();
+    ABT_mutex_lock(table->mutex);
+    HASH_ITER(hh, table->cursors, c, tmp) {
+        if(c->in_use || now - c->last_used < SCAN_IDLE_TIMEOUT) continue;
+        HASH_DEL(table->cursors, c);
+        c->expired = expired;
+        expired = c;
+    }
+    size_t count = HASH_COUNT(table->cursors);
+    ABT_mutex_unlock(table->mutex);
+    while(expired) {
+        c = expired;
+        expired = c->expired;
+        free_cursor(c);
+    }
+    return count;
+}
+
+YP_return_t scan_open(
+        scan_table* table,
+        size_t page_size,
+        uint64_t* id)
+{
+    if(!table->fn->scan && !table->fn->list_range)
+        return YP_ERR_OP_UNSUPPORTED;
+
+    if(close_idle_cursors(table) >= SCAN_MAX_CURSORS) {
+        margo_error(table->provider->mid,
+            "Too many scans open on the phonebook (max %d)", SCAN_MAX_CURSORS);
+        return YP_ERR_OP_FORBIDDEN;
+    }
+
+    scan_cursor* c = (scan_cursor*)calloc(1, sizeof(*c));
+    if(!c) return YP_ERR_ALLOCATION;
+    c->table    = table;
+    c->ordered  = !table->fn->scan;
+    c->capacity = page_size;
+    c->bulk     = HG_BULK_NULL;
+    c->reader   = ABT_THREAD_NULL;
+    c->page     = (char*)malloc(page_size);
+    if(!c->page) {
+        free(c);
+        return YP_ERR_ALLOCATION;
+    }
+    void* segment = c->page;
+    hg_size_t segment_size = page_size;
+    hg_return_t hret = margo_bulk_create(table->provider->mid, 1, &segment, &segment_size,
+                                         HG_BULK_READ_ONLY, &c->bulk);
+    if(hret != HG_SUCCESS) {
+        c->bulk = HG_BULK_NULL;
+        free_cursor(c);
+        return YP_ERR_FROM_MERCURY;
+    }
+
+    /* the cursor can't be found until it's reading */
+    start_reading(c);
+    ABT_mutex_lock(table->mutex);
+    if(HASH_COUNT(table->cursors) >= SCAN_MAX_CURSORS) {
+        /* others were opened concurrently */
+        ABT_mutex_unlock(table->mutex);
+        free_cursor(c);
+        return YP_ERR_OP_FORBIDDEN;
+    }
+    c->id        = table->next_id++;
+    c->last_used = ABT_get_wtime();
+    HASH_ADD(hh, table->cursors, id, sizeof(c->id), c);
+    ABT_mutex_unlock(table->mutex);
+    *id = c->id;
+    return YP_SUCCESS;
+}
+
+/* Makes the cursor available again, or frees it if it was closed */
+static void put_cursor(scan_table* table, scan_cursor* c)
+{
+    ABT_mutex_lock(table->mutex);
+    c->in_use    = 0;
+    c->last_used = ABT_get_wtime();
+    int closed = c->closed;
+    ABT_mutex_unlock(table->mutex);
+    if(closed) free_cursor(c);
+}
+
+YP_return_t scan_acquire(
+        scan_table* table,
+        uint64_t id,
+        scan_cursor** cursor,
+        scan_page* page)
+{
+    scan_cursor* c = NULL;
+    ABT_mutex_lock(table->mutex);
+    HASH_FIND(hh, table->cursors, &id, sizeof(id), c);
+    if(c && c->in_use) {
+        /* pages of a cursor are read one after the other */
+        ABT_mutex_unlock(table->mutex);
+        return YP_ERR_OP_FORBIDDEN;
+    }
+    if(c) c->in_use = 1;
+    ABT_mutex_unlock(table->mutex);
+    if(!c) return YP_ERR_INVALID_ARGS;
+
+    wait_reader(c);
+    if(c->ret != YP_SUCCESS) {
+        YP_return_t ret = c->ret;
+        put_cursor(table, c);
+        return ret;
+    }
+    page->data  = c->page;
+    page->bulk  = c->bulk;
+    page->size  = c->size;
+    page->count = c->count;
+    page->last  = c->last;
+    *cursor = c;
+    return YP_SUCCESS;
+}
+
+void scan_release(
+        scan_table* table,
+        scan_cursor* cursor)
+{
+    /* start reading before the cursor can be found again */
+    start_reading(cursor);
+    put_cursor(table, cursor);
+}
+
+YP_return_t scan_close(
+        scan_table* table,
+        uint64_t id)
+{
+    scan_cursor* c = NULL;
+    int in_use = 0;
+    ABT_mutex_lock(table->mutex);
+    HASH_FIND(hh, table->cursors, &id, sizeof(id), c);
+    if(c) {
+        HASH_DEL(table->cursors, c);
+        /* a cursor in use is freed by put_cursor */
+        in_use = c->in_use;
+        c->closed = 1;
+    }
+    ABT_mutex_unlock(table->mutex);
+    if(!c) return YP_ERR_INVALID_ARGS;
+    if(!in_use) free_cursor(c);
+    return YP_SUCCESS;
+}
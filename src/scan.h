@@ -0,0 +1,116 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <margo.h>
+#include "YP/YP-backend.h"
+
+/*
+ * Cursors of the scans of a phonebook. A cursor reads the records one
+ * page at a time, resuming either from the position returned by the
+ * backend's scan function or, for ordered backends, after the last
+ * name it listed. Once a page has been taken, a ULT reads the next one
+ * in advance, so that it's ready when the client asks for it.
+ *
+ * A phonebook has at most SCAN_MAX_CURSORS cursors open, and cursors
+ * left unused for SCAN_IDLE_TIMEOUT seconds are closed when another
+ * is opened, so that clients that die don't hold their pages forever.
+ *
+ * Records inserted or erased during a scan may or may not be listed.
+ * Backends listing the slots of a hash table put the number of times
+ * the table was rehashed in their positions (see scan_slot_position),
+ * and fail with YP_ERR_SCAN_INVALIDATED if it was rehashed since, rather
+ * than list some records twice or skip them. The tiered backend may
+ * list twice a name that was inserted then evicted during the scan.
+ *
+ * Pages hold records made of their number, a uint32_t name size and
+ * the null-terminated name, unaligned (see scan_next_in_t).
+ */
+
+/* Positions in a hash table: the slot index in the low SCAN_SLOT_BITS
+ * bits, and the low SCAN_REHASH_BITS bits of the rehash count above */
+#define SCAN_SLOT_BITS   40
+#define SCAN_REHASH_BITS 12
+#define SCAN_SLOT_MASK   ((UINT64_C(1) << SCAN_SLOT_BITS) - 1)
+#define SCAN_REHASH_MASK ((UINT64_C(1) << SCAN_REHASH_BITS) - 1)
+
+static inline uint64_t scan_slot_position(uint64_t rehashes, uint64_t slot)
+{
+    return ((rehashes & SCAN_REHASH_MASK) << SCAN_SLOT_BITS) | slot;
+}
+
+/* Sets the slot a scan resumes from, or returns YP_ERR_SCAN_INVALIDATED
+ * if the table was rehashed since the position was taken. Position 0
+ * always starts from the first slot. */
+static inline YP_return_t scan_slot_resume(
+        uint64_t position, uint64_t rehashes, uint64_t* slot)
+{
+    *slot = position & SCAN_SLOT_MASK;
+    if(position && (position >> SCAN_SLOT_BITS) != (rehashes & SCAN_REHASH_MASK))
+        return YP_ERR_SCAN_INVALIDATED;
+    return YP_SUCCESS;
+}
+
+typedef struct scan_table  scan_table;
+typedef struct scan_cursor scan_cursor;
+
+/* Page of records read by a cursor */
+typedef struct scan_page {
+    const char* data;
+    hg_bulk_t   bulk;  // exposes data for reading
+    size_t      size;  // in bytes
+    size_t      count; // records
+    int         last;  // no records come after this page
+} scan_page;
+
+YP_return_t scan_table_create(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        scan_table** table);
+
+/**
+ * @brief Closes the cursors left open. No page may be in use.
+ */
+void scan_table_destroy(scan_table* table);
+
+/**
+ * @brief Opens a cursor reading pages of page_size bytes, and starts
+ * reading its first page.
+ */
+YP_return_t scan_open(
+        scan_table* table,
+        size_t page_size,
+        uint64_t* id);
+
+/**
+ * @brief Waits for the next page of a cursor to be read and returns
+ * it. It remains valid until scan_release is called on the cursor.
+ */
+YP_return_t scan_acquire(
+        scan_table* table,
+        uint64_t id,
+        scan_cursor** cursor,
+        scan_page* page);
+
+/**
+ * @brief Releases the page of a cursor and starts reading the next.
+ */
+void scan_release(
+        scan_table* table,
+        scan_cursor* cursor);
+
+/**
+ * @brief Closes a cursor, once its page is released if in use.
+ */
+YP_return_t scan_close(
+        scan_table* table,
+        uint64_t id);
+
+#endif
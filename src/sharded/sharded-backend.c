@@ -0,0 +1,535 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../scan.h"
+#include "../memory/memory-table.h"
+#include "../wal.h"
+#include "sharded-backend.h"
+
+/*
+ * In-memory phonebook split into "num_shards" independent memory
+ * tables, each guarded by its own ABT_rwlock, so that it can safely be
+ * accessed from RPC handlers running on several execution streams.
+ * A name goes to the shard given by the high bits of its hash (the
+ * tables themselves index slots with the low bits). Shards are aligned
+ * on cache lines so that locking one doesn't invalidate its neighbors.
+ * Updates can be made durable in a write-ahead log ("wal" path), to
+ * which they are appended while holding the lock of their shard, right
+ * after being applied (and undone if the append fails). If a sync
+ * fails the shards are rebuilt from the records that were synced, and
+ * the log is checkpointed with every shard locked once it has doubled
+ * in size.
+ */
+
+#define SHARDED_DEFAULT_NUM_SHARDS 16
+#define SHARDED_MAX_NUM_SHARDS     4096
+
+typedef struct sharded_shard {
+    _Alignas(64) ABT_rwlock lock;
+    memory_table            table;
+} sharded_shard;
+
+typedef struct sharded_context {
+    struct json_object* config;
+    size_t              num_shards;
+    sharded_shard*      shards;
+    wal*                wal;
+    int                 reloaded; // set once the shards were rebuilt from the log
+} sharded_context;
+
+static inline sharded_shard* sharded_find_shard(sharded_context* ctx, uint64_t hash)
+{
+    return &ctx->shards[((YP_uint128_t)hash * ctx->num_shards) >> 64];
+}
+
+static void sharded_free_context(sharded_context* ctx)
+{
+    for(size_t i = 0; i < ctx->num_shards; i++) {
+        if(ctx->shards[i].lock != ABT_RWLOCK_NULL)
+            ABT_rwlock_free(&ctx->shards[i].lock);
+        if(ctx->shards[i].table.ctrl)
+            memory_table_destroy(&ctx->shards[i].table);
+    }
+    free(ctx->shards);
+    json_object_put(ctx->config);
+    free(ctx);
+}
+
+static int sharded_apply(
+        memory_table* table, int type, const char* name, size_t name_size,
+        uint64_t hash, uint64_t number)
+{
+    if(type == WAL_ERASE) {
+        memory_table_erase(table, name, name_size, hash);
+        return 0;
+    }
+    return memory_table_insert(table, name, name_size, hash, number, NULL, NULL) != YP_SUCCESS;
+}
+
+static int sharded_replay(
+        void* uargs, int type, const char* name, size_t name_size, uint64_t number)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    memory_table* table = &sharded_find_shard((sharded_context*)uargs, hash)->table;
+    return sharded_apply(table, type, name, name_size, hash, number);
+}
+
+static YP_return_t sharded_create_context(
+        YP_provider_t provider,
+        const char* config_str,
+        int create,
+        sharded_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+        if (!json_object_is_type(config, json_type_object)) {
+            margo_error(provider->mid, "JSON configuration should be an object");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+
+    // "num_shards" is the number of independently locked tables
+    size_t num_shards = SHARDED_DEFAULT_NUM_SHARDS;
+    struct json_object* jshards = json_object_object_get(config, "num_shards");
+    if (jshards) {
+        if (!json_object_is_type(jshards, json_type_int)
+        ||  json_object_get_int64(jshards) < 1
+        ||  json_object_get_int64(jshards) > SHARDED_MAX_NUM_SHARDS) {
+            margo_error(provider->mid,
+                "\"num_shards\" should be an integer between 1 and %d",
+                SHARDED_MAX_NUM_SHARDS);
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        num_shards = (size_t)json_object_get_int64(jshards);
+    }
+    // "initial_capacity" lets the user pre-size the tables
+    size_t capacity = 0;
+    struct json_object* jcapacity = json_object_object_get(config, "initial_capacity");
+    if (jcapacity) {
+        if (!json_object_is_type(jcapacity, json_type_int)
+        ||  json_object_get_int64(jcapacity) < 0) {
+            margo_error(provider->mid,
+                "\"initial_capacity\" should be a positive integer");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+    // "wal" is the path of the write-ahead log, if any
+    struct json_object* jwal = json_object_object_get(config, "wal");
+    if (jwal && !json_object_is_type(jwal, json_type_string)) {
+        margo_error(provider->mid, "\"wal\" should be a string");
+        json_object_put(config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+
+    sharded_context* ctx = (sharded_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    ctx->config = config;
+    ctx->shards = (sharded_shard*)aligned_alloc(64, num_shards * sizeof(sharded_shard));
+    if (!ctx->shards) {
+        json_object_put(config);
+        free(ctx);
+        return YP_ERR_ALLOCATION;
+    }
+    memset(ctx->shards, 0, num_shards * sizeof(sharded_shard));
+    ctx->num_shards = num_shards;
+    for (size_t i = 0; i < num_shards; i++) {
+        YP_return_t ret = memory_table_init(&ctx->shards[i].table,
+                                            (capacity + num_shards - 1) / num_shards);
+        if (ret != YP_SUCCESS) {
+            sharded_free_context(ctx);
+            return ret;
+        }
+        if (ABT_rwlock_create(&ctx->shards[i].lock) != ABT_SUCCESS) {
+            ctx->shards[i].lock = ABT_RWLOCK_NULL;
+            sharded_free_context(ctx);
+            return YP_ERR_FROM_ARGOBOTS;
+        }
+    }
+    if (jwal) {
+        YP_return_t ret = wal_open(provider, json_object_get_string(jwal), create,
+                                   sharded_replay, ctx, &ctx->wal);
+        if (ret != YP_SUCCESS) {
+            sharded_free_context(ctx);
+            return ret;
+        }
+    }
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t sharded_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return sharded_create_context(provider, config_str, 1, (sharded_context**)context);
+}
+
+static YP_return_t sharded_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return sharded_create_context(provider, config_str, 0, (sharded_context**)context);
+}
+
+static YP_return_t sharded_close_phonebook(void* ctx)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    if(context->wal) wal_close(context->wal);
+    sharded_free_context(context);
+    return YP_SUCCESS;
+}
+
+static YP_return_t sharded_destroy_phonebook(void* ctx)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    if(context->wal) wal_destroy(context->wal);
+    sharded_free_context(context);
+    return YP_SUCCESS;
+}
+
+static char* sharded_get_config(void* ctx)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void sharded_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from Sharded phonebook\n");
+}
+
+static int32_t sharded_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static void sharded_lock_all(sharded_context* context)
+{
+    for(size_t s = 0; s < context->num_shards; s++)
+        ABT_rwlock_wrlock(context->shards[s].lock);
+}
+
+static void sharded_unlock_all(sharded_context* context)
+{
+    for(size_t s = 0; s < context->num_shards; s++)
+        ABT_rwlock_unlock(context->shards[s].lock);
+}
+
+/* Applies an insertion and appends its record, undoing the insertion
+ * if the record can't be appended. Called with the shard's lock held. */
+static YP_return_t sharded_log_insert(
+        sharded_context* context, memory_table* table, const char* name,
+        size_t name_size, uint64_t hash, YP_number_t number, wal_ticket* ticket)
+{
+    memory_slot* slot = memory_table_find(table, name, name_size, hash);
+    uint64_t old = slot ? slot->value : 0;
+    int inserted;
+    YP_return_t ret = memory_table_insert(table, name, name_size, hash,
+                                          number, &slot, &inserted);
+    if(ret != YP_SUCCESS || !context->wal) return ret;
+    ret = wal_append(context->wal, WAL_INSERT, name, name_size, number, ticket);
+    if(ret != YP_SUCCESS) {
+        if(inserted) memory_table_erase_slot(table, slot);
+        else slot->value = old;
+    }
+    return ret;
+}
+
+typedef struct sharded_reload_args {
+    sharded_context* context;
+    memory_table*    tables;
+} sharded_reload_args;
+
+static int sharded_reload_replay(
+        void* uargs, int type, const char* name, size_t name_size, uint64_t number)
+{
+    sharded_reload_args* args = (sharded_reload_args*)uargs;
+    uint64_t hash = YP_hash(name, name_size);
+    size_t s = (size_t)(sharded_find_shard(args->context, hash) - args->context->shards);
+    return sharded_apply(&args->tables[s], type, name, name_size, hash, number);
+}
+
+/* Rebuilds the shards from the records that were synced, dropping the
+ * updates whose batch failed. The first caller does it. */
+static void sharded_reload(sharded_context* context)
+{
+    size_t num_shards = context->num_shards;
+    sharded_lock_all(context);
+    if(context->reloaded) goto finish;
+    sharded_reload_args args = { context, NULL };
+    args.tables = (memory_table*)calloc(num_shards, sizeof(memory_table));
+    if(!args.tables) goto finish;
+    size_t s;
+    for(s = 0; s < num_shards; s++)
+        if(memory_table_init(&args.tables[s], context->shards[s].table.size) != YP_SUCCESS)
+            break;
+    if(s == num_shards
+    && wal_reload(context->wal, sharded_reload_replay, &args) == YP_SUCCESS) {
+        for(s = 0; s < num_shards; s++) {
+            memory_table_destroy(&context->shards[s].table);
+            context->shards[s].table = args.tables[s];
+        }
+        context->reloaded = 1;
+    } else {
+        for(size_t t = 0; t < s; t++)
+            memory_table_destroy(&args.tables[t]);
+    }
+    free(args.tables);
+
+finish:
+    sharded_unlock_all(context);
+}
+
+static int sharded_dump(void* uargs, wal_replay_fn fn, void* fn_args)
+{
+    const sharded_context* context = (const sharded_context*)uargs;
+    for(size_t s = 0; s < context->num_shards; s++) {
+        const memory_table* table = &context->shards[s].table;
+        for(size_t i = 0; i < table->capacity; i++) {
+            if(!memory_table_slot_is_full(table, i)) continue;
+            const memory_slot* slot = &table->slots[i];
+            if(fn(fn_args, WAL_INSERT, memory_slot_key(slot), slot->key_size, slot->value))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Waits for the records to be durable, then rebuilds the shards if one
+ * of them couldn't be, or checkpoints the log if it has grown enough */
+static YP_return_t sharded_sync(sharded_context* context, wal_ticket* tickets, size_t count)
+{
+    YP_return_t ret = YP_SUCCESS;
+    for(size_t i = 0; i < count; i++) {
+        YP_return_t sync_ret = wal_wait(tickets[i]);
+        if(ret == YP_SUCCESS) ret = sync_ret;
+    }
+    if(ret != YP_SUCCESS) {
+        sharded_reload(context);
+    } else if(wal_should_checkpoint(context->wal)) {
+        sharded_lock_all(context);
+        if(wal_should_checkpoint(context->wal))
+            wal_checkpoint(context->wal, sharded_dump, context);
+        sharded_unlock_all(context);
+    }
+    return ret;
+}
+
+static YP_return_t sharded_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    sharded_shard* shard = sharded_find_shard(context, hash);
+    wal_ticket ticket;
+    ABT_rwlock_wrlock(shard->lock);
+    YP_return_t ret = sharded_log_insert(context, &shard->table, name, name_size,
+                                         hash, number, &ticket);
+    ABT_rwlock_unlock(shard->lock);
+    if(ret != YP_SUCCESS || !context->wal) return ret;
+    return sharded_sync(context, &ticket, 1);
+}
+
+static YP_return_t sharded_insert_batch(
+        void* ctx, size_t count, const char* const* names,
+        const size_t* name_sizes, const YP_number_t* numbers)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    size_t num_shards = context->num_shards;
+    /* group the records by shard (counting sort), so that each shard is
+     * sized and locked once */
+    uint64_t* hashes  = (uint64_t*)malloc(count*sizeof(*hashes));
+    size_t*   order   = (size_t*)malloc(count*sizeof(*order));
+    size_t*   starts  = (size_t*)calloc(num_shards + 1, sizeof(*starts));
+    wal_ticket* tickets = context->wal ? (wal_ticket*)malloc(count*sizeof(*tickets)) : NULL;
+    YP_return_t ret = YP_SUCCESS;
+    if(!hashes || !order || !starts || (context->wal && !tickets)) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(size_t i = 0; i < count; i++) {
+        hashes[i] = YP_hash(names[i], name_sizes[i]);
+        starts[sharded_find_shard(context, hashes[i]) - context->shards + 1] += 1;
+    }
+    for(size_t s = 0; s < num_shards; s++)
+        starts[s + 1] += starts[s];
+    for(size_t i = 0; i < count; i++)
+        order[starts[sharded_find_shard(context, hashes[i]) - context->shards]++] = i;
+    /* starts[s] is now the end of shard s */
+
+    size_t appended = 0;
+    for(size_t s = 0, begin = 0; s < num_shards && ret == YP_SUCCESS; begin = starts[s++]) {
+        if(begin == starts[s]) continue;
+        sharded_shard* shard = &context->shards[s];
+        ABT_rwlock_wrlock(shard->lock);
+        ret = memory_table_reserve(&shard->table, shard->table.size + starts[s] - begin);
+        for(size_t k = begin; k < starts[s] && ret == YP_SUCCESS; k++) {
+            size_t i = order[k];
+            ret = sharded_log_insert(context, &shard->table, names[i], name_sizes[i],
+                                     hashes[i], numbers[i],
+                                     tickets ? &tickets[appended] : NULL);
+            if(ret == YP_SUCCESS && tickets) appended += 1;
+        }
+        ABT_rwlock_unlock(shard->lock);
+    }
+    if(tickets) {
+        YP_return_t sync_ret = sharded_sync(context, tickets, appended);
+        if(ret == YP_SUCCESS) ret = sync_ret;
+    }
+
+finish:
+    free(hashes);
+    free(order);
+    free(starts);
+    free(tickets);
+    return ret;
+}
+
+static YP_return_t sharded_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    sharded_shard* shard = sharded_find_shard(context, hash);
+    YP_return_t ret = YP_SUCCESS;
+    ABT_rwlock_rdlock(shard->lock);
+    memory_slot* slot = memory_table_find(&shard->table, name, name_size, hash);
+    if(slot) *number = slot->value;
+    else ret = YP_ERR_NOT_FOUND;
+    ABT_rwlock_unlock(shard->lock);
+    return ret;
+}
+
+static YP_return_t sharded_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    sharded_shard* shard = sharded_find_shard(context, hash);
+    wal_ticket ticket;
+    YP_return_t ret = YP_ERR_NOT_FOUND;
+    ABT_rwlock_wrlock(shard->lock);
+    memory_slot* slot = memory_table_find(&shard->table, name, name_size, hash);
+    if(slot) {
+        ret = context->wal ?
+            wal_append(context->wal, WAL_ERASE, name, name_size, 0, &ticket) : YP_SUCCESS;
+        if(ret == YP_SUCCESS) memory_table_erase_slot(&shard->table, slot);
+    }
+    ABT_rwlock_unlock(shard->lock);
+    if(ret != YP_SUCCESS || !context->wal) return ret;
+    return sharded_sync(context, &ticket, 1);
+}
+
+/* Shards are listed one after the other, each under its read lock */
+static YP_return_t sharded_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    int stop = 0;
+    for(size_t s = 0; s < context->num_shards && !stop; s++) {
+        sharded_shard* shard = &context->shards[s];
+        ABT_rwlock_rdlock(shard->lock);
+        const memory_table* table = &shard->table;
+        for(size_t i = 0; i < table->capacity && !stop; i++) {
+            if(!memory_table_slot_is_full(table, i)) continue;
+            const memory_slot* slot = &table->slots[i];
+            stop = fn(uargs, memory_slot_key(slot), slot->key_size, slot->value);
+        }
+        ABT_rwlock_unlock(shard->lock);
+    }
+    return YP_SUCCESS;
+}
+
+/* positions hold the shard above its position (see scan.h) */
+#define SHARDED_SCAN_SHIFT (SCAN_SLOT_BITS + SCAN_REHASH_BITS)
+
+static YP_return_t sharded_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    sharded_context* context = (sharded_context*)ctx;
+    uint64_t start = *position & ((UINT64_C(1) << SHARDED_SCAN_SHIFT) - 1);
+    for(size_t s = *position >> SHARDED_SCAN_SHIFT; s < context->num_shards; s++, start = 0) {
+        sharded_shard* shard = &context->shards[s];
+        ABT_rwlock_rdlock(shard->lock);
+        const memory_table* table = &shard->table;
+        uint64_t i;
+        YP_return_t ret = scan_slot_resume(start, table->rehashes, &i);
+        if(ret != YP_SUCCESS) {
+            ABT_rwlock_unlock(shard->lock);
+            return ret;
+        }
+        for(; i < table->capacity; i++) {
+            if(!memory_table_slot_is_full(table, i)) continue;
+            const memory_slot* slot = &table->slots[i];
+            if(fn(uargs, memory_slot_key(slot), slot->key_size, slot->value)) {
+                *position = ((uint64_t)s << SHARDED_SCAN_SHIFT)
+                          | scan_slot_position(table->rehashes, i);
+                ABT_rwlock_unlock(shard->lock);
+                return YP_SUCCESS;
+            }
+        }
+        ABT_rwlock_unlock(shard->lock);
+    }
+    *position = UINT64_MAX;
+    return YP_SUCCESS;
+}
+
+static YP_backend_impl sharded_backend = {
+    .name             = "sharded",
+
+    .create_phonebook  = sharded_create_phonebook,
+    .open_phonebook    = sharded_open_phonebook,
+    .close_phonebook   = sharded_close_phonebook,
+    .destroy_phonebook = sharded_destroy_phonebook,
+    .get_config       = sharded_get_config,
+
+    .hello            = sharded_say_hello,
+    .sum              = sharded_compute_sum,
+    .insert           = sharded_insert,
+    .lookup           = sharded_lookup,
+    .erase            = sharded_erase,
+    .iterate          = sharded_iterate,
+    .insert_batch     = sharded_insert_batch,
+    .scan             = sharded_scan
+};
+
+YP_return_t YP_provider_register_sharded_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &sharded_backend);
+}
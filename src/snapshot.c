@@ -0,0 +1,366 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "provider.h"
+#include "hash.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_RECORD_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+struct snapshot_task {
+    YP_provider_t    provider;
+    YP_backend_impl* fn;
+    void*            ctx;
+    char*            path;
+    double           interval;
+    /* stop flag, protected by mutex */
+    ABT_mutex        mutex;
+    ABT_cond         cond;
+    int              stop;
+    ABT_thread       ult;
+};
+
+typedef struct snapshot_writer {
+    int         fd;
+    char*       chunk;       // SNAPSHOT_CHUNK_SIZE bytes
+    size_t      chunk_size;  // bytes of the current chunk
+    uint64_t    checksum;
+    uint64_t    num_records;
+    uint64_t    data_size;
+    YP_return_t ret;
+} snapshot_writer;
+
+static int write_all(int fd, const char* data, size_t size)
+{
+    while(size) {
+        ssize_t w = write(fd, data, size);
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        data += w;
+        size -= (size_t)w;
+    }
+    return 0;
+}
+
+static void flush_chunk(snapshot_writer* w)
+{
+    if(!w->chunk_size) return;
+    w->checksum = YP_hash_seeded(w->chunk, w->chunk_size, w->checksum);
+    if(write_all(w->fd, w->chunk, w->chunk_size) != 0)
+        w->ret = YP_ERR_IO;
+    w->chunk_size = 0;
+}
+
+static void put_bytes(snapshot_writer* w, const void* data, size_t size)
+{
+    const char* src = (const char*)data;
+    while(size) {
+        size_t n = SNAPSHOT_CHUNK_SIZE - w->chunk_size;
+        if(n > size) n = size;
+        memcpy(w->chunk + w->chunk_size, src, n);
+        w->chunk_size += n;
+        w->data_size  += n;
+        src  += n;
+        size -= n;
+        if(w->chunk_size == SNAPSHOT_CHUNK_SIZE)
+            flush_chunk(w);
+    }
+}
+
+static int write_record(void* uargs, const char* name, size_t name_size, uint64_t number)
+{
+    snapshot_writer* w = (snapshot_writer*)uargs;
+    uint32_t size = (uint32_t)name_size;
+    put_bytes(w, &size, sizeof(size));
+    put_bytes(w, &number, sizeof(number));
+    put_bytes(w, name, name_size);
+    w->num_records += 1;
+    return w->ret != YP_SUCCESS;
+}
+
+/* Syncs the directory holding path, so that a rename into it is durable */
+static int sync_parent(const char* path)
+{
+    char* copy = strdup(path);
+    if(!copy) return -1;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if(fd < 0) return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+YP_return_t snapshot_write(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path)
+{
+    if(!fn->iterate) return YP_ERR_OP_UNSUPPORTED;
+
+    size_t path_size = strlen(path);
+    char* tmp_path = (char*)malloc(path_size + 8);
+    if(!tmp_path) return YP_ERR_ALLOCATION;
+    memcpy(tmp_path, path, path_size);
+    memcpy(tmp_path + path_size, ".XXXXXX", 8);
+
+    snapshot_writer w;
+    memset(&w, 0, sizeof(w));
+    w.chunk = (char*)malloc(SNAPSHOT_CHUNK_SIZE);
+    if(!w.chunk) {
+        free(tmp_path);
+        return YP_ERR_ALLOCATION;
+    }
+    w.fd = mkstemp(tmp_path);
+    if(w.fd < 0) {
+        margo_error(provider->mid, "Could not create snapshot file %s: %s",
+                    tmp_path, strerror(errno));
+        free(w.chunk);
+        free(tmp_path);
+        return YP_ERR_IO;
+    }
+
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    if(lseek(w.fd, sizeof(header), SEEK_SET) < 0)
+        w.ret = YP_ERR_IO;
+    if(w.ret == YP_SUCCESS) {
+        YP_return_t ret = fn->iterate(ctx, write_record, &w);
+        if(w.ret == YP_SUCCESS) w.ret = ret;
+    }
+    flush_chunk(&w);
+
+    if(w.ret == YP_SUCCESS) {
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version     = SNAPSHOT_VERSION;
+        header.num_records = w.num_records;
+        header.data_size   = w.data_size;
+        header.checksum    = w.checksum;
+        if(pwrite(w.fd, &header, sizeof(header), 0) != sizeof(header)
+        || fdatasync(w.fd) != 0
+        || rename(tmp_path, path) != 0
+        || sync_parent(path) != 0)
+            w.ret = YP_ERR_IO;
+    }
+    if(w.ret == YP_ERR_IO)
+        margo_error(provider->mid, "Could not write snapshot %s: %s",
+                    path, strerror(errno));
+    close(w.fd);
+    if(w.ret != YP_SUCCESS)
+        unlink(tmp_path);
+    else
+        margo_debug(provider->mid, "Wrote %llu records to snapshot %s",
+                    (unsigned long long)w.num_records, path);
+    free(w.chunk);
+    free(tmp_path);
+    return w.ret;
+}
+
+YP_return_t snapshot_load(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path)
+{
+    if(!fn->insert) return YP_ERR_OP_UNSUPPORTED;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        if(errno == ENOENT) return YP_ERR_NOT_FOUND;
+        margo_error(provider->mid, "Could not open snapshot %s: %s",
+                    path, strerror(errno));
+        return YP_ERR_IO;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header)) {
+        margo_error(provider->mid, "Invalid snapshot %s", path);
+        close(fd);
+        return YP_ERR_IO;
+    }
+    size_t size = (size_t)st.st_size;
+    char* data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        margo_error(provider->mid, "Could not map snapshot %s: %s",
+                    path, strerror(errno));
+        return YP_ERR_IO;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    YP_return_t ret = YP_SUCCESS;
+    const char** names = NULL;
+    size_t* name_sizes = NULL;
+    YP_number_t* numbers = NULL;
+    snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+    || header.version != SNAPSHOT_VERSION
+    || header.data_size != size - sizeof(header)) {
+        margo_error(provider->mid, "Invalid snapshot %s", path);
+        ret = YP_ERR_IO;
+        goto finish;
+    }
+    const char* records = data + sizeof(header);
+    uint64_t checksum = 0;
+    for(size_t offset = 0; offset < header.data_size; offset += SNAPSHOT_CHUNK_SIZE) {
+        size_t n = header.data_size - offset;
+        if(n > SNAPSHOT_CHUNK_SIZE) n = SNAPSHOT_CHUNK_SIZE;
+        checksum = YP_hash_seeded(records + offset, n, checksum);
+    }
+    if(checksum != header.checksum) {
+        margo_error(provider->mid, "Corrupted snapshot %s", path);
+        ret = YP_ERR_IO;
+        goto finish;
+    }
+
+    /* records are handed to the backend in batches when it can take
+     * them, so that a backend syncing each update (e.g. to a write-ahead
+     * log) does so once per batch rather than once per record */
+    if(fn->insert_batch) {
+        names      = (const char**)malloc(SNAPSHOT_LOAD_BATCH*sizeof(*names));
+        name_sizes = (size_t*)malloc(SNAPSHOT_LOAD_BATCH*sizeof(*name_sizes));
+        numbers    = (YP_number_t*)malloc(SNAPSHOT_LOAD_BATCH*sizeof(*numbers));
+        if(!names || !name_sizes || !numbers) {
+            ret = YP_ERR_ALLOCATION;
+            goto finish;
+        }
+    }
+    size_t count = 0;
+    size_t offset = 0;
+    for(uint64_t i = 0; i < header.num_records; i++) {
+        uint32_t name_size;
+        uint64_t number;
+        if(header.data_size - offset < SNAPSHOT_RECORD_HEADER_SIZE) {
+            ret = YP_ERR_IO;
+            break;
+        }
+        memcpy(&name_size, records + offset, sizeof(name_size));
+        memcpy(&number, records + offset + sizeof(name_size), sizeof(number));
+        offset += SNAPSHOT_RECORD_HEADER_SIZE;
+        if(header.data_size - offset < name_size) {
+            ret = YP_ERR_IO;
+            break;
+        }
+        if(!fn->insert_batch) {
+            ret = fn->insert(ctx, records + offset, name_size, number);
+            if(ret != YP_SUCCESS) break;
+        } else {
+            names[count]      = records + offset;
+            name_sizes[count] = name_size;
+            numbers[count]    = number;
+            count += 1;
+            if(count == SNAPSHOT_LOAD_BATCH) {
+                ret = fn->insert_batch(ctx, count, names, name_sizes, numbers);
+                count = 0;
+                if(ret != YP_SUCCESS) break;
+            }
+        }
+        offset += name_size;
+    }
+    if(ret == YP_SUCCESS && count)
+        ret = fn->insert_batch(ctx, count, names, name_sizes, numbers);
+    if(ret != YP_SUCCESS)
+        margo_error(provider->mid, "Could not load snapshot %s (error %d)", path, ret);
+    else
+        margo_debug(provider->mid, "Loaded %llu records from snapshot %s",
+                    (unsigned long long)header.num_records, path);
+
+finish:
+    free(names);
+    free(name_sizes);
+    free(numbers);
+    munmap(data, size);
+    return ret;
+}
+
+static void snapshot_ult(void* args)
+{
+    snapshot_task* task = (snapshot_task*)args;
+    ABT_mutex_lock(task->mutex);
+    while(!task->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double t = (double)deadline.tv_sec + deadline.tv_nsec*1e-9 + task->interval;
+        deadline.tv_sec  = (time_t)t;
+        deadline.tv_nsec = (long)((t - (double)deadline.tv_sec)*1e9);
+        int ret = ABT_SUCCESS;
+        while(!task->stop && ret != ABT_ERR_COND_TIMEDOUT)
+            ret = ABT_cond_timedwait(task->cond, task->mutex, &deadline);
+        if(task->stop) break;
+        ABT_mutex_unlock(task->mutex);
+        snapshot_write(task->provider, task->fn, task->ctx, task->path);
+        ABT_mutex_lock(task->mutex);
+    }
+    ABT_mutex_unlock(task->mutex);
+}
+
+static void free_task(snapshot_task* task)
+{
+    if(task->mutex != ABT_MUTEX_NULL) ABT_mutex_free(&task->mutex);
+    if(task->cond != ABT_COND_NULL) ABT_cond_free(&task->cond);
+    free(task->path);
+    free(task);
+}
+
+YP_return_t snapshot_task_start(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path,
+        double interval,
+        snapshot_task** out)
+{
+    snapshot_task* task = (snapshot_task*)calloc(1, sizeof(*task));
+    if(!task) return YP_ERR_ALLOCATION;
+    task->provider = provider;
+    task->fn       = fn;
+    task->ctx      = ctx;
+    task->interval = interval;
+    task->mutex    = ABT_MUTEX_NULL;
+    task->cond     = ABT_COND_NULL;
+    task->path     = strdup(path);
+    if(!task->path) {
+        free_task(task);
+        return YP_ERR_ALLOCATION;
+    }
+    if(ABT_mutex_create(&task->mutex) != ABT_SUCCESS
+    || ABT_cond_create(&task->cond) != ABT_SUCCESS) {
+        free_task(task);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    if(ABT_thread_create(pool, snapshot_ult, task,
+                         ABT_THREAD_ATTR_NULL, &task->ult) != ABT_SUCCESS) {
+        free_task(task);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = task;
+    return YP_SUCCESS;
+}
+
+void snapshot_task_stop(snapshot_task* task)
+{
+    ABT_mutex_lock(task->mutex);
+    task->stop = 1;
+    ABT_cond_signal(task->cond);
+    ABT_mutex_unlock(task->mutex);
+    ABT_thread_join(task->ult);
+    ABT_thread_free(&task->ult);
+    free_task(task);
+}
@@ -0,0 +1,85 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-backend.h"
+
+/*
+ * Snapshot of the records of a phonebook, obtained by listing them
+ * through the iterate function of its backend. The file is made of a
+ * fixed-size header followed by packed records (32-bit name size,
+ * 64-bit number, name bytes). The header holds the number of records,
+ * the size of the data and a checksum of the data computed in chunks
+ * of SNAPSHOT_CHUNK_SIZE bytes.
+ *
+ * Snapshots are written to a temporary file that is renamed once
+ * synced, so a crash leaves the previous snapshot in place. They are
+ * loaded by mapping the file and reading it sequentially, feeding the
+ * records to the insert_batch function of the backend in batches of
+ * SNAPSHOT_LOAD_BATCH records (or to insert if it has none).
+ *
+ * Snapshots are not point-in-time: no lock keeps the phonebook from
+ * being updated while it is listed, so a snapshot written during
+ * updates may hold some of them and not others.
+ */
+
+#define SNAPSHOT_MAGIC      "YPSNAPSH"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_CHUNK_SIZE (1024*1024)
+#define SNAPSHOT_LOAD_BATCH 1024
+
+typedef struct snapshot_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_records;
+    uint64_t data_size;
+    uint64_t checksum;
+} snapshot_header;
+
+typedef struct snapshot_task snapshot_task;
+
+/**
+ * @brief Writes a snapshot of the phonebook to path.
+ */
+YP_return_t snapshot_write(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path);
+
+/**
+ * @brief Inserts the records of the snapshot at path into the phonebook.
+ * Returns YP_ERR_NOT_FOUND if there is no such file and YP_ERR_IO if it
+ * isn't a valid snapshot.
+ */
+YP_return_t snapshot_load(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path);
+
+/**
+ * @brief Starts a ULT in the provider's pool writing a snapshot of the
+ * phonebook to path every interval seconds.
+ */
+YP_return_t snapshot_task_start(
+        YP_provider_t provider,
+        YP_backend_impl* fn,
+        void* ctx,
+        const char* path,
+        double interval,
+        snapshot_task** task);
+
+/**
+ * @brief Stops the ULT, waiting for the snapshot it may be writing.
+ */
+void snapshot_task_stop(snapshot_task* task);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SWISS_GROUP_H
+#define _SWISS_GROUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Control-byte primitives shared by the Swiss-table style hash tables
+ * of the backends. Each slot of a table has a control byte that is
+ * either EMPTY, DELETED, or the 7 low bits of the hash of its key (H2).
+ * Lookups load a whole group of control bytes and get back a mask with
+ * one bit (SSE2) or one byte (SWAR) per matching control byte.
+ *
+ * Tables keep SWISS_GROUP_WIDTH extra control bytes mirroring the
+ * first ones so that a group can be loaded at any position.
+ */
+
+#define SWISS_CTRL_EMPTY   ((uint8_t)0x80)
+#define SWISS_CTRL_DELETED ((uint8_t)0xFE)
+
+#define SWISS_H1(hash) ((hash) >> 7)
+#define SWISS_H2(hash) ((uint8_t)((hash) & 0x7F))
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SWISS_GROUP_WIDTH 16
+
+typedef __m128i  swiss_group_t;
+typedef uint32_t swiss_mask_t;
+
+static inline swiss_group_t swiss_group_load(const uint8_t* ctrl)
+{
+    return _mm_loadu_si128((const __m128i*)ctrl);
+}
+
+static inline swiss_mask_t swiss_group_match(swiss_group_t g, uint8_t h2)
+{
+    return (swiss_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)h2), g));
+}
+
+static inline swiss_mask_t swiss_group_match_empty(swiss_group_t g)
+{
+    return (swiss_mask_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_set1_epi8((char)SWISS_CTRL_EMPTY), g));
+}
+
+static inline swiss_mask_t swiss_group_match_empty_or_deleted(swiss_group_t g)
+{
+    return (swiss_mask_t)_mm_movemask_epi8(g);
+}
+
+static inline size_t swiss_mask_trailing(swiss_mask_t m)
+{
+    return __builtin_ctz(m);
+}
+
+static inline size_t swiss_mask_leading(swiss_mask_t m)
+{
+    return __builtin_clz(m) - 16;
+}
+
+#else
+
+#define SWISS_GROUP_WIDTH 8
+
+typedef uint64_t swiss_group_t;
+typedef uint64_t swiss_mask_t;
+
+#define SWISS_LSBS 0x0101010101010101ull
+#define SWISS_MSBS 0x8080808080808080ull
+
+static inline swiss_group_t swiss_group_load(const uint8_t* ctrl)
+{
+    uint64_t g;
+    memcpy(&g, ctrl, sizeof(g));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    g = __builtin_bswap64(g);
+#endif
+    return g;
+}
+
+static inline swiss_mask_t swiss_group_match(swiss_group_t g, uint8_t h2)
+{
+    uint64_t x = g ^ (SWISS_LSBS * h2);
+    return (x - SWISS_LSBS) & ~x & SWISS_MSBS;
+}
+
+static inline swiss_mask_t swiss_group_match_empty(swiss_group_t g)
+{
+    return g & (~g << 6) & SWISS_MSBS;
+}
+
+static inline swiss_mask_t swiss_group_match_empty_or_deleted(swiss_group_t g)
+{
+    return g & (~g << 7) & SWISS_MSBS;
+}
+
+static inline size_t swiss_mask_trailing(swiss_mask_t m)
+{
+    return __builtin_ctzll(m) >> 3;
+}
+
+static inline size_t swiss_mask_leading(swiss_mask_t m)
+{
+    return __builtin_clzll(m) >> 3;
+}
+
+#endif
+
+/* Tables never have fewer slots than this, which is also the number of
+ * mirrored control bytes at the end of the control array. */
+#define SWISS_MIN_CAPACITY 16
+
+static inline size_t swiss_max_growth(size_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+static inline size_t swiss_capacity_for(size_t count)
+{
+    size_t capacity = SWISS_MIN_CAPACITY;
+    while(swiss_max_growth(capacity) < count) capacity *= 2;
+    return capacity;
+}
+
+static inline void swiss_set_ctrl(uint8_t* ctrl, size_t capacity, size_t i, uint8_t h)
+{
+    ctrl[i] = h;
+    if(i < SWISS_MIN_CAPACITY)
+        ctrl[capacity + i] = h;
+}
+
+/* Returns the index of the first EMPTY or DELETED slot on the probe
+ * sequence of the given hash. */
+static inline size_t swiss_find_first_non_full(
+        const uint8_t* ctrl, size_t capacity, uint64_t hash)
+{
+    size_t mask = capacity - 1;
+    size_t pos  = SWISS_H1(hash) & mask;
+    size_t step = 0;
+    while(1) {
+        swiss_mask_t m = swiss_group_match_empty_or_deleted(swiss_group_load(ctrl + pos));
+        if(m) return (pos + swiss_mask_trailing(m)) & mask;
+        step += SWISS_GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+/* Returns the control byte an erased slot should get: EMPTY if no probe
+ * window containing it can ever have been seen full, DELETED otherwise. */
+static inline uint8_t swiss_erased_ctrl(
+        const uint8_t* ctrl, size_t capacity, size_t i)
+{
+    size_t before = (i - SWISS_GROUP_WIDTH) & (capacity - 1);
+    swiss_mask_t empty_after  = swiss_group_match_empty(swiss_group_load(ctrl + i));
+    swiss_mask_t empty_before = swiss_group_match_empty(swiss_group_load(ctrl + before));
+    int was_never_full = empty_before && empty_after
+        && (swiss_mask_trailing(empty_after) + swiss_mask_leading(empty_before))
+            < SWISS_GROUP_WIDTH;
+    return was_never_full ? SWISS_CTRL_EMPTY : SWISS_CTRL_DELETED;
+}
+
+#endif
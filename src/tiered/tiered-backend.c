@@ -0,0 +1,458 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <json-c/json.h>
+#include "YP/YP-backend.h"
+#include "../provider.h"
+#include "../hash.h"
+#include "../scan.h"
+#include "../memory/memory-table.h"
+#include "../mmap/mmap-store.h"
+#include "tiered-backend.h"
+
+/*
+ * Two-tier phonebook: at most "hot_capacity" names are kept in a memory
+ * table (the hot tier), in front of an mmap store (the cold tier, see
+ * mmap-store.h) that holds the others. The hot tier is write-back:
+ * inserted names go to the hot tier only and reach the cold tier when
+ * they are evicted or when the phonebook is closed.
+ *
+ * Hot entries carry an 8-bit logarithmic access counter (Morris
+ * counter, as in Redis' LFU policy) in the "meta" field of their slot,
+ * along with a dirty bit. Counters are halved every 16 * hot_capacity
+ * accesses so that names that stop being used eventually cool down.
+ * When the hot tier is full, TIERED_SAMPLES random hot entries are
+ * sampled and the one with the lowest counter is the eviction victim.
+ * A name found in the cold tier is promoted only if the victim is not
+ * used more often than a newly promoted name would be, so lookups
+ * change the content of the hot tier.
+ *
+ * Listings therefore don't rely on which names are hot. They start by
+ * writing the dirty hot entries back to the cold tier, then go over the
+ * hot entries whose name is not in the cold tier (names inserted since
+ * the listing began), then over every entry of the cold tier, taking
+ * its number from the hot tier if the name is there too. Promotions and
+ * evictions of names that were there when the listing began don't move
+ * them from one pass to the other, so a scan interleaved with lookups
+ * lists each of them once. A name inserted then evicted while a scan is
+ * in progress may be listed twice.
+ */
+
+#define TIERED_DEFAULT_HOT_CAPACITY 65536
+#define TIERED_SAMPLES      8
+#define TIERED_COUNTER_MASK 0xffu
+#define TIERED_COUNTER_INIT 5        // counter of a newly promoted name
+#define TIERED_LOG_FACTOR   10
+#define TIERED_DIRTY        0x100u   // not written to the cold tier yet
+
+typedef struct tiered_context {
+    struct json_object* config;
+    memory_table        hot;
+    mmap_store          cold;
+    size_t              hot_capacity;
+    size_t              accesses; // since counters were last halved
+    uint64_t            rng;
+} tiered_context;
+
+static inline uint64_t tiered_random(tiered_context* ctx)
+{
+    /* xorshift64* */
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static void tiered_touch(tiered_context* ctx, memory_slot* slot)
+{
+    uint32_t counter = slot->meta & TIERED_COUNTER_MASK;
+    if(counter < TIERED_COUNTER_MASK) {
+        uint32_t base = counter > TIERED_COUNTER_INIT ? counter - TIERED_COUNTER_INIT : 0;
+        if(tiered_random(ctx) % (base * TIERED_LOG_FACTOR + 1) == 0)
+            slot->meta += 1;
+    }
+    if(++ctx->accesses < 16 * ctx->hot_capacity) return;
+    ctx->accesses = 0;
+    memory_table* hot = &ctx->hot;
+    for(size_t i = 0; i < hot->capacity; i++) {
+        if(!memory_table_slot_is_full(hot, i)) continue;
+        uint32_t meta = hot->slots[i].meta;
+        hot->slots[i].meta = (meta & ~TIERED_COUNTER_MASK) | ((meta & TIERED_COUNTER_MASK) / 2);
+    }
+}
+
+/* Samples the hot tier and returns the entry with the lowest counter */
+static memory_slot* tiered_pick_victim(tiered_context* ctx)
+{
+    memory_table* hot = &ctx->hot;
+    memory_slot* victim = NULL;
+    for(unsigned s = 0; s < TIERED_SAMPLES; s++) {
+        size_t i = (size_t)tiered_random(ctx) & (hot->capacity - 1);
+        while(!memory_table_slot_is_full(hot, i))
+            i = (i + 1) & (hot->capacity - 1);
+        memory_slot* slot = &hot->slots[i];
+        if(!victim || (slot->meta & TIERED_COUNTER_MASK) < (victim->meta & TIERED_COUNTER_MASK))
+            victim = slot;
+    }
+    return victim;
+}
+
+static YP_return_t tiered_evict(tiered_context* ctx, memory_slot* victim)
+{
+    if(victim->meta & TIERED_DIRTY) {
+        const char* key = memory_slot_key(victim);
+        YP_return_t ret = mmap_store_insert(&ctx->cold, key, victim->key_size,
+                                            YP_hash(key, victim->key_size), victim->value);
+        if(ret != YP_SUCCESS) return ret;
+    }
+    memory_table_erase_slot(&ctx->hot, victim);
+    return YP_SUCCESS;
+}
+
+/* Writes all the dirty hot entries to the cold tier */
+static YP_return_t tiered_flush(tiered_context* ctx)
+{
+    memory_table* hot = &ctx->hot;
+    for(size_t i = 0; i < hot->capacity; i++) {
+        if(!memory_table_slot_is_full(hot, i)) continue;
+        memory_slot* slot = &hot->slots[i];
+        if(!(slot->meta & TIERED_DIRTY)) continue;
+        const char* key = memory_slot_key(slot);
+        YP_return_t ret = mmap_store_insert(&ctx->cold, key, slot->key_size,
+                                            YP_hash(key, slot->key_size), slot->value);
+        if(ret != YP_SUCCESS) return ret;
+        slot->meta &= ~TIERED_DIRTY;
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_parse_config(
+        YP_provider_t provider,
+        const char* config_str,
+        struct json_object** config,
+        size_t* hot_capacity)
+{
+    // read JSON config from provided string argument
+    if (!config_str) {
+        margo_error(provider->mid, "tiered backend requires a configuration");
+        return YP_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    *config = json_tokener_parse_ex(
+            tokener, config_str,
+            strlen(config_str));
+    if (!*config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+    if (!json_object_is_type(*config, json_type_object)) {
+        margo_error(provider->mid, "JSON configuration should be an object");
+        json_object_put(*config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "path" is the directory of the cold tier
+    struct json_object* jpath = json_object_object_get(*config, "path");
+    if (!jpath || !json_object_is_type(jpath, json_type_string)) {
+        margo_error(provider->mid, "\"path\" should be a string");
+        json_object_put(*config);
+        return YP_ERR_INVALID_CONFIG;
+    }
+    // "hot_capacity" is the maximum number of names kept in memory
+    *hot_capacity = TIERED_DEFAULT_HOT_CAPACITY;
+    struct json_object* jhot = json_object_object_get(*config, "hot_capacity");
+    if (jhot) {
+        if (!json_object_is_type(jhot, json_type_int)
+        ||  json_object_get_int64(jhot) < 1) {
+            margo_error(provider->mid,
+                "\"hot_capacity\" should be a strictly positive integer");
+            json_object_put(*config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        *hot_capacity = (size_t)json_object_get_int64(jhot);
+    }
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_init_context(
+        YP_provider_t provider,
+        const char* config_str,
+        int create,
+        tiered_context** context)
+{
+    struct json_object* config = NULL;
+    size_t hot_capacity = 0;
+    YP_return_t ret = tiered_parse_config(provider, config_str, &config, &hot_capacity);
+    if (ret != YP_SUCCESS) return ret;
+
+    size_t cold_capacity = 0;
+    struct json_object* jcapacity = json_object_object_get(config, "initial_capacity");
+    if (create && jcapacity) {
+        if (!json_object_is_type(jcapacity, json_type_int)
+        ||  json_object_get_int64(jcapacity) < 0) {
+            margo_error(provider->mid,
+                "\"initial_capacity\" should be a positive integer");
+            json_object_put(config);
+            return YP_ERR_INVALID_CONFIG;
+        }
+        cold_capacity = (size_t)json_object_get_int64(jcapacity);
+    }
+
+    tiered_context* ctx = (tiered_context*)calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        json_object_put(config);
+        return YP_ERR_ALLOCATION;
+    }
+    ret = memory_table_init(&ctx->hot, hot_capacity + 1);
+    if (ret != YP_SUCCESS) {
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    const char* path = json_object_get_string(json_object_object_get(config, "path"));
+    if (create) {
+        ret = mmap_store_create(&ctx->cold, path, cold_capacity);
+        if (ret != YP_SUCCESS)
+            margo_error(provider->mid,
+                "Could not create tiered phonebook in %s (it may already exist)", path);
+    } else {
+        ret = mmap_store_open(&ctx->cold, path);
+        if (ret != YP_SUCCESS)
+            margo_error(provider->mid, "Could not open tiered phonebook in %s", path);
+    }
+    if (ret != YP_SUCCESS) {
+        memory_table_destroy(&ctx->hot);
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    ctx->hot_capacity = hot_capacity;
+    ctx->rng          = (uintptr_t)ctx | 1;
+    ctx->config       = config;
+    *context = ctx;
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_create_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return tiered_init_context(provider, config_str, 1, (tiered_context**)context);
+}
+
+static YP_return_t tiered_open_phonebook(
+        YP_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    return tiered_init_context(provider, config_str, 0, (tiered_context**)context);
+}
+
+static YP_return_t tiered_close_phonebook(void* ctx)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    YP_return_t ret = tiered_flush(context);
+    YP_return_t close_ret = mmap_store_close(&context->cold);
+    if (ret == YP_SUCCESS) ret = close_ret;
+    memory_table_destroy(&context->hot);
+    json_object_put(context->config);
+    free(context);
+    return ret;
+}
+
+static YP_return_t tiered_destroy_phonebook(void* ctx)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    YP_return_t ret = mmap_store_destroy(&context->cold);
+    memory_table_destroy(&context->hot);
+    json_object_put(context->config);
+    free(context);
+    return ret;
+}
+
+static char* tiered_get_config(void* ctx)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    return strdup(json_object_to_json_string(context->config));
+}
+
+static void tiered_say_hello(void* ctx)
+{
+    (void)ctx;
+    printf("Hello World from Tiered phonebook\n");
+}
+
+static int32_t tiered_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static YP_return_t tiered_insert(
+        void* ctx, const char* name, size_t name_size, YP_number_t number)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    memory_slot* slot = memory_table_find(&context->hot, name, name_size, hash);
+    if(slot) {
+        slot->value = number;
+        slot->meta |= TIERED_DIRTY;
+        tiered_touch(context, slot);
+        return YP_SUCCESS;
+    }
+    if(context->hot.size >= context->hot_capacity) {
+        YP_return_t ret = tiered_evict(context, tiered_pick_victim(context));
+        if(ret != YP_SUCCESS) return ret;
+    }
+    YP_return_t ret = memory_table_insert(&context->hot, name, name_size, hash,
+                                          number, &slot, NULL);
+    if(ret != YP_SUCCESS) return ret;
+    slot->meta = TIERED_DIRTY | TIERED_COUNTER_INIT;
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_lookup(
+        void* ctx, const char* name, size_t name_size, YP_number_t* number)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    memory_slot* slot = memory_table_find(&context->hot, name, name_size, hash);
+    if(slot) {
+        *number = slot->value;
+        tiered_touch(context, slot);
+        return YP_SUCCESS;
+    }
+    mmap_slot* cold_slot = mmap_store_find(&context->cold, name, name_size, hash);
+    if(!cold_slot) return YP_ERR_NOT_FOUND;
+    *number = cold_slot->value;
+
+    /* promote the name, unless the hot tier is full of names that are
+     * used more often than it is likely to be */
+    if(context->hot.size >= context->hot_capacity) {
+        memory_slot* victim = tiered_pick_victim(context);
+        if((victim->meta & TIERED_COUNTER_MASK) > TIERED_COUNTER_INIT)
+            return YP_SUCCESS;
+        if(tiered_evict(context, victim) != YP_SUCCESS)
+            return YP_SUCCESS;
+    }
+    if(memory_table_insert(&context->hot, name, name_size, hash,
+                           *number, &slot, NULL) == YP_SUCCESS)
+        slot->meta = TIERED_COUNTER_INIT;
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_erase(
+        void* ctx, const char* name, size_t name_size)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    uint64_t hash = YP_hash(name, name_size);
+    YP_return_t hot_ret  = memory_table_erase(&context->hot, name, name_size, hash);
+    YP_return_t cold_ret = mmap_store_erase(&context->cold, name, name_size, hash);
+    if(hot_ret == YP_SUCCESS && cold_ret == YP_ERR_NOT_FOUND)
+        return YP_SUCCESS;
+    return cold_ret;
+}
+
+/* Whether a hot entry is listed by the first pass of a listing: clean
+ * entries are copies of cold ones, dirty ones may or may not be */
+static int tiered_hot_only(const tiered_context* ctx, const memory_slot* slot)
+{
+    if(!(slot->meta & TIERED_DIRTY)) return 0;
+    const char* key = memory_slot_key(slot);
+    return !mmap_store_find(&ctx->cold, key, slot->key_size, YP_hash(key, slot->key_size));
+}
+
+/* Number of a cold entry, as updated in the hot tier if it is there */
+static uint64_t tiered_cold_value(
+        const tiered_context* ctx, const char* key, const mmap_slot* slot)
+{
+    const memory_slot* hot_slot = memory_table_find(
+            &ctx->hot, key, slot->key_size, YP_hash(key, slot->key_size));
+    return hot_slot ? hot_slot->value : slot->value;
+}
+
+/* positions of a scan in the cold tier have this bit set, above the
+ * position in either tier (see scan.h) */
+#define TIERED_SCAN_COLD (UINT64_C(1) << 63)
+
+static YP_return_t tiered_scan(
+        void* ctx, uint64_t* position, YP_record_fn fn, void* uargs)
+{
+    tiered_context* context = (tiered_context*)ctx;
+    const memory_table* hot = &context->hot;
+    const mmap_store* cold = &context->cold;
+    YP_return_t ret;
+    uint64_t i = 0, start;
+    if(*position == 0) {
+        ret = tiered_flush(context);
+        if(ret != YP_SUCCESS) return ret;
+    }
+    if(*position & TIERED_SCAN_COLD) {
+        ret = scan_slot_resume(*position & ~TIERED_SCAN_COLD, cold->rehashes, &i);
+        if(ret != YP_SUCCESS) return ret;
+    } else if(scan_slot_resume(*position, hot->rehashes, &start) == YP_SUCCESS) {
+        /* the hot pass only lists names inserted since the scan started,
+         * so if the hot tier was rehashed (e.g. by promotions) the scan
+         * goes on with the cold pass rather than fail */
+        for(i = start; i < hot->capacity; i++) {
+            if(!memory_table_slot_is_full(hot, i)) continue;
+            const memory_slot* slot = &hot->slots[i];
+            if(!tiered_hot_only(context, slot)) continue;
+            if(fn(uargs, memory_slot_key(slot), slot->key_size, slot->value)) {
+                *position = scan_slot_position(hot->rehashes, i);
+                return YP_SUCCESS;
+            }
+        }
+        i = 0;
+    }
+    for(; i < cold->header->capacity; i++) {
+        if(!mmap_store_slot_is_full(cold, i)) continue;
+        const mmap_slot* slot = &cold->slots[i];
+        const char* key = mmap_slot_key(cold, slot);
+        if(!key) continue;
+        if(fn(uargs, key, slot->key_size, tiered_cold_value(context, key, slot))) {
+            *position = scan_slot_position(cold->rehashes, i) | TIERED_SCAN_COLD;
+            return YP_SUCCESS;
+        }
+    }
+    *position = UINT64_MAX;
+    return YP_SUCCESS;
+}
+
+static YP_return_t tiered_iterate(
+        void* ctx, YP_record_fn fn, void* uargs)
+{
+    uint64_t position = 0;
+    return tiered_scan(ctx, &position, fn, uargs);
+}
+
+static YP_backend_impl tiered_backend = {
+    .name             = "tiered",
+
+    .create_phonebook  = tiered_create_phonebook,
+    .open_phonebook    = tiered_open_phonebook,
+    .close_phonebook   = tiered_close_phonebook,
+    .destroy_phonebook = tiered_destroy_phonebook,
+    .get_config       = tiered_get_config,
+
+    .hello            = tiered_say_hello,
+    .sum              = tiered_compute_sum,
+    .insert           = tiered_insert,
+    .lookup           = tiered_lookup,
+    .erase            = tiered_erase,
+    .iterate          = tiered_iterate,
+    .scan             = tiered_scan
+};
+
+YP_return_t YP_provider_register_tiered_backend(YP_provider_t provider)
+{
+    return YP_provider_register_backend(provider, &tiered_backend);
+}
@@ -0,0 +1,114 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "timer-wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static void list_init(timer_entry* head)
+{
+    head->prev = head->next = head;
+}
+
+static void list_push(timer_entry* head, timer_entry* timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(timer_entry* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+/* Puts a timer in the slot of the lowest level covering its deadline,
+ * which must not be before the current tick */
+static void place(timer_wheel* wheel, timer_entry* timer)
+{
+    uint64_t delta = timer->deadline - wheel->now;
+    int level = 0;
+    while(level < TIMER_WHEEL_LEVELS - 1
+       && delta >= (UINT64_C(1) << ((level + 1)*TIMER_WHEEL_BITS)))
+        level += 1;
+    size_t slot = (size_t)(timer->deadline >> (level*TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    list_push(&wheel->slots[level][slot], timer);
+}
+
+void timer_wheel_init(timer_wheel* wheel, uint64_t now)
+{
+    wheel->now   = now;
+    wheel->count = 0;
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+            list_init(&wheel->slots[level][slot]);
+}
+
+void timer_wheel_add(timer_wheel* wheel, timer_entry* timer, uint64_t deadline)
+{
+    if(deadline <= wheel->now)
+        deadline = wheel->now + 1;
+    if(deadline - wheel->now > TIMER_WHEEL_MAX_TICKS)
+        deadline = wheel->now + TIMER_WHEEL_MAX_TICKS;
+    timer->deadline = deadline;
+    place(wheel, timer);
+    wheel->count += 1;
+}
+
+void timer_wheel_remove(timer_wheel* wheel, timer_entry* timer)
+{
+    list_unlink(timer);
+    wheel->count -= 1;
+}
+
+/* Moves the timers of a slot back into the wheel, at lower levels */
+static void cascade(timer_wheel* wheel, int level)
+{
+    size_t slot = (size_t)(wheel->now >> (level*TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    timer_entry pending;
+    timer_entry* head = &wheel->slots[level][slot];
+    if(head->next == head) return;
+    /* detach the list first, since timers may land back in this slot */
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+    while(pending.next != &pending) {
+        timer_entry* timer = pending.next;
+        list_unlink(timer);
+        place(wheel, timer);
+    }
+}
+
+void timer_wheel_advance(timer_wheel* wheel, uint64_t now, timer_fn fn, void* uargs)
+{
+    while(wheel->now < now) {
+        if(!wheel->count) {
+            /* nothing can expire, the slots are all empty */
+            wheel->now = now;
+            break;
+        }
+        wheel->now += 1;
+        /* when the first level wraps around, refill it from the levels
+         * above, highest first so that timers can cascade twice */
+        int levels = 1;
+        while(levels < TIMER_WHEEL_LEVELS
+           && ((wheel->now >> (levels*TIMER_WHEEL_BITS)) << (levels*TIMER_WHEEL_BITS)) == wheel->now)
+            levels += 1;
+        for(int level = levels - 1; level > 0; level--)
+            cascade(wheel, level);
+        timer_entry* head = &wheel->slots[0][wheel->now & TIMER_WHEEL_MASK];
+        while(head->next != head) {
+            timer_entry* timer = head->next;
+            list_unlink(timer);
+            wheel->count -= 1;
+            fn(uargs, timer);
+        }
+    }
+}
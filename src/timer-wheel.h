@@ -0,0 +1,61 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Hierarchical timer wheel: timers are kept in intrusive lists, in
+ * one of TIMER_WHEEL_SLOTS slots of one of TIMER_WHEEL_LEVELS levels,
+ * level k covering deadlines up to 256^(k+1) ticks ahead. Each tick
+ * expires the timers of one slot of the first level, and every 256
+ * ticks the timers of the next slot of the level above are moved down
+ * (cascaded), so adding, removing and expiring a timer are O(1).
+ */
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS   8
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+/* deadlines are at most this many ticks ahead */
+#define TIMER_WHEEL_MAX_TICKS ((UINT64_C(1) << (TIMER_WHEEL_LEVELS*TIMER_WHEEL_BITS)) - 1)
+
+typedef struct timer_entry {
+    struct timer_entry* prev;
+    struct timer_entry* next;
+    uint64_t            deadline; // in ticks
+} timer_entry;
+
+typedef struct timer_wheel {
+    uint64_t    now;   // last tick processed
+    size_t      count; // timers in the wheel
+    timer_entry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list heads
+} timer_wheel;
+
+typedef void (*timer_fn)(void* uargs, timer_entry* timer);
+
+void timer_wheel_init(timer_wheel* wheel, uint64_t now);
+
+/**
+ * @brief Adds a timer expiring at the given tick, or at the next tick
+ * if it's in the past. The deadline is clamped to TIMER_WHEEL_MAX_TICKS
+ * ticks ahead.
+ */
+void timer_wheel_add(timer_wheel* wheel, timer_entry* timer, uint64_t deadline);
+
+/**
+ * @brief Removes a timer that is in the wheel.
+ */
+void timer_wheel_remove(timer_wheel* wheel, timer_entry* timer);
+
+/**
+ * @brief Processes the ticks up to now, calling fn on each expired
+ * timer after removing it from the wheel (fn may free it).
+ */
+void timer_wheel_advance(timer_wheel* wheel, uint64_t now, timer_fn fn, void* uargs);
+
+#endif
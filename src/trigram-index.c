@@ -0,0 +1,549 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "trigram-index.h"
+
+#define TRIGRAM_NO_ID           UINT32_MAX
+#define TRIGRAM_MIN_CAPACITY    16
+
+static int is_word_byte(unsigned char c)
+{
+    /* bytes of multi-byte UTF-8 characters are kept as they are */
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static unsigned char to_lower(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+typedef struct word {
+    const char* data;
+    size_t      size;
+} word;
+
+static int compare_words(const word* a, const word* b)
+{
+    int c = memcmp(a->data, b->data, a->size < b->size ? a->size : b->size);
+    if(c) return c;
+    return (a->size > b->size) - (a->size < b->size);
+}
+
+/* Writes the words of the name, lowercased, sorted and separated by
+ * single spaces into out (of at least size bytes), returns the size
+ * of the result, or (size_t)-1 if allocation failed */
+static size_t normalize(const char* name, size_t size, char* out)
+{
+    if(!size) return 0;
+    char*  lower = (char*)malloc(size);
+    word*  words = (word*)malloc((size/2 + 1)*sizeof(*words));
+    if(!lower || !words) {
+        free(lower);
+        free(words);
+        return (size_t)-1;
+    }
+    size_t num_words = 0;
+    for(size_t i = 0; i < size;) {
+        if(!is_word_byte((unsigned char)name[i])) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        for(; i < size && is_word_byte((unsigned char)name[i]); i++)
+            lower[i] = (char)to_lower((unsigned char)name[i]);
+        /* insertion sort, names have few words */
+        word w = { lower + start, i - start };
+        size_t j = num_words++;
+        for(; j > 0 && compare_words(&words[j-1], &w) > 0; j--)
+            words[j] = words[j-1];
+        words[j] = w;
+    }
+    size_t n = 0;
+    for(size_t i = 0; i < num_words; i++) {
+        if(i) out[n++] = ' ';
+        memcpy(out + n, words[i].data, words[i].size);
+        n += words[i].size;
+    }
+    free(lower);
+    free(words);
+    return n;
+}
+
+static int compare_ids(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Fills out (of at least size + 1 entries) with the distinct trigrams
+ * of a normalized name, returns their number */
+static size_t extract_trigrams(const char* s, size_t size, uint32_t* out)
+{
+    size_t n = 0;
+    for(size_t i = 0; i < size;) {
+        size_t start = i;
+        while(i < size && s[i] != ' ') i++;
+        /* trigrams of "  word " */
+        uint32_t t = ((uint32_t)' ' << 8) | ' ';
+        for(size_t j = start; j <= i; j++) {
+            unsigned char c = j < i ? (unsigned char)s[j] : ' ';
+            t = ((t << 8) | c) & 0xffffff;
+            out[n++] = t;
+        }
+        i++;
+    }
+    qsort(out, n, sizeof(*out), compare_ids);
+    size_t m = 0;
+    for(size_t i = 0; i < n; i++)
+        if(!m || out[m-1] != out[i]) out[m++] = out[i];
+    return m;
+}
+
+/* Normalizes a name and extracts its trigrams into a new array */
+static YP_return_t name_trigrams(
+        const char* name,
+        size_t name_size,
+        uint32_t** trigrams,
+        size_t* count)
+{
+    char*     norm = (char*)malloc(name_size + 1);
+    uint32_t* t    = (uint32_t*)malloc((name_size + 1)*sizeof(*t));
+    size_t    size = norm ? normalize(name, name_size, norm) : (size_t)-1;
+    if(!t || size == (size_t)-1) {
+        free(norm);
+        free(t);
+        return YP_ERR_ALLOCATION;
+    }
+    *count    = extract_trigrams(norm, size, t);
+    *trigrams = t;
+    free(norm);
+    return YP_SUCCESS;
+}
+
+static void trigram_key(uint32_t t, char key[3])
+{
+    key[0] = (char)(t >> 16);
+    key[1] = (char)(t >> 8);
+    key[2] = (char)t;
+}
+
+static trigram_posting* find_posting(const trigram_index* index, uint32_t t)
+{
+    char key[3];
+    trigram_key(t, key);
+    memory_slot* slot = memory_table_find(&index->trigrams, key, 3, YP_hash(key, 3));
+    return slot ? &index->postings[slot->value] : NULL;
+}
+
+static trigram_posting* get_posting(trigram_index* index, uint32_t t)
+{
+    trigram_posting* posting = find_posting(index, t);
+    if(posting) return posting;
+    if(index->num_postings == index->postings_capacity) {
+        uint32_t capacity = index->postings_capacity
+                          ? 2*index->postings_capacity : TRIGRAM_MIN_CAPACITY;
+        trigram_posting* postings = (trigram_posting*)realloc(
+                index->postings, capacity*sizeof(*postings));
+        if(!postings) return NULL;
+        index->postings = postings;
+        index->postings_capacity = capacity;
+    }
+    char key[3];
+    trigram_key(t, key);
+    if(memory_table_insert(&index->trigrams, key, 3, YP_hash(key, 3),
+                           index->num_postings, NULL, NULL) != YP_SUCCESS)
+        return NULL;
+    posting = &index->postings[index->num_postings++];
+    memset(posting, 0, sizeof(*posting));
+    return posting;
+}
+
+/* Returns the position of the first id not smaller than the provided one */
+static uint32_t lower_bound(const trigram_posting* posting, uint32_t id)
+{
+    uint32_t lo = 0, hi = posting->count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        if(posting->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static YP_return_t posting_add(trigram_posting* posting, uint32_t id)
+{
+    uint32_t pos = lower_bound(posting, id);
+    if(pos < posting->count && posting->ids[pos] == id)
+        return YP_SUCCESS;
+    if(posting->count == posting->capacity) {
+        uint32_t capacity = posting->capacity ? 2*posting->capacity : 4;
+        uint32_t* ids = (uint32_t*)realloc(posting->ids, capacity*sizeof(*ids));
+        if(!ids) return YP_ERR_ALLOCATION;
+        posting->ids = ids;
+        posting->capacity = capacity;
+    }
+    memmove(posting->ids + pos + 1, posting->ids + pos,
+            (posting->count - pos)*sizeof(*posting->ids));
+    posting->ids[pos] = id;
+    posting->count += 1;
+    return YP_SUCCESS;
+}
+
+static void posting_remove(trigram_posting* posting, uint32_t id)
+{
+    uint32_t pos = lower_bound(posting, id);
+    if(pos == posting->count || posting->ids[pos] != id)
+        return;
+    posting->count -= 1;
+    memmove(posting->ids + pos, posting->ids + pos + 1,
+            (posting->count - pos)*sizeof(*posting->ids));
+}
+
+static void remove_postings(
+        trigram_index* index,
+        const uint32_t* trigrams,
+        size_t count,
+        uint32_t id)
+{
+    for(size_t i = 0; i < count; i++) {
+        trigram_posting* posting = find_posting(index, trigrams[i]);
+        if(posting) posting_remove(posting, id);
+    }
+}
+
+/* Moves the names in use to a new arena, in a single allocation so
+ * that the index is left untouched if it fails */
+static void compact_strings(trigram_index* index)
+{
+    arena strings;
+    arena_init(&strings, index->strings.chunk_size);
+    char* dst = (char*)arena_alloc(&strings, index->strings.live, 1);
+    if(!dst) return;
+    for(uint32_t id = 0; id < index->num_ids; id++) {
+        trigram_name* name = &index->names[id];
+        if(!name->data) continue;
+        memcpy(dst, name->data, name->size);
+        name->data = dst;
+        dst += name->size;
+    }
+    arena_destroy(&index->strings);
+    index->strings = strings;
+}
+
+static YP_return_t new_id(trigram_index* index, uint32_t* id)
+{
+    if(index->free_id != TRIGRAM_NO_ID) {
+        *id = index->free_id;
+        index->free_id = index->names[*id].num_trigrams;
+        return YP_SUCCESS;
+    }
+    if(index->num_ids == index->names_capacity) {
+        uint32_t capacity = index->names_capacity
+                          ? 2*index->names_capacity : TRIGRAM_MIN_CAPACITY;
+        trigram_name* names = (trigram_name*)realloc(
+                index->names, capacity*sizeof(*names));
+        if(!names) return YP_ERR_ALLOCATION;
+        index->names = names;
+        index->names_capacity = capacity;
+    }
+    *id = index->num_ids++;
+    return YP_SUCCESS;
+}
+
+static void free_id(trigram_index* index, uint32_t id)
+{
+    index->names[id].data = NULL;
+    index->names[id].num_trigrams = index->free_id;
+    index->free_id = id;
+}
+
+YP_return_t trigram_index_init(trigram_index* index)
+{
+    memset(index, 0, sizeof(*index));
+    index->free_id = TRIGRAM_NO_ID;
+    arena_init(&index->strings, ARENA_DEFAULT_CHUNK_SIZE);
+    YP_return_t ret = memory_table_init(&index->ids, 0);
+    if(ret != YP_SUCCESS) return ret;
+    ret = memory_table_init(&index->trigrams, 0);
+    if(ret != YP_SUCCESS) memory_table_destroy(&index->ids);
+    return ret;
+}
+
+void trigram_index_destroy(trigram_index* index)
+{
+    for(uint32_t i = 0; i < index->num_postings; i++)
+        free(index->postings[i].ids);
+    free(index->postings);
+    free(index->names);
+    arena_destroy(&index->strings);
+    memory_table_destroy(&index->ids);
+    memory_table_destroy(&index->trigrams);
+}
+
+YP_return_t trigram_index_add(
+        trigram_index* index,
+        const char* name,
+        size_t name_size)
+{
+    uint64_t hash = YP_hash(name, name_size);
+    if(memory_table_find(&index->ids, name, name_size, hash))
+        return YP_SUCCESS;
+
+    uint32_t* trigrams = NULL;
+    size_t count = 0;
+    YP_return_t ret = name_trigrams(name, name_size, &trigrams, &count);
+    if(ret != YP_SUCCESS) return ret;
+
+    uint32_t id;
+    ret = new_id(index, &id);
+    if(ret != YP_SUCCESS) goto finish;
+    if(arena_should_compact(&index->strings))
+        compact_strings(index);
+    char* data = arena_copy(&index->strings, name, name_size);
+    if(!data) {
+        free_id(index, id);
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    index->names[id].data         = data;
+    index->names[id].size         = (uint32_t)name_size;
+    index->names[id].num_trigrams = (uint32_t)count;
+
+    size_t i;
+    for(i = 0; i < count && ret == YP_SUCCESS; i++) {
+        trigram_posting* posting = get_posting(index, trigrams[i]);
+        ret = posting ? posting_add(posting, id) : YP_ERR_ALLOCATION;
+    }
+    if(ret == YP_SUCCESS)
+        ret = memory_table_insert(&index->ids, name, name_size, hash, id, NULL, NULL);
+    if(ret != YP_SUCCESS) {
+        remove_postings(index, trigrams, i, id);
+        arena_release(&index->strings, name_size);
+        free_id(index, id);
+    }
+
+finish:
+    free(trigrams);
+    return ret;
+}
+
+YP_return_t trigram_index_remove(
+        trigram_index* index,
+        const char* name,
+        size_t name_size)
+{
+    memory_slot* slot = memory_table_find(&index->ids, name, name_size,
+                                          YP_hash(name, name_size));
+    if(!slot) return YP_ERR_NOT_FOUND;
+    uint32_t* trigrams = NULL;
+    size_t count = 0;
+    YP_return_t ret = name_trigrams(name, name_size, &trigrams, &count);
+    if(ret != YP_SUCCESS) return ret;
+    uint32_t id = (uint32_t)slot->value;
+    remove_postings(index, trigrams, count, id);
+    memory_table_erase_slot(&index->ids, slot);
+    arena_release(&index->strings, index->names[id].size);
+    free_id(index, id);
+    free(trigrams);
+    return YP_SUCCESS;
+}
+
+/* Advances *pos to the first id of the posting not smaller than the
+ * provided one, doubling the step until it is overshot, then returns
+ * whether that id was found */
+static int gallop(const trigram_posting* posting, uint32_t* pos, uint32_t id)
+{
+    uint32_t lo = *pos, n = posting->count;
+    if(lo >= n) return 0;
+    if(posting->ids[lo] >= id) return posting->ids[lo] == id;
+    /* ids[lo] < id, find hi with ids[hi] >= id (or hi = n) */
+    uint32_t step = 1, hi = lo + 1;
+    while(hi < n && posting->ids[hi] < id) {
+        lo = hi;
+        step *= 2;
+        hi = (n - lo > step) ? lo + step : n;
+    }
+    /* the first id >= id is in (lo, hi] */
+    lo += 1;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        if(posting->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < n && posting->ids[lo] == id;
+}
+
+/* Levenshtein distance between a pattern of m <= 64 bytes, described by
+ * the bitmasks of the positions of each byte in it, and a text, using
+ * Myers' bit-vector algorithm (in the global form given by Hyyrö):
+ * the column of the dynamic programming matrix is encoded as vertical
+ * positive/negative deltas, updated for a whole column at once */
+static size_t edit_distance(
+        const uint64_t peq[256],
+        size_t m,
+        const char* text,
+        size_t n)
+{
+    if(m == 0) return n;
+    uint64_t pv = ~UINT64_C(0), mv = 0;
+    uint64_t high = UINT64_C(1) << (m - 1);
+    size_t score = m;
+    for(size_t i = 0; i < n; i++) {
+        uint64_t eq = peq[(unsigned char)text[i]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if(ph & high) score++;
+        else if(mh & high) score--;
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+static int compare_postings(const void* a, const void* b)
+{
+    uint32_t x = (*(const trigram_posting* const*)a)->count;
+    uint32_t y = (*(const trigram_posting* const*)b)->count;
+    return (x > y) - (x < y);
+}
+
+/* Inserts a match into the k best ones found so far, sorted by
+ * decreasing score then increasing name */
+static void add_match(
+        trigram_match* matches,
+        size_t* count,
+        size_t k,
+        const trigram_match* m)
+{
+    size_t i = *count;
+    while(i > 0) {
+        const trigram_match* p = &matches[i-1];
+        if(p->score > m->score) break;
+        if(p->score == m->score) {
+            word a = { p->name, p->name_size }, b = { m->name, m->name_size };
+            if(compare_words(&a, &b) < 0) break;
+        }
+        i--;
+    }
+    if(i == k) return;
+    size_t last = *count < k ? *count : k - 1;
+    memmove(matches + i + 1, matches + i, (last - i)*sizeof(*matches));
+    matches[i] = *m;
+    if(*count < k) *count += 1;
+}
+
+YP_return_t trigram_index_search(
+        const trigram_index* index,
+        const char* query,
+        size_t query_size,
+        trigram_match* matches,
+        size_t* count)
+{
+    size_t k = *count;
+    *count = 0;
+    if(!k) return YP_SUCCESS;
+
+    YP_return_t ret = YP_SUCCESS;
+    char*      norm = (char*)malloc(query_size + 1);
+    uint32_t*  trigrams = (uint32_t*)malloc((query_size + 1)*sizeof(*trigrams));
+    const trigram_posting** lists =
+        (const trigram_posting**)malloc((query_size + 1)*sizeof(*lists));
+    uint32_t*  candidates = NULL;
+    uint32_t*  cursors = NULL;
+    char*      text = NULL;
+    size_t     text_capacity = 0;
+    size_t     m = norm ? normalize(query, query_size, norm) : (size_t)-1;
+    if(!trigrams || !lists || m == (size_t)-1) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* posting lists of the trigrams of the query, shortest first */
+    size_t num_trigrams = extract_trigrams(norm, m, trigrams);
+    size_t num_lists = 0;
+    for(size_t i = 0; i < num_trigrams; i++) {
+        const trigram_posting* posting = find_posting(index, trigrams[i]);
+        if(posting && posting->count) lists[num_lists++] = posting;
+    }
+    size_t threshold = (num_trigrams + 3) / 4;
+    if(threshold == 0) threshold = 1;
+    if(num_lists < threshold) goto finish;
+    qsort(lists, num_lists, sizeof(*lists), compare_postings);
+
+    /* candidates from the shortest lists, sorted so that occurrences
+     * of the same id are contiguous */
+    size_t num_short = num_lists - threshold + 1;
+    size_t num_long  = threshold - 1;
+    size_t total = 0;
+    for(size_t i = 0; i < num_short; i++) total += lists[i]->count;
+    candidates = (uint32_t*)malloc(total*sizeof(*candidates));
+    cursors    = (uint32_t*)calloc(num_long + 1, sizeof(*cursors));
+    if(!candidates || !cursors) {
+        ret = YP_ERR_ALLOCATION;
+        goto finish;
+    }
+    total = 0;
+    for(size_t i = 0; i < num_short; i++) {
+        memcpy(candidates + total, lists[i]->ids, lists[i]->count*sizeof(*candidates));
+        total += lists[i]->count;
+    }
+    qsort(candidates, total, sizeof(*candidates), compare_ids);
+
+    /* pattern bitmasks of the (truncated) query for the edit distance */
+    uint64_t peq[256];
+    memset(peq, 0, sizeof(peq));
+    if(m > TRIGRAM_MAX_QUERY) m = TRIGRAM_MAX_QUERY;
+    for(size_t i = 0; i < m; i++)
+        peq[(unsigned char)norm[i]] |= UINT64_C(1) << i;
+
+    for(size_t i = 0; i < total;) {
+        uint32_t id = candidates[i];
+        size_t shared = 0;
+        for(; i < total && candidates[i] == id; i++) shared++;
+        for(size_t j = 0; j < num_long && shared + (num_long - j) >= threshold; j++)
+            shared += gallop(lists[num_short + j], &cursors[j], id);
+        if(shared < threshold) continue;
+
+        const trigram_name* name = &index->names[id];
+        if(name->size > text_capacity) {
+            char* t = (char*)realloc(text, name->size);
+            if(!t) {
+                ret = YP_ERR_ALLOCATION;
+                goto finish;
+            }
+            text = t;
+            text_capacity = name->size;
+        }
+        size_t n = normalize(name->data, name->size, text);
+        if(n == (size_t)-1) {
+            ret = YP_ERR_ALLOCATION;
+            goto finish;
+        }
+        if(n > TRIGRAM_MAX_QUERY) n = TRIGRAM_MAX_QUERY;
+        size_t longest = m > n ? m : n;
+        double edit = longest ? 1.0 - (double)edit_distance(peq, m, text, n) / (double)longest : 1.0;
+        double dice = 2.0 * (double)shared / (double)(num_trigrams + name->num_trigrams);
+        trigram_match match = { name->data, name->size, (edit + dice) / 2 };
+        add_match(matches, count, k, &match);
+    }
+
+finish:
+    free(norm);
+    free(trigrams);
+    free(lists);
+    free(candidates);
+    free(cursors);
+    free(text);
+    return ret;
+}
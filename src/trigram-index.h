@@ -0,0 +1,102 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _TRIGRAM_INDEX_H
+#define _TRIGRAM_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "arena.h"
+#include "memory/memory-table.h"
+
+/*
+ * Inverted index of the trigrams of the names of a phonebook, used to
+ * answer fuzzy searches. Names are normalized first (alphanumeric words,
+ * lowercased and sorted) so that case, punctuation and word order don't
+ * matter, then each word is padded ("  word ") and cut into trigrams.
+ * Each name gets a small integer id, and each trigram a sorted posting
+ * list of the ids of the names containing it.
+ *
+ * A search looks for the names sharing at least a fraction of the
+ * trigrams of the query, using the MergeSkip strategy: a name sharing
+ * T trigrams must appear in one of the n - T + 1 shortest posting
+ * lists, so candidates are only collected from those, then counted in
+ * the T - 1 longest ones by galloping search. Candidates are ranked by
+ * the average of their trigram Dice coefficient and of their edit
+ * similarity to the query, the edit distance being computed with
+ * Myers' bit-parallel algorithm (64 cells per word operation).
+ *
+ * The index is not thread-safe, the provider serializes its updates
+ * with those of the phonebook.
+ */
+
+#define TRIGRAM_MAX_QUERY 64 // bytes of normalized query used for scoring
+
+typedef struct trigram_name {
+    char*    data;         // NULL if the id is free
+    uint32_t size;
+    uint32_t num_trigrams; // next free id if the id is free
+} trigram_name;
+
+typedef struct trigram_posting {
+    uint32_t* ids;
+    uint32_t  count;
+    uint32_t  capacity;
+} trigram_posting;
+
+typedef struct trigram_index {
+    memory_table     ids;          // name -> id
+    trigram_name*    names;        // by id
+    uint32_t         num_ids;      // ids in use or free
+    uint32_t         names_capacity;
+    uint32_t         free_id;      // first free id, UINT32_MAX if none
+    arena            strings;      // names
+    memory_table     trigrams;     // trigram -> index in postings
+    trigram_posting* postings;
+    uint32_t         num_postings;
+    uint32_t         postings_capacity;
+} trigram_index;
+
+typedef struct trigram_match {
+    const char* name;  // owned by the index
+    size_t      name_size;
+    double      score; // between 0 and 1
+} trigram_match;
+
+YP_return_t trigram_index_init(trigram_index* index);
+
+void trigram_index_destroy(trigram_index* index);
+
+/**
+ * @brief Adds a name to the index (nothing happens if it's already there).
+ */
+YP_return_t trigram_index_add(
+        trigram_index* index,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Removes a name from the index, returns YP_ERR_NOT_FOUND if it
+ * wasn't there.
+ */
+YP_return_t trigram_index_remove(
+        trigram_index* index,
+        const char* name,
+        size_t name_size);
+
+/**
+ * @brief Fills matches with the (at most *count) names closest to the
+ * query, best first, and sets *count to the number of matches. The
+ * names are valid until the index is next modified.
+ */
+YP_return_t trigram_index_search(
+        const trigram_index* index,
+        const char* query,
+        size_t query_size,
+        trigram_match* matches,
+        size_t* count);
+
+#endif
@@ -12,8 +12,10 @@
 #include <mercury_proc.h>
 #include <mercury_proc_string.h>
 #include "YP/YP-common.h"
+#include "YP/YP-number.h"
 
 static inline hg_return_t hg_proc_YP_phonebook_id_t(hg_proc_t proc, YP_phonebook_id_t *id);
+static inline hg_return_t hg_proc_YP_number_t(hg_proc_t proc, YP_number_t *number);
 
 /* Admin RPC types */
 
@@ -49,6 +51,14 @@ MERCURY_GEN_PROC(destroy_phonebook_in_t,
 MERCURY_GEN_PROC(destroy_phonebook_out_t,
         ((int32_t)(ret)))
 
+MERCURY_GEN_PROC(snapshot_phonebook_in_t,
+        ((hg_string_t)(token))\
+        ((YP_phonebook_id_t)(id))\
+        ((hg_string_t)(path)))
+
+MERCURY_GEN_PROC(snapshot_phonebook_out_t,
+        ((int32_t)(ret)))
+
 MERCURY_GEN_PROC(list_phonebooks_in_t,
         ((hg_string_t)(token))\
         ((hg_size_t)(max_ids)))
@@ -99,6 +109,232 @@ MERCURY_GEN_PROC(sum_out_t,
         ((int32_t)(result))\
         ((int32_t)(ret)))
 
+MERCURY_GEN_PROC(insert_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(name))\
+        ((YP_number_t)(number))\
+        ((uint64_t)(ttl_ms)))
+
+MERCURY_GEN_PROC(insert_out_t,
+        ((int32_t)(ret)))
+
+/* The bulk handle of a batch insert exposes size bytes holding count
+ * records, each made of a uint32_t name size, the name (without null
+ * terminator) and its number, unaligned */
+MERCURY_GEN_PROC(insert_batch_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_size_t)(count))\
+        ((hg_size_t)(size))\
+        ((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(insert_batch_out_t,
+        ((int32_t)(ret)))
+
+/* lease is set by handles that cache their lookups, the provider
+ * only grants leases to those (see lease.h) */
+MERCURY_GEN_PROC(lookup_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(name))\
+        ((hg_bool_t)(lease)))
+
+MERCURY_GEN_PROC(lookup_out_t,
+        ((YP_number_t)(number))\
+        ((uint32_t)(lease_ms))\
+        ((int32_t)(ret)))
+
+/* The bulk handle of a batch lookup exposes names_size bytes holding
+ * count null-terminated names, followed by count numbers, count
+ * int32_t return codes and count uint32_t lease durations (in ms)
+ * written by the provider */
+MERCURY_GEN_PROC(lookup_batch_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_size_t)(count))\
+        ((hg_size_t)(names_size))\
+        ((hg_bool_t)(lease))\
+        ((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(lookup_batch_out_t,
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(erase_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(name)))
+
+MERCURY_GEN_PROC(erase_out_t,
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(scan_begin_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_size_t)(page_size)))
+
+MERCURY_GEN_PROC(scan_begin_out_t,
+        ((uint64_t)(scan_id))\
+        ((int32_t)(ret)))
+
+/* The bulk handle of a scan exposes a page into which the provider
+ * writes size bytes holding count records, each made of its number, a
+ * uint32_t name size and the null-terminated name, unaligned */
+MERCURY_GEN_PROC(scan_next_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((uint64_t)(scan_id))\
+        ((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(scan_next_out_t,
+        ((hg_size_t)(count))\
+        ((hg_size_t)(size))\
+        ((hg_bool_t)(last))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(scan_end_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((uint64_t)(scan_id)))
+
+MERCURY_GEN_PROC(scan_end_out_t,
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(list_range_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(lower))\
+        ((hg_bool_t)(inclusive))\
+        ((hg_string_t)(upper))\
+        ((hg_size_t)(max)))
+
+MERCURY_GEN_PROC(list_prefix_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(prefix))\
+        ((hg_size_t)(max)))
+
+typedef struct list_records_out_t {
+    int32_t ret;
+    hg_size_t count;
+    hg_string_t* names;
+    YP_number_t* numbers;
+} list_records_out_t;
+
+static inline hg_return_t hg_proc_list_records_out_t(hg_proc_t proc, void *data)
+{
+    list_records_out_t* out = (list_records_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        out->names   = (hg_string_t*)calloc(out->count, sizeof(*(out->names)));
+        out->numbers = (YP_number_t*)calloc(out->count, sizeof(*(out->numbers)));
+        if(out->count && (!out->names || !out->numbers))
+            return HG_NOMEM;
+    }
+    if(out->count) {
+        for(hg_size_t i = 0; i < out->count; i++) {
+            ret = hg_proc_hg_string_t(proc, &(out->names[i]));
+            if(ret != HG_SUCCESS) return ret;
+        }
+        if(hg_proc_get_op(proc) != HG_FREE)
+            ret = hg_proc_memcpy(proc, out->numbers, sizeof(*(out->numbers))*out->count);
+    }
+    if(hg_proc_get_op(proc) == HG_FREE) {
+        free(out->names);
+        free(out->numbers);
+    }
+    return ret;
+}
+
+MERCURY_GEN_PROC(lookup_number_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((YP_number_t)(number))\
+        ((hg_size_t)(max)))
+
+typedef struct lookup_number_out_t {
+    int32_t ret;
+    hg_size_t count;
+    hg_string_t* names;
+} lookup_number_out_t;
+
+static inline hg_return_t hg_proc_lookup_number_out_t(hg_proc_t proc, void *data)
+{
+    lookup_number_out_t* out = (lookup_number_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        out->names = (hg_string_t*)calloc(out->count, sizeof(*(out->names)));
+        if(out->count && !out->names)
+            return HG_NOMEM;
+    }
+    for(hg_size_t i = 0; i < out->count; i++) {
+        ret = hg_proc_hg_string_t(proc, &(out->names[i]));
+        if(ret != HG_SUCCESS) return ret;
+    }
+    if(hg_proc_get_op(proc) == HG_FREE)
+        free(out->names);
+    return ret;
+}
+
+MERCURY_GEN_PROC(phonetic_lookup_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(query))\
+        ((hg_size_t)(max)))
+
+MERCURY_GEN_PROC(fuzzy_search_in_t,
+        ((YP_phonebook_id_t)(phonebook_id))\
+        ((hg_string_t)(query))\
+        ((hg_size_t)(max)))
+
+typedef struct fuzzy_search_out_t {
+    int32_t ret;
+    hg_size_t count;
+    hg_string_t* names;
+    YP_number_t* numbers;
+    double* scores;
+} fuzzy_search_out_t;
+
+static inline hg_return_t hg_proc_fuzzy_search_out_t(hg_proc_t proc, void *data)
+{
+    fuzzy_search_out_t* out = (fuzzy_search_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        out->names   = (hg_string_t*)calloc(out->count, sizeof(*(out->names)));
+        out->numbers = (YP_number_t*)calloc(out->count, sizeof(*(out->numbers)));
+        out->scores  = (double*)calloc(out->count, sizeof(*(out->scores)));
+        if(out->count && (!out->names || !out->numbers || !out->scores)) {
+            free(out->names);
+            free(out->numbers);
+            free(out->scores);
+            return HG_NOMEM;
+        }
+    }
+    for(hg_size_t i = 0; i < out->count; i++) {
+        ret = hg_proc_hg_string_t(proc, &(out->names[i]));
+        if(ret != HG_SUCCESS) return ret;
+        ret = hg_proc_YP_number_t(proc, &(out->numbers[i]));
+        if(ret != HG_SUCCESS) return ret;
+        ret = hg_proc_memcpy(proc, &(out->scores[i]), sizeof(double));
+        if(ret != HG_SUCCESS) return ret;
+    }
+    if(hg_proc_get_op(proc) == HG_FREE) {
+        free(out->names);
+        free(out->numbers);
+        free(out->scores);
+    }
+    return ret;
+}
+
 /* Extra hand-coded serialization functions */
 
 static inline hg_return_t hg_proc_YP_phonebook_id_t(
@@ -107,4 +343,10 @@ static inline hg_return_t hg_proc_YP_phonebook_id_t(
     return hg_proc_memcpy(proc, id, sizeof(*id));
 }
 
+static inline hg_return_t hg_proc_YP_number_t(
+        hg_proc_t proc, YP_number_t *number)
+{
+    return hg_proc_uint64_t(proc, number);
+}
+
 #endif
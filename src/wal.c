@@ -0,0 +1,514 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <libgen.h>
+#include "hash.h"
+#include "wal.h"
+
+#define WAL_BATCH_MIN_CAPACITY 4096
+#define WAL_READ_SIZE          (1024*1024)
+#define WAL_CHECKPOINT_MIN     (16*1024*1024)
+
+typedef struct wal_record_header {
+    uint32_t checksum;  // of the rest of the header and of the name
+    uint32_t name_size;
+    uint64_t number;
+    uint8_t  type;
+    uint8_t  reserved[7];
+} wal_record_header;
+
+struct wal_batch {
+    char*        data;     // serialized records
+    size_t       size;
+    size_t       capacity;
+    ABT_eventual eventual; // set to the result of the sync
+    int          refcount; // commit ULT and waiting ULTs
+};
+
+struct wal {
+    int              fd;
+    char*            path;
+    off_t            end;     // end of the last synced batch
+    off_t            base;    // size of the log after the last checkpoint
+    margo_instance_id mid;
+    /* pending batch and flags, protected by mutex */
+    ABT_mutex        mutex;
+    ABT_cond         cond;    // signaled when there is a batch to commit
+    ABT_cond         idle;    // broadcast when a batch has been committed
+    struct wal_batch* pending;
+    int              writing; // set while the commit ULT writes a batch
+    int              stop;
+    int              failed;  // set once a batch couldn't be written
+    ABT_thread       commit_ult;
+};
+
+static uint32_t record_checksum(const wal_record_header* h, const char* name)
+{
+    uint64_t seed = YP_hash(&h->name_size, sizeof(*h) - offsetof(wal_record_header, name_size));
+    return (uint32_t)YP_hash_seeded(name, h->name_size, seed);
+}
+
+/* Serializes a record into p, which must hold wal_record_size(name_size) bytes */
+static void put_record(char* p, int type, const char* name, size_t name_size, uint64_t number)
+{
+    wal_record_header h;
+    memset(&h, 0, sizeof(h));
+    h.name_size = (uint32_t)name_size;
+    h.number    = number;
+    h.type      = (uint8_t)type;
+    h.checksum  = record_checksum(&h, name);
+    memcpy(p, &h, sizeof(h));
+    memcpy(p + sizeof(h), name, name_size);
+}
+
+static inline size_t wal_record_size(size_t name_size)
+{
+    return sizeof(wal_record_header) + name_size;
+}
+
+static struct wal_batch* new_batch(void)
+{
+    struct wal_batch* batch = (struct wal_batch*)calloc(1, sizeof(*batch));
+    if(!batch) return NULL;
+    if(ABT_eventual_create(sizeof(int), &batch->eventual) != ABT_SUCCESS) {
+        free(batch);
+        return NULL;
+    }
+    batch->refcount = 1; // reference held by the commit ULT
+    return batch;
+}
+
+static void release_batch(struct wal_batch* batch)
+{
+    if(__atomic_sub_fetch(&batch->refcount, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    ABT_eventual_free(&batch->eventual);
+    free(batch->data);
+    free(batch);
+}
+
+/* Removes what a failed write_batch may have left after the last synced
+ * batch, so that replay doesn't stop at the torn bytes */
+static void discard_batch(wal* log)
+{
+    if(ftruncate(log->fd, log->end) != 0
+    || lseek(log->fd, log->end, SEEK_SET) < 0)
+        margo_error(log->mid, "Could not truncate log %s: %s",
+                    log->path, strerror(errno));
+}
+
+static int write_batch(wal* log, const struct wal_batch* batch)
+{
+    size_t done = 0;
+    while(done < batch->size) {
+        ssize_t w = write(log->fd, batch->data + done, batch->size - done);
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            margo_error(log->mid, "Could not write to log %s: %s",
+                        log->path, strerror(errno));
+            discard_batch(log);
+            return YP_ERR_IO;
+        }
+        done += (size_t)w;
+    }
+    if(fdatasync(log->fd) != 0) {
+        margo_error(log->mid, "Could not sync log %s: %s",
+                    log->path, strerror(errno));
+        discard_batch(log);
+        return YP_ERR_IO;
+    }
+    log->end += (off_t)batch->size;
+    return YP_SUCCESS;
+}
+
+static void commit_ult(void* args)
+{
+    wal* log = (wal*)args;
+    ABT_mutex_lock(log->mutex);
+    while(1) {
+        while(!log->pending && !log->stop)
+            ABT_cond_wait(log->cond, log->mutex);
+        if(!log->pending) break;
+        /* let the handlers that are ready to run join the batch */
+        ABT_mutex_unlock(log->mutex);
+        ABT_thread_yield();
+        ABT_mutex_lock(log->mutex);
+        struct wal_batch* batch = log->pending;
+        log->pending = NULL;
+        log->writing = 1;
+        int failed = log->failed;
+        ABT_mutex_unlock(log->mutex);
+
+        /* after a failed sync the file's content can't be trusted
+         * (the kernel may have dropped the dirty pages), so batches
+         * are no longer written once one has failed */
+        int ret = failed ? YP_ERR_IO : write_batch(log, batch);
+        ABT_eventual_set(batch->eventual, &ret, sizeof(ret));
+        release_batch(batch);
+
+        ABT_mutex_lock(log->mutex);
+        if(ret != YP_SUCCESS) log->failed = 1;
+        log->writing = 0;
+        ABT_cond_broadcast(log->idle);
+    }
+    ABT_mutex_unlock(log->mutex);
+}
+
+/* Reads the records found in the first limit bytes of the log, setting
+ * valid to the end of the last one that is complete and intact */
+static YP_return_t read_records(
+        wal* log, off_t limit, wal_replay_fn fn, void* uargs, off_t* valid)
+{
+    size_t capacity = WAL_READ_SIZE;
+    char*  buffer = (char*)malloc(capacity);
+    if(!buffer) return YP_ERR_ALLOCATION;
+    size_t begin = 0, end = 0; // valid bytes of the buffer
+    off_t  offset = 0;         // offset of buffer[begin] in the file
+    YP_return_t ret = YP_SUCCESS;
+
+    while(1) {
+        /* make sure the next header, then the next name, is in the buffer */
+        size_t needed = sizeof(wal_record_header);
+        if(end - begin >= needed) {
+            wal_record_header h;
+            memcpy(&h, buffer + begin, sizeof(h));
+            needed += h.name_size;
+        }
+        if(offset + (off_t)needed > limit) break;
+        if(end - begin < needed) {
+            memmove(buffer, buffer + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            if(needed > capacity) {
+                char* b = (char*)realloc(buffer, needed);
+                if(!b) { ret = YP_ERR_ALLOCATION; goto finish; }
+                buffer = b;
+                capacity = needed;
+            }
+            ssize_t r = pread(log->fd, buffer + end, capacity - end, offset + (off_t)end);
+            if(r < 0) {
+                if(errno == EINTR) continue;
+                ret = YP_ERR_IO;
+                goto finish;
+            }
+            if(r == 0) break;
+            end += (size_t)r;
+            continue;
+        }
+        wal_record_header h;
+        memcpy(&h, buffer + begin, sizeof(h));
+        const char* name = buffer + begin + sizeof(h);
+        if((h.type != WAL_INSERT && h.type != WAL_ERASE)
+        || record_checksum(&h, name) != h.checksum)
+            break;
+        if(fn(uargs, h.type, name, h.name_size, h.number)) {
+            ret = YP_ERR_OTHER;
+            goto finish;
+        }
+        begin  += needed;
+        offset += (off_t)needed;
+    }
+    *valid = offset;
+
+finish:
+    free(buffer);
+    return ret;
+}
+
+/* Reads the records of the log, truncating it after the last valid one */
+static YP_return_t replay(wal* log, wal_replay_fn fn, void* uargs)
+{
+    struct stat st;
+    if(fstat(log->fd, &st) != 0) return YP_ERR_IO;
+    off_t valid = 0;
+    YP_return_t ret = read_records(log, st.st_size, fn, uargs, &valid);
+    if(ret != YP_SUCCESS) return ret;
+    /* discard what follows the last complete record */
+    if(ftruncate(log->fd, valid) != 0 || lseek(log->fd, valid, SEEK_SET) < 0)
+        return YP_ERR_IO;
+    log->end  = valid;
+    log->base = valid;
+    return YP_SUCCESS;
+}
+
+static void free_log(wal* log)
+{
+    if(log->fd >= 0) close(log->fd);
+    if(log->mutex != ABT_MUTEX_NULL) ABT_mutex_free(&log->mutex);
+    if(log->cond != ABT_COND_NULL) ABT_cond_free(&log->cond);
+    if(log->idle != ABT_COND_NULL) ABT_cond_free(&log->idle);
+    free(log->path);
+    free(log);
+}
+
+YP_return_t wal_open(
+        YP_provider_t provider,
+        const char* path,
+        int create,
+        wal_replay_fn fn,
+        void* uargs,
+        wal** out)
+{
+    wal* log = (wal*)calloc(1, sizeof(*log));
+    if(!log) return YP_ERR_ALLOCATION;
+    log->mid   = provider->mid;
+    log->mutex = ABT_MUTEX_NULL;
+    log->cond  = ABT_COND_NULL;
+    log->idle  = ABT_COND_NULL;
+    log->path  = strdup(path);
+    log->fd    = open(path, O_RDWR | O_CREAT | (create ? O_EXCL : 0), 0644);
+    if(log->fd < 0) {
+        margo_error(provider->mid, "Could not open log %s: %s",
+                    path, strerror(errno));
+        free_log(log);
+        return YP_ERR_IO;
+    }
+    YP_return_t ret = create ? YP_SUCCESS : replay(log, fn, uargs);
+    if(ret != YP_SUCCESS) {
+        margo_error(provider->mid, "Could not replay log %s", path);
+        free_log(log);
+        return ret;
+    }
+    if(ABT_mutex_create(&log->mutex) != ABT_SUCCESS
+    || ABT_cond_create(&log->cond) != ABT_SUCCESS
+    || ABT_cond_create(&log->idle) != ABT_SUCCESS) {
+        free_log(log);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    if(ABT_thread_create(pool, commit_ult, log,
+                         ABT_THREAD_ATTR_NULL, &log->commit_ult) != ABT_SUCCESS) {
+        free_log(log);
+        return YP_ERR_FROM_ARGOBOTS;
+    }
+    *out = log;
+    return YP_SUCCESS;
+}
+
+void wal_close(wal* log)
+{
+    ABT_mutex_lock(log->mutex);
+    log->stop = 1;
+    ABT_cond_signal(log->cond);
+    ABT_mutex_unlock(log->mutex);
+    ABT_thread_join(log->commit_ult);
+    ABT_thread_free(&log->commit_ult);
+    free_log(log);
+}
+
+void wal_destroy(wal* log)
+{
+    char* path = strdup(log->path);
+    wal_close(log);
+    if(path) unlink(path);
+    free(path);
+}
+
+YP_return_t wal_append(
+        wal* log,
+        int type,
+        const char* name,
+        size_t name_size,
+        uint64_t number,
+        wal_ticket* ticket)
+{
+    size_t size = wal_record_size(name_size);
+
+    YP_return_t ret = YP_SUCCESS;
+    ABT_mutex_lock(log->mutex);
+    if(log->failed) {
+        ret = YP_ERR_IO;
+        goto finish;
+    }
+    struct wal_batch* batch = log->pending;
+    if(!batch) {
+        batch = new_batch();
+        if(!batch) { ret = YP_ERR_ALLOCATION; goto finish; }
+        log->pending = batch;
+    }
+    if(batch->size + size > batch->capacity) {
+        size_t capacity = batch->capacity ? 2*batch->capacity : WAL_BATCH_MIN_CAPACITY;
+        while(capacity < batch->size + size) capacity *= 2;
+        char* data = (char*)realloc(batch->data, capacity);
+        if(!data) { ret = YP_ERR_ALLOCATION; goto finish; }
+        batch->data     = data;
+        batch->capacity = capacity;
+    }
+    put_record(batch->data + batch->size, type, name, name_size, number);
+    batch->size += size;
+    __atomic_add_fetch(&batch->refcount, 1, __ATOMIC_RELAXED);
+    *ticket = batch;
+    ABT_cond_signal(log->cond);
+
+finish:
+    ABT_mutex_unlock(log->mutex);
+    return ret;
+}
+
+YP_return_t wal_wait(wal_ticket batch)
+{
+    int* ret = NULL;
+    ABT_eventual_wait(batch->eventual, (void**)&ret);
+    YP_return_t result = *ret;
+    release_batch(batch);
+    return result;
+}
+
+YP_return_t wal_reload(wal* log, wal_replay_fn fn, void* uargs)
+{
+    /* the commit ULT writes nothing past end once the log has failed,
+     * and end only moves forward while it is not */
+    off_t valid;
+    ABT_mutex_lock(log->mutex);
+    off_t limit = log->end;
+    ABT_mutex_unlock(log->mutex);
+    return read_records(log, limit, fn, uargs, &valid);
+}
+
+int wal_should_checkpoint(wal* log)
+{
+    ABT_mutex_lock(log->mutex);
+    int ret = !log->failed && log->end >= WAL_CHECKPOINT_MIN
+           && log->end >= 2*log->base;
+    ABT_mutex_unlock(log->mutex);
+    return ret;
+}
+
+typedef struct wal_writer {
+    int         fd;
+    char*       data;
+    size_t      size;
+    off_t       written;
+    YP_return_t ret;
+} wal_writer;
+
+static void flush_writer(wal_writer* w)
+{
+    size_t done = 0;
+    while(w->ret == YP_SUCCESS && done < w->size) {
+        ssize_t n = write(w->fd, w->data + done, w->size - done);
+        if(n < 0) {
+            if(errno != EINTR) w->ret = YP_ERR_IO;
+            continue;
+        }
+        done += (size_t)n;
+    }
+    w->written += (off_t)done;
+    w->size = 0;
+}
+
+static int write_checkpoint_record(
+        void* uargs, int type, const char* name, size_t name_size, uint64_t number)
+{
+    wal_writer* w = (wal_writer*)uargs;
+    size_t size = wal_record_size(name_size);
+    if(w->size + size > WAL_READ_SIZE) flush_writer(w);
+    if(size > WAL_READ_SIZE) {
+        char* data = (char*)malloc(size);
+        if(!data) {
+            w->ret = YP_ERR_ALLOCATION;
+            return 1;
+        }
+        put_record(data, type, name, name_size, number);
+        char* chunk = w->data;
+        w->data = data;
+        w->size = size;
+        flush_writer(w);
+        w->data = chunk;
+        free(data);
+    } else {
+        put_record(w->data + w->size, type, name, name_size, number);
+        w->size += size;
+    }
+    return w->ret != YP_SUCCESS;
+}
+
+/* Syncs the directory holding path, so that a rename into it is durable */
+static int sync_parent(const char* path)
+{
+    char* copy = strdup(path);
+    if(!copy) return -1;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if(fd < 0) return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+YP_return_t wal_checkpoint(wal* log, wal_dump_fn dump, void* uargs)
+{
+    size_t path_size = strlen(log->path);
+    char* tmp_path = (char*)malloc(path_size + 5);
+    if(!tmp_path) return YP_ERR_ALLOCATION;
+    memcpy(tmp_path, log->path, path_size);
+    memcpy(tmp_path + path_size, ".new", 5);
+
+    wal_writer w;
+    memset(&w, 0, sizeof(w));
+    w.fd = -1;
+    w.data = (char*)malloc(WAL_READ_SIZE);
+    if(!w.data) {
+        free(tmp_path);
+        return YP_ERR_ALLOCATION;
+    }
+
+    /* the state dumped includes every record appended so far, so the
+     * batches holding them must be durable before the old log goes */
+    ABT_mutex_lock(log->mutex);
+    while((log->pending || log->writing) && !log->failed)
+        ABT_cond_wait(log->idle, log->mutex);
+    if(log->failed) {
+        w.ret = YP_ERR_IO;
+        goto finish;
+    }
+
+    w.fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(w.fd < 0) {
+        w.ret = YP_ERR_IO;
+        goto finish;
+    }
+    if(dump(uargs, write_checkpoint_record, &w) && w.ret == YP_SUCCESS)
+        w.ret = YP_ERR_OTHER;
+    flush_writer(&w);
+    if(w.ret == YP_SUCCESS
+    && (fdatasync(w.fd) != 0 || rename(tmp_path, log->path) != 0))
+        w.ret = YP_ERR_IO;
+    if(w.ret != YP_SUCCESS) {
+        margo_error(log->mid, "Could not checkpoint log %s: %s",
+                    log->path, strerror(errno));
+        close(w.fd);
+        unlink(tmp_path);
+        goto finish;
+    }
+    /* the old log is gone, so from here on appends go to the new one */
+    close(log->fd);
+    log->fd   = w.fd;
+    log->end  = w.written;
+    log->base = w.written;
+    if(sync_parent(log->path) != 0) {
+        margo_error(log->mid, "Could not sync the directory of log %s: %s",
+                    log->path, strerror(errno));
+        log->failed = 1;
+        w.ret = YP_ERR_IO;
+        goto finish;
+    }
+    margo_debug(log->mid, "Checkpointed log %s to %lld bytes",
+                log->path, (long long)w.written);
+
+finish:
+    ABT_mutex_unlock(log->mutex);
+    free(w.data);
+    free(tmp_path);
+    return w.ret;
+}
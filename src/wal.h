@@ -0,0 +1,121 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "YP/YP-common.h"
+#include "provider.h"
+
+/*
+ * Write-ahead log backends can opt into to make their updates durable.
+ * Records appended by handler ULTs are accumulated in a pending batch;
+ * a commit ULT running in the provider's pool writes the whole batch
+ * and issues a single fdatasync for it, then wakes up every ULT waiting
+ * on the batch through its ABT_eventual. Records appended while a batch
+ * is being synced go to the next one, so the number of syncs per second
+ * stays bounded regardless of the number of concurrent updates.
+ *
+ * A backend appends a record, applies the update to its own structure
+ * (in the same critical section, so that the order of the log matches
+ * the order in which updates were applied) then waits for the record
+ * to be durable before acknowledging the update.
+ *
+ * If a batch can't be written or synced, what was written of it is
+ * truncated away and the log is marked as failed: every later append
+ * and wait returns YP_ERR_IO, so no update is acknowledged that a
+ * replay would not find. The backend can then rebuild its structure
+ * from the records that were synced with wal_reload, dropping the
+ * updates it applied but couldn't make durable.
+ *
+ * The log only grows, so backends checkpoint it once wal_should_checkpoint
+ * says so: wal_checkpoint writes their current content as a new log and
+ * renames it over the old one.
+ */
+
+#define WAL_INSERT 1
+#define WAL_ERASE  2
+
+typedef struct wal wal;
+typedef struct wal_batch* wal_ticket;
+
+/**
+ * @brief Function called on each record found when opening a log.
+ * Returning a non-zero value aborts the replay.
+ */
+typedef int (*wal_replay_fn)(void* uargs, int type, const char* name, size_t name_size, uint64_t number);
+
+/**
+ * @brief Function called by wal_checkpoint to list the content of the
+ * backend: it calls fn(fn_args, WAL_INSERT, ...) on each entry and
+ * returns non-zero if fn did.
+ */
+typedef int (*wal_dump_fn)(void* uargs, wal_replay_fn fn, void* fn_args);
+
+/**
+ * @brief Opens the log at path and replays its records through fn.
+ * The log is created if needed; if create is non-zero it must not
+ * already exist.
+ * A torn record at the end of the log is discarded.
+ */
+YP_return_t wal_open(
+        YP_provider_t provider,
+        const char* path,
+        int create,
+        wal_replay_fn fn,
+        void* uargs,
+        wal** log);
+
+/**
+ * @brief Stops the commit ULT after it has synced the pending records,
+ * then closes the log.
+ */
+void wal_close(wal* log);
+
+/**
+ * @brief Closes the log and removes its file.
+ */
+void wal_destroy(wal* log);
+
+/**
+ * @brief Adds a record to the pending batch. The ticket must then be
+ * passed to wal_wait. Returns YP_ERR_IO if the log has failed.
+ */
+YP_return_t wal_append(
+        wal* log,
+        int type,
+        const char* name,
+        size_t name_size,
+        uint64_t number,
+        wal_ticket* ticket);
+
+/**
+ * @brief Blocks the calling ULT until the batch holding the record is
+ * durable, returns YP_ERR_IO if it couldn't be written.
+ */
+YP_return_t wal_wait(wal_ticket ticket);
+
+/**
+ * @brief Replays the records that were synced, e.g. into a fresh
+ * structure once wal_wait has returned YP_ERR_IO.
+ */
+YP_return_t wal_reload(wal* log, wal_replay_fn fn, void* uargs);
+
+/**
+ * @brief Returns non-zero once the log is past 16 MiB and has at least
+ * doubled in size since it was opened or last checkpointed.
+ */
+int wal_should_checkpoint(wal* log);
+
+/**
+ * @brief Waits for the pending batches to be synced, then replaces the
+ * log with the records listed by dump. The caller must hold off appends
+ * until it returns.
+ */
+YP_return_t wal_checkpoint(wal* log, wal_dump_fn dump, void* uargs);
+
+#endif
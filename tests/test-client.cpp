@@ -4,6 +4,11 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <margo.h>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/catch_all.hpp>
@@ -23,6 +28,83 @@ static const char* token = "ABCDEFGH";
 static const uint16_t provider_id = 42;
 static const char* backend_config = "{ \"foo\" : \"bar\" }";
 
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+/*
+ * Margo instance running a YP provider, with an admin and a client.
+ * create_phonebook creates the phonebook a test works on and a handle
+ * to it; both are released along with the fixture. Files go in a
+ * directory of their own, so that concurrent runs don't collide:
+ * in_tmpdir replaces $TMP with it in a configuration.
+ */
+struct phonebook_fixture {
+    margo_instance_id     mid;
+    hg_addr_t             addr;
+    YP_admin_t            admin;
+    YP_client_t           client;
+    YP_phonebook_id_t     id;
+    YP_phonebook_handle_t rh = YP_PHONEBOOK_HANDLE_NULL;
+    bool                  created = false;
+    std::string           tmpdir;
+
+    phonebook_fixture() {
+        const char* parent = getenv("TMPDIR");
+        tmpdir = std::string(parent && *parent ? parent : "/tmp") + "/YP-test-XXXXXX";
+        REQUIRE(mkdtemp(&tmpdir[0]) != NULL);
+        // create margo instance
+        mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+        REQUIRE(mid != MARGO_INSTANCE_NULL);
+        // get address of current process
+        hg_return_t hret = margo_addr_self(mid, &addr);
+        REQUIRE(hret == HG_SUCCESS);
+        // register YP provider
+        struct YP_provider_args args = YP_PROVIDER_ARGS_INIT;
+        args.token = token;
+        YP_return_t ret = YP_provider_register(
+                mid, provider_id, &args,
+                YP_PROVIDER_IGNORE);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_admin_init(mid, &admin);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_client_init(mid, &client);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+
+    std::string in_tmpdir(const char* config) const {
+        std::string result = config;
+        for(size_t i = result.find("$TMP"); i != std::string::npos;
+                i = result.find("$TMP", i + tmpdir.size()))
+            result.replace(i, 4, tmpdir);
+        return result;
+    }
+
+    void create_phonebook(const char* backend_type, const char* backend_config) {
+        std::string config = in_tmpdir(backend_config);
+        YP_return_t ret = YP_create_phonebook(admin, addr,
+                provider_id, token, backend_type, config.c_str(), &id);
+        REQUIRE(ret == YP_SUCCESS);
+        created = true;
+        ret = YP_phonebook_handle_create(client, addr, provider_id, id, &rh);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+
+    ~phonebook_fixture() {
+        // CHECK rather than REQUIRE: margo_finalize must be called no matter what
+        if(rh != YP_PHONEBOOK_HANDLE_NULL)
+            CHECK(YP_phonebook_handle_release(rh) == YP_SUCCESS);
+        if(created)
+            CHECK(YP_destroy_phonebook(admin, addr, provider_id, token, id) == YP_SUCCESS);
+        CHECK(YP_client_finalize(client) == YP_SUCCESS);
+        CHECK(YP_admin_finalize(admin) == YP_SUCCESS);
+        margo_addr_free(mid, addr);
+        margo_finalize(mid);
+        nftw(tmpdir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+};
+
 TEST_CASE("Test client interface", "[client]") {
 
     YP_return_t      ret;
@@ -140,3 +222,1093 @@ TEST_CASE("Test client interface", "[client]") {
     // munit because we need margo_finalize to be called no matter what.
     margo_finalize(context->mid);
 }
+
+TEST_CASE_METHOD(phonebook_fixture, "Test phonebook operations", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory", "{ \"initial_capacity\" : 4 }" },
+        { "mmap",   "{ \"path\" : \"$TMP/mmap\" }" },
+        { "log",    "{ \"path\" : \"$TMP/log\", \"segment_size\" : 4096 }" },
+        { "btree",  "{}" },
+        { "art",    "{}" },
+        { "frontcode", "{ \"block_size\" : 4 }" },
+        { "memory", "{ \"filter\" : { \"bits_per_name\" : 8 } }" },
+        { "tiered", "{ \"path\" : \"$TMP/tiered\", \"hot_capacity\" : 16 }" },
+        { "sharded", "{ \"num_shards\" : 4, \"filter\" : true }" },
+        { "cache",  "{ \"backend\" : \"memory\", \"capacity\" : 4 }" }
+    }));
+    create_phonebook(std::get<0>(backend), std::get<1>(backend));
+    YP_return_t ret;
+
+    SECTION("Insert and lookup") {
+        uint64_t number = 0;
+        // names short enough to be inlined and long enough not to be
+        const char* names[] = {
+            "Alice", "Bob", "Carol Ann Longname-Smithson", "Dave"
+        };
+        for(unsigned i = 0; i < 4; i++) {
+            ret = YP_insert(rh, names[i], 5550100 + i);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+        for(unsigned i = 0; i < 4; i++) {
+            ret = YP_lookup(rh, names[i], &number);
+            REQUIRE(ret == YP_SUCCESS);
+            REQUIRE(number == 5550100 + i);
+        }
+        // updating a name replaces its number
+        ret = YP_insert(rh, "Bob", 5559999);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_lookup(rh, "Bob", &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == 5559999);
+        // looking up an unknown name fails
+        ret = YP_lookup(rh, "Eve", &number);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+    }
+
+    SECTION("Erase") {
+        uint64_t number = 0;
+        ret = YP_insert(rh, "Alice", 5550100);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_erase(rh, "Alice");
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_lookup(rh, "Alice", &number);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+        ret = YP_erase(rh, "Alice");
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+    }
+
+    SECTION("Many names") {
+        uint64_t number = 0;
+        char name[64];
+        for(unsigned i = 0; i < 1000; i++) {
+            snprintf(name, sizeof(name), "Person number %u", i);
+            ret = YP_insert(rh, name, i);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+        for(unsigned i = 0; i < 1000; i++) {
+            snprintf(name, sizeof(name), "Person number %u", i);
+            ret = YP_lookup(rh, name, &number);
+            REQUIRE(ret == YP_SUCCESS);
+            REQUIRE(number == i);
+        }
+    }
+
+    SECTION("E.164 numbers") {
+        YP_number_t number = 0, alice = 0, bob = 0;
+        char str[YP_NUMBER_STRING_SIZE];
+        // equivalent spellings pack to the same number
+        REQUIRE(YP_number_from_string("+1 (212) 555-0100", &alice) == YP_SUCCESS);
+        REQUIRE(YP_number_from_string("0012125550100", &number) == YP_SUCCESS);
+        REQUIRE(number == alice);
+        // leading zeros of the subscriber number are kept
+        REQUIRE(YP_number_from_string("+39 06 1234 5678", &bob) == YP_SUCCESS);
+        YP_number_to_string(bob, str);
+        REQUIRE(std::string(str) == "+390612345678");
+        // packed numbers compare like their E.164 strings
+        REQUIRE(YP_number_from_string("+1212555010", &number) == YP_SUCCESS);
+        REQUIRE(number < alice);
+        REQUIRE(alice < bob);
+        REQUIRE(YP_number_from_string("212 555 0100", &number) == YP_ERR_INVALID_ARGS);
+        REQUIRE(YP_number_from_string("+0212", &number) == YP_ERR_INVALID_ARGS);
+        REQUIRE(YP_number_from_string("+1234567890123456", &number) == YP_ERR_INVALID_ARGS);
+
+        ret = YP_insert(rh, "Alice", alice);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_insert(rh, "Bob", bob);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_lookup(rh, "Bob", &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == bob);
+        YP_number_to_string(number, str);
+        REQUIRE(std::string(str) == "+390612345678");
+    }
+
+    SECTION("Scan") {
+        char name[64];
+        for(unsigned i = 0; i < 200; i++) {
+            snprintf(name, sizeof(name), "Person number %u", i);
+            ret = YP_insert(rh, name, i);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+        // small pages, so that the records span many of them
+        YP_scan_t scan;
+        ret = YP_scan_begin(rh, 256, &scan);
+        REQUIRE(ret == YP_SUCCESS);
+        std::vector<bool> seen(200, false);
+        const char* scanned;
+        YP_number_t number;
+        unsigned count = 0;
+        while((ret = YP_scan_next(scan, &scanned, &number)) == YP_SUCCESS && scanned) {
+            REQUIRE(number < 200);
+            REQUIRE(!seen[number]);
+            seen[number] = true;
+            snprintf(name, sizeof(name), "Person number %u", (unsigned)number);
+            REQUIRE(std::string(scanned) == name);
+            // lookups may move names around (e.g. between tiers)
+            // without making the scan skip or repeat them
+            YP_number_t looked_up;
+            snprintf(name, sizeof(name), "Person number %u", (count * 37) % 200);
+            ret = YP_lookup(rh, name, &looked_up);
+            REQUIRE(ret == YP_SUCCESS);
+            count += 1;
+        }
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 200);
+        ret = YP_scan_end(scan);
+        REQUIRE(ret == YP_SUCCESS);
+        // a record must fit in a page
+        ret = YP_scan_begin(rh, 16, &scan);
+        REQUIRE(ret == YP_SUCCESS);
+        ret = YP_scan_next(scan, &scanned, &number);
+        REQUIRE(ret == YP_ERR_INVALID_ARGS);
+        ret = YP_scan_end(scan);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test ordered listing", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "btree", "{}" },
+        { "art",   "{}" },
+        { "frontcode", "{ \"block_size\" : 4 }" },
+        { "cache", "{ \"backend\" : \"btree\", \"capacity\" : 8 }" }
+    }));
+    create_phonebook(std::get<0>(backend), std::get<1>(backend));
+    YP_return_t ret;
+    char* names[16];
+    uint64_t numbers[16];
+    size_t count;
+
+    // insert names out of order
+    const char* sorted[] = {
+        "Smith Adam", "Smith Eve", "Smithers Wayland", "Smythe Ann", "Snow Jon"
+    };
+    const unsigned order[] = { 3, 0, 4, 2, 1 };
+    for(unsigned i = 0; i < 5; i++) {
+        ret = YP_insert(rh, sorted[order[i]], order[i]);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+
+    SECTION("Range") {
+        count = 16;
+        ret = YP_list_range(rh, "Smith", 1, "Snow", names, numbers, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 4);
+        for(unsigned i = 0; i < count; i++) {
+            REQUIRE(strcmp(names[i], sorted[i]) == 0);
+            REQUIRE(numbers[i] == i);
+            free(names[i]);
+        }
+    }
+
+    SECTION("Paging") {
+        unsigned total = 0;
+        const char* lower = NULL;
+        char* last = NULL;
+        do {
+            count = 2;
+            ret = YP_list_range(rh, lower, 0, NULL, names, numbers, &count);
+            REQUIRE(ret == YP_SUCCESS);
+            for(unsigned i = 0; i < count; i++) {
+                REQUIRE(strcmp(names[i], sorted[total + i]) == 0);
+                if(i + 1 < count) free(names[i]);
+            }
+            free(last);
+            last  = count ? names[count-1] : NULL;
+            lower = last;
+            total += count;
+        } while(count == 2);
+        free(last);
+        REQUIRE(total == 5);
+    }
+
+    SECTION("Prefix") {
+        count = 16;
+        ret = YP_list_prefix(rh, "Smith", names, numbers, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 3);
+        for(unsigned i = 0; i < count; i++) {
+            REQUIRE(strcmp(names[i], sorted[i]) == 0);
+            free(names[i]);
+        }
+        count = 1;
+        ret = YP_list_prefix(rh, "Smith", names, numbers, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 1);
+        free(names[0]);
+        count = 16;
+        ret = YP_list_prefix(rh, "Jones", names, numbers, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 0);
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test persistent phonebook", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "mmap", "{ \"path\" : \"$TMP/mmap-reopen\" }" },
+        { "log",  "{ \"path\" : \"$TMP/log-reopen\", \"segment_size\" : 4096 }" },
+        { "log",  "{ \"path\" : \"$TMP/log-filter\", \"segment_size\" : 4096, \"filter\" : true }" },
+        { "tiered", "{ \"path\" : \"$TMP/tiered-reopen\", \"hot_capacity\" : 64 }" },
+        { "memory", "{ \"wal\" : \"$TMP/memory-wal\" }" },
+        { "sharded", "{ \"wal\" : \"$TMP/sharded-wal\", \"num_shards\" : 4 }" },
+        { "cache", "{ \"backend\" : \"mmap\", \"config\" : { \"path\" : \"$TMP/cache-mmap\" } }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    std::string backend_config = in_tmpdir(std::get<1>(backend));
+
+    YP_return_t ret;
+    uint64_t number = 0;
+    char name[64];
+
+    // create a phonebook and fill it
+    create_phonebook(backend_type, backend_config.c_str());
+    for(unsigned i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "Person number %u", i);
+        ret = YP_insert(rh, name, i);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+    ret = YP_erase(rh, "Person number 0");
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_phonebook_handle_release(rh);
+    REQUIRE(ret == YP_SUCCESS);
+    rh = YP_PHONEBOOK_HANDLE_NULL;
+
+    // creating it again in the same place fails
+    YP_phonebook_id_t other_id;
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, backend_type, backend_config.c_str(), &other_id);
+    REQUIRE(ret != YP_SUCCESS);
+
+    // close it and open it again
+    ret = YP_close_phonebook(admin, addr, provider_id, token, id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_open_phonebook(admin, addr,
+            provider_id, token, backend_type, backend_config.c_str(), &id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_phonebook_handle_create(client, addr, provider_id, id, &rh);
+    REQUIRE(ret == YP_SUCCESS);
+    for(unsigned i = 1; i < 1000; i++) {
+        snprintf(name, sizeof(name), "Person number %u", i);
+        ret = YP_lookup(rh, name, &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == i);
+    }
+    ret = YP_lookup(rh, "Person number 0", &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test provider restart", "[phonebook]") {
+
+    auto phonebook_config = GENERATE(as<const char*>{},
+        "{ \"type\" : \"mmap\", \"config\" : { \"path\" : \"$TMP/mmap-restart\" } }",
+        "{ \"type\" : \"log\", \"config\" : { \"path\" : \"$TMP/log-restart\", \"segment_size\" : 4096 } }",
+        "{ \"type\" : \"memory\", \"config\" : { \"wal\" : \"$TMP/memory-restart-wal\" } }",
+        "{ \"type\" : \"sharded\", \"config\" : { \"wal\" : \"$TMP/sharded-restart-wal\", \"num_shards\" : 4 } }"
+    );
+    // phonebooks declared in the configuration of a second provider
+    std::string config = std::string("{ \"phonebooks\" : [ ") + in_tmpdir(phonebook_config) + " ] }";
+    const uint16_t restarted_id = provider_id + 1;
+    YP_return_t ret;
+    char name[64];
+
+    for(int run = 0; run < 2; run++) {
+        YP_provider_t provider;
+        struct YP_provider_args args = YP_PROVIDER_ARGS_INIT;
+        args.token  = token;
+        args.config = config.c_str();
+        ret = YP_provider_register(mid, restarted_id, &args, &provider);
+        REQUIRE(ret == YP_SUCCESS);
+        YP_phonebook_id_t restarted;
+        size_t count = 1;
+        ret = YP_list_phonebooks(admin, addr, restarted_id, token, &restarted, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 1);
+        YP_phonebook_handle_t handle;
+        ret = YP_phonebook_handle_create(client, addr, restarted_id, restarted, &handle);
+        REQUIRE(ret == YP_SUCCESS);
+        for(unsigned i = 0; i < 100; i++) {
+            snprintf(name, sizeof(name), "Person number %u", i);
+            if(run == 0) {
+                ret = YP_insert(handle, name, i);
+                REQUIRE(ret == YP_SUCCESS);
+            } else {
+                // the records written before the restart are still there
+                YP_number_t number;
+                ret = YP_lookup(handle, name, &number);
+                REQUIRE(ret == YP_SUCCESS);
+                REQUIRE(number == i);
+            }
+        }
+        ret = YP_phonebook_handle_release(handle);
+        REQUIRE(ret == YP_SUCCESS);
+        if(run == 1) {
+            ret = YP_destroy_phonebook(admin, addr, restarted_id, token, restarted);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+        ret = YP_provider_destroy(provider);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test write-ahead log failure", "[phonebook]") {
+
+    std::string wal_path       = in_tmpdir("$TMP/failed-wal");
+    std::string backend_config = in_tmpdir("{ \"wal\" : \"$TMP/failed-wal\" }");
+    create_phonebook("memory", backend_config.c_str());
+    YP_return_t ret;
+    YP_number_t number;
+    struct stat st;
+
+    ret = YP_insert(rh, "Before the failure", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(stat(wal_path.c_str(), &st) == 0);
+    off_t synced = st.st_size;
+
+    // cap the file size so that the next record is only partly written
+    struct rlimit limit, capped;
+    REQUIRE(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+    capped = limit;
+    capped.rlim_cur = synced + 16;
+    signal(SIGXFSZ, SIG_IGN);
+    REQUIRE(setrlimit(RLIMIT_FSIZE, &capped) == 0);
+    std::string torn(256, 'x');
+    ret = YP_insert(rh, torn.c_str(), 5550101);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    REQUIRE(ret == YP_ERR_IO);
+    // the torn record is removed, along with the update it held
+    REQUIRE(stat(wal_path.c_str(), &st) == 0);
+    REQUIRE(st.st_size == synced);
+    ret = YP_lookup(rh, torn.c_str(), &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    ret = YP_lookup(rh, "Before the failure", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550100);
+    // and the log refuses further updates
+    ret = YP_insert(rh, "After the failure", 5550102);
+    REQUIRE(ret == YP_ERR_IO);
+
+    // the log still replays up to the last acknowledged update
+    ret = YP_phonebook_handle_release(rh);
+    REQUIRE(ret == YP_SUCCESS);
+    rh = YP_PHONEBOOK_HANDLE_NULL;
+    ret = YP_close_phonebook(admin, addr, provider_id, token, id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_open_phonebook(admin, addr,
+            provider_id, token, "memory", backend_config.c_str(), &id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_phonebook_handle_create(client, addr, provider_id, id, &rh);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(rh, "Before the failure", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550100);
+    ret = YP_lookup(rh, torn.c_str(), &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    ret = YP_insert(rh, "After reopening", 5550103);
+    REQUIRE(ret == YP_SUCCESS);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test write-ahead log checkpoint", "[phonebook]") {
+
+    std::string wal_path       = in_tmpdir("$TMP/checkpoint-wal");
+    std::string backend_config = in_tmpdir("{ \"wal\" : \"$TMP/checkpoint-wal\" }");
+    create_phonebook("memory", backend_config.c_str());
+    YP_return_t ret;
+    YP_number_t number;
+    struct stat st;
+
+    // overwrite the same names until the log has been rewritten
+    const size_t count = 10000;
+    const unsigned rounds = 30;
+    std::vector<std::string> names;
+    std::vector<const char*> name_ptrs;
+    std::vector<YP_number_t> numbers(count);
+    for(size_t i = 0; i < count; i++)
+        names.push_back("Checkpointed subscriber with a fairly long name #" + std::to_string(i));
+    for(auto& name : names) name_ptrs.push_back(name.c_str());
+    off_t appended = 0;
+    for(unsigned r = 0; r < rounds; r++) {
+        for(size_t i = 0; i < count; i++) numbers[i] = r*count + i;
+        ret = YP_insert_batch(rh, name_ptrs.data(), numbers.data(), count);
+        REQUIRE(ret == YP_SUCCESS);
+        for(auto& name : names) appended += 24 + name.size();
+    }
+    REQUIRE(stat(wal_path.c_str(), &st) == 0);
+    REQUIRE(st.st_size < appended);
+
+    // the checkpointed log replays to the same content
+    ret = YP_phonebook_handle_release(rh);
+    REQUIRE(ret == YP_SUCCESS);
+    rh = YP_PHONEBOOK_HANDLE_NULL;
+    ret = YP_close_phonebook(admin, addr, provider_id, token, id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_open_phonebook(admin, addr,
+            provider_id, token, "memory", backend_config.c_str(), &id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_phonebook_handle_create(client, addr, provider_id, id, &rh);
+    REQUIRE(ret == YP_SUCCESS);
+    for(size_t i = 0; i < count; i += 97) {
+        ret = YP_lookup(rh, names[i].c_str(), &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == (rounds - 1)*count + i);
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test static phonebook", "[phonebook]") {
+
+    std::string source_path = in_tmpdir("$TMP/mphf-source.csv");
+    auto backend_config = GENERATE(as<const char*>{},
+        "{ \"source\" : \"$TMP/mphf-source.csv\" }",
+        "{ \"source\" : \"$TMP/mphf-source.csv\", \"verify\" : false, \"gamma\" : 1 }"
+    );
+
+    YP_return_t ret;
+    uint64_t number = 0;
+    char name[64];
+
+    // write the dataset the phonebook is built from
+    FILE* source = fopen(source_path.c_str(), "w");
+    REQUIRE(source != NULL);
+    for(unsigned i = 0; i < 1000; i++)
+        fprintf(source, "Doe, Person %u,%u\n", i, 5550000 + i);
+    fclose(source);
+
+    create_phonebook("mphf", backend_config);
+
+    for(unsigned i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "Doe, Person %u", i);
+        ret = YP_lookup(rh, name, &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == 5550000 + i);
+    }
+    ret = YP_lookup(rh, "Doe, Person 1000", &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+
+    // the phonebook is read-only
+    ret = YP_insert(rh, "Roe, Richard", 5551234);
+    REQUIRE(ret == YP_ERR_OP_FORBIDDEN);
+    ret = YP_erase(rh, "Doe, Person 0");
+    REQUIRE(ret == YP_ERR_OP_FORBIDDEN);
+
+    remove(source_path.c_str());
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test phonebook snapshot", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory", "{ \"snapshot\" : \"$TMP/memory.snapshot\" }" },
+        { "btree",  "{ \"snapshot\" : { \"path\" : \"$TMP/btree.snapshot\", \"interval\" : 60 } }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    std::string backend_config = in_tmpdir(std::get<1>(backend));
+    std::string copy_path      = in_tmpdir("$TMP/copy.snapshot");
+    std::string copy_config    = in_tmpdir("{ \"snapshot\" : \"$TMP/copy.snapshot\" }");
+
+    YP_return_t ret;
+    YP_phonebook_id_t copy_id, other_id;
+    uint64_t number = 0;
+    char name[64];
+
+    // create a phonebook, fill it, and snapshot it to another path
+    create_phonebook(backend_type, backend_config.c_str());
+    for(unsigned i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "Person number %u", i);
+        ret = YP_insert(rh, name, i);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+    ret = YP_erase(rh, "Person number 0");
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_phonebook_handle_release(rh);
+    REQUIRE(ret == YP_SUCCESS);
+    rh = YP_PHONEBOOK_HANDLE_NULL;
+    ret = YP_snapshot_phonebook(admin, addr, provider_id, token, id, copy_path.c_str());
+    REQUIRE(ret == YP_SUCCESS);
+
+    // closing it writes its own snapshot, which is loaded when reopening
+    ret = YP_close_phonebook(admin, addr, provider_id, token, id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_open_phonebook(admin, addr,
+            provider_id, token, backend_type, backend_config.c_str(), &id);
+    REQUIRE(ret == YP_SUCCESS);
+
+    // a phonebook created from the copy has the same records
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, "memory", copy_config.c_str(), &copy_id);
+    REQUIRE(ret == YP_SUCCESS);
+
+    for(auto phonebook_id : { id, copy_id }) {
+        YP_phonebook_handle_t handle;
+        ret = YP_phonebook_handle_create(client, addr, provider_id, phonebook_id, &handle);
+        REQUIRE(ret == YP_SUCCESS);
+        for(unsigned i = 1; i < 1000; i++) {
+            snprintf(name, sizeof(name), "Person number %u", i);
+            ret = YP_lookup(handle, name, &number);
+            REQUIRE(ret == YP_SUCCESS);
+            REQUIRE(number == i);
+        }
+        ret = YP_lookup(handle, "Person number 0", &number);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+        ret = YP_phonebook_handle_release(handle);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+
+    // a phonebook without snapshot path needs one to be provided
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, "memory", "{}", &other_id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_snapshot_phonebook(admin, addr, provider_id, token, other_id, NULL);
+    REQUIRE(ret == YP_ERR_INVALID_ARGS);
+
+    // destroying the phonebooks removes their snapshots
+    ret = YP_destroy_phonebook(admin, addr, provider_id, token, other_id);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_destroy_phonebook(admin, addr, provider_id, token, copy_id);
+    REQUIRE(ret == YP_SUCCESS);
+    FILE* copy = fopen(copy_path.c_str(), "r");
+    REQUIRE(copy == NULL);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test reverse index", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory",  "{ \"reverse_index\" : true, \"snapshot\" : \"$TMP/index.snapshot\" }" },
+        { "sharded", "{ \"reverse_index\" : true, \"num_shards\" : 4, \"filter\" : true }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    std::string backend_config = in_tmpdir(std::get<1>(backend));
+    create_phonebook(backend_type, backend_config.c_str());
+    YP_return_t ret;
+    YP_phonebook_id_t other_id;
+    char* names[4];
+    size_t count;
+
+    // a family shares a number, a lodger has their own
+    for(auto name : { "Smith, John", "Smith, Jane", "Smith, Anna" }) {
+        ret = YP_insert(rh, name, 5550100);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+    ret = YP_insert(rh, "Jones, Bob", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    // updates and erasures are reflected in the index
+    ret = YP_insert(rh, "Jones, Bob", 5550199);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_erase(rh, "Smith, Jane");
+    REQUIRE(ret == YP_SUCCESS);
+
+    SECTION("Lookup by number") {
+        count = 4;
+        ret = YP_lookup_number(rh, 5550100, names, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 2);
+        REQUIRE(std::string(names[0]) == "Smith, Anna");
+        REQUIRE(std::string(names[1]) == "Smith, John");
+        for(size_t i = 0; i < count; i++) free(names[i]);
+        count = 1;
+        ret = YP_lookup_number(rh, 5550199, names, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 1);
+        REQUIRE(std::string(names[0]) == "Jones, Bob");
+        free(names[0]);
+        count = 4;
+        ret = YP_lookup_number(rh, 5550123, names, &count);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+        REQUIRE(count == 0);
+    }
+
+    SECTION("Index rebuilt when reopening") {
+        ret = YP_phonebook_handle_release(rh);
+        REQUIRE(ret == YP_SUCCESS);
+        rh = YP_PHONEBOOK_HANDLE_NULL;
+        if(std::string(backend_type) == "memory") {
+            ret = YP_close_phonebook(admin, addr, provider_id, token, id);
+            REQUIRE(ret == YP_SUCCESS);
+            ret = YP_open_phonebook(admin, addr,
+                    provider_id, token, backend_type, backend_config.c_str(), &id);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+        ret = YP_phonebook_handle_create(client, addr, provider_id, id, &rh);
+        REQUIRE(ret == YP_SUCCESS);
+        count = 4;
+        ret = YP_lookup_number(rh, 5550100, names, &count);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(count == 2);
+        for(size_t i = 0; i < count; i++) free(names[i]);
+    }
+
+    // phonebooks without an index can't be looked up by number
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, "memory", "{}", &other_id);
+    REQUIRE(ret == YP_SUCCESS);
+    YP_phonebook_handle_t other;
+    ret = YP_phonebook_handle_create(client, addr, provider_id, other_id, &other);
+    REQUIRE(ret == YP_SUCCESS);
+    count = 4;
+    ret = YP_lookup_number(other, 5550100, names, &count);
+    REQUIRE(ret == YP_ERR_OP_UNSUPPORTED);
+    ret = YP_phonebook_handle_release(other);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_destroy_phonebook(admin, addr, provider_id, token, other_id);
+    REQUIRE(ret == YP_SUCCESS);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test fuzzy search", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory",  "{ \"fuzzy_index\" : true }" },
+        { "sharded", "{ \"fuzzy_index\" : true, \"reverse_index\" : true, \"num_shards\" : 4 }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    const char* backend_config = std::get<1>(backend);
+    create_phonebook(backend_type, backend_config);
+    YP_return_t ret;
+    YP_phonebook_id_t other_id;
+    char* names[5];
+    YP_number_t numbers[5];
+    double scores[5];
+    size_t count;
+
+    ret = YP_insert(rh, "Smith, John", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Johnson, Mary", 5550101);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Schmidt, Johann", 5550102);
+    REQUIRE(ret == YP_SUCCESS);
+    // replacing the number of a name doesn't duplicate it
+    ret = YP_insert(rh, "Smith, John", 5550103);
+    REQUIRE(ret == YP_SUCCESS);
+
+    // misspelled, in another case and word order
+    count = 5;
+    ret = YP_fuzzy_search(rh, "jonh smith", names, numbers, scores, &count);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(count >= 1);
+    REQUIRE(std::string(names[0]) == "Smith, John");
+    REQUIRE(numbers[0] == 5550103);
+    REQUIRE(scores[0] > 0.5);
+    for(size_t i = 1; i < count; i++) {
+        REQUIRE(std::string(names[i]) != "Smith, John");
+        REQUIRE(scores[i] <= scores[i-1]);
+    }
+    for(size_t i = 0; i < count; i++) free(names[i]);
+
+    // erased names aren't found anymore
+    ret = YP_erase(rh, "Smith, John");
+    REQUIRE(ret == YP_SUCCESS);
+    count = 5;
+    ret = YP_fuzzy_search(rh, "jonh smith", names, numbers, NULL, &count);
+    REQUIRE(ret == YP_SUCCESS);
+    for(size_t i = 0; i < count; i++) {
+        REQUIRE(std::string(names[i]) != "Smith, John");
+        free(names[i]);
+    }
+
+    // phonebooks without an index can't be searched
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, "memory", "{}", &other_id);
+    REQUIRE(ret == YP_SUCCESS);
+    YP_phonebook_handle_t other;
+    ret = YP_phonebook_handle_create(client, addr, provider_id, other_id, &other);
+    REQUIRE(ret == YP_SUCCESS);
+    count = 5;
+    ret = YP_fuzzy_search(other, "smith", names, numbers, NULL, &count);
+    REQUIRE(ret == YP_ERR_OP_UNSUPPORTED);
+    ret = YP_phonebook_handle_release(other);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_destroy_phonebook(admin, addr, provider_id, token, other_id);
+    REQUIRE(ret == YP_SUCCESS);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test phonetic lookup", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory",  "{ \"phonetic_index\" : true }" },
+        { "sharded", "{ \"phonetic_index\" : true, \"fuzzy_index\" : true, \"num_shards\" : 4 }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    const char* backend_config = std::get<1>(backend);
+    create_phonebook(backend_type, backend_config);
+    YP_return_t ret;
+    char* names[4];
+    YP_number_t numbers[4];
+    size_t count;
+
+    ret = YP_insert(rh, "Smith, John", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Smyth, Jon", 5550101);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Schmidt, Johann", 5550102);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Jones, Bob", 5550103);
+    REQUIRE(ret == YP_SUCCESS);
+
+    // all the spellings of a name sound alike
+    count = 4;
+    ret = YP_phonetic_lookup(rh, "SMITH", names, numbers, &count);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(count == 3);
+    REQUIRE(std::string(names[0]) == "Schmidt, Johann");
+    REQUIRE(numbers[0] == 5550102);
+    REQUIRE(std::string(names[1]) == "Smith, John");
+    REQUIRE(std::string(names[2]) == "Smyth, Jon");
+    for(size_t i = 0; i < count; i++) free(names[i]);
+
+    // every word of the query must match
+    count = 4;
+    ret = YP_phonetic_lookup(rh, "jon smith", names, numbers, &count);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(count == 2);
+    REQUIRE(std::string(names[0]) == "Smith, John");
+    REQUIRE(std::string(names[1]) == "Smyth, Jon");
+    for(size_t i = 0; i < count; i++) free(names[i]);
+
+    // erased names aren't found anymore
+    ret = YP_erase(rh, "Smyth, Jon");
+    REQUIRE(ret == YP_SUCCESS);
+    count = 4;
+    ret = YP_phonetic_lookup(rh, "smyth", names, numbers, &count);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(count == 2);
+    for(size_t i = 0; i < count; i++) free(names[i]);
+    count = 4;
+    ret = YP_phonetic_lookup(rh, "Brown", names, numbers, &count);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    REQUIRE(count == 0);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test record expiry", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory",  "{ \"expiry\" : { \"tick\" : 0.05 } }" },
+        { "sharded", "{ \"expiry\" : true, \"reverse_index\" : true, \"num_shards\" : 4 }" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    const char* backend_config = std::get<1>(backend);
+    create_phonebook(backend_type, backend_config);
+    YP_return_t ret;
+    YP_phonebook_id_t other_id;
+    YP_number_t number;
+
+    ret = YP_insert_with_ttl(rh, "Hot desk 12", 5550112, 0.2);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert_with_ttl(rh, "Contractor", 5550113, 0.2);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert(rh, "Reception", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    // updating a record without a ttl makes it permanent
+    ret = YP_insert(rh, "Contractor", 5550114);
+    REQUIRE(ret == YP_SUCCESS);
+    // the ttl may also be extended
+    ret = YP_insert_with_ttl(rh, "Reception", 5550100, 60);
+    REQUIRE(ret == YP_SUCCESS);
+
+    ret = YP_lookup(rh, "Hot desk 12", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    margo_thread_sleep(mid, 500);
+    ret = YP_lookup(rh, "Hot desk 12", &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    ret = YP_lookup(rh, "Contractor", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550114);
+    ret = YP_lookup(rh, "Reception", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    if(std::string(backend_type) == "sharded") {
+        // expired records are removed from the indexes
+        char* names[1];
+        size_t count = 1;
+        ret = YP_lookup_number(rh, 5550112, names, &count);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+    }
+
+    // phonebooks without expiry don't accept a ttl
+    ret = YP_create_phonebook(admin, addr,
+            provider_id, token, "memory", "{}", &other_id);
+    REQUIRE(ret == YP_SUCCESS);
+    YP_phonebook_handle_t other;
+    ret = YP_phonebook_handle_create(client, addr, provider_id, other_id, &other);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_insert_with_ttl(other, "Hot desk 12", 5550112, 0.2);
+    REQUIRE(ret == YP_ERR_OP_UNSUPPORTED);
+    ret = YP_phonebook_handle_release(other);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_destroy_phonebook(admin, addr, provider_id, token, other_id);
+    REQUIRE(ret == YP_SUCCESS);
+
+    // deadlines aren't persisted, so neither are phonebooks with expiry
+    ret = YP_create_phonebook(admin, addr, provider_id, token, "memory",
+            in_tmpdir("{ \"expiry\" : true, \"wal\" : \"$TMP/expiry-wal\" }").c_str(), &other_id);
+    REQUIRE(ret == YP_ERR_INVALID_CONFIG);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test batch lookup", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory", "{ \"filter\" : true }" },
+        { "btree",  "{}" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    const char* backend_config = std::get<1>(backend);
+    create_phonebook(backend_type, backend_config);
+    YP_return_t ret;
+
+    // even names are in the phonebook, odd names are not
+    const size_t count = 10000;
+    std::vector<std::string> names(count);
+    std::vector<const char*> name_ptrs(count);
+    for(size_t i = 0; i < count; i++) {
+        names[i] = "Batch name " + std::to_string(i);
+        name_ptrs[i] = names[i].c_str();
+        if(i % 2 == 0) {
+            ret = YP_insert(rh, name_ptrs[i], 5550000 + i);
+            REQUIRE(ret == YP_SUCCESS);
+        }
+    }
+
+    std::vector<YP_number_t> numbers(count);
+    std::vector<YP_return_t> results(count);
+    ret = YP_lookup_batch(rh, name_ptrs.data(), count, numbers.data(), results.data());
+    REQUIRE(ret == YP_SUCCESS);
+    for(size_t i = 0; i < count; i++) {
+        if(i % 2 == 0) {
+            REQUIRE(results[i] == YP_SUCCESS);
+            REQUIRE(numbers[i] == 5550000 + i);
+        } else {
+            REQUIRE(results[i] == YP_ERR_NOT_FOUND);
+        }
+    }
+
+    // an empty batch doesn't need an RPC
+    ret = YP_lookup_batch(rh, NULL, 0, NULL, NULL);
+    REQUIRE(ret == YP_SUCCESS);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test batch insert", "[phonebook]") {
+
+    auto backend = GENERATE(table<const char*, const char*>({
+        { "memory",  "{ \"filter\" : { \"bits_per_name\" : 8, \"capacity\" : 16 } }" },
+        { "sharded", "{ \"wal\" : \"$TMP/sharded-batch-wal\", \"num_shards\" : 4 }" },
+        { "memory",  "{ \"reverse_index\" : true }" },
+        { "btree",   "{}" }
+    }));
+    const char* backend_type   = std::get<0>(backend);
+    const char* backend_config = std::get<1>(backend);
+    create_phonebook(backend_type, backend_config);
+    YP_return_t ret;
+
+    const size_t count = 10000;
+    std::vector<std::string> names(count);
+    std::vector<const char*> name_ptrs(count);
+    std::vector<YP_number_t> numbers(count);
+    for(size_t i = 0; i < count; i++) {
+        names[i] = "Batch name " + std::to_string(i);
+        name_ptrs[i] = names[i].c_str();
+        numbers[i] = 5550000 + i;
+    }
+    ret = YP_insert_batch(rh, name_ptrs.data(), numbers.data(), count);
+    REQUIRE(ret == YP_SUCCESS);
+    // a second batch updates half of the records
+    for(size_t i = 0; i < count; i++) numbers[i] = 5560000 + i;
+    ret = YP_insert_batch(rh, name_ptrs.data(), numbers.data(), count/2);
+    REQUIRE(ret == YP_SUCCESS);
+
+    std::vector<YP_return_t> results(count);
+    ret = YP_lookup_batch(rh, name_ptrs.data(), count, numbers.data(), results.data());
+    REQUIRE(ret == YP_SUCCESS);
+    for(size_t i = 0; i < count; i++) {
+        REQUIRE(results[i] == YP_SUCCESS);
+        REQUIRE(numbers[i] == (i < count/2 ? 5560000 : 5550000) + i);
+    }
+    ret = YP_insert_batch(rh, NULL, NULL, 0);
+    REQUIRE(ret == YP_SUCCESS);
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test asynchronous operations", "[phonebook]") {
+
+    create_phonebook("memory", "{}");
+    YP_return_t ret;
+
+    // keep all the inserts in flight, and complete them in any order
+    const size_t count = 256;
+    std::vector<std::string> names(count);
+    std::vector<YP_request_t> reqs(count);
+    for(size_t i = 0; i < count; i++) {
+        names[i] = "Async name " + std::to_string(i);
+        ret = YP_insert_async(rh, names[i].c_str(), 5550000 + i, &reqs[i]);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+    std::vector<bool> done(count);
+    for(size_t n = 0; n < count; n++) {
+        size_t index = count;
+        ret = YP_wait_any(count, reqs.data(), &index);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(index < count);
+        REQUIRE(!done[index]);
+        REQUIRE(reqs[index] == YP_REQUEST_NULL);
+        done[index] = true;
+    }
+    size_t index;
+    ret = YP_wait_any(count, reqs.data(), &index);
+    REQUIRE(ret == YP_ERR_INVALID_ARGS);
+
+    std::vector<YP_number_t> numbers(count);
+    for(size_t i = 0; i < count; i++) {
+        ret = YP_lookup_async(rh, names[i].c_str(), &numbers[i], &reqs[i]);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+    YP_number_t missing_number;
+    YP_request_t missing;
+    ret = YP_lookup_async(rh, "Nobody", &missing_number, &missing);
+    REQUIRE(ret == YP_SUCCESS);
+    int flag = 0;
+    while(!flag) {
+        ret = YP_test(missing, &flag);
+        REQUIRE(ret == YP_SUCCESS);
+        // let the progress loop and the provider run
+        if(!flag) margo_thread_sleep(mid, 1);
+    }
+    ret = YP_wait(missing);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    for(size_t i = 0; i < count; i++) {
+        ret = YP_wait(reqs[i]);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(numbers[i] == 5550000 + i);
+    }
+
+    int32_t result = 0;
+    YP_request_t sum_req, erase_req;
+    ret = YP_compute_sum_async(rh, 42, 51, &result, &sum_req);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_erase_async(rh, names[0].c_str(), &erase_req);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_wait(sum_req);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(result == 93);
+    ret = YP_wait(erase_req);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(rh, names[0].c_str(), &numbers[0]);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+}
+
+struct coalesced_lookup_args {
+    YP_phonebook_handle_t handle;
+    size_t                first;
+    size_t                count;
+    size_t                errors;
+};
+
+static void coalesced_lookups(void* uargs)
+{
+    auto args = static_cast<coalesced_lookup_args*>(uargs);
+    for(size_t i = args->first; i < args->first + args->count; i++) {
+        std::string name = "Coalesced name " + std::to_string(i);
+        YP_number_t number = 0;
+        YP_return_t ret = YP_lookup(args->handle, name.c_str(), &number);
+        // odd names are not in the phonebook
+        if(i % 2 == 0 ? (ret != YP_SUCCESS || number != 5550000 + i)
+                      : ret != YP_ERR_NOT_FOUND)
+            args->errors += 1;
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test lookup coalescing", "[phonebook]") {
+
+    YP_return_t ret = YP_client_set_coalescing(client, 8, 1000);
+    REQUIRE(ret == YP_SUCCESS);
+    create_phonebook("memory", "{}");
+
+    const size_t num_ults = 16, per_ult = 32;
+    for(size_t i = 0; i < num_ults*per_ult; i += 2) {
+        std::string name = "Coalesced name " + std::to_string(i);
+        ret = YP_insert(rh, name.c_str(), 5550000 + i);
+        REQUIRE(ret == YP_SUCCESS);
+    }
+
+    // a lone lookup is sent once the delay expires
+    YP_number_t number;
+    ret = YP_lookup(rh, "Coalesced name 0", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550000);
+
+    ABT_pool pool;
+    margo_get_handler_pool(mid, &pool);
+    std::vector<coalesced_lookup_args> ult_args(num_ults);
+    std::vector<ABT_thread> ults(num_ults);
+    for(size_t t = 0; t < num_ults; t++) {
+        ult_args[t] = { rh, t*per_ult, per_ult, 0 };
+        int aret = ABT_thread_create(pool, coalesced_lookups, &ult_args[t],
+                                     ABT_THREAD_ATTR_NULL, &ults[t]);
+        REQUIRE(aret == ABT_SUCCESS);
+    }
+    for(size_t t = 0; t < num_ults; t++) {
+        ABT_thread_join(ults[t]);
+        ABT_thread_free(&ults[t]);
+        REQUIRE(ult_args[t].errors == 0);
+    }
+}
+
+TEST_CASE_METHOD(phonebook_fixture, "Test lookup cache with leases", "[phonebook]") {
+
+    create_phonebook("memory", "{ \"lease\" : 0.2 }");
+    YP_return_t ret = YP_phonebook_handle_set_cache(rh, 4);
+    REQUIRE(ret == YP_SUCCESS);
+
+    YP_number_t number;
+    ret = YP_insert(rh, "Leased name", 5550100);
+    REQUIRE(ret == YP_SUCCESS);
+    // the second lookup is served from the cache
+    for(int i = 0; i < 2; i++) {
+        ret = YP_lookup(rh, "Leased name", &number);
+        REQUIRE(ret == YP_SUCCESS);
+        REQUIRE(number == 5550100);
+        ret = YP_lookup(rh, "Missing name", &number);
+        REQUIRE(ret == YP_ERR_NOT_FOUND);
+    }
+
+    // writes wait for the leases, so the cache can't return old values
+    ret = YP_insert(rh, "Leased name", 5550101);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(rh, "Leased name", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550101);
+    ret = YP_insert(rh, "Missing name", 5550102);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(rh, "Missing name", &number);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(number == 5550102);
+    ret = YP_erase(rh, "Leased name");
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(rh, "Leased name", &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+
+    // more names than the cache holds
+    for(int round = 0; round < 2; round++) {
+        for(int i = 0; i < 8; i++) {
+            std::string name = "Evicted name " + std::to_string(i);
+            if(round == 0) {
+                ret = YP_insert(rh, name.c_str(), 5550200 + i);
+                REQUIRE(ret == YP_SUCCESS);
+            }
+            ret = YP_lookup(rh, name.c_str(), &number);
+            REQUIRE(ret == YP_SUCCESS);
+            REQUIRE(number == (YP_number_t)(5550200 + i));
+        }
+    }
+
+    // handles without a cache don't take leases, so their lookups
+    // don't delay writes
+    YP_phonebook_handle_t plain;
+    ret = YP_phonebook_handle_create(client, addr, provider_id, id, &plain);
+    REQUIRE(ret == YP_SUCCESS);
+    ret = YP_lookup(plain, "Plain name", &number);
+    REQUIRE(ret == YP_ERR_NOT_FOUND);
+    double start = ABT_get_wtime();
+    ret = YP_insert(plain, "Plain name", 5550300);
+    REQUIRE(ret == YP_SUCCESS);
+    REQUIRE(ABT_get_wtime() - start < 0.1);
+    ret = YP_phonebook_handle_release(plain);
+    REQUIRE(ret == YP_SUCCESS);
+
+    ret = YP_phonebook_handle_set_cache(rh, 0);
+    REQUIRE(ret == YP_SUCCESS);
+}